@@ -0,0 +1 @@
+../../../core/ga-atomic.h
\ No newline at end of file
@@ -679,7 +679,7 @@ rtp_packet_handler(void *clientData, unsigned char *packet, unsigned &packetSize
 //// drop frame feature
 
 typedef struct drop_vframe_s {
-	struct timeval tv_real_start;	// 1st wall-clock timestamp
+	long long real_start;		// 1st local timestamp, see ga_clock_ns()
 	struct timeval tv_stream_start;	// 1st pkt timestamp
 	int no_drop;			// keep N frames not dropped
 }	drop_vframe_t;
@@ -701,17 +701,17 @@ drop_video_frame_init(long long max_delay_us) {
 
 static int
 drop_video_frame(int ch/*channel*/, unsigned char *buffer, int bufsize, struct timeval pts) {
-	struct timeval now;
+	long long now;
 	// disabled?
 	if(max_tolerable_video_delay_us <= 0)
 		return 0;
 	//
-	gettimeofday(&now, NULL);
-	if(drop_vframe_ctx[ch].tv_real_start.tv_sec == 0) {
-		drop_vframe_ctx[ch].tv_real_start = now;
+	now = ga_clock_ns();
+	if(drop_vframe_ctx[ch].real_start == 0) {
+		drop_vframe_ctx[ch].real_start = now;
 		drop_vframe_ctx[ch].tv_stream_start = pts;
-		ga_error("rtspclient: frame dropping initialized real=%lu.%06ld stream=%lu.%06ld (latency=%lld).\n",
-			now.tv_sec, now.tv_usec, pts.tv_sec, pts.tv_usec,
+		ga_error("rtspclient: frame dropping initialized real=%lld.%09lld stream=%lu.%06ld (latency=%lld).\n",
+			now / 1000000000LL, now % 1000000000LL, pts.tv_sec, pts.tv_usec,
 			max_tolerable_video_delay_us);
 		return 0;
 	}
@@ -741,7 +741,7 @@ drop_video_frame(int ch/*channel*/, unsigned char *buffer, int bufsize, struct t
 			}
 			//
 			long long dstream = tvdiff_us(&pts, &drop_vframe_ctx[ch].tv_stream_start);
-			long long dreal = tvdiff_us(&now, &drop_vframe_ctx[ch].tv_real_start);
+			long long dreal = (now - drop_vframe_ctx[ch].real_start) / 1000LL;
 			if(drop_vframe_ctx[ch].no_drop > 0)
 				drop_vframe_ctx[ch].no_drop--;
 			if(dreal-dstream > max_tolerable_video_delay_us) {
@@ -21,15 +21,321 @@
  * dpipe implementation: pipe for delivering discrete frames
  */
 #include "dpipe.h"
+#include "ga-atomic.h"
+
+#if defined(__linux__)
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+/** Park and wake lock-free dpipe consumers with futex */
+#define	DPIPE_USE_FUTEX	1
+#ifndef ANDROID
+/** Support shared memory dpipes (DPIPE_MODE_SHM): bionic has no shm_open */
+#define	DPIPE_USE_SHM	1
+#endif
+#endif
 
 #include <map>
 #include <string>
 using namespace std;
 
+/** Magic number of a shared memory dpipe segment: 'GADP' */
+#define	DPIPE_SHM_MAGIC		0x47414450
+/** Layout version of a shared memory dpipe segment */
+#define	DPIPE_SHM_VERSION	1
+/** Alignment of rings and frame buffers in a shared memory dpipe segment */
+#define	DPIPE_SHM_ALIGN		64
+
+/**
+ * Header of a shared memory dpipe segment.
+ * It is followed by the input ring, the output ring, and the frame buffers.
+ */
+typedef struct dpipe_shm_header_s {
+	unsigned int magic;	/**< DPIPE_SHM_MAGIC */
+	int version;		/**< DPIPE_SHM_VERSION */
+	volatile int ready;	/**< set by the creator when the segment is initialized */
+	int nframe;		/**< number of frame buffers */
+	int maxframesize;	/**< size of each frame buffer */
+	int framestride;	/**< distance between two frame buffers */
+	long long inring;	/**< offset of the input ring */
+	long long outring;	/**< offset of the output ring */
+	long long frames;	/**< offset of the first frame buffer */
+	long long size;		/**< size of the segment */
+	dpipe_ctl_t ctl;	/**< shared dpipe states */
+	char userdata[DPIPE_SHM_USERDATA];	/**< see dpipe_shm_userdata() */
+}	dpipe_shm_header_t;
+
 /** Store the mapping between pipe-name and pipe structure */
 static pthread_mutex_t dpipemap_mutex = PTHREAD_MUTEX_INITIALIZER;
 static map<string,dpipe_t*> dpipemap;
 
+/**
+ * Compute the size of a lock-free ring. This is an internal function.
+ *
+ * @param nframe [in] Number of frame buffers the ring has to hold.
+ * @param cells [out] Number of cells in the ring, can be NULL.
+ * @return Size of the ring in bytes.
+ */
+static size_t
+dpipe_ring_size(int nframe, unsigned int *cells) {
+	unsigned int size = 1;
+	// leave room for slots that are being released by consumers
+	while(size < 2 * (unsigned int) nframe)
+		size <<= 1;
+	if(cells != NULL)
+		*cells = size;
+	return sizeof(dpipe_ring_t) + sizeof(dpipe_ring_cell_t) * (size - 1);
+}
+
+/**
+ * Initialize an empty lock-free ring. This is an internal function.
+ *
+ * @param ring [in] The ring, must have at least dpipe_ring_size() bytes.
+ * @param nframe [in] Number of frame buffers the ring has to hold.
+ * @param multi_producer [in] Set to non-zero if the ring has multiple producers.
+ */
+static void
+dpipe_ring_init(dpipe_ring_t *ring, int nframe, int multi_producer) {
+	unsigned int i, size;
+	dpipe_ring_size(nframe, &size);
+	bzero(ring, sizeof(dpipe_ring_t));
+	ring->mask = size - 1;
+	ring->multi_producer = multi_producer;
+	for(i = 0; i < size; i++) {
+		ring->cell[i].seq = (int) i;
+		ring->cell[i].index = -1;
+	}
+	return;
+}
+
+/**
+ * Create a lock-free ring that is able to hold at least \a nframe buffers.
+ * This is an internal function.
+ *
+ * @param nframe [in] Number of frame buffers the ring has to hold.
+ * @param multi_producer [in] Set to non-zero if the ring has multiple producers.
+ * @return Pointer to the ring, or NULL on failure.
+ */
+static dpipe_ring_t *
+dpipe_ring_create(int nframe, int multi_producer) {
+	dpipe_ring_t *ring;
+	if((ring = (dpipe_ring_t*) malloc(dpipe_ring_size(nframe, NULL))) == NULL)
+		return NULL;
+	dpipe_ring_init(ring, nframe, multi_producer);
+	return ring;
+}
+
+/**
+ * Release a lock-free ring. This is an internal function.
+ *
+ * @param ring [in] The ring to be released. Buffers in the ring are not freed.
+ */
+static void
+dpipe_ring_destroy(dpipe_ring_t *ring) {
+	if(ring == NULL)
+		return;
+	free(ring);
+	return;
+}
+
+/**
+ * Append a buffer into a lock-free ring. This is an internal function.
+ *
+ * @param ring [in] The ring.
+ * @param buffer [in] The buffer to be appended.
+ *
+ * Each slot carries a sequence number, so a producer only claims a slot
+ * that has been released by the consumer of the previous lap.
+ * A single-producer ring claims the slot without CAS.
+ *
+ * A ring never really overflows because it is larger than the number of
+ * buffers owned by a pipe. A slot that still looks occupied is being
+ * released by a concurrent consumer, so the producer simply retries.
+ */
+static void
+dpipe_ring_enqueue(dpipe_ring_t *ring, dpipe_buffer_t *buffer) {
+	unsigned int pos, idx;
+	int diff;
+	//
+	pos = (unsigned int) ga_atomic_load(&ring->enqpos);
+	for(;;) {
+		idx = pos & ring->mask;
+		diff = (int) ((unsigned int) ga_atomic_load(&ring->cell[idx].seq) - pos);
+		if(diff == 0) {
+			if(ring->multi_producer == 0) {
+				ga_atomic_store(&ring->enqpos, (int) (pos + 1));
+				break;
+			}
+			if(ga_atomic_cas(&ring->enqpos, (int) pos, (int) (pos + 1)))
+				break;
+		} else if(diff < 0) {
+			ga_atomic_pause();
+		}
+		pos = (unsigned int) ga_atomic_load(&ring->enqpos);
+	}
+	ring->cell[idx].index = buffer->index;
+	ga_atomic_store(&ring->cell[idx].seq, (int) (pos + 1));
+	return;
+}
+
+/**
+ * Remove the eldest buffer from a lock-free ring. This is an internal function.
+ *
+ * @param dpipe [in] The pipe that owns the ring.
+ * @param ring [in] The ring.
+ * @return Pointer to the buffer, or NULL if the ring is empty.
+ *
+ * A ring can always have multiple consumers:
+ * dpipe_get() steals frames from the output pool when the input pool is empty.
+ */
+static dpipe_buffer_t *
+dpipe_ring_dequeue(dpipe_t *dpipe, dpipe_ring_t *ring) {
+	unsigned int pos, idx;
+	int diff, index;
+	//
+	pos = (unsigned int) ga_atomic_load(&ring->deqpos);
+	for(;;) {
+		idx = pos & ring->mask;
+		diff = (int) ((unsigned int) ga_atomic_load(&ring->cell[idx].seq) - (pos + 1));
+		if(diff == 0) {
+			if(ga_atomic_cas(&ring->deqpos, (int) pos, (int) (pos + 1)))
+				break;
+		} else if(diff < 0) {
+			return NULL;
+		}
+		pos = (unsigned int) ga_atomic_load(&ring->deqpos);
+	}
+	index = ring->cell[idx].index;
+	ga_atomic_store(&ring->cell[idx].seq, (int) (pos + ring->mask + 1));
+	// a shared ring can be corrupted by another process
+	if(index < 0 || index >= dpipe->nframe) {
+		ga_error("dpipe: '%s' invalid buffer index %d\n", dpipe->name, index);
+		return NULL;
+	}
+	return dpipe->buffers[index];
+}
+
+/**
+ * Park a consumer (or a producer) of a lock-free dpipe until it is woken up.
+ * This is an internal function.
+ *
+ * @param dpipe [in] The pipe.
+ * @param cond [in] The condition used when futex is not available.
+ * @param word [in] The wakeup sequence: \a wakeseq for consumers, or \a putseq for producers.
+ * @param seq [in] The \a word value read before the caller checks the pool.
+ * @param abstime [in] Wait until \a abstime, or NULL to wait indefinitely.
+ *
+ * It returns immediately if \a word has been changed since \a seq is read.
+ */
+static void
+dpipe_park(dpipe_t *dpipe, pthread_cond_t *cond, volatile int *word, int seq, const struct timespec *abstime) {
+#ifdef DPIPE_USE_FUTEX
+	// futex words in a shared memory segment cannot be private
+	int priv = dpipe->shm != NULL ? 0 : FUTEX_PRIVATE_FLAG;
+	if(abstime == NULL) {
+		syscall(SYS_futex, word, FUTEX_WAIT | priv,
+			seq, NULL, NULL, 0);
+	} else {
+		syscall(SYS_futex, word,
+			FUTEX_WAIT_BITSET | priv | FUTEX_CLOCK_REALTIME,
+			seq, abstime, NULL, FUTEX_BITSET_MATCH_ANY);
+	}
+#else
+	int err = 0;
+	pthread_mutex_lock(&dpipe->cond_mutex);
+	while(err == 0 && ga_atomic_load(word) == seq) {
+		if(abstime == NULL) {
+			err = pthread_cond_wait(cond, &dpipe->cond_mutex);
+		} else {
+			err = pthread_cond_timedwait(cond, &dpipe->cond_mutex, abstime);
+		}
+	}
+	pthread_mutex_unlock(&dpipe->cond_mutex);
+#endif
+	return;
+}
+
+/**
+ * Wake up parked consumers (or producers) of a lock-free dpipe.
+ * This is an internal function.
+ *
+ * @param dpipe [in] The pipe.
+ * @param cond [in] The condition used when futex is not available.
+ * @param word [in] The wakeup sequence: \a wakeseq for consumers, or \a putseq for producers.
+ * @param waiters [in] The number of parked threads: \a waiters or \a put_waiters.
+ *
+ * No system call is made unless a thread is actually parked.
+ */
+static void
+dpipe_wake(dpipe_t *dpipe, pthread_cond_t *cond, volatile int *word, volatile int *waiters) {
+	ga_atomic_fence();
+	if(ga_atomic_load(waiters) == 0)
+		return;
+#ifdef DPIPE_USE_FUTEX
+	ga_atomic_add(word, 1);
+	syscall(SYS_futex, word,
+		FUTEX_WAKE | (dpipe->shm != NULL ? 0 : FUTEX_PRIVATE_FLAG),
+		INT_MAX, NULL, NULL, 0);
+#else
+	pthread_mutex_lock(&dpipe->cond_mutex);
+	ga_atomic_add(word, 1);
+	pthread_cond_broadcast(cond);
+	pthread_mutex_unlock(&dpipe->cond_mutex);
+#endif
+	return;
+}
+
+/**
+ * Convert a dpipe mode name to the corresponding mode value.
+ *
+ * @param mode [in] Mode name: "locked", "spsc", "mpsc", or "shm".
+ * @return The \a DPIPE_MODE_* value, or -1 if the name is unknown.
+ *
+ * A NULL or empty name refers to the default mode (DPIPE_MODE_LOCKED).
+ */
+int
+dpipe_parse_mode(const char *mode) {
+	if(mode == NULL || *mode == '\0')
+		return DPIPE_MODE_LOCKED;
+	if(strcasecmp(mode, "locked") == 0)
+		return DPIPE_MODE_LOCKED;
+	if(strcasecmp(mode, "spsc") == 0)
+		return DPIPE_MODE_SPSC;
+	if(strcasecmp(mode, "mpsc") == 0)
+		return DPIPE_MODE_MPSC;
+	if(strcasecmp(mode, "shm") == 0)
+		return DPIPE_MODE_SHM;
+	return -1;
+}
+
+/**
+ * Convert a dpipe delivery policy name to the corresponding policy value.
+ *
+ * @param policy [in] Policy name: "fifo", "latest", "bounded", or "block".
+ * @return The \a DPIPE_POLICY_* value, or -1 if the name is unknown.
+ *
+ * A NULL or empty name refers to the default policy (DPIPE_POLICY_FIFO).
+ */
+int
+dpipe_parse_policy(const char *policy) {
+	if(policy == NULL || *policy == '\0')
+		return DPIPE_POLICY_FIFO;
+	if(strcasecmp(policy, "fifo") == 0)
+		return DPIPE_POLICY_FIFO;
+	if(strcasecmp(policy, "latest") == 0)
+		return DPIPE_POLICY_LATEST;
+	if(strcasecmp(policy, "bounded") == 0)
+		return DPIPE_POLICY_BOUNDED;
+	if(strcasecmp(policy, "block") == 0)
+		return DPIPE_POLICY_BLOCK;
+	return -1;
+}
+
 /**
  * Create and register a new video pipe.
  *
@@ -40,48 +346,258 @@ static map<string,dpipe_t*> dpipemap;
  * @return Pointer to a created dpipe, or NULL on failure
  *
  * Note: dpipe_create() also returns NULL if the requesting name is existed.
+ * This function creates a pipe in DPIPE_MODE_LOCKED mode.
  */
 dpipe_t *
 dpipe_create(int id, const char *name, int nframe, int maxframesize) {
-	int i;
+	return dpipe_create_ex(id, name, nframe, maxframesize, DPIPE_MODE_LOCKED);
+}
+
+/**
+ * Allocate and initialize a dpipe structure. This is an internal function.
+ *
+ * @param id [in] The video channel id
+ * @param name [in] The name of the dpipe
+ * @param mode [in] The operation mode
+ * @return Pointer to the dpipe, or NULL on failure
+ *
+ * Rings and frame buffers are not allocated.
+ */
+static dpipe_t *
+dpipe_alloc(int id, const char *name, int mode) {
 	dpipe_t *dpipe;
-	// sanity checks
-	if(name == NULL || id < 0 || nframe <= 0 || maxframesize <= 0)
-		return NULL;
-	// existing?
-	if((dpipe = dpipe_lookup(name)) != NULL)
-		return NULL;
-	// allocate the space
 	if((dpipe = (dpipe_t*) malloc(sizeof(dpipe_t))) == NULL)
 		return NULL;
 	//
 	bzero(dpipe, sizeof(dpipe_t));
 	dpipe->channel_id = id;
-	if((dpipe->name = strdup(name)) == NULL)
-		goto err_create;
+	dpipe->mode = mode;
+	dpipe->ctl = &dpipe->ctl_local;
 	pthread_mutex_init(&dpipe->cond_mutex, NULL);
 	pthread_cond_init(&dpipe->cond, NULL);
+	pthread_cond_init(&dpipe->put_cond, NULL);
 	pthread_mutex_init(&dpipe->io_mutex, NULL);
-	// alloc and init frame buffers
-	for(i = 0; i < nframe; i++) {
+	dpipe->policy = DPIPE_POLICY_FIFO;
+	if((dpipe->name = strdup(name)) == NULL) {
+		dpipe_destroy(dpipe);
+		return NULL;
+	}
+	return dpipe;
+}
+
+#ifdef DPIPE_USE_SHM
+/**
+ * Create or open the shared memory segment of a dpipe.
+ * This is an internal function.
+ *
+ * @param dpipe [in] The dpipe. For creation, \a nframe and \a maxframesize must be set.
+ * @param create [in] Create a new segment if non-zero, otherwise open an existing one.
+ * @return 0 on success, or -1 on failure.
+ *
+ * The segment is named /ga-<uid>-<pipename>.
+ * An existing segment with the same name is replaced on creation.
+ * On success, \a shm, \a ctl, \a inring, and \a outring point into the segment,
+ * and \a nframe and \a maxframesize are loaded from the segment when opening.
+ */
+static int
+dpipe_shm_open(dpipe_t *dpipe, int create) {
+	dpipe_shm_header_t *hdr;
+	struct stat st;
+	char shmname[256];
+	long long ringsize, size;
+	int fd;
+	//
+	snprintf(shmname, sizeof(shmname), "/ga-%u-%s", (unsigned int) getuid(), dpipe->name);
+	if((dpipe->shmname = strdup(shmname)) == NULL)
+		return -1;
+	if(create) {
+		shm_unlink(shmname);
+		fd = shm_open(shmname, O_RDWR | O_CREAT | O_EXCL, 0600);
+	} else {
+		fd = shm_open(shmname, O_RDWR, 0);
+	}
+	if(fd < 0) {
+		if(create)
+			ga_error("dpipe: create shared memory %s failed: %s\n", shmname, strerror(errno));
+		return -1;
+	}
+	if(create) {
+#define	SHM_ALIGN(x)	((((x) + DPIPE_SHM_ALIGN - 1) / DPIPE_SHM_ALIGN) * DPIPE_SHM_ALIGN)
+		ringsize = SHM_ALIGN((long long) dpipe_ring_size(dpipe->nframe, NULL));
+		size = SHM_ALIGN((long long) sizeof(dpipe_shm_header_t)) + 2 * ringsize
+			+ (long long) dpipe->nframe * SHM_ALIGN(dpipe->maxframesize);
+		if(ftruncate(fd, size) < 0) {
+			ga_error("dpipe: resize shared memory %s failed: %s\n", shmname, strerror(errno));
+			goto err_shm;
+		}
+	} else {
+		if(fstat(fd, &st) < 0 || st.st_size < (off_t) sizeof(dpipe_shm_header_t))
+			goto err_shm;
+		size = st.st_size;
+	}
+	dpipe->shm = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if(dpipe->shm == MAP_FAILED) {
+		dpipe->shm = NULL;
+		ga_error("dpipe: map shared memory %s failed: %s\n", shmname, strerror(errno));
+		goto err_shm;
+	}
+	close(fd);
+	dpipe->shmsize = size;
+	dpipe->shmcreator = create;
+	hdr = (dpipe_shm_header_t*) dpipe->shm;
+	//
+	if(create) {
+		bzero(hdr, sizeof(dpipe_shm_header_t));
+		hdr->magic = DPIPE_SHM_MAGIC;
+		hdr->version = DPIPE_SHM_VERSION;
+		hdr->nframe = dpipe->nframe;
+		hdr->maxframesize = dpipe->maxframesize;
+		hdr->framestride = SHM_ALIGN(dpipe->maxframesize);
+		hdr->inring = SHM_ALIGN((long long) sizeof(dpipe_shm_header_t));
+		hdr->outring = hdr->inring + ringsize;
+		hdr->frames = hdr->outring + ringsize;
+		hdr->size = size;
+		// the hooked game and the server can both be producers
+		dpipe_ring_init((dpipe_ring_t*) ((char*) dpipe->shm + hdr->inring), dpipe->nframe, 1);
+		dpipe_ring_init((dpipe_ring_t*) ((char*) dpipe->shm + hdr->outring), dpipe->nframe, 1);
+#undef	SHM_ALIGN
+	} else {
+		if(hdr->magic != DPIPE_SHM_MAGIC || hdr->version != DPIPE_SHM_VERSION
+		|| ga_atomic_load(&hdr->ready) == 0 || hdr->size != size) {
+			ga_error("dpipe: shared memory %s is not ready or incompatible.\n", shmname);
+			return -1;
+		}
+		dpipe->nframe = hdr->nframe;
+		dpipe->maxframesize = hdr->maxframesize;
+	}
+	dpipe->ctl = &hdr->ctl;
+	dpipe->inring = (dpipe_ring_t*) ((char*) dpipe->shm + hdr->inring);
+	dpipe->outring = (dpipe_ring_t*) ((char*) dpipe->shm + hdr->outring);
+	return 0;
+err_shm:
+	close(fd);
+	return -1;
+}
+#endif	/* DPIPE_USE_SHM */
+
+/**
+ * Setup frame buffers of a dpipe. This is an internal function.
+ *
+ * @param dpipe [in] The dpipe.
+ * @param fill [in] Put all the frame buffers into the input pool.
+ * @return 0 on success, or -1 on failure.
+ *
+ * Frame buffers of a shared memory dpipe are located in the segment.
+ */
+static int
+dpipe_setup_buffers(dpipe_t *dpipe, int fill) {
+	int i;
+	dpipe->buffers = (dpipe_buffer_t**) calloc(dpipe->nframe, sizeof(dpipe_buffer_t*));
+	if(dpipe->buffers == NULL)
+		return -1;
+	for(i = 0; i < dpipe->nframe; i++) {
 		dpipe_buffer_t* dbuffer;
 		if((dbuffer = (dpipe_buffer_t*) malloc(sizeof(dpipe_buffer_t))) == NULL)
-			goto err_create;
-		if(ga_malloc(maxframesize, &dbuffer->internal, &dbuffer->offset) < 0) {
+			return -1;
+		bzero(dbuffer, sizeof(dpipe_buffer_t));
+		if(dpipe->shm != NULL) {
+			dpipe_shm_header_t *hdr = (dpipe_shm_header_t*) dpipe->shm;
+			dbuffer->pointer = (void*) ((char*) dpipe->shm + hdr->frames + (long long) i * hdr->framestride);
+		} else if(ga_malloc(dpipe->maxframesize, &dbuffer->internal, &dbuffer->offset) < 0) {
 			free(dbuffer);
-			goto err_create;
+			return -1;
+		} else {
+			dbuffer->pointer = (void*) (((char*) dbuffer->internal) + dbuffer->offset);
 		}
-		dbuffer->pointer = (void*) (((char*) dbuffer->internal) + dbuffer->offset);
+		dbuffer->owner = dpipe;
+		dbuffer->index = i;
+		dpipe->buffers[i] = dbuffer;
 		dbuffer->next = dpipe->in;
 		dpipe->in = dbuffer;
-		dpipe->in_count++;
+		if(fill == 0)
+			continue;
+		dpipe->ctl->in_count++;
+		if(dpipe->inring != NULL)
+			dpipe_ring_enqueue(dpipe->inring, dbuffer);
 	}
+	return 0;
+}
+
+/**
+ * Create and register a new video pipe with a given operation mode.
+ *
+ * @param id [in] The video channel id
+ * @param name [in] The name of the dpipe, must be unique
+ * @param nframe [in] Number of frame buffers in the pipe
+ * @param maxframesize [in] The maximum frame buffer size
+ * @param mode [in] The operation mode: DPIPE_MODE_LOCKED, DPIPE_MODE_SPSC, DPIPE_MODE_MPSC, or DPIPE_MODE_SHM
+ * @return Pointer to a created dpipe, or NULL on failure
+ *
+ * In lock-free modes (DPIPE_MODE_SPSC, DPIPE_MODE_MPSC, and DPIPE_MODE_SHM),
+ * the input and output pools are bounded lock-free rings.
+ * dpipe_get(), dpipe_put(), dpipe_store(), and dpipe_load_nowait()
+ * never block, and dpipe_load() only enters the kernel when the
+ * output pool is empty. A producer only issues a wakeup system call
+ * when the consumer is actually parked.
+ *
+ * In lock-free modes, the \a in list links all the frame buffers owned by
+ * the pipe and is never changed after creation, so that callers can still
+ * walk through \a in to initialize the frame buffers.
+ * The \a in_count and \a out_count are maintained atomically.
+ *
+ * DPIPE_MODE_SHM places the rings, the shared states, and the frame buffers
+ * in a POSIX shared memory segment, so that another process can
+ * attach to the pipe using dpipe_attach() and work as its consumer
+ * (or producer). Processes are signalled with shared futexes.
+ * It is only available on Linux.
+ */
+dpipe_t *
+dpipe_create_ex(int id, const char *name, int nframe, int maxframesize, int mode) {
+	dpipe_t *dpipe;
+	static const char *modename[] = { "locked", "spsc", "mpsc", "shm" };
+	// sanity checks
+	if(name == NULL || id < 0 || nframe <= 0 || maxframesize <= 0)
+		return NULL;
+	if(mode < DPIPE_MODE_LOCKED || mode > DPIPE_MODE_SHM)
+		return NULL;
+#ifndef DPIPE_USE_SHM
+	if(mode == DPIPE_MODE_SHM) {
+		ga_error("dpipe: shared memory mode is not supported on this platform.\n");
+		return NULL;
+	}
+#endif
+	// existing?
+	if((dpipe = dpipe_lookup(name)) != NULL)
+		return NULL;
+	// allocate the space
+	if((dpipe = dpipe_alloc(id, name, mode)) == NULL)
+		return NULL;
+	dpipe->nframe = nframe;
+	dpipe->maxframesize = maxframesize;
+	if(mode == DPIPE_MODE_SHM) {
+#ifdef DPIPE_USE_SHM
+		if(dpipe_shm_open(dpipe, 1) < 0)
+			goto err_create;
+#endif
+	} else if(mode != DPIPE_MODE_LOCKED) {
+		// the input pool is refilled by the consumer, and
+		// can be filled by any thread calling dpipe_put()
+		dpipe->inring = dpipe_ring_create(nframe, 1);
+		dpipe->outring = dpipe_ring_create(nframe, mode == DPIPE_MODE_MPSC);
+		if(dpipe->inring == NULL || dpipe->outring == NULL)
+			goto err_create;
+	}
+	// alloc and init frame buffers
+	if(dpipe_setup_buffers(dpipe, 1) < 0)
+		goto err_create;
+	if(dpipe->shm != NULL)
+		ga_atomic_store(&((dpipe_shm_header_t*) dpipe->shm)->ready, 1);
 	//
 	pthread_mutex_lock(&dpipemap_mutex);
 	dpipemap[dpipe->name] = dpipe;
 	pthread_mutex_unlock(&dpipemap_mutex);
-	ga_error("dpipe: '%s' initialized, %d frames, framesize = %d\n",
-		dpipe->name, dpipe->in_count, maxframesize);
+	ga_error("dpipe: '%s' initialized, %d frames, framesize = %d, mode = %s\n",
+		dpipe->name, dpipe->ctl->in_count, maxframesize, modename[mode]);
 	return dpipe;
 	// failure cases
 err_create:
@@ -89,6 +605,138 @@ err_create:
 	return NULL;
 }
 
+/**
+ * Attach to a shared memory pipe created by another process.
+ *
+ * @param id [in] The video channel id
+ * @param name [in] The name of the dpipe, must be the same as the creator's
+ * @return Pointer to the attached dpipe, or NULL on failure
+ *
+ * The returned pipe works in DPIPE_MODE_SHM mode and is registered
+ * with \a name, so it can be found using dpipe_lookup().
+ * The number of frames and the frame size are defined by the creator.
+ * It returns NULL if the pipe has not been created yet.
+ * Frame buffers are not initialized by this function.
+ */
+dpipe_t *
+dpipe_attach(int id, const char *name) {
+#ifdef DPIPE_USE_SHM
+	dpipe_t *dpipe;
+	if(name == NULL || id < 0)
+		return NULL;
+	if(dpipe_lookup(name) != NULL)
+		return NULL;
+	if((dpipe = dpipe_alloc(id, name, DPIPE_MODE_SHM)) == NULL)
+		return NULL;
+	if(dpipe_shm_open(dpipe, 0) < 0)
+		goto err_attach;
+	if(dpipe_setup_buffers(dpipe, 0) < 0)
+		goto err_attach;
+	//
+	pthread_mutex_lock(&dpipemap_mutex);
+	dpipemap[dpipe->name] = dpipe;
+	pthread_mutex_unlock(&dpipemap_mutex);
+	ga_error("dpipe: '%s' attached, %d frames, framesize = %d\n",
+		dpipe->name, dpipe->nframe, dpipe->maxframesize);
+	return dpipe;
+err_attach:
+	// not registered yet: destroy quietly
+	free(dpipe->name);
+	dpipe->name = NULL;
+	dpipe_destroy(dpipe);
+	return NULL;
+#else
+	ga_error("dpipe: shared memory mode is not supported on this platform.\n");
+	return NULL;
+#endif
+}
+
+/**
+ * Get the user data area of a shared memory pipe.
+ *
+ * @param dpipe [in] The pipe.
+ * @param size [out] Size of the user data area, can be NULL.
+ * @return Pointer to the user data area, or NULL if \a dpipe is not in shared memory.
+ *
+ * The area has DPIPE_SHM_USERDATA bytes. It is initially zeroed,
+ * and can be used by the creator to pass configurations to other processes.
+ */
+void *
+dpipe_shm_userdata(dpipe_t *dpipe, int *size) {
+	if(dpipe == NULL || dpipe->shm == NULL)
+		return NULL;
+	if(size != NULL)
+		*size = DPIPE_SHM_USERDATA;
+	return ((dpipe_shm_header_t*) dpipe->shm)->userdata;
+}
+
+/**
+ * Set the callback to fix process-local data in frame buffers.
+ *
+ * @param dpipe [in] The pipe.
+ * @param localize [in] The callback function, or NULL to remove the callback.
+ *
+ * Frame buffers of a shared memory pipe are mapped at different addresses
+ * in different processes. If a frame contains pointers to itself,
+ * \a localize is called with the frame buffer whenever it is obtained
+ * by this process, i.e., returned from dpipe_get(), dpipe_load(),
+ * and dpipe_load_nowait(), so that the pointers can be fixed.
+ */
+void
+dpipe_set_localize(dpipe_t *dpipe, dpipe_localize_t localize) {
+	dpipe->localize = localize;
+	return;
+}
+
+/**
+ * Set the frame delivery policy of a pipe.
+ *
+ * @param dpipe [in] The pipe.
+ * @param policy [in] The delivery policy: DPIPE_POLICY_*.
+ * @param depth [in] Maximum number of queued frames for DPIPE_POLICY_BOUNDED.
+ *	Values less than 1 are treated as 1. Ignored by other policies.
+ * @return 0 on success, or -1 if \a policy is unknown.
+ *
+ * - DPIPE_POLICY_FIFO: all frames are delivered in order.
+ *	dpipe_get() drops the eldest frame only if no free buffer is available.
+ * - DPIPE_POLICY_LATEST: the pipe works as a mailbox.
+ *	dpipe_load() and dpipe_load_nowait() always return the newest frame,
+ *	and older frames are recycled.
+ * - DPIPE_POLICY_BOUNDED: dpipe_store() drops the eldest frames
+ *	if there are more than \a depth frames in the output pool.
+ * - DPIPE_POLICY_BLOCK: frames are never dropped.
+ *	dpipe_get() waits until a consumer releases a buffer.
+ *
+ * The policy can be changed at any time.
+ * Producers waiting in dpipe_get() are woken up on changes.
+ */
+int
+dpipe_set_policy(dpipe_t *dpipe, int policy, int depth) {
+	static const char *names[] = { "fifo", "latest", "bounded", "block" };
+	if(policy < DPIPE_POLICY_FIFO || policy > DPIPE_POLICY_BLOCK)
+		return -1;
+	if(depth < 1)
+		depth = 1;
+	ga_atomic_store(&dpipe->depth, depth);
+	ga_atomic_store(&dpipe->policy, policy);
+	// release producers blocked by the previous policy
+	if(dpipe->mode != DPIPE_MODE_LOCKED) {
+		dpipe_wake(dpipe, &dpipe->put_cond, &dpipe->ctl->putseq, &dpipe->ctl->put_waiters);
+	} else {
+		pthread_mutex_lock(&dpipe->io_mutex);
+		pthread_cond_broadcast(&dpipe->put_cond);
+		pthread_mutex_unlock(&dpipe->io_mutex);
+	}
+	if(policy == DPIPE_POLICY_BOUNDED) {
+		ga_error("dpipe: '%s' delivery policy = %s, depth = %d\n",
+			dpipe->name, names[policy], depth);
+	} else {
+		ga_error("dpipe: '%s' delivery policy = %s\n",
+			dpipe->name, names[policy]);
+	}
+	return 0;
+}
+
 /**
  * Lookup an existing video pipe
  *
@@ -115,58 +763,124 @@ dpipe_lookup(const char *name) {
  */
 int
 dpipe_destroy(dpipe_t *dpipe) {
-	dpipe_buffer_t *vbuf, *next;
+	int i;
 	if(dpipe == NULL)
 		return 0;
 	if(dpipe->name) {
 		pthread_mutex_lock(&dpipemap_mutex);
 		dpipemap.erase(dpipe->name);
 		pthread_mutex_unlock(&dpipemap_mutex);
+		ga_error("dpipe: '%s' destroyed, %lld frames stored, %lld loaded, dropped: overrun = %lld, stale = %lld, depth = %lld\n",
+			dpipe->name, dpipe->stored, dpipe->loaded,
+			dpipe->dropped_overrun, dpipe->dropped_stale, dpipe->dropped_depth);
 		free(dpipe->name);
 	}
 	pthread_mutex_destroy(&dpipe->cond_mutex);
 	pthread_cond_destroy(&dpipe->cond);
+	pthread_cond_destroy(&dpipe->put_cond);
 	pthread_mutex_destroy(&dpipe->io_mutex);
-	//
-	for(vbuf = dpipe->in; vbuf != NULL; vbuf = next) {
-		next = vbuf->next;
-		free(vbuf->internal);
-		free(vbuf);
+	if(dpipe->shm == NULL) {
+		dpipe_ring_destroy(dpipe->inring);
+		dpipe_ring_destroy(dpipe->outring);
+	}
+	if(dpipe->buffers != NULL) {
+		for(i = 0; i < dpipe->nframe; i++) {
+			if(dpipe->buffers[i] == NULL)
+				continue;
+			free(dpipe->buffers[i]->internal);
+			free(dpipe->buffers[i]);
+		}
+		free(dpipe->buffers);
 	}
-	for(vbuf = dpipe->out; vbuf != NULL; vbuf = next) {
-		next = vbuf->next;
-		free(vbuf->internal);
-		free(vbuf);
+#ifdef DPIPE_USE_SHM
+	if(dpipe->shm != NULL)
+		munmap(dpipe->shm, dpipe->shmsize);
+	if(dpipe->shmname != NULL) {
+		if(dpipe->shmcreator)
+			shm_unlink(dpipe->shmname);
+		free(dpipe->shmname);
 	}
+#endif
 	//
 	free(dpipe);
 	return 0;
 }
 
 /**
- * Get a free frame buffer from the pipe
+ * Record the wait time of a producer or a consumer. This is an internal function.
+ *
+ * @param hist [in] The wait time histogram.
+ * @param start [in] When the caller started waiting, or NULL if it did not wait.
+ */
+static void
+dpipe_wait_record(ga_hist_t *hist, long long *start) {
+	if(start == NULL) {
+		ga_hist_add(hist, 0);
+		return;
+	}
+	ga_hist_add(hist, (ga_clock_ns() - *start) / 1000LL);
+	return;
+}
+
+/**
+ * Get a free frame buffer, or the eldest frame buffer in the output pool.
+ * This is an internal function.
  *
  * @param dpipe [in] The pipe to get a free frame
  * @return Pointer to the frame buffer structure
  *
- * Note: Data should be stored in vbuf->pointer, with a maximum size
- * of \a maxframesize given when creating the pipe.
- * This function should always success.
- * In case there is no availabe free frame buffer, this function
- * returns the eldest frame buffer in the output pool.
- * 
+ * With DPIPE_POLICY_BLOCK, it waits for a free frame buffer instead.
  */
-dpipe_buffer_t *
-dpipe_get(dpipe_t *dpipe) {
+static dpipe_buffer_t *
+dpipe_get_internal(dpipe_t *dpipe) {
 	dpipe_buffer_t *vbuf = NULL;
+	long long waitstart;
+	int waited = 0;
+	//
+	if(dpipe->mode != DPIPE_MODE_LOCKED) {
+		int seq;
+		while((vbuf = dpipe_ring_dequeue(dpipe, dpipe->inring)) == NULL) {
+			if(ga_atomic_load(&dpipe->policy) != DPIPE_POLICY_BLOCK) {
+				// no available buffers: drop the eldest frame buffer
+				if((vbuf = dpipe_ring_dequeue(dpipe, dpipe->outring)) != NULL) {
+					ga_atomic_add(&dpipe->ctl->out_count, -1);
+					ga_atomic_add64(&dpipe->dropped_overrun, 1);
+				}
+				goto quit_get;
+			}
+			if(waited == 0) {
+				waitstart = ga_clock_ns();
+				waited = 1;
+			}
+			seq = ga_atomic_load(&dpipe->ctl->putseq);
+			ga_atomic_add(&dpipe->ctl->put_waiters, 1);
+			// check again: a consumer may have missed our waiters count
+			if((vbuf = dpipe_ring_dequeue(dpipe, dpipe->inring)) != NULL) {
+				ga_atomic_add(&dpipe->ctl->put_waiters, -1);
+				break;
+			}
+			if(ga_atomic_load(&dpipe->policy) == DPIPE_POLICY_BLOCK)
+				dpipe_park(dpipe, &dpipe->put_cond, &dpipe->ctl->putseq, seq, NULL);
+			ga_atomic_add(&dpipe->ctl->put_waiters, -1);
+		}
+		ga_atomic_add(&dpipe->ctl->in_count, -1);
+		goto quit_get;
+	}
 	//
 	pthread_mutex_lock(&dpipe->io_mutex);
+	if(dpipe->in == NULL && dpipe->policy == DPIPE_POLICY_BLOCK) {
+		waitstart = ga_clock_ns();
+		waited = 1;
+	}
+	while(dpipe->in == NULL && dpipe->policy == DPIPE_POLICY_BLOCK) {
+		pthread_cond_wait(&dpipe->put_cond, &dpipe->io_mutex);
+	}
 	if(dpipe->in != NULL) {
 		// quick path: has available frame buffers
 		if((vbuf = dpipe->in) != NULL) {
 			dpipe->in = vbuf->next;
 			vbuf->next = NULL;
-			dpipe->in_count--;
+			dpipe->ctl->in_count--;
 		}
 	} else {
 		// no available buffers: drop the eldest frame buffer from output pool
@@ -176,46 +890,222 @@ dpipe_get(dpipe_t *dpipe) {
 			if(dpipe->out == NULL) {
 				dpipe->out_tail = NULL;
 			}
-			dpipe->out_count--;
+			dpipe->ctl->out_count--;
+			ga_atomic_add64(&dpipe->dropped_overrun, 1);
 		}
 	}
 	pthread_mutex_unlock(&dpipe->io_mutex);
 	//
+quit_get:
+	dpipe_wait_record(&dpipe->producer_wait, waited ? &waitstart : NULL);
 	return vbuf;
 }
 
 /**
- * Put a frame back to the free frame buffer (input pool)
+ * Put a frame back to the free frame buffer (input pool).
+ * This is an internal function.
  *
  * @param dpipe [in] The involved pipe
  * @param buffer [in] Pointer to the buffer to be released
  */
-void
-dpipe_put(dpipe_t *dpipe, dpipe_buffer_t *buffer) {
+static void
+dpipe_put_internal(dpipe_t *dpipe, dpipe_buffer_t *buffer) {
+	if(dpipe->mode != DPIPE_MODE_LOCKED) {
+		dpipe_ring_enqueue(dpipe->inring, buffer);
+		ga_atomic_add(&dpipe->ctl->in_count, 1);
+		// producers in other processes may have a different policy
+		if(dpipe->shm != NULL || ga_atomic_load(&dpipe->policy) == DPIPE_POLICY_BLOCK)
+			dpipe_wake(dpipe, &dpipe->put_cond, &dpipe->ctl->putseq, &dpipe->ctl->put_waiters);
+		return;
+	}
 	pthread_mutex_lock(&dpipe->io_mutex);
 	buffer->next = dpipe->in;
 	dpipe->in = buffer;
-	dpipe->in_count++;
+	dpipe->ctl->in_count++;
 	pthread_mutex_unlock(&dpipe->io_mutex);
+	pthread_cond_signal(&dpipe->put_cond);
 	return;
 }
 
 /**
- * Load a frame from the output pool of the pipe
+ * Drop a reference to a shared payload. This is an internal function.
  *
- * @param dpipe [in] Pointer to the pipe to load a buffer
- * @param abstime [in] Wait for a frame until \a abstime, pass NULL to wait indefinitely
- * @return Pointer to the loaded buffer
+ * @param buffer [in] The buffer that owns the shared payload.
  *
- * This function returns the first frame buffer in the output pool.
- * If \a abstime is NULL, this function blocks until a frame buffer
- * is available in the output pool.
- * If \a abstime is given, it returns NULL on timed out.
+ * The buffer is recycled into its owner's input pool
+ * when the last reference is dropped.
+ */
+static void
+dpipe_unref(dpipe_buffer_t *buffer) {
+	if(ga_atomic_add(&buffer->refcount, -1) == 1)
+		dpipe_put_internal(buffer->owner, buffer);
+	return;
+}
+
+/**
+ * Detach a buffer from the payload it references and drop the reference.
+ * This is an internal function.
+ *
+ * @param buffer [in] A buffer that references a shared payload.
+ */
+static void
+dpipe_detach(dpipe_buffer_t *buffer) {
+	dpipe_buffer_t *source = buffer->source;
+	buffer->source = NULL;
+	buffer->pointer = (void*) (((char*) buffer->internal) + buffer->offset);
+	dpipe_unref(source);
+	return;
+}
+
+/**
+ * Get a free frame buffer from the pipe
+ *
+ * @param dpipe [in] The pipe to get a free frame
+ * @return Pointer to the frame buffer structure, or NULL if all the
+ *	buffers of the pipe are held by references from other pipes.
+ *
+ * Note: Data should be stored in vbuf->pointer, with a maximum size
+ * of \a maxframesize given when creating the pipe.
+ * In case there is no availabe free frame buffer, this function
+ * returns the eldest frame buffer in the output pool,
+ * unless the pipe works with DPIPE_POLICY_BLOCK.
+ * With DPIPE_POLICY_BLOCK, this function waits until a buffer is released.
+ *
+ * A dropped frame whose payload is still referenced by other pipes
+ * is never reused here. It is recycled when its last reference is released.
+ * So a pipe whose frames are published with dpipe_share() can run out of
+ * buffers while the consumers of the other pipes lag behind.
+ * Producers of such a pipe must skip the frame if NULL is returned.
+ * It does not wait for the references: a pipe without a running consumer
+ * only drops them when the producer shares its next frame.
+ * A pipe whose frames are never shared always returns a buffer.
  */
 dpipe_buffer_t *
-dpipe_load(dpipe_t *dpipe, const struct timespec *abstime) {
+dpipe_get(dpipe_t *dpipe) {
+	dpipe_buffer_t *vbuf;
+	//
+	while((vbuf = dpipe_get_internal(dpipe)) != NULL) {
+		// a dropped reference to another payload
+		if(vbuf->source != NULL) {
+			dpipe_detach(vbuf);
+			break;
+		}
+		if(ga_atomic_load(&vbuf->refcount) == 0)
+			break;
+		// a dropped frame that is shared: give up our reference
+		dpipe_unref(vbuf);
+	}
+	if(vbuf != NULL && dpipe->localize != NULL)
+		dpipe->localize(dpipe, vbuf);
+	return vbuf;
+}
+
+/**
+ * Put a frame back to the free frame buffer (input pool)
+ *
+ * @param dpipe [in] The involved pipe
+ * @param buffer [in] Pointer to the buffer to be released
+ *
+ * If \a buffer references a shared payload (see dpipe_share()),
+ * the reference is released as well.
+ * If \a buffer's own payload is shared, the buffer is not recycled until
+ * all the references are released.
+ */
+void
+dpipe_put(dpipe_t *dpipe, dpipe_buffer_t *buffer) {
+	if(buffer->source != NULL) {
+		dpipe_detach(buffer);
+	} else if(ga_atomic_load(&buffer->refcount) != 0) {
+		dpipe_unref(buffer);
+		return;
+	}
+	dpipe_put_internal(dpipe, buffer);
+	return;
+}
+
+/**
+ * Publish the payload of a frame buffer to another pipe without copying.
+ *
+ * @param dpipe [in] The pipe to publish the payload.
+ * @param buffer [in] The frame buffer that holds the payload.
+ * @return A buffer of \a dpipe that references the payload of \a buffer,
+ *	or NULL if \a dpipe has no available buffers.
+ *
+ * The returned buffer should be stored into \a dpipe using dpipe_store().
+ * Its \a pointer is the same as \a buffer->pointer, so the payload
+ * must be read-only for all the consumers.
+ * The caller must still hold \a buffer, i.e., call this function before
+ * \a buffer is stored into (or put back to) its own pipe.
+ *
+ * A shared payload is reference-counted: \a buffer is recycled into its
+ * own pipe only after its consumer and all the consumers of the
+ * referencing buffers have called dpipe_put().
+ *
+ * A payload cannot be referenced by another process, so the payload is
+ * copied if \a dpipe is a shared memory pipe (DPIPE_MODE_SHM).
+ * The consumer's localize callback (see dpipe_set_localize()) has to fix
+ * the copied payload.
+ */
+dpipe_buffer_t *
+dpipe_share(dpipe_t *dpipe, dpipe_buffer_t *buffer) {
+	dpipe_buffer_t *ref;
+	// always refer to the real payload
+	if(buffer->source != NULL)
+		buffer = buffer->source;
+	if((ref = dpipe_get(dpipe)) == NULL)
+		return NULL;
+	if(dpipe->shm != NULL) {
+		bcopy(buffer->pointer, ref->pointer,
+			dpipe->maxframesize < buffer->owner->maxframesize ?
+			dpipe->maxframesize : buffer->owner->maxframesize);
+		return ref;
+	}
+	// the first reference also counts the current holder
+	if(ga_atomic_cas(&buffer->refcount, 0, 2) == 0)
+		ga_atomic_add(&buffer->refcount, 1);
+	ref->source = buffer;
+	ref->pointer = buffer->pointer;
+	return ref;
+}
+
+/**
+ * Load the eldest frame from the output pool of the pipe.
+ * This is an internal function.
+ *
+ * @param dpipe [in] Pointer to the pipe to load a buffer
+ * @param abstime [in] Wait for a frame until \a abstime, pass NULL to wait indefinitely
+ * @return Pointer to the loaded buffer, or NULL on timed out
+ */
+static dpipe_buffer_t *
+dpipe_load_internal(dpipe_t *dpipe, const struct timespec *abstime) {
 	dpipe_buffer_t *vbuf = NULL;
-	int failed = 0;
+	long long waitstart;
+	int failed = 0, waited = 0;
+	//
+	if(dpipe->mode != DPIPE_MODE_LOCKED) {
+		int seq;
+		while((vbuf = dpipe_ring_dequeue(dpipe, dpipe->outring)) == NULL) {
+			if(failed != 0)
+				goto quit_load;
+			if(waited == 0) {
+				waitstart = ga_clock_ns();
+				waited = 1;
+			}
+			seq = ga_atomic_load(&dpipe->ctl->wakeseq);
+			ga_atomic_add(&dpipe->ctl->waiters, 1);
+			// check again: a producer may have missed our waiters count
+			if((vbuf = dpipe_ring_dequeue(dpipe, dpipe->outring)) != NULL) {
+				ga_atomic_add(&dpipe->ctl->waiters, -1);
+				break;
+			}
+			dpipe_park(dpipe, &dpipe->cond, &dpipe->ctl->wakeseq, seq, abstime);
+			ga_atomic_add(&dpipe->ctl->waiters, -1);
+			if(abstime != NULL)
+				failed = 1;
+		}
+		ga_atomic_add(&dpipe->ctl->out_count, -1);
+		goto quit_load;
+	}
 	//
 	pthread_mutex_lock(&dpipe->io_mutex);
 again:
@@ -225,34 +1115,46 @@ again:
 		vbuf->next = NULL;
 		if(dpipe->out == NULL)
 			dpipe->out_tail = NULL;
-		dpipe->out_count--;
+		dpipe->ctl->out_count--;
 	} else if(abstime == NULL) {
 		// no frame buffered
+		if(waited == 0) {
+			waitstart = ga_clock_ns();
+			waited = 1;
+		}
 		pthread_cond_wait(&dpipe->cond, &dpipe->io_mutex);
 		goto again;
 	} else if(failed == 0) {
+		waitstart = ga_clock_ns();
+		waited = 1;
 		pthread_cond_timedwait(&dpipe->cond, &dpipe->io_mutex, abstime);
 		failed = 1;
 		goto again;
 	}
 	pthread_mutex_unlock(&dpipe->io_mutex);
 	//
+quit_load:
+	dpipe_wait_record(&dpipe->consumer_wait, waited ? &waitstart : NULL);
 	return vbuf;
 }
 
 /**
- * Load a frame from the output pool of the pipe without wait
+ * Load the eldest frame from the output pool of the pipe without wait.
+ * This is an internal function.
  *
  * @param dpipe [in] Pointer to the pipe to load a buffer
- * @return Pointer to the loaded buffer
- *
- * This function returns the first frame buffer in the output pool.
- * If there is not a frame in the output pool, it returns NULL immediately.
+ * @return Pointer to the loaded buffer, or NULL if the output pool is empty
  */
-dpipe_buffer_t *
-dpipe_load_nowait(dpipe_t *dpipe) {
+static dpipe_buffer_t *
+dpipe_load_nowait_internal(dpipe_t *dpipe) {
 	dpipe_buffer_t *vbuf = NULL;
 	//
+	if(dpipe->mode != DPIPE_MODE_LOCKED) {
+		if((vbuf = dpipe_ring_dequeue(dpipe, dpipe->outring)) != NULL)
+			ga_atomic_add(&dpipe->ctl->out_count, -1);
+		return vbuf;
+	}
+	//
 	pthread_mutex_lock(&dpipe->io_mutex);
 	if(dpipe->out != NULL) {
 		vbuf = dpipe->out;
@@ -260,22 +1162,123 @@ dpipe_load_nowait(dpipe_t *dpipe) {
 		vbuf->next = NULL;
 		if(dpipe->out == NULL)
 			dpipe->out_tail = NULL;
-		dpipe->out_count--;
+		dpipe->ctl->out_count--;
 	}
 	pthread_mutex_unlock(&dpipe->io_mutex);
 	//
 	return vbuf;
 }
 
+/**
+ * Skip stale frames for DPIPE_POLICY_LATEST. This is an internal function.
+ *
+ * @param dpipe [in] Pointer to the pipe
+ * @param vbuf [in] The frame just loaded from the pipe
+ * @return The newest frame in the pipe
+ *
+ * All the frames older than the returned one are put back to the pipe.
+ */
+static dpipe_buffer_t *
+dpipe_load_latest(dpipe_t *dpipe, dpipe_buffer_t *vbuf) {
+	dpipe_buffer_t *newer;
+	if(vbuf == NULL || ga_atomic_load(&dpipe->policy) != DPIPE_POLICY_LATEST)
+		return vbuf;
+	while((newer = dpipe_load_nowait_internal(dpipe)) != NULL) {
+		dpipe_put(dpipe, vbuf);
+		ga_atomic_add64(&dpipe->dropped_stale, 1);
+		vbuf = newer;
+	}
+	return vbuf;
+}
+
+/**
+ * Load a frame from the output pool of the pipe
+ *
+ * @param dpipe [in] Pointer to the pipe to load a buffer
+ * @param abstime [in] Wait for a frame until \a abstime, pass NULL to wait indefinitely
+ * @return Pointer to the loaded buffer
+ *
+ * This function returns the first frame buffer in the output pool.
+ * If \a abstime is NULL, this function blocks until a frame buffer
+ * is available in the output pool.
+ * If \a abstime is given, it returns NULL on timed out.
+ *
+ * With DPIPE_POLICY_LATEST, it returns the last frame buffer in the
+ * output pool instead, and all the older frames are put back to the pipe.
+ */
+dpipe_buffer_t *
+dpipe_load(dpipe_t *dpipe, const struct timespec *abstime) {
+	dpipe_buffer_t *vbuf = dpipe_load_latest(dpipe, dpipe_load_internal(dpipe, abstime));
+	if(vbuf == NULL)
+		return NULL;
+	ga_atomic_add64(&dpipe->loaded, 1);
+	if(dpipe->localize != NULL && vbuf->source == NULL)
+		dpipe->localize(dpipe, vbuf);
+	return vbuf;
+}
+
+/**
+ * Load a frame from the output pool of the pipe without wait
+ *
+ * @param dpipe [in] Pointer to the pipe to load a buffer
+ * @return Pointer to the loaded buffer
+ *
+ * This function returns the first frame buffer in the output pool.
+ * If there is not a frame in the output pool, it returns NULL immediately.
+ *
+ * With DPIPE_POLICY_LATEST, it returns the last frame buffer in the
+ * output pool instead, and all the older frames are put back to the pipe.
+ */
+dpipe_buffer_t *
+dpipe_load_nowait(dpipe_t *dpipe) {
+	dpipe_buffer_t *vbuf = dpipe_load_latest(dpipe, dpipe_load_nowait_internal(dpipe));
+	if(vbuf == NULL)
+		return NULL;
+	ga_atomic_add64(&dpipe->loaded, 1);
+	if(dpipe->localize != NULL && vbuf->source == NULL)
+		dpipe->localize(dpipe, vbuf);
+	return vbuf;
+}
+
+/**
+ * Drop the eldest frames beyond \a depth for DPIPE_POLICY_BOUNDED.
+ * This is an internal function.
+ *
+ * @param dpipe [in] The involved pipe
+ */
+static void
+dpipe_store_bounded(dpipe_t *dpipe) {
+	dpipe_buffer_t *vbuf;
+	while(ga_atomic_load(&dpipe->ctl->out_count) > ga_atomic_load(&dpipe->depth)) {
+		if((vbuf = dpipe_load_nowait_internal(dpipe)) == NULL)
+			break;
+		dpipe_put(dpipe, vbuf);
+		ga_atomic_add64(&dpipe->dropped_depth, 1);
+	}
+	return;
+}
+
 /**
  * Store a frame into the output pool of the pipe.
  * This function also notifies the receiver that is attempting to load a buffer.
  *
  * @param dpipe [in] The involved pipe
  * @param buffer [in] Pointer to the buffer to be stored.
+ *
+ * With DPIPE_POLICY_BOUNDED, the eldest frames are dropped
+ * if the output pool has more than \a depth frames.
  */
 void
 dpipe_store(dpipe_t *dpipe, dpipe_buffer_t *buffer) {
+	ga_atomic_add64(&dpipe->stored, 1);
+	if(dpipe->mode != DPIPE_MODE_LOCKED) {
+		dpipe_ring_enqueue(dpipe->outring, buffer);
+		ga_hist_add(&dpipe->occupancy, ga_atomic_add(&dpipe->ctl->out_count, 1) + 1);
+		if(ga_atomic_load(&dpipe->policy) == DPIPE_POLICY_BOUNDED)
+			dpipe_store_bounded(dpipe);
+		dpipe_wake(dpipe, &dpipe->cond, &dpipe->ctl->wakeseq, &dpipe->ctl->waiters);
+		return;
+	}
 	pthread_mutex_lock(&dpipe->io_mutex);
 	// put at the end
 	if(dpipe->out_tail != NULL) {
@@ -285,10 +1288,43 @@ dpipe_store(dpipe_t *dpipe, dpipe_buffer_t *buffer) {
 		dpipe->out = dpipe->out_tail = buffer;
 	}
 	buffer->next = NULL;
-	dpipe->out_count++;
+	dpipe->ctl->out_count++;
+	ga_hist_add(&dpipe->occupancy, dpipe->ctl->out_count);
 	//
 	pthread_mutex_unlock(&dpipe->io_mutex);
+	if(dpipe->policy == DPIPE_POLICY_BOUNDED)
+		dpipe_store_bounded(dpipe);
 	pthread_cond_signal(&dpipe->cond);
 	return;
 }
 
+/**
+ * Take a snapshot of the statistics of a pipe.
+ *
+ * @param dpipe [in] The pipe.
+ * @param stats [out] Pointer to store the statistics.
+ * @return 0 on success, or -1 on error.
+ *
+ * All the counters are updated atomically, so this function can be called
+ * from any thread without stopping producers and consumers.
+ * Counters are read one by one, so they may be slightly inconsistent
+ * with each other if the pipe is busy.
+ */
+int
+dpipe_stats(dpipe_t *dpipe, dpipe_stats_t *stats) {
+	if(dpipe == NULL || stats == NULL)
+		return -1;
+	stats->stored = ga_atomic_load64(&dpipe->stored);
+	stats->loaded = ga_atomic_load64(&dpipe->loaded);
+	stats->dropped_overrun = ga_atomic_load64(&dpipe->dropped_overrun);
+	stats->dropped_stale = ga_atomic_load64(&dpipe->dropped_stale);
+	stats->dropped_depth = ga_atomic_load64(&dpipe->dropped_depth);
+	stats->dropped = stats->dropped_overrun + stats->dropped_stale + stats->dropped_depth;
+	stats->in_count = ga_atomic_load(&dpipe->ctl->in_count);
+	stats->out_count = ga_atomic_load(&dpipe->ctl->out_count);
+	ga_hist_snapshot(&dpipe->occupancy, stats->occupancy);
+	ga_hist_snapshot(&dpipe->producer_wait, stats->producer_wait);
+	ga_hist_snapshot(&dpipe->consumer_wait, stats->consumer_wait);
+	return 0;
+}
+
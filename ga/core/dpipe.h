@@ -37,11 +37,86 @@ typedef struct dpipe_buffer_s {
 	void *internal;		/**< internal pointer to the allocated buffer space. Used with malloc() and free(). */
 	int offset;		/**< data pointer offset from internal */
 	struct dpipe_buffer_s *next;	/**< pointer to the next dpipe frame buffer */
+	// shared payload support, see dpipe_share()
+	struct dpipe_s *owner;		/**< the pipe that allocates this buffer */
+	struct dpipe_buffer_s *source;	/**< the buffer whose payload is referenced by this buffer, or NULL */
+	volatile int refcount;		/**< number of holders of this buffer's payload, 0 if not shared */
+	int index;			/**< index of this buffer in the owner's \a buffers */
 }	dpipe_buffer_t;
 
+/**
+ * dpipe operation modes, see dpipe_create_ex()
+ */
+enum dpipe_modes {
+	DPIPE_MODE_LOCKED = 0,	/**< Buffer pools protected by \a io_mutex (default) */
+	DPIPE_MODE_SPSC,	/**< Lock-free: single producer, single consumer */
+	DPIPE_MODE_MPSC,	/**< Lock-free: multiple producers, single consumer */
+	DPIPE_MODE_SHM		/**< Lock-free in a shared memory segment: producers and the consumer can be in different processes */
+};
+
+/** Size of the user data area in a shared memory dpipe, see dpipe_shm_userdata() */
+#define	DPIPE_SHM_USERDATA	1024
+
+/**
+ * dpipe frame delivery policies, see dpipe_set_policy()
+ */
+enum dpipe_policies {
+	DPIPE_POLICY_FIFO = 0,	/**< Deliver frames in order, drop the eldest only if no free buffer (default) */
+	DPIPE_POLICY_LATEST,	/**< Mailbox: dpipe_load() always returns the newest frame */
+	DPIPE_POLICY_BOUNDED,	/**< Keep at most \a depth frames in the output pool */
+	DPIPE_POLICY_BLOCK	/**< Never drop frames: dpipe_get() waits for a free buffer */
+};
+
+/**
+ * A cell of a lock-free ring
+ */
+typedef struct dpipe_ring_cell_s {
+	volatile int seq;	/**< sequence number of the cell */
+	int index;		/**< index of the frame buffer stored in the cell */
+}	dpipe_ring_cell_t;
+
+/**
+ * Bounded lock-free ring of frame buffer indices (used by lock-free modes).
+ * It contains no pointers, so that it can be placed in shared memory.
+ */
+typedef struct dpipe_ring_s {
+	unsigned int mask;	/**< ring size - 1, ring size is 2^n */
+	int multi_producer;	/**< enqueue with CAS if there are multiple producers */
+	char pad0[64];		/**< keep producer and consumer positions in different cache lines */
+	volatile int enqpos;	/**< next position to enqueue */
+	char pad1[64];
+	volatile int deqpos;	/**< next position to dequeue */
+	char pad2[64];
+	dpipe_ring_cell_t cell[1];	/**< the cells: there are (mask + 1) cells in total */
+}	dpipe_ring_t;
+
+/**
+ * dpipe states shared by all producers and consumers.
+ * It is placed in the shared memory segment for DPIPE_MODE_SHM.
+ */
+typedef struct dpipe_ctl_s {
+	volatile int in_count;		/**< number of unused frame buffers */
+	volatile int out_count;		/**< number of occupied frames */
+	volatile int waiters;		/**< number of parked consumers (lock-free modes) */
+	volatile int wakeseq;		/**< wakeup sequence, also used as the futex word (lock-free modes) */
+	volatile int put_waiters;	/**< number of parked producers (lock-free modes) */
+	volatile int putseq;		/**< producer wakeup sequence, also used as the futex word (lock-free modes) */
+}	dpipe_ctl_t;
+
+struct dpipe_s;
+/**
+ * Callback to fix process-local data in a frame buffer of a shared memory dpipe,
+ * see dpipe_set_localize()
+ */
+typedef void (*dpipe_localize_t)(struct dpipe_s *dpipe, dpipe_buffer_t *buffer);
+
 typedef struct dpipe_s {
 	int channel_id;		/**< channel id for the dpipe */
 	char *name;		/**< name of the dpipe */
+	int mode;		/**< dpipe operation mode: DPIPE_MODE_* */
+	int nframe;		/**< number of frame buffers */
+	int maxframesize;	/**< size of each frame buffer */
+	dpipe_buffer_t **buffers;	/**< all the frame buffers, indexed by \a dpipe_buffer_t::index */
 	//
 	pthread_mutex_t cond_mutex;	/**< pthread mutex for conditional signaling */
 	pthread_cond_t cond;		/**< pthread condition */
@@ -50,11 +125,57 @@ typedef struct dpipe_s {
 	dpipe_buffer_t *in;		/**< input pool: pointer to the first frame buffer in input pool (free frames) */
 	dpipe_buffer_t *out;		/**< output pool: pointer to the first frame buffer in output pool (occupied frames) */
 	dpipe_buffer_t *out_tail;	/**< output pool: pointer to the last frame buffer in output pool (occupied frames) */
-	int in_count;			/**< number of unused frame buffers */
-	int out_count;			/**< number of occupied frames */
+	dpipe_ctl_t *ctl;		/**< shared states: points to \a ctl_local, or into the shared memory segment */
+	dpipe_ctl_t ctl_local;		/**< shared states of a process-local dpipe */
+	// lock-free modes only
+	dpipe_ring_t *inring;		/**< lock-free input pool (free frames) */
+	dpipe_ring_t *outring;		/**< lock-free output pool (occupied frames) */
+	// DPIPE_MODE_SHM only
+	void *shm;			/**< the mapped shared memory segment */
+	size_t shmsize;			/**< size of the segment */
+	char *shmname;			/**< name of the segment */
+	int shmcreator;			/**< the segment is created (and will be removed) by this process */
+	dpipe_localize_t localize;	/**< fix process-local data when a frame buffer is acquired */
+	// delivery policy
+	int policy;			/**< frame delivery policy: DPIPE_POLICY_* */
+	int depth;			/**< maximum number of queued frames for DPIPE_POLICY_BOUNDED */
+	pthread_cond_t put_cond;	/**< pthread condition for producers waiting for a free buffer */
+	volatile long long dropped_overrun;	/**< eldest frames reused by dpipe_get() because no free buffer is available */
+	volatile long long dropped_stale;	/**< stale frames skipped by dpipe_load() with DPIPE_POLICY_LATEST */
+	volatile long long dropped_depth;	/**< eldest frames dropped by dpipe_store() with DPIPE_POLICY_BOUNDED */
+	// statistics, see dpipe_stats()
+	volatile long long stored;	/**< frames stored by dpipe_store() */
+	volatile long long loaded;	/**< frames returned by dpipe_load() and dpipe_load_nowait() */
+	ga_hist_t occupancy;		/**< number of frames in the output pool, sampled on each store */
+	ga_hist_t producer_wait;	/**< time (in microseconds) dpipe_get() waits for a free buffer */
+	ga_hist_t consumer_wait;	/**< time (in microseconds) dpipe_load() waits for a frame */
 }	dpipe_t;
 
+/**
+ * Snapshot of dpipe statistics, see dpipe_stats()
+ */
+typedef struct dpipe_stats_s {
+	long long stored;		/**< frames stored */
+	long long loaded;		/**< frames loaded */
+	long long dropped;		/**< total dropped frames */
+	long long dropped_overrun;	/**< frames dropped because no free buffer is available */
+	long long dropped_stale;	/**< stale frames skipped with DPIPE_POLICY_LATEST */
+	long long dropped_depth;	/**< frames dropped with DPIPE_POLICY_BOUNDED */
+	int in_count;			/**< current number of free frame buffers */
+	int out_count;			/**< current number of frames in the output pool */
+	long long occupancy[GA_HIST_BUCKETS];	/**< output pool occupancy histogram, see ga_hist_add() */
+	long long producer_wait[GA_HIST_BUCKETS];	/**< producer wait time histogram (microseconds) */
+	long long consumer_wait[GA_HIST_BUCKETS];	/**< consumer wait time histogram (microseconds) */
+}	dpipe_stats_t;
+
 EXPORT dpipe_t *	dpipe_create(int id, const char *name, int nframe, int maxframesize);
+EXPORT dpipe_t *	dpipe_create_ex(int id, const char *name, int nframe, int maxframesize, int mode);
+EXPORT int		dpipe_parse_mode(const char *mode);
+EXPORT int		dpipe_parse_policy(const char *policy);
+EXPORT int		dpipe_set_policy(dpipe_t *dpipe, int policy, int depth);
+EXPORT dpipe_t *	dpipe_attach(int id, const char *name);
+EXPORT void *		dpipe_shm_userdata(dpipe_t *dpipe, int *size);
+EXPORT void		dpipe_set_localize(dpipe_t *dpipe, dpipe_localize_t localize);
 EXPORT dpipe_t *	dpipe_lookup(const char *name);
 EXPORT int		dpipe_destroy(dpipe_t *dpipe);
 EXPORT dpipe_buffer_t *	dpipe_get(dpipe_t *dpipe);
@@ -62,5 +183,7 @@ EXPORT void		dpipe_put(dpipe_t *dpipe, dpipe_buffer_t *buffer);
 EXPORT dpipe_buffer_t *	dpipe_load(dpipe_t *dpipe, const struct timespec *abstime);
 EXPORT dpipe_buffer_t *	dpipe_load_nowait(dpipe_t *dpipe);
 EXPORT void		dpipe_store(dpipe_t *dpipe, dpipe_buffer_t *buffer);
+EXPORT dpipe_buffer_t *	dpipe_share(dpipe_t *dpipe, dpipe_buffer_t *buffer);
+EXPORT int		dpipe_stats(dpipe_t *dpipe, dpipe_stats_t *stats);
 
 #endif	/* __GA_DPIPE_H__ */
@@ -27,6 +27,8 @@
 
 #include "vsource.h"
 #include "encoder-common.h"
+#include "ga-atomic.h"
+#include "ga-trace.h"
 
 using namespace std;
 
@@ -34,11 +36,13 @@ static pthread_rwlock_t encoder_lock = PTHREAD_RWLOCK_INITIALIZER;
 static map<void*, void*> encoder_clients; /**< Count for encoder clients */
 
 static bool threadLaunched = false;	/**< Encoder thread is running? */
+static pthread_mutex_t runmutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t runcond = PTHREAD_COND_INITIALIZER;	/**< Signaled when encoders are launched */
 
 // for pts sync between encoders
 static pthread_mutex_t syncmutex = PTHREAD_MUTEX_INITIALIZER;
 static bool sync_reset = true;
-static struct timeval synctv;
+static long long syncns;
 
 // list of encoders
 static ga_module_t *vencoder = NULL;	/**< Video encoder instance */
@@ -58,21 +62,19 @@ static void *aencoder_param = NULL;	/**< Audio encoder parameter */
  */
 int	// XXX: need to be int64_t ?
 encoder_pts_sync(int samplerate) {
-	struct timeval tv;
-	long long us;
+	long long ns;
 	int ret;
 	//
 	pthread_mutex_lock(&syncmutex);
 	if(sync_reset) {
-		gettimeofday(&synctv, NULL);
+		syncns = ga_clock_ns();
 		sync_reset = false; 
 		pthread_mutex_unlock(&syncmutex);
 		return 0;
 	}
-	gettimeofday(&tv, NULL);
-	us = tvdiff_us(&tv, &synctv);
+	ns = ga_clock_ns() - syncns;
 	pthread_mutex_unlock(&syncmutex);
-	ret = (int) (0.000001 * us * samplerate);
+	ret = (int) (0.000000001 * ns * samplerate);
 	return ret > 0 ? ret : 0;
 }
 
@@ -86,6 +88,30 @@ encoder_running() {
 	return threadLaunched ? 1 : 0;
 }
 
+/**
+ * Wait until the encoder is launched.
+ *
+ * @param abstime [in] Wait until \a abstime (in the wall-clock time),
+ *	or NULL to wait indefinitely.
+ * @return 0 if encoder is not running or 1 if encdoer is running.
+ *
+ * Sources can block here instead of polling encoder_running()
+ * while no client is connected.
+ */
+int
+encoder_wait_running(const struct timespec *abstime) {
+	pthread_mutex_lock(&runmutex);
+	while(threadLaunched == false) {
+		if(abstime == NULL) {
+			pthread_cond_wait(&runcond, &runmutex);
+		} else if(pthread_cond_timedwait(&runcond, &runmutex, abstime) != 0) {
+			break;
+		}
+	}
+	pthread_mutex_unlock(&runmutex);
+	return threadLaunched ? 1 : 0;
+}
+
 /**
  * Register a video encoder module.
  *
@@ -225,7 +251,10 @@ encoder_register_client(void /*RTSPContext*/ *rtsp) {
 			}
 		}
 		// must be set before encoder starts!
+		pthread_mutex_lock(&runmutex);
 		threadLaunched = true;
+		pthread_cond_broadcast(&runcond);
+		pthread_mutex_unlock(&runmutex);
 		// start video encoder
 		if(vencoder != NULL && vencoder->start != NULL) {
 			if(vencoder->start(vencoder_param) < 0) {
@@ -277,6 +306,9 @@ encoder_unregister_client(void /*RTSPContext*/ *rtsp) {
 #endif
 		// reset packet queue
 		encoder_pktqueue_reset();
+		// save the latency trace of this session
+		if(ga_trace_enabled())
+			ga_trace_save(NULL);
 		// reset sync pts
 		pthread_mutex_lock(&syncmutex);
 		sync_reset = true;
@@ -293,7 +325,8 @@ encoder_unregister_client(void /*RTSPContext*/ *rtsp) {
  * @param channelId [in] Channel id.
  * @param pkt [in] The packet to be delivery.
  * @param encoderPts [in] Encoder presentation timestamp in an integer.
- * @param ptv [in] Encoder presentation timestamp in \a timeval structure.
+ * @param ptime [in] Presentation time in nano seconds (see ga_clock_ns()),
+ *	or 0 to use the current time.
  * @return 0 on success, or -1 on error.
  *
  * \a channelId is used to identify whether this packet is an audio packet or
@@ -302,9 +335,9 @@ encoder_unregister_client(void /*RTSPContext*/ *rtsp) {
  * A audio packet usually uses a channel id of \a N.
  */
 int
-encoder_send_packet(const char *prefix, int channelId, AVPacket *pkt, int64_t encoderPts, struct timeval *ptv) {
+encoder_send_packet(const char *prefix, int channelId, AVPacket *pkt, int64_t encoderPts, int64_t ptime) {
 	if(sinkserver) {
-		return sinkserver->send_packet(prefix, channelId, pkt, encoderPts, ptv);
+		return sinkserver->send_packet(prefix, channelId, pkt, encoderPts, ptime);
 	}
 	ga_error("encoder: no sink server registered.\n");
 	return -1;
@@ -332,16 +365,16 @@ encoder_pts_clear(unsigned queueid) {
  *
  * @param queueid [in] The id of the pts queue.
  * @param pts [in] The pts value.
- * @param ptv [in] The correspond ptv value for the \a pts.
+ * @param ptime [in] The correspond presentation time (nano seconds) for the \a pts.
  * @return 0 on success, or -1 on failure.
  */
 int
-encoder_pts_put(unsigned queueid, long long pts, struct timeval *ptv) {
+encoder_pts_put(unsigned queueid, long long pts, long long ptime) {
 	encoder_pts_t p;
 	if(queueid >= MAX_PTS_QUEUE)
 		return -1;
 	p.pts = pts;
-	p.ptv = *ptv;
+	p.ptime = ptime;
 	pts_queue[queueid].push_back(p);
 	return 0;
 }
@@ -351,58 +384,128 @@ encoder_pts_put(unsigned queueid, long long pts, struct timeval *ptv) {
  *
  * @param queueid [in] The id of the pts queue.
  * @param pts [in] The pts value.
- * @param ptv [out] Store the retrieved ptv value.
  * @param interpolation [in] Use interpolation to get an approximate ptv value.
- * @return The \a ptv pointer if success, or NULL on failure.
+ * @return The presentation time in nano seconds, or -1 on failure.
  *
  * Note that the interpolation feature may be only required for audio packets.
  * The \a interpolation value should be the sample rate of audio frames.
  */
-struct timeval *
-encoder_ptv_get(unsigned queueid, long long pts, struct timeval *ptv, int interpolation) {
-	if(ptv == NULL)
-		return NULL;
+long long
+encoder_ptv_get(unsigned queueid, long long pts, int interpolation) {
+	long long ptime;
 	if(queueid >= MAX_PTS_QUEUE)
-		return NULL;
+		return -1LL;
 	while(pts_queue[queueid].size() > 0) {
 		if(pts > pts_queue[queueid].front().pts) {
 			pts_queue[queueid].pop_front();
 			continue;
 		}
 		if(pts_queue[queueid].front().pts == pts) {
-			*ptv = pts_queue[queueid].front().ptv;
+			ptime = pts_queue[queueid].front().ptime;
 			pts_queue[queueid].pop_front();
-			return ptv;
+			return ptime;
 		}
 		if(interpolation > 0) {
-			long long delta_ts, delta_tv;
+			long long delta_ts;
 			delta_ts = pts_queue[queueid].front().pts - pts;
-			delta_tv = (long long) (1.0 * delta_ts / interpolation);
-			*ptv = pts_queue[queueid].front().ptv;
-			ptv->tv_sec -= (delta_tv / 1000000LL);
-			delta_tv %= 1000000LL;
-			if(ptv->tv_usec < delta_tv) {
-				ptv->tv_sec--;
-				ptv->tv_usec += 1000000LL;
-			}
-			ptv->tv_usec -= delta_tv;
-			return ptv;
+			ptime = pts_queue[queueid].front().ptime;
+			return ptime - (long long) (1000000000.0 * delta_ts / interpolation);
 		}
 		break;
 	}
 #if 1
 	ga_error("FIXME: encoder_ptv_get failed: id=%d, pts=%lld\n", queueid, pts);
 #endif
-	return NULL;
+	return -1LL;
 }
 
 // encoder packet queue functions - for async packet delivery
 static int pktqueue_initqsize = -1;
 static int pktqueue_initchannels = -1;
 static encoder_packet_queue_t pktqueue[VIDEO_SOURCE_CHANNEL_MAX+1];
-static list<encoder_packet_t> pktlist[VIDEO_SOURCE_CHANNEL_MAX+1];
 static map<qcallback_t,qcallback_t>queue_cb[VIDEO_SOURCE_CHANNEL_MAX+1];
 
+/**
+ * Get the \a idx-th queued packet descriptor. This is an internal function.
+ */
+static inline encoder_packet_t *
+encoder_pktqueue_desc(encoder_packet_queue_t *q, int idx) {
+	return &q->pkts[(q->pkthead + idx) % ENCODER_PKTQUEUE_DESCRIPTORS];
+}
+
+/**
+ * Make room for a packet at the queue tail. This is an internal function.
+ *
+ * @param q [in] The packet queue, must be locked by the caller.
+ * @param size [in] Size of the packet.
+ * @return 0 if \a size contiguous bytes are available at \a q->tail, or -1 if the queue is full.
+ *
+ * If the end-of-buffer space is not sufficient, the space is padded to
+ * the last queued packet and \a q->tail is wrapped to the beginning.
+ * One descriptor is always kept for encoder_pktqueue_split_packet().
+ */
+static int
+encoder_pktqueue_make_room(encoder_packet_queue_t *q, int size) {
+	int padding;
+	while(1) {
+		if(q->datasize + size > q->bufsize)
+			return -1;
+		if(q->pktcount >= ENCODER_PKTQUEUE_DESCRIPTORS - 1)
+			return -1;
+		if(q->bufsize - q->tail >= size)
+			return 0;
+		// end-of-buffer space is not sufficient
+		if(q->pktcount == 0) {
+			q->datasize = q->tail = q->head = 0;
+		} else {
+			padding = q->bufsize - q->tail;
+			encoder_pktqueue_desc(q, q->pktcount - 1)->padding += padding;
+			q->datasize += padding;
+			q->tail = 0;
+		}
+	}
+	return -1;
+}
+
+/**
+ * Remove the last frame from a packet queue. This is an internal function.
+ *
+ * @param q [in] The packet queue, must be locked by the caller.
+ * @param disposable [in] Remove the frame only if it is disposable.
+ * @return The number of removed packets.
+ *
+ * The frame is removed only if none of its packets has been read,
+ * i.e., the first packet of the frame is not the queue head.
+ */
+static int
+encoder_pktqueue_rollback(encoder_packet_queue_t *q, int disposable) {
+	encoder_packet_t *prev;
+	int i, k;
+	// find the first packet of the last frame
+	for(k = q->pktcount - 1; k > 0; k--) {
+		if(encoder_pktqueue_desc(q, k)->framestart)
+			break;
+	}
+	if(k <= 0)
+		return 0;
+	if(disposable && (encoder_pktqueue_desc(q, k)->flags & AV_PKT_FLAG_DISPOSABLE) == 0)
+		return 0;
+	for(i = k; i < q->pktcount; i++) {
+		encoder_packet_t *p = encoder_pktqueue_desc(q, i);
+		q->datasize -= p->size + p->padding;
+	}
+	// the tail goes back to the end of the previous packet
+	prev = encoder_pktqueue_desc(q, k - 1);
+	q->datasize -= prev->padding;
+	prev->padding = 0;
+	q->tail = (prev->data + prev->size) - q->buf;
+	if(q->tail == q->bufsize)
+		q->tail = 0;
+	i = q->pktcount - k;
+	q->pktcount = k;
+	return i;
+}
+
 /**
  * Initialize an encoder packet queue.
  *
@@ -411,6 +514,7 @@ static map<qcallback_t,qcallback_t>queue_cb[VIDEO_SOURCE_CHANNEL_MAX+1];
  * @return 0 on success, or quit the program on error.
  *
  * This function creates a packet queue of size \a qsize for each channel.
+ * Each queue holds up to ENCODER_PKTQUEUE_DESCRIPTORS-1 packets.
  * This functoin should be called only once.
  * If you have multiple channels, specify the number in the \a channels 
  * parameter.
@@ -421,10 +525,13 @@ encoder_pktqueue_init(int channels, int qsize) {
 	for(i = 0; i < channels; i++) {
 		if(pktqueue[i].buf != NULL)
 			free(pktqueue[i].buf);
+		if(pktqueue[i].pkts != NULL)
+			free(pktqueue[i].pkts);
 		//
 		bzero(&pktqueue[i], sizeof(encoder_packet_queue_t));
 		pthread_mutex_init(&pktqueue[i].mutex, NULL);
-		if((pktqueue[i].buf = (char *) malloc(qsize)) == NULL) {
+		if((pktqueue[i].buf = (char *) malloc(qsize)) == NULL
+		|| (pktqueue[i].pkts = (encoder_packet_t*) malloc(sizeof(encoder_packet_t) * ENCODER_PKTQUEUE_DESCRIPTORS)) == NULL) {
 			ga_error("encoder: initialized packet queue#%d failed (%d bytes)\n",
 				i, qsize);
 			exit(-1);
@@ -433,7 +540,10 @@ encoder_pktqueue_init(int channels, int qsize) {
 		pktqueue[i].datasize = 0;
 		pktqueue[i].head = 0;
 		pktqueue[i].tail = 0;
-		pktlist[i].clear();
+		pktqueue[i].reserved = 0;
+		pktqueue[i].pkthead = 0;
+		pktqueue[i].pktcount = 0;
+		pktqueue[i].framecount = 0;
 	}
 	pktqueue_initqsize = qsize;
 	pktqueue_initchannels = channels;
@@ -463,9 +573,14 @@ encoder_pktqueue_reset() {
 int
 encoder_pktqueue_reset_channel(int channelId) {
 	pthread_mutex_lock(&pktqueue[channelId].mutex);
-	pktlist[channelId].clear();
+	pktqueue[channelId].pkthead = pktqueue[channelId].pktcount = 0;
 	pktqueue[channelId].head = pktqueue[channelId].tail = 0;
 	pktqueue[channelId].datasize = 0;
+	pktqueue[channelId].reserved = 0;
+	pktqueue[channelId].framecount = 0;
+	pktqueue[channelId].keyseen = 0;
+	pktqueue[channelId].dropframe = 0;
+	pktqueue[channelId].needkey = 0;
 	pktqueue[channelId].bufsize = pktqueue_initqsize;
 	pthread_mutex_unlock(&pktqueue[channelId].mutex);
 	return 0;
@@ -482,72 +597,188 @@ encoder_pktqueue_size(int channelId) {
 	return pktqueue[channelId].datasize;
 }
 
+/**
+ * Reserve space at the tail of a packet queue.
+ *
+ * @param channelId [in] The channel id.
+ * @param size [in] Size of the packet to be written.
+ * @return Pointer to \a size contiguous bytes, or NULL if the queue is not
+ *	initialized or it does not have sufficient space.
+ *
+ * An encoder can write its output directly into the returned space and
+ * then pass it to encoder_send_packet() (i.e., \a pkt->data points to the
+ * returned space and \a pkt->size is no more than \a size).
+ * encoder_pktqueue_append() then queues the packet without copying it.
+ * The space is valid until the next packet is appended to the channel,
+ * so only the producer of a channel should call this function.
+ */
+char *
+encoder_pktqueue_reserve(int channelId, int size) {
+	encoder_packet_queue_t *q;
+	char *ptr = NULL;
+	if(channelId < 0 || channelId >= pktqueue_initchannels || size <= 0)
+		return NULL;
+	q = &pktqueue[channelId];
+	pthread_mutex_lock(&q->mutex);
+	if(encoder_pktqueue_make_room(q, size) == 0) {
+		q->reserved = size;
+		ptr = q->buf + q->tail;
+	}
+	pthread_mutex_unlock(&q->mutex);
+	return ptr;
+}
+
 /**
  * Add a packet into a packet queue.
  *
  * @param channelId [in] The channel id.
  * @param pkt [in] The packet to be stored.
  * @param encoderPts [in] The presentation timestamp in an integer.
- * @param ptv [in] The presentation timestamp in a \timeval structure.
+ * @param ptime [in] Presentation time in nano seconds, or 0 to use the current time.
  * @return 0 on success, or -1 on error.
  *
  * The content of \a pkt is copied into the queue buffer, so it can be released
- * after returing from the function.
+ * after returing from the function. If the content has been written into
+ * the space returned from encoder_pktqueue_reserve(), it is not copied.
+ *
+ * Packets with the same \a pkt->pts belong to the same frame, e.g., slices.
+ * Producers should mark keyframes with AV_PKT_FLAG_KEY and non-reference
+ * frames with AV_PKT_FLAG_DISPOSABLE. If the queue is full:
+ * - Queued disposable frames that have not been read are dropped first,
+ *	starting from the most recent one.
+ * - Otherwise, the whole incoming frame is dropped, including its queued
+ *	part, so no partial frame is delivered.
+ * - If a dropped video frame is not disposable, the following frames are
+ *	dropped until the next keyframe, and the video encoder is requested
+ *	to encode a keyframe (GA_IOCTL_REQUEST_KEYFRAME).
+ *	This only applies to producers that mark keyframes.
+ *
+ * Packets without a timestamp (AV_NOPTS_VALUE) cannot be grouped into frames,
+ * so each of them is dropped on its own if the queue is full.
  */
 int
-encoder_pktqueue_append(int channelId, AVPacket *pkt, int64_t encoderPts, struct timeval *ptv) {
+encoder_pktqueue_append(int channelId, AVPacket *pkt, int64_t encoderPts, int64_t ptime) {
 	encoder_packet_queue_t *q = &pktqueue[channelId];
-	encoder_packet_t qp;
+	encoder_packet_t *qp;
 	map<qcallback_t,qcallback_t>::iterator mi;
-	int padding = 0;
-	pthread_mutex_lock(&q->mutex);
-size_check:
-	// size checking
-	if(q->datasize + pkt->size > q->bufsize) {
-		pthread_mutex_unlock(&q->mutex);
-		ga_error("encoder: packet queue #%d full, packet dropped (%d+%d)\n",
-			channelId, q->datasize, pkt->size);
-		return -1;
+	long long waitstart;
+	int framed, framestart, flags, video, rolled = 0, dropped = 0, reqkey = 0;
+	// only measure the wait time if the queue is busy
+	if(pthread_mutex_trylock(&q->mutex) != 0) {
+		waitstart = ga_clock_ns();
+		pthread_mutex_lock(&q->mutex);
+		ga_hist_add(&q->producer_wait, (ga_clock_ns() - waitstart) / 1000LL);
+	} else {
+		ga_hist_add(&q->producer_wait, 0);
 	}
-	// end-of-buffer space is not sufficient
-	if(q->bufsize - q->tail < pkt->size) {
-		if(pktlist[channelId].size() == 0) {
-			q->datasize = q->tail = q->head = 0;
+	// frame tracking
+	video = channelId < video_source_channels();
+	flags = pkt->flags & (AV_PKT_FLAG_KEY | AV_PKT_FLAG_DISPOSABLE);
+	framed = (pkt->pts != AV_NOPTS_VALUE);
+	framestart = (framed == 0 || q->framecount == 0 || pkt->pts != q->lastpts);
+	if(flags & AV_PKT_FLAG_KEY)
+		q->keyseen = 1;
+	if(framestart) {
+		q->lastpts = pkt->pts;
+		q->framecount++;
+		q->dropframe = 0;
+		if(framed && q->needkey && (flags & AV_PKT_FLAG_KEY) == 0) {
+			q->dropframe = 1;
 		} else {
-			padding = q->bufsize - q->tail;
-			pktlist[channelId].back().padding = padding;
-			q->datasize += padding;
-			q->tail = 0;
+			q->needkey = 0;
 		}
-		goto size_check;
 	}
-	bcopy(pkt->data, q->buf + q->tail, pkt->size);
-	//
-	qp.data = q->buf + q->tail;
-	qp.size = pkt->size;
-	qp.pts_int64 = pkt->pts;
-	if(ptv != NULL) {
-		qp.pts_tv = *ptv;
+	if(q->dropframe) {
+		q->reserved = 0;
+		dropped = 1;
+		goto drop_packet;
+	}
+	// written in the reserved space?
+	if(q->reserved > 0
+	&& (char*) pkt->data == q->buf + q->tail
+	&& pkt->size <= q->reserved) {
+		q->reserved = 0;
 	} else {
-		gettimeofday(&qp.pts_tv, NULL);
+		q->reserved = 0;
+		// drop queued disposable frames first
+		while(encoder_pktqueue_make_room(q, pkt->size) < 0) {
+			int n;
+			// do not drop the current frame partially
+			if(framestart == 0
+			&& q->pktcount > 0
+			&& encoder_pktqueue_desc(q, q->pktcount - 1)->pts_int64 == pkt->pts)
+				break;
+			if((n = encoder_pktqueue_rollback(q, 1)) <= 0)
+				break;
+			rolled += n;
+		}
+		if(encoder_pktqueue_make_room(q, pkt->size) < 0) {
+			// drop the whole frame
+			if(framestart == 0
+			&& q->pktcount > 0
+			&& encoder_pktqueue_desc(q, q->pktcount - 1)->pts_int64 == pkt->pts)
+				rolled += encoder_pktqueue_rollback(q, 0);
+			dropped = 1;
+			// packets without a timestamp are dropped one by one
+			if(framed) {
+				q->dropframe = 1;
+				if(video && q->keyseen && (flags & AV_PKT_FLAG_DISPOSABLE) == 0) {
+					reqkey = (q->needkey == 0);
+					q->needkey = 1;
+				}
+			}
+			GA_ERROR_RATELIMITED("encoder: packet queue #%d full, frame dropped (%d+%d)\n",
+				channelId, q->datasize, pkt->size);
+			goto drop_packet;
+		}
+		bcopy(pkt->data, q->buf + q->tail, pkt->size);
 	}
-	//qp.pos = q->tail;
-	qp.padding = 0;
+	//
+	qp = encoder_pktqueue_desc(q, q->pktcount);
+	qp->data = q->buf + q->tail;
+	qp->size = pkt->size;
+	qp->pts_int64 = pkt->pts;
+	qp->queued_ns = ga_clock_ns();
+	qp->pts_ns = ptime = (ptime > 0 ? ptime : qp->queued_ns);
+	qp->flags = flags;
+	qp->framestart = framestart;
+	qp->padding = 0;
 	//
 	q->tail += pkt->size;
 	q->datasize += pkt->size;
-	pktlist[channelId].push_back(qp);
+	q->pktcount++;
+	ga_atomic_add64(&q->stored, 1);
+	ga_hist_add(&q->occupancy, q->datasize);
 	//
 	if(q->tail == q->bufsize)
 		q->tail = 0;
 	//
 	pthread_mutex_unlock(&q->mutex);
+	if(video)
+		ga_trace(GA_TRACE_ENQUEUE, channelId, ptime);
+	// queued disposable frames may have been dropped
+	if(rolled > 0) {
+		ga_atomic_add64(&q->stored, -rolled);
+		ga_atomic_add64(&q->dropped, rolled);
+	}
 	// notify client
 	for(mi = queue_cb[channelId].begin(); mi != queue_cb[channelId].end(); mi++) {
 		mi->second(channelId);
 	}
 	//
 	return 0;
+drop_packet:
+	pthread_mutex_unlock(&q->mutex);
+	ga_atomic_add64(&q->stored, -rolled);
+	ga_atomic_add64(&q->dropped, rolled + dropped);
+	if(reqkey) {
+		ga_ioctl_keyframe_t kf;
+		kf.id = channelId;
+		if(ga_module_ioctl(vencoder, GA_IOCTL_REQUEST_KEYFRAME, sizeof(kf), &kf) < 0) {
+			ga_error("encoder: request keyframe for channel #%d failed.\n", channelId);
+		}
+	}
+	return -1;
 }
 
 /**
@@ -564,11 +795,11 @@ char *
 encoder_pktqueue_front(int channelId, encoder_packet_t *pkt) {
 	encoder_packet_queue_t *q = &pktqueue[channelId];
 	pthread_mutex_lock(&q->mutex);
-	if(pktlist[channelId].size() == 0) {
+	if(q->pktcount == 0) {
 		pthread_mutex_unlock(&q->mutex);
 		return NULL;
 	}
-	*pkt = pktlist[channelId].front();
+	*pkt = *encoder_pktqueue_desc(q, 0);
 	pthread_mutex_unlock(&q->mutex);
 	return pkt->data;
 }
@@ -593,24 +824,27 @@ encoder_pktqueue_front(int channelId, encoder_packet_t *pkt) {
 void
 encoder_pktqueue_split_packet(int channelId, char *offset) {
 	encoder_packet_queue_t *q = &pktqueue[channelId];
-	encoder_packet_t *pkt, newpkt;
+	encoder_packet_t *pkt, *newpkt;
 	pthread_mutex_lock(&q->mutex);
 	// has packet?
-	if(pktlist[channelId].size() == 0)
+	if(q->pktcount == 0)
 		goto quit_split_packet;
-	pkt = &pktlist[channelId].front();
+	pkt = encoder_pktqueue_desc(q, 0);
 	// offset must be in the middle
 	if(offset <= pkt->data || offset >= pkt->data + pkt->size)
 		goto quit_split_packet;
-	// split the packet: the new one
-	newpkt = *pkt;
-	newpkt.size = offset - pkt->data;
-	newpkt.padding = 0;
+	// split the packet: the new one (a descriptor is always available)
+	q->pkthead = (q->pkthead + ENCODER_PKTQUEUE_DESCRIPTORS - 1) % ENCODER_PKTQUEUE_DESCRIPTORS;
+	q->pktcount++;
+	newpkt = encoder_pktqueue_desc(q, 0);
+	*newpkt = *pkt;
+	newpkt->size = offset - pkt->data;
+	newpkt->padding = 0;
 	//
 	pkt->data = offset;
-	pkt->size -= newpkt.size;
-	//
-	pktlist[channelId].push_front(newpkt);
+	pkt->size -= newpkt->size;
+	// both parts are popped, but only one packet was appended
+	ga_atomic_add64(&q->loaded, -1);
 	//
 	pthread_mutex_unlock(&q->mutex);
 	return;
@@ -629,12 +863,15 @@ encoder_pktqueue_pop_front(int channelId) {
 	encoder_packet_queue_t *q = &pktqueue[channelId];
 	encoder_packet_t qp;
 	pthread_mutex_lock(&q->mutex);
-	if(pktlist[channelId].size() == 0) {
+	if(q->pktcount == 0) {
 		pthread_mutex_unlock(&q->mutex);
 		return;
 	}
-	qp = pktlist[channelId].front();
-	pktlist[channelId].pop_front();
+	qp = *encoder_pktqueue_desc(q, 0);
+	q->pkthead = (q->pkthead + 1) % ENCODER_PKTQUEUE_DESCRIPTORS;
+	q->pktcount--;
+	ga_atomic_add64(&q->loaded, 1);
+	ga_hist_add(&q->consumer_wait, (ga_clock_ns() - qp.queued_ns) / 1000LL);
 	// update the packet queue
 	q->head += qp.size;
 	q->head += qp.padding;
@@ -643,7 +880,8 @@ encoder_pktqueue_pop_front(int channelId) {
 	if(q->head == q->bufsize) {
 		q->head = 0;
 	}
-	if(q->head == q->tail) {
+	// do not move the space reserved by the producer
+	if(q->head == q->tail && q->reserved == 0) {
 		q->head = q->tail = 0;
 	}
 	//
@@ -685,3 +923,31 @@ encoder_pktqueue_unregister_callback(int channelId, qcallback_t cb) {
 	return 0;
 }
 
+/**
+ * Take a snapshot of the statistics of a packet queue.
+ *
+ * @param channelId [in] The channel id.
+ * @param stats [out] Pointer to store the statistics.
+ * @return 0 on success, or -1 on error.
+ *
+ * Counters are updated atomically, so this function does not lock the queue.
+ * The consumer wait time is the time a packet stays in the queue,
+ * i.e., from encoder_pktqueue_append() to encoder_pktqueue_pop_front().
+ */
+int
+encoder_pktqueue_stats(int channelId, encoder_pktqueue_stats_t *stats) {
+	encoder_packet_queue_t *q;
+	if(channelId < 0 || channelId >= pktqueue_initchannels || stats == NULL)
+		return -1;
+	q = &pktqueue[channelId];
+	stats->stored = ga_atomic_load64(&q->stored);
+	stats->loaded = ga_atomic_load64(&q->loaded);
+	stats->dropped = ga_atomic_load64(&q->dropped);
+	stats->datasize = ga_atomic_load(&q->datasize);
+	stats->bufsize = q->bufsize;
+	ga_hist_snapshot(&q->occupancy, stats->occupancy);
+	ga_hist_snapshot(&q->producer_wait, stats->producer_wait);
+	ga_hist_snapshot(&q->consumer_wait, stats->consumer_wait);
+	return 0;
+}
+
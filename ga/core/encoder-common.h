@@ -30,6 +30,12 @@
 #include "ga-avcodec.h"
 #include "ga-module.h"
 
+#ifndef AV_PKT_FLAG_DISPOSABLE
+/** The packet can be dropped without breaking the reference chain,
+ * e.g., a non-reference B-frame. Same as the one in newer ffmpeg. */
+#define	AV_PKT_FLAG_DISPOSABLE	0x0010
+#endif
+
 /*
  * Packet format for encoder packet queue.
  *
@@ -39,11 +45,24 @@ typedef struct encoder_packet_s {
 	char *data;		/**< Pointer to the data buffer */
 	unsigned size;		/**< Size of the buffer */
 	int64_t pts_int64;	/**< Packet timestamp in a 64-bit integer */
-	struct timeval pts_tv;	/**< Packet timestamp in \a timeval structure */
+	int64_t pts_ns;		/**< Packet timestamp in nano seconds, see ga_clock_ns() */
+	int flags;		/**< AV_PKT_FLAG_KEY and AV_PKT_FLAG_DISPOSABLE of the packet */
 	// internal data structure - do not touch
+	int framestart;		/**< First packet of a frame: internal used */
 	int padding;		/**< Padding area: internal used */
+	int64_t queued_ns;	/**< When the packet is appended: internal used */
 }	encoder_packet_t;
 
+/** Define the number of packet descriptors in a packet queue */
+#define	ENCODER_PKTQUEUE_DESCRIPTORS	4096
+
+/*
+ * Encoder packet queue.
+ *
+ * Packet data are stored in a byte ring (\a buf), and packets are
+ * described by a fixed descriptor ring (\a pkts), so no memory
+ * allocation is done after the queue is initialized.
+ */
 typedef struct encoder_packet_queue_s {
 	pthread_mutex_t mutex;	/**< Per-queue mutex */
 	char *buf;		/**< Pointer to the packet queue buffer */
@@ -51,17 +70,49 @@ typedef struct encoder_packet_queue_s {
 	int datasize;		/**< Size of occupied data size */
 	int head;		/**< Position of queue head */
 	int tail;		/**< Position of queue tail */
+	int reserved;		/**< Size reserved at \a tail by encoder_pktqueue_reserve() */
+	encoder_packet_t *pkts;	/**< Packet descriptor ring */
+	int pkthead;		/**< Index of the first packet descriptor */
+	int pktcount;		/**< Number of queued packet descriptors */
+	// frame tracking, see encoder_pktqueue_append()
+	int64_t lastpts;	/**< Timestamp of the last appended packet */
+	int framecount;		/**< Number of frames appended */
+	int keyseen;		/**< The producer has marked keyframes */
+	int dropframe;		/**< Drop the rest of the current frame */
+	int needkey;		/**< Drop frames until the next keyframe */
+	// statistics, see encoder_pktqueue_stats()
+	volatile long long stored;	/**< Packets appended (excluding dropped ones) */
+	volatile long long loaded;	/**< Packets removed by encoder_pktqueue_pop_front() */
+	volatile long long dropped;	/**< Packets dropped, see encoder_pktqueue_append() */
+	ga_hist_t occupancy;		/**< Occupied size in bytes, sampled on each append */
+	ga_hist_t producer_wait;	/**< Time (in microseconds) encoder_pktqueue_append() waits for the queue */
+	ga_hist_t consumer_wait;	/**< Time (in microseconds) a packet stays in the queue */
 }	encoder_packet_queue_t;
 
+/**
+ * Snapshot of packet queue statistics, see encoder_pktqueue_stats()
+ */
+typedef struct encoder_pktqueue_stats_s {
+	long long stored;	/**< Packets appended (excluding dropped ones) */
+	long long loaded;	/**< Packets removed */
+	long long dropped;	/**< Packets dropped, see encoder_pktqueue_append() */
+	int datasize;		/**< Current occupied size in bytes */
+	int bufsize;		/**< Size of the queue buffer */
+	long long occupancy[GA_HIST_BUCKETS];	/**< Occupancy histogram in bytes, see ga_hist_add() */
+	long long producer_wait[GA_HIST_BUCKETS];	/**< Producer wait time histogram (microseconds) */
+	long long consumer_wait[GA_HIST_BUCKETS];	/**< Packet queueing delay histogram (microseconds) */
+}	encoder_pktqueue_stats_t;
+
 typedef struct encoder_pts_s {
 	long long pts;
-	struct timeval ptv;
+	long long ptime;	/**< Presentation time in nano seconds */
 }	encoder_pts_t;
 
 typedef void (*qcallback_t)(int);
 
 EXPORT int encoder_pts_sync(int samplerate);
 EXPORT int encoder_running();
+EXPORT int encoder_wait_running(const struct timespec *abstime);
 EXPORT int encoder_register_vencoder(ga_module_t *m, void *param);
 EXPORT int encoder_register_aencoder(ga_module_t *m, void *param);
 EXPORT int encoder_register_sinkserver(ga_module_t *m);
@@ -71,23 +122,25 @@ EXPORT ga_module_t *encoder_get_sinkserver();
 EXPORT int encoder_register_client(void *ctx);
 EXPORT int encoder_unregister_client(void *ctx);
 
-EXPORT int encoder_send_packet(const char *prefix, int channelId, AVPacket *pkt, int64_t encoderPts, struct timeval *ptv);
+EXPORT int encoder_send_packet(const char *prefix, int channelId, AVPacket *pkt, int64_t encoderPts, int64_t ptime);
 
 // encoder pts to ptv mapping function
 EXPORT int encoder_pts_clear(unsigned queueid);
-EXPORT int encoder_pts_put(unsigned queueid, long long pts, struct timeval *ptv);
-EXPORT struct timeval * encoder_ptv_get(unsigned queueid, long long pts, struct timeval *ptv, int interpolation);
+EXPORT int encoder_pts_put(unsigned queueid, long long pts, long long ptime);
+EXPORT long long encoder_ptv_get(unsigned queueid, long long pts, int interpolation);
 
 // encoder packet queue - for async packet delivery
 EXPORT int encoder_pktqueue_init(int channels, int qsize);
 EXPORT int encoder_pktqueue_reset();
 EXPORT int encoder_pktqueue_reset_channel(int channelId);
 EXPORT int encoder_pktqueue_size(int channelId);
-EXPORT int encoder_pktqueue_append(int channelId, AVPacket *pkt, int64_t encoderPts, struct timeval *ptv);
+EXPORT char * encoder_pktqueue_reserve(int channelId, int size);
+EXPORT int encoder_pktqueue_append(int channelId, AVPacket *pkt, int64_t encoderPts, int64_t ptime);
 EXPORT char * encoder_pktqueue_front(int channelId, encoder_packet_t *pkt);
 EXPORT void encoder_pktqueue_split_packet(int channelId, char *offset);
 EXPORT void encoder_pktqueue_pop_front(int channelId);
 EXPORT int encoder_pktqueue_register_callback(int channelId, qcallback_t cb);
 EXPORT int encoder_pktqueue_unregister_callback(int channelId, qcallback_t cb);
+EXPORT int encoder_pktqueue_stats(int channelId, encoder_pktqueue_stats_t *stats);
 
 #endif
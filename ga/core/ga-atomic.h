@@ -0,0 +1,93 @@
+/*
+ * Copyright (c) 2013-2015 Chun-Ying Huang
+ *
+ * This file is part of GamingAnywhere (GA).
+ *
+ * GA is free software; you can redistribute it and/or modify it
+ * under the terms of the 3-clause BSD License as published by the
+ * Free Software Foundation: http://directory.fsf.org/wiki/License:BSD_3Clause
+ *
+ * GA is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * You should have received a copy of the 3-clause BSD License along with GA;
+ * if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __GA_ATOMIC_H__
+#define __GA_ATOMIC_H__
+
+/**
+ * @file
+ * Minimal atomic operations used by GA's lock-free data structures.
+ *
+ * All operations are sequentially consistent.
+ * GCC/clang builtins are used on UNIX-like systems (including Android),
+ * and Interlocked functions are used on Windows.
+ */
+
+#ifdef WIN32
+#include <windows.h>
+#endif
+
+#ifdef WIN32
+/////////////////////////////////////////////////////////////////////////
+
+static __inline int ga_atomic_load(volatile int *p)		{ return InterlockedCompareExchange((volatile LONG*) p, 0, 0); }
+static __inline void ga_atomic_store(volatile int *p, int v)	{ InterlockedExchange((volatile LONG*) p, v); }
+/** Add \a v to \a *p and return the old value */
+static __inline int ga_atomic_add(volatile int *p, int v)	{ return InterlockedExchangeAdd((volatile LONG*) p, v); }
+/** Replace \a *p with \a v if \a *p equals to \a expected. Return non-zero on success */
+static __inline int ga_atomic_cas(volatile int *p, int expected, int v) {
+	return InterlockedCompareExchange((volatile LONG*) p, v, expected) == expected;
+}
+static __inline long long ga_atomic_load64(volatile long long *p) {
+	return InterlockedCompareExchange64(p, 0, 0);
+}
+/* XXX: 64-bit exchange/add are not available on 32-bit XP, emulate with CAS */
+static __inline void ga_atomic_store64(volatile long long *p, long long v) {
+	long long old;
+	do { old = *p; } while(InterlockedCompareExchange64(p, v, old) != old);
+}
+static __inline long long ga_atomic_add64(volatile long long *p, long long v) {
+	long long old;
+	do { old = *p; } while(InterlockedCompareExchange64(p, old + v, old) != old);
+	return old;
+}
+static __inline void * ga_atomic_loadptr(void * volatile *p) {
+	return InterlockedCompareExchangePointer(p, NULL, NULL);
+}
+static __inline void ga_atomic_storeptr(void * volatile *p, void *v) { InterlockedExchangePointer(p, v); }
+static __inline void ga_atomic_fence()				{ MemoryBarrier(); }
+static __inline void ga_atomic_pause()				{ YieldProcessor(); }
+
+#else	/* GCC builtins */
+/////////////////////////////////////////////////////////////////////////
+
+static inline int ga_atomic_load(volatile int *p)		{ return __atomic_load_n(p, __ATOMIC_SEQ_CST); }
+static inline void ga_atomic_store(volatile int *p, int v)	{ __atomic_store_n(p, v, __ATOMIC_SEQ_CST); }
+/** Add \a v to \a *p and return the old value */
+static inline int ga_atomic_add(volatile int *p, int v)		{ return __atomic_fetch_add(p, v, __ATOMIC_SEQ_CST); }
+/** Replace \a *p with \a v if \a *p equals to \a expected. Return non-zero on success */
+static inline int ga_atomic_cas(volatile int *p, int expected, int v) {
+	return __atomic_compare_exchange_n(p, &expected, v, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+static inline long long ga_atomic_load64(volatile long long *p)	{ return __atomic_load_n(p, __ATOMIC_SEQ_CST); }
+static inline void ga_atomic_store64(volatile long long *p, long long v) { __atomic_store_n(p, v, __ATOMIC_SEQ_CST); }
+static inline long long ga_atomic_add64(volatile long long *p, long long v) {
+	return __atomic_fetch_add(p, v, __ATOMIC_SEQ_CST);
+}
+static inline void * ga_atomic_loadptr(void * volatile *p)	{ return __atomic_load_n(p, __ATOMIC_SEQ_CST); }
+static inline void ga_atomic_storeptr(void * volatile *p, void *v) { __atomic_store_n(p, v, __ATOMIC_SEQ_CST); }
+static inline void ga_atomic_fence()				{ __atomic_thread_fence(__ATOMIC_SEQ_CST); }
+static inline void ga_atomic_pause() {
+#if defined(__i386__) || defined(__x86_64__)
+	__builtin_ia32_pause();
+#endif
+}
+
+#endif	/* WIN32 */
+
+#endif	/* __GA_ATOMIC_H__ */
@@ -150,12 +150,22 @@ ga_avcodec_find_decoder(const char **names, enum AVCodecID cid) {
 }
 
 AVCodecContext*
-ga_avcodec_vencoder_init(AVCodecContext *ctx, AVCodec *codec, int width, int height, int fps, vector<string> *vso) {
+ga_avcodec_vencoder_init(AVCodecContext *ctx, AVCodec *codec, int width, int height, int fps, vector<string> *vso, AVPixelFormat pixfmt) {
 	AVDictionary *opts = NULL;
 
 	if(codec == NULL) {
 		return NULL;
 	}
+	if(codec->pix_fmts != NULL) {
+		const enum AVPixelFormat *p = codec->pix_fmts;
+		while(*p != AV_PIX_FMT_NONE && *p != pixfmt)
+			p++;
+		if(*p == AV_PIX_FMT_NONE) {
+			ga_error("vencoder-init: codec \"%s\" does not support pixel format %d\n",
+				codec->name, pixfmt);
+			return NULL;
+		}
+	}
 	if(ctx == NULL) {
 		if((ctx = avcodec_alloc_context3(codec)) == NULL) {
 			return NULL;
@@ -172,7 +182,7 @@ ga_avcodec_vencoder_init(AVCodecContext *ctx, AVCodec *codec, int width, int hei
 #else
 	ctx->time_base = (AVRational) {1, fps};
 #endif
-	ctx->pix_fmt = AV_PIX_FMT_YUV420P;
+	ctx->pix_fmt = pixfmt;
 	ctx->width = width;
 	ctx->height = height;
 
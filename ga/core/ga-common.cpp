@@ -25,6 +25,7 @@
 #include <stdlib.h>
 #include <stdarg.h>
 #include <string.h>
+#include <errno.h>
 #include <time.h>
 #include <pthread.h>
 #ifndef WIN32
@@ -41,6 +42,7 @@
 #endif /* ANDROID */
 #ifdef __APPLE__
 #include <syslog.h>
+#include <mach/mach_time.h>
 #endif
 
 #if !defined(WIN32) && !defined(__APPLE__) && !defined(ANDROID)
@@ -48,6 +50,7 @@
 #endif
 
 #include "ga-common.h"
+#include "ga-atomic.h"
 #include "ga-conf.h"
 #ifndef ANDROID_NO_FFMPEG
 #include "ga-avcodec.h"
@@ -66,8 +69,8 @@ using namespace std;
 			((unsigned char*)&(x))[3]
 #endif
 
-/** The gloabl log file name */
-static char *ga_logfile = NULL;
+/** The global log file */
+static FILE *ga_logfp = NULL;
 
 /**
  * Compute the time difference for two \a timeval data structure, i.e.,
@@ -128,27 +131,354 @@ ga_usleep(long long interval, struct timeval *ptv) {
 }
 
 /**
- * Write message \a s into the log file.
- * This in an internal function only called by \em ga_log function.
+ * Sleep until an absolute time of the monotonic clock.
  *
- * @param tv [in] The timestamp of logging.
- * @param s [in] The message to be written.
+ * @param deadline [in] The wake-up time, see ga_clock_ns().
  *
- * This function is SLOW, but it attempts to make all writes successfull.
- * It appends the message into the file each time when it is called.
+ * It returns immediately if \a deadline has passed.
+ * Sleeping to an absolute deadline, rather than for an interval,
+ * keeps periodic wake-ups from drifting with the time spent between them.
+ * On Windows and Mac OS X, the deadline is converted to a relative sleep.
  */
-static void
-ga_writelog(struct timeval tv, const char *s) {
-	FILE *fp;
-	if(ga_logfile == NULL)
+void
+ga_sleep_until_ns(long long deadline) {
+#ifdef WIN32
+	long long delta = deadline - ga_clock_ns();
+	if(delta > 0)
+		Sleep((DWORD) ((delta + 999999LL) / 1000000LL));
+#elif defined __APPLE__
+	long long delta = deadline - ga_clock_ns();
+	struct timespec ts;
+	if(delta <= 0)
 		return;
-	if((fp = fopen(ga_logfile, "at")) != NULL) {
-		fprintf(fp, "[%d] %ld.%06ld %s", getpid(), tv.tv_sec, tv.tv_usec, s);
-		fclose(fp);
+	ts.tv_sec = delta / 1000000000LL;
+	ts.tv_nsec = delta % 1000000000LL;
+	while(nanosleep(&ts, &ts) != 0 && errno == EINTR)
+		;
+#else
+	struct timespec ts;
+	if(deadline <= 0)
+		return;
+	ts.tv_sec = deadline / 1000000000LL;
+	ts.tv_nsec = deadline % 1000000000LL;
+	// same clock as ga_clock_ns()
+	while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+		;
+#endif
+	return;
+}
+
+/** Offset from ga_clock_ns() to the wall-clock time, in nano seconds */
+static long long ga_clock_walloffset = 0LL;
+/** Initialize \a ga_clock_walloffset only once */
+static pthread_once_t ga_clock_once = PTHREAD_ONCE_INIT;
+
+/**
+ * Initialize the wall-clock offset. This is an internal function.
+ */
+static void
+ga_clock_init() {
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	ga_clock_walloffset = (1000000LL * tv.tv_sec + tv.tv_usec) * 1000LL - ga_clock_ns();
+	return;
+}
+
+/**
+ * Get the current time of the monotonic clock.
+ *
+ * @return The current time in nano seconds.
+ *
+ * The clock is not affected by wall-clock adjustments,
+ * so it should be used to timestamp and pace the pipeline.
+ * The starting point is unspecified: use ga_clock_timeval() to
+ * get the corresponding wall-clock time, e.g., for RTP presentation times.
+ */
+long long
+ga_clock_ns() {
+#ifdef WIN32
+	static LARGE_INTEGER freq = { 0 };
+	LARGE_INTEGER counter;
+	if(freq.QuadPart == 0)
+		QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&counter);
+	return (counter.QuadPart / freq.QuadPart) * 1000000000LL
+		+ (counter.QuadPart % freq.QuadPart) * 1000000000LL / freq.QuadPart;
+#elif defined __APPLE__
+	static mach_timebase_info_data_t timebase = { 0, 0 };
+	if(timebase.denom == 0)
+		mach_timebase_info(&timebase);
+	return mach_absolute_time() * timebase.numer / timebase.denom;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return 1000000000LL * ts.tv_sec + ts.tv_nsec;
+#endif
+}
+
+/**
+ * Convert a monotonic clock time to the wall-clock time.
+ *
+ * @param ns [in] The time obtained from ga_clock_ns().
+ * @param tv [out] Pointer to store the wall-clock time.
+ * @return The \a tv pointer.
+ *
+ * The offset between the two clocks is sampled only once,
+ * so converted times do not jump when the wall-clock is adjusted.
+ */
+struct timeval *
+ga_clock_timeval(long long ns, struct timeval *tv) {
+	long long us;
+	pthread_once(&ga_clock_once, ga_clock_init);
+	us = (ns + ga_clock_walloffset) / 1000LL;
+	tv->tv_sec = us / 1000000LL;
+	tv->tv_usec = us % 1000000LL;
+	return tv;
+}
+
+/**
+ * Convert a wall-clock time to the monotonic clock time.
+ *
+ * @param tv [in] The wall-clock time.
+ * @return The corresponding time of ga_clock_ns().
+ */
+long long
+ga_clock_from_timeval(const struct timeval *tv) {
+	pthread_once(&ga_clock_once, ga_clock_init);
+	return (1000000LL * tv->tv_sec + tv->tv_usec) * 1000LL - ga_clock_walloffset;
+}
+
+// asynchronous logger
+
+/** Number of slots in the log ring: must be a power of two */
+#define	GA_LOG_SLOTS	512
+/** Size of the message buffer in a slot: longer messages are allocated */
+#define	GA_LOG_MSGSIZE	512
+
+/**
+ * A message slot in the log ring.
+ */
+typedef struct ga_log_slot_s {
+	volatile int seq;	/**< Sequence number of the lock-free ring */
+	int level;		/**< Severity level, see \a ga_log_levels */
+	int console;		/**< Print the message on the console as well */
+	struct timeval tv;	/**< When the message was logged */
+	char *longmsg;		/**< Allocated buffer for a long message, or NULL */
+	char msg[GA_LOG_MSGSIZE];	/**< The message */
+}	ga_log_slot_t;
+
+static ga_log_slot_t ga_logring[GA_LOG_SLOTS];
+static volatile int ga_log_enqpos = 0;	/**< Next slot to be filled by producers */
+static int ga_log_deqpos = 0;		/**< Next slot to be written: protected by \a ga_log_writemutex */
+static volatile int ga_log_dropped = 0;	/**< Messages dropped because the ring is full */
+static volatile int ga_log_async = 0;	/**< Non-zero if the writer thread is running */
+static volatile int ga_log_sleeping = 0;	/**< Non-zero if the writer thread is waiting */
+static long ga_log_pid = 0;		/**< The process running the writer thread */
+static int ga_log_minlevel = GA_LOG_INFO;	/**< Messages below this level are discarded */
+static int ga_log_maxrate = GA_LOG_DEFAULT_RATELIMIT;	/**< See ga_log_ratelimit() */
+static pthread_t ga_log_thread;
+static pthread_mutex_t ga_log_writemutex = PTHREAD_MUTEX_INITIALIZER;	/**< Serializes console and file outputs */
+static pthread_mutex_t ga_log_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ga_log_cond = PTHREAD_COND_INITIALIZER;
+static const char *ga_log_levelname[] = { "[debug] ", "", "[warning] ", "[error] ", "" };
+
+/**
+ * Output a message to the console and the log file.
+ * This is an internal function. The caller must hold \a ga_log_writemutex.
+ *
+ * @param level [in] Severity level of the message.
+ * @param console [in] Print on the console (\em stderr) as well.
+ * @param tv [in] The timestamp of logging.
+ * @param msg [in] The message.
+ */
+static void
+ga_log_output(int level, int console, struct timeval *tv, const char *msg) {
+#ifdef ANDROID
+	__android_log_write(ANDROID_LOG_INFO, "ga_log.native", msg);
+#endif
+#ifdef __APPLE__
+	syslog(LOG_NOTICE, "%s", msg);
+#endif
+	if(console) {
+		fprintf(stderr, "# [%d] %ld.%06ld %s%s", getpid(),
+			(long) tv->tv_sec, (long) tv->tv_usec, ga_log_levelname[level], msg);
+	}
+	if(ga_logfp != NULL) {
+		fprintf(ga_logfp, "[%d] %ld.%06ld %s%s", getpid(),
+			(long) tv->tv_sec, (long) tv->tv_usec, ga_log_levelname[level], msg);
 	}
 	return;
 }
 
+/**
+ * Output all messages queued in the log ring.
+ * This is an internal function. The caller must hold \a ga_log_writemutex.
+ *
+ * @return The number of written messages.
+ */
+static int
+ga_log_drain() {
+	ga_log_slot_t *slot;
+	int n = 0, dropped;
+	//
+	while(1) {
+		slot = &ga_logring[ga_log_deqpos & (GA_LOG_SLOTS-1)];
+		if(ga_atomic_load(&slot->seq) != ga_log_deqpos + 1)
+			break;
+		ga_log_output(slot->level, slot->console, &slot->tv,
+			slot->longmsg != NULL ? slot->longmsg : slot->msg);
+		if(slot->longmsg != NULL) {
+			free(slot->longmsg);
+			slot->longmsg = NULL;
+		}
+		ga_atomic_store(&slot->seq, ga_log_deqpos + GA_LOG_SLOTS);
+		ga_log_deqpos++;
+		n++;
+	}
+	if((dropped = ga_atomic_load(&ga_log_dropped)) > 0) {
+		struct timeval tv;
+		char msg[128];
+		ga_atomic_add(&ga_log_dropped, -dropped);
+		gettimeofday(&tv, NULL);
+		snprintf(msg, sizeof(msg), "log: %d messages dropped (log ring full).\n", dropped);
+		ga_log_output(GA_LOG_WARNING, 1, &tv, msg);
+		n++;
+	}
+	if(n > 0 && ga_logfp != NULL)
+		fflush(ga_logfp);
+	return n;
+}
+
+/**
+ * Queue a message into the log ring. This is an internal function.
+ *
+ * @return 0 on success, or -1 if the ring is full.
+ *
+ * It never blocks: if the ring is full, the message is dropped and counted.
+ */
+static int
+ga_log_enqueue(int level, int console, struct timeval *tv, const char *msg, int len) {
+	ga_log_slot_t *slot;
+	int pos, diff;
+	//
+	pos = ga_atomic_load(&ga_log_enqpos);
+	while(1) {
+		slot = &ga_logring[pos & (GA_LOG_SLOTS-1)];
+		diff = ga_atomic_load(&slot->seq) - pos;
+		if(diff == 0) {
+			if(ga_atomic_cas(&ga_log_enqpos, pos, pos + 1))
+				break;
+		} else if(diff < 0) {
+			ga_atomic_add(&ga_log_dropped, 1);
+			return -1;
+		}
+		pos = ga_atomic_load(&ga_log_enqpos);
+	}
+	slot->level = level;
+	slot->console = console;
+	slot->tv = *tv;
+	slot->longmsg = NULL;
+	if(len >= GA_LOG_MSGSIZE)
+		slot->longmsg = strdup(msg);
+	if(slot->longmsg == NULL) {
+		strncpy(slot->msg, msg, GA_LOG_MSGSIZE);
+		slot->msg[GA_LOG_MSGSIZE-1] = '\0';
+	}
+	ga_atomic_store(&slot->seq, pos + 1);
+	// wake up the writer
+	if(ga_atomic_load(&ga_log_sleeping)) {
+		pthread_mutex_lock(&ga_log_mutex);
+		pthread_cond_signal(&ga_log_cond);
+		pthread_mutex_unlock(&ga_log_mutex);
+	}
+	return 0;
+}
+
+/**
+ * Thread that writes queued log messages. This is an internal function.
+ */
+static void *
+ga_log_threadproc(void *arg) {
+	struct timeval tv;
+	struct timespec to;
+	//
+	while(ga_atomic_load(&ga_log_async)) {
+		pthread_mutex_lock(&ga_log_writemutex);
+		ga_log_drain();
+		pthread_mutex_unlock(&ga_log_writemutex);
+		// wait for new messages
+		pthread_mutex_lock(&ga_log_mutex);
+		ga_atomic_store(&ga_log_sleeping, 1);
+		if(ga_atomic_load(&ga_logring[ga_log_deqpos & (GA_LOG_SLOTS-1)].seq) != ga_log_deqpos + 1
+		&& ga_atomic_load(&ga_log_dropped) == 0
+		&& ga_atomic_load(&ga_log_async)) {
+			gettimeofday(&tv, NULL);
+			to.tv_sec = tv.tv_sec;
+			to.tv_nsec = tv.tv_usec * 1000 + 100000000;
+			if(to.tv_nsec >= 1000000000) {
+				to.tv_sec++;
+				to.tv_nsec -= 1000000000;
+			}
+			pthread_cond_timedwait(&ga_log_cond, &ga_log_mutex, &to);
+		}
+		ga_atomic_store(&ga_log_sleeping, 0);
+		pthread_mutex_unlock(&ga_log_mutex);
+	}
+	return NULL;
+}
+
+/**
+ * Log a formatted message. This is an internal function.
+ *
+ * @param level [in] Severity level of the message.
+ * @param console [in] Print on the console as well.
+ * @param msg [in] The message.
+ * @param len [in] Length of the message.
+ * @return 0 on success, or -1 if the message is dropped.
+ *
+ * The message is queued if the writer thread is running.
+ * Otherwise, it is written synchronously after the queued ones.
+ */
+static int
+ga_log_string(int level, int console, const char *msg, int len) {
+	struct timeval tv;
+	//
+	if(level < ga_log_minlevel)
+		return 0;
+	gettimeofday(&tv, NULL);
+	if(ga_atomic_load(&ga_log_async)) {
+		if(getpid() == ga_log_pid)
+			return ga_log_enqueue(level, console, &tv, msg, len);
+		// forked child: the ring belongs to the parent
+		ga_log_output(level, console, &tv, msg);
+		return 0;
+	}
+	pthread_mutex_lock(&ga_log_writemutex);
+	ga_log_drain();
+	ga_log_output(level, console, &tv, msg);
+	if(ga_logfp != NULL)
+		fflush(ga_logfp);
+	pthread_mutex_unlock(&ga_log_writemutex);
+	return 0;
+}
+
+/**
+ * Format and log a message. This is an internal function.
+ */
+static int
+ga_log_vprintf(int level, int console, const char *fmt, va_list ap) {
+	char msg[4096];
+	int len;
+	//
+	if(level < ga_log_minlevel)
+		return 0;
+	if((len = vsnprintf(msg, sizeof(msg), fmt, ap)) < 0)
+		return -1;
+	if(len >= (int) sizeof(msg))
+		len = sizeof(msg) - 1;
+	return ga_log_string(level, console, msg, len);
+}
+
 /**
  * Write log messages and print on Android console.
  *
@@ -161,23 +491,10 @@ ga_writelog(struct timeval tv, const char *s) {
  */
 int
 ga_log(const char *fmt, ...) {
-	char msg[4096];
-	struct timeval tv;
 	va_list ap;
-	//
-	gettimeofday(&tv, NULL);
 	va_start(ap, fmt);
-#ifdef ANDROID
-	__android_log_vprint(ANDROID_LOG_INFO, "ga_log.native", fmt, ap);
-#endif
-	vsnprintf(msg, sizeof(msg), fmt, ap);
+	ga_log_vprintf(GA_LOG_UNCLASSIFIED, 0, fmt, ap);
 	va_end(ap);
-#ifdef __APPLE__
-	syslog(LOG_NOTICE, "%s", msg);
-#endif
-	//
-	ga_writelog(tv, msg);
-	//
 	return 0;
 }
 
@@ -189,27 +506,120 @@ ga_log(const char *fmt, ...) {
  *
  * This function has the same syntax as the \em printf function.
  * It outputs a timestamp before the message.
+ * Once ga_openlog() is called, messages are written by a background
+ * thread, so the caller never waits for the console or the disk.
+ *
+ * ga_error() is used for errors and progress reports alike,
+ * so its messages are not filtered by the \em log-level configuration.
  */
 int
 ga_error(const char *fmt, ...) {
-	char msg[4096];
-	struct timeval tv;
 	va_list ap;
-	gettimeofday(&tv, NULL);
 	va_start(ap, fmt);
-#ifdef ANDROID
-	__android_log_vprint(ANDROID_LOG_INFO, "ga_log.native", fmt, ap);
-#endif
-	vsnprintf(msg, sizeof(msg), fmt, ap);
+	ga_log_vprintf(GA_LOG_UNCLASSIFIED, 1, fmt, ap);
 	va_end(ap);
-#ifdef __APPLE__
-	syslog(LOG_NOTICE, "%s", msg);
-#endif
-	fprintf(stderr, "# [%d] %ld.%06ld %s", getpid(), tv.tv_sec, tv.tv_usec, msg);
+	return -1;
+}
+
+/**
+ * Print out log messages with a severity level.
+ *
+ * @param level [in] Severity level, see \a ga_log_levels.
+ * @param fmt [in] The format string for the message.
+ * @param ... [in] The arguments for replacing specifiers in the format string.
+ * @return Always -1, same as ga_error().
+ *
+ * Messages below the \em log-level configuration are discarded.
+ * Messages from ga_error() and ga_log() are always kept.
+ */
+int
+ga_log_printf(int level, const char *fmt, ...) {
+	va_list ap;
+	if(level < GA_LOG_DEBUG)
+		level = GA_LOG_DEBUG;
+	if(level > GA_LOG_ERROR)
+		level = GA_LOG_ERROR;
+	va_start(ap, fmt);
+	ga_log_vprintf(level, 1, fmt, ap);
+	va_end(ap);
+	return -1;
+}
+
+/**
+ * Check if a rate-limited call site can log a message now.
+ *
+ * @param rl [in] The rate limit state of the call site.
+ * @return Non-zero if the message can be logged.
+ *
+ * Each call site can log at most \em log-ratelimit messages per second.
+ * The number of suppressed messages is reported when the next
+ * one-second window starts. See GA_ERROR_RATELIMITED().
+ */
+int
+ga_log_ratelimit(ga_log_ratelimit_t *rl) {
+	int now, window, suppressed;
 	//
-	ga_writelog(tv, msg);
+	if(ga_log_maxrate <= 0)
+		return 1;
+	now = (int) (ga_clock_ns() / 1000000000LL) + 1;
+	window = ga_atomic_load(&rl->window);
+	if(window != now && ga_atomic_cas(&rl->window, window, now)) {
+		ga_atomic_store(&rl->count, 0);
+		if((suppressed = ga_atomic_load(&rl->suppressed)) > 0) {
+			ga_atomic_add(&rl->suppressed, -suppressed);
+			ga_log_printf(GA_LOG_WARNING, "log: %d similar messages suppressed.\n", suppressed);
+		}
+	}
+	if(ga_atomic_add(&rl->count, 1) < ga_log_maxrate)
+		return 1;
+	ga_atomic_add(&rl->suppressed, 1);
+	return 0;
+}
+
+/**
+ * Write all queued log messages now.
+ *
+ * It is registered with atexit(), so messages logged right before
+ * exit() are not lost.
+ */
+void
+ga_log_flush() {
+	pthread_mutex_lock(&ga_log_writemutex);
+	ga_log_drain();
+	pthread_mutex_unlock(&ga_log_writemutex);
+	return;
+}
+
+/**
+ * Start the log writer thread. This is an internal function.
+ */
+static void
+ga_log_start() {
+	static int flush_registered = 0;
+	int i;
 	//
-	return -1;
+	if(ga_atomic_load(&ga_log_async))
+		return;
+	pthread_mutex_lock(&ga_log_writemutex);
+	ga_log_drain();
+	for(i = 0; i < GA_LOG_SLOTS; i++) {
+		ga_logring[i].seq = i;
+		ga_logring[i].longmsg = NULL;
+	}
+	ga_log_enqpos = ga_log_deqpos = 0;
+	ga_log_pid = getpid();
+	ga_atomic_store(&ga_log_async, 1);
+	pthread_mutex_unlock(&ga_log_writemutex);
+	if(pthread_create(&ga_log_thread, NULL, ga_log_threadproc, NULL) != 0) {
+		ga_atomic_store(&ga_log_async, 0);
+		ga_error("log: cannot create the writer thread, write synchronously.\n");
+		return;
+	}
+	if(flush_registered == 0) {
+		atexit(ga_log_flush);
+		flush_registered = 1;
+	}
+	return;
 }
 
 /**
@@ -353,32 +763,67 @@ ga_deinit() {
  * Enable log feature
  *
  * This function must be called if you plan to write logs into a file.
- * It reads the \em logfile option specified in the configuration file.
+ * It reads the \em logfile option specified in the configuration file,
+ * as well as \em log-level, \em log-ratelimit, and \em log-async.
+ * Unless \em log-async is disabled, messages are written by a
+ * background thread afterward.
  */
 void
 ga_openlog() {
 	char fn[1024];
 	FILE *fp;
+	int level;
 	//
-	if(ga_conf_readv("logfile", fn, sizeof(fn)) == NULL)
-		return;
-	if((fp = fopen(fn, "at")) != NULL) {
-		fclose(fp);
-		ga_logfile = strdup(fn);
+	if(ga_conf_readv("log-level", fn, sizeof(fn)) != NULL) {
+		if(strcasecmp(fn, "debug") == 0)		level = GA_LOG_DEBUG;
+		else if(strcasecmp(fn, "info") == 0)		level = GA_LOG_INFO;
+		else if(strcasecmp(fn, "warning") == 0)		level = GA_LOG_WARNING;
+		else if(strcasecmp(fn, "error") == 0)		level = GA_LOG_ERROR;
+		else						level = ga_conf_readint("log-level");
+		if(level < GA_LOG_DEBUG)	level = GA_LOG_DEBUG;
+		if(level > GA_LOG_ERROR)	level = GA_LOG_ERROR;
+		ga_log_minlevel = level;
 	}
+	if(ga_conf_readv("log-ratelimit", fn, sizeof(fn)) != NULL)
+		ga_log_maxrate = ga_conf_readint("log-ratelimit");
+	//
+	if(ga_conf_readv("logfile", fn, sizeof(fn)) != NULL
+	&& (fp = fopen(fn, "at")) != NULL) {
+		pthread_mutex_lock(&ga_log_writemutex);
+		if(ga_logfp != NULL)
+			fclose(ga_logfp);
+		ga_logfp = fp;
+		pthread_mutex_unlock(&ga_log_writemutex);
+	}
+	//
+	if(ga_conf_readbool("log-async", 1) != 0)
+		ga_log_start();
 	//
 	return;
 }
 
 /**
  * Disable log feature
+ *
+ * It stops the writer thread, writes all queued messages,
+ * and closes the log file.
  */
 void
 ga_closelog() {
-	if(ga_logfile != NULL) {
-		free(ga_logfile);
-		ga_logfile = NULL;
+	if(ga_atomic_load(&ga_log_async) && getpid() == ga_log_pid) {
+		pthread_mutex_lock(&ga_log_mutex);
+		ga_atomic_store(&ga_log_async, 0);
+		pthread_cond_signal(&ga_log_cond);
+		pthread_mutex_unlock(&ga_log_mutex);
+		pthread_join(ga_log_thread, NULL);
 	}
+	pthread_mutex_lock(&ga_log_writemutex);
+	ga_log_drain();
+	if(ga_logfp != NULL) {
+		fclose(ga_logfp);
+		ga_logfp = NULL;
+	}
+	pthread_mutex_unlock(&ga_log_writemutex);
 	return;
 }
 
@@ -518,6 +963,42 @@ err_save_yuv:
 	return -1;
 }
 
+/**
+ * Save NV12 image frame data
+ *
+ * @param fp [in] FILE pointer to the opened file (by \em ga_save_init).
+ * @param w [in] Width of the frame.
+ * @param h [in] Height of the frame.
+ * @param planes [in] Pointers to address of (2) planes [Y and interleaved UV].
+ * @param linesize [in] Pointers to linesize.
+ */
+int
+ga_save_nv12(FILE *fp, int w, int h, unsigned char *planes[], int linesize[]) {
+	int i, j, wlen, written = 0;
+	int expected = w * h * 3 / 2;
+	unsigned char *src;
+	if(fp == NULL || w <= 0 || h <= 0 || planes == NULL || linesize == NULL)
+		return -1;
+	// write Y, and then UV
+	for(j = 0; j < 2; j++) {
+		src = planes[j];
+		for(i = 0; i < (j == 0 ? h : h/2); i++) {
+			if((wlen = fwrite(src, sizeof(char), w, fp)) < 0)
+				return -1;
+			written += wlen;
+			src += linesize[j];
+		}
+	}
+	//
+	if(written != expected) {
+		ga_error("save NV12 (%dx%d): expected %d, save %d (frame may be corrupted)\n",
+			w, h, expected, written);
+	}
+	//
+	fflush(fp);
+	return written;
+}
+
 /**
  * Save RGB4 image frame data
  *
@@ -613,7 +1094,6 @@ ga_aggregated_print(int key, unsigned int limit, int value) {
 		int pos, left, wlen;
 		char *ptr, buf[16384] = "AGGREGATED-VALUES:";
 		list<int>::iterator li;
-		struct timeval tv;
 		//
 		pos = snprintf(buf, sizeof(buf), "AGGREGATED-OUTPUT[%04x]:", key);
 		left = sizeof(buf) - pos;
@@ -628,19 +1108,53 @@ ga_aggregated_print(int key, unsigned int limit, int value) {
 		}
 		mi->second.clear();
 		//
-		gettimeofday(&tv, NULL);
-#ifdef ANDROID
-		__android_log_write(ANDROID_LOG_INFO, "ga_log.native", buf);
-#else
-		fprintf(stderr, "# [%d] %ld.%06ld %s\n",
-			getpid(), tv.tv_sec, tv.tv_usec, buf);
-#endif
-		ga_writelog(tv, buf);
+		wlen = snprintf(ptr, left, "\n");
+		ga_log_string(GA_LOG_INFO, 1, buf, (int) (ptr - buf) + wlen);
 	}
 	//
 	return;
 }
 
+/**
+ * Add a sample into a histogram.
+ *
+ * @param hist [in] The histogram.
+ * @param value [in] The sample value.
+ *
+ * Values not greater than 0 are counted in the first bucket.
+ * Other values are counted in bucket \a i, where 2^(i-1) <= \a value < 2^i.
+ * Large values are all counted in the last bucket.
+ * It is safe to call this function from multiple threads.
+ */
+void
+ga_hist_add(ga_hist_t *hist, long long value) {
+	int i = 0;
+	while(value > 0 && i < GA_HIST_BUCKETS-1) {
+		value >>= 1;
+		i++;
+	}
+	ga_atomic_add64(&hist->count[i], 1);
+	return;
+}
+
+/**
+ * Read all buckets of a histogram.
+ *
+ * @param hist [in] The histogram.
+ * @param count [out] Array of \a GA_HIST_BUCKETS elements to store the counts.
+ *
+ * Each bucket is read atomically, and the histogram keeps being updated
+ * while it is read, so the buckets may not be read at the same instant.
+ */
+void
+ga_hist_snapshot(ga_hist_t *hist, long long *count) {
+	int i;
+	for(i = 0; i < GA_HIST_BUCKETS; i++) {
+		count[i] = ga_atomic_load64(&hist->count[i]);
+	}
+	return;
+}
+
 /**
  * Find mpeg start code 00 00 01 or 00 00 00 01.
  *
@@ -77,10 +77,60 @@ struct gaImage {
 	int bytes_per_line;
 };
 
+/** Number of buckets in a histogram */
+#define	GA_HIST_BUCKETS	32
+
+/**
+ * Histogram with power-of-two buckets. Updated atomically.
+ */
+typedef struct ga_hist_s {
+	volatile long long count[GA_HIST_BUCKETS];	/**< count[0]: values <= 0; count[i]: values in [2^(i-1), 2^i) */
+}	ga_hist_t;
+
+/**
+ * Severity levels of log messages, see ga_log_printf().
+ */
+enum ga_log_levels {
+	GA_LOG_DEBUG = 0,	/**< Debug messages */
+	GA_LOG_INFO,		/**< Informational messages */
+	GA_LOG_WARNING,		/**< Warnings */
+	GA_LOG_ERROR,		/**< Errors */
+	GA_LOG_UNCLASSIFIED	/**< Messages from ga_error() and ga_log(): printed at all levels */
+};
+
+/** Default number of messages per second allowed for a rate-limited call site */
+#define	GA_LOG_DEFAULT_RATELIMIT	10
+
+/**
+ * Rate limit state of a log call site, see ga_log_ratelimit().
+ */
+typedef struct ga_log_ratelimit_s {
+	volatile int window;	/**< Current one-second window */
+	volatile int count;	/**< Messages logged in the current window */
+	volatile int suppressed;	/**< Messages suppressed since the last report */
+}	ga_log_ratelimit_t;
+
+/**
+ * ga_error() for messages that may be emitted per frame or per packet.
+ * Each call site logs at most \em log-ratelimit messages per second.
+ */
+#define	GA_ERROR_RATELIMITED(...)	do { \
+		static ga_log_ratelimit_t __ga_rl = { 0, 0, 0 }; \
+		if(ga_log_ratelimit(&__ga_rl)) ga_error(__VA_ARGS__); \
+	} while(0)
+
 EXPORT long long tvdiff_us(struct timeval *tv1, struct timeval *tv2);
 EXPORT long long ga_usleep(long long interval, struct timeval *ptv);
+// monotonic clock
+EXPORT long long ga_clock_ns();
+EXPORT void	ga_sleep_until_ns(long long deadline);
+EXPORT struct timeval * ga_clock_timeval(long long ns, struct timeval *tv);
+EXPORT long long ga_clock_from_timeval(const struct timeval *tv);
 EXPORT int	ga_log(const char *fmt, ...);
 EXPORT int	ga_error(const char *fmt, ...);
+EXPORT int	ga_log_printf(int level, const char *fmt, ...);
+EXPORT int	ga_log_ratelimit(ga_log_ratelimit_t *rl);
+EXPORT void	ga_log_flush();
 EXPORT int	ga_malloc(int size, void **ptr, int *alignment);
 EXPORT int	ga_alignment(void *ptr, int alignto);
 EXPORT long	ga_gettid();
@@ -95,11 +145,15 @@ EXPORT FILE *	ga_save_init_txt(const char *filename);
 EXPORT int	ga_save_data(FILE *fp, unsigned char *buffer, int size);
 EXPORT int	ga_save_printf(FILE *fp, const char *fmt, ...);
 EXPORT int	ga_save_yuv420p(FILE *fp, int w, int h, unsigned char *planes[], int linesize[]);
+EXPORT int	ga_save_nv12(FILE *fp, int w, int h, unsigned char *planes[], int linesize[]);
 EXPORT int	ga_save_rgb4(FILE *fp, int w, int h, unsigned char *planes, int linesize);
 EXPORT int	ga_save_close(FILE *fp);
 // aggregated output feature
 EXPORT void	ga_aggregated_reset();
 EXPORT void	ga_aggregated_print(int key, int limit, int value);
+// histogram feature
+EXPORT void	ga_hist_add(ga_hist_t *hist, long long value);
+EXPORT void	ga_hist_snapshot(ga_hist_t *hist, long long *count);
 // encoders or decoders would require this
 EXPORT unsigned char * ga_find_startcode(unsigned char *buf, unsigned char *end, int *startcode_len);
 //
@@ -0,0 +1,172 @@
+/*
+ * Copyright (c) 2013-2015 Chun-Ying Huang
+ *
+ * This file is part of GamingAnywhere (GA).
+ *
+ * GA is free software; you can redistribute it and/or modify it
+ * under the terms of the 3-clause BSD License as published by the
+ * Free Software Foundation: http://directory.fsf.org/wiki/License:BSD_3Clause
+ *
+ * GA is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * You should have received a copy of the 3-clause BSD License along with GA;
+ * if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/**
+ * @file
+ * CPU feature detection: implementations
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#if defined(_M_IX86) || defined(_M_X64)
+#include <intrin.h>
+#elif defined(__i386__) || defined(__x86_64__)
+#include <cpuid.h>
+#endif
+
+#include "ga-common.h"
+#include "ga-conf.h"
+#include "ga-cpu.h"
+
+static unsigned int cpu_features = 0;
+static pthread_once_t cpu_once = PTHREAD_ONCE_INIT;
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+/**
+ * Execute the CPUID instruction. This is an internal function.
+ *
+ * @param leaf [in] The leaf (EAX) to query.
+ * @param subleaf [in] The subleaf (ECX) to query.
+ * @param regs [out] EAX, EBX, ECX, and EDX.
+ */
+static void
+ga_cpu_cpuid(unsigned int leaf, unsigned int subleaf, unsigned int regs[4]) {
+#ifdef _MSC_VER
+	__cpuidex((int*) regs, leaf, subleaf);
+#else
+	__cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+	return;
+}
+
+/**
+ * Read the XCR0 register. This is an internal function.
+ * The caller must have checked that OSXSAVE is supported.
+ */
+static unsigned long long
+ga_cpu_xgetbv() {
+#ifdef _MSC_VER
+	return _xgetbv(0);
+#else
+	unsigned int eax, edx;
+	__asm__ __volatile__ (".byte 0x0f, 0x01, 0xd0" : "=a"(eax), "=d"(edx) : "c"(0));
+	return ((unsigned long long) edx << 32) | eax;
+#endif
+}
+
+/**
+ * Detect x86 CPU features. This is an internal function.
+ */
+static unsigned int
+ga_cpu_detect() {
+	unsigned int regs[4], maxleaf, flags = 0;
+	//
+	ga_cpu_cpuid(0, 0, regs);
+	if((maxleaf = regs[0]) < 1)
+		return 0;
+	ga_cpu_cpuid(1, 0, regs);
+	if(regs[3] & (1<<26))	flags |= GA_CPU_SSE2;
+	if(regs[2] & (1<<9))	flags |= GA_CPU_SSSE3;
+	if(regs[2] & (1<<19))	flags |= GA_CPU_SSE41;
+	// AVX requires the OS to save YMM states
+	if((regs[2] & (1<<28)) && (regs[2] & (1<<27))
+	&& (ga_cpu_xgetbv() & 0x06) == 0x06) {
+		flags |= GA_CPU_AVX;
+		if(maxleaf >= 7) {
+			ga_cpu_cpuid(7, 0, regs);
+			if(regs[1] & (1<<5))	flags |= GA_CPU_AVX2;
+		}
+	}
+	return flags;
+}
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+static unsigned int
+ga_cpu_detect() {
+	return GA_CPU_NEON;
+}
+#else
+static unsigned int
+ga_cpu_detect() {
+	return 0;
+}
+#endif
+
+/**
+ * Initialize CPU features. This is an internal function.
+ *
+ * Features can be limited by the \em cpu-simd configuration:
+ * \em none, \em sse2, \em avx, or \em avx2 (default: no limit).
+ */
+static void
+ga_cpu_init() {
+	char simd[64], desc[128];
+	unsigned int mask = ~0U;
+	//
+	cpu_features = ga_cpu_detect();
+	if(ga_conf_readv("cpu-simd", simd, sizeof(simd)) != NULL) {
+		if(strcasecmp(simd, "none") == 0)
+			mask = 0;
+		else if(strcasecmp(simd, "sse2") == 0)
+			mask = GA_CPU_SSE2;
+		else if(strcasecmp(simd, "avx") == 0)
+			mask = GA_CPU_SSE2 | GA_CPU_SSSE3 | GA_CPU_SSE41 | GA_CPU_AVX;
+		else if(strcasecmp(simd, "avx2") != 0 && strcasecmp(simd, "auto") != 0)
+			ga_error("cpu: unknown cpu-simd '%s', ignored.\n", simd);
+		cpu_features &= mask;
+	}
+	ga_error("cpu: features = %s\n", ga_cpu_features_string(desc, sizeof(desc)));
+	return;
+}
+
+/**
+ * Get the features of the running CPU.
+ *
+ * @return Bitwise OR of \a ga_cpu_feature_flags.
+ *
+ * Features are detected only once.
+ * The configuration must have been loaded before the first call.
+ */
+unsigned int
+ga_cpu_features() {
+	pthread_once(&cpu_once, ga_cpu_init);
+	return cpu_features;
+}
+
+/**
+ * Describe the features of the running CPU.
+ *
+ * @param buf [out] Buffer to store the description.
+ * @param size [in] Size of the buffer.
+ * @return \a buf.
+ */
+const char *
+ga_cpu_features_string(char *buf, int size) {
+	unsigned int flags = cpu_features;
+	//
+	snprintf(buf, size, "%s%s%s%s%s%s%s",
+		flags == 0 ? " none" : "",
+		flags & GA_CPU_SSE2 ? " sse2" : "",
+		flags & GA_CPU_SSSE3 ? " ssse3" : "",
+		flags & GA_CPU_SSE41 ? " sse4.1" : "",
+		flags & GA_CPU_AVX ? " avx" : "",
+		flags & GA_CPU_AVX2 ? " avx2" : "",
+		flags & GA_CPU_NEON ? " neon" : "");
+	return buf;
+}
@@ -0,0 +1,44 @@
+/*
+ * Copyright (c) 2013-2015 Chun-Ying Huang
+ *
+ * This file is part of GamingAnywhere (GA).
+ *
+ * GA is free software; you can redistribute it and/or modify it
+ * under the terms of the 3-clause BSD License as published by the
+ * Free Software Foundation: http://directory.fsf.org/wiki/License:BSD_3Clause
+ *
+ * GA is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * You should have received a copy of the 3-clause BSD License along with GA;
+ * if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __GA_CPU_H__
+#define	__GA_CPU_H__
+
+/**
+ * @file
+ * CPU feature detection: used to select SIMD kernels at runtime.
+ */
+
+#include "ga-common.h"
+
+/**
+ * CPU features, returned by ga_cpu_features().
+ */
+enum ga_cpu_feature_flags {
+	GA_CPU_SSE2	= 0x0001,	/**< x86 SSE2 */
+	GA_CPU_SSSE3	= 0x0002,	/**< x86 SSSE3 */
+	GA_CPU_SSE41	= 0x0004,	/**< x86 SSE4.1 */
+	GA_CPU_AVX	= 0x0008,	/**< x86 AVX, enabled by the OS */
+	GA_CPU_AVX2	= 0x0010,	/**< x86 AVX2, enabled by the OS */
+	GA_CPU_NEON	= 0x0100	/**< ARM NEON */
+};
+
+EXPORT unsigned int ga_cpu_features();
+EXPORT const char * ga_cpu_features_string(char *buf, int size);
+
+#endif
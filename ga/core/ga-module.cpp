@@ -332,7 +332,7 @@ ga_module_raw(ga_module_t *m, void *arg, int *size) {
  * @param channelId [in] Channel ID, used to determine audio or video data.
  * @param pkt [in] The packet data to be sent.
  * @param encoderPts [out] Presentation time stamp, store as a 64-bit sequence number.
- * @param ptv [out] Presentation time stamp, stored as a \a timeval structure.
+ * @param ptime [in] Presentation time in nano seconds, see ga_clock_ns().
  *
  * This function is only used by a server module.
  *
@@ -341,13 +341,50 @@ ga_module_raw(ga_module_t *m, void *arg, int *size) {
  * before calling the interface.
  */
 int
-ga_module_send_packet(ga_module_t *m, const char *prefix, int channelId, AVPacket *pkt, int64_t encoderPts, struct timeval *ptv) {
+ga_module_send_packet(ga_module_t *m, const char *prefix, int channelId, AVPacket *pkt, int64_t encoderPts, int64_t ptime) {
 #if 0	/* not checked: for performance considersation */
 	if(m == NULL)
 		return GA_IOCTL_ERR_NULLMODULE;
 	if(m->send_packet == NULL)
 		return GA_IOCTL_ERR_NOINTERFACE;
 #endif
-	return m->send_packet(prefix, channelId, pkt, encoderPts, ptv);
+	return m->send_packet(prefix, channelId, pkt, encoderPts, ptime);
+}
+
+/**
+ * Merge a codec reconfiguration request into a pending one.
+ *
+ * @param pending [in,out] The request that has not been applied yet.
+ *	Its \a id is negative if there is no pending request.
+ * @param reconf [in] The new request.
+ *
+ * For encoders that apply reconfigurations in their encoding threads.
+ * Only the fields that are set in \a reconf (i.e., greater than zero)
+ * replace the pending ones, so a request that only changes the bitrate
+ * does not cancel a pending resolution or crf change.
+ * The caller must hold the lock of \a pending.
+ */
+void
+ga_module_reconfigure_merge(ga_ioctl_reconfigure_t *pending, const ga_ioctl_reconfigure_t *reconf) {
+	if(pending->id < 0) {
+		bcopy(reconf, pending, sizeof(ga_ioctl_reconfigure_t));
+		return;
+	}
+	pending->id = reconf->id;
+	if(reconf->crf > 0)
+		pending->crf = reconf->crf;
+	if(reconf->framerate_n > 0) {
+		pending->framerate_n = reconf->framerate_n;
+		pending->framerate_d = reconf->framerate_d;
+	}
+	if(reconf->bitrateKbps > 0)
+		pending->bitrateKbps = reconf->bitrateKbps;
+	if(reconf->bufsize > 0)
+		pending->bufsize = reconf->bufsize;
+	if(reconf->width > 0 && reconf->height > 0) {
+		pending->width = reconf->width;
+		pending->height = reconf->height;
+	}
+	return;
 }
 
@@ -52,6 +52,7 @@ enum ga_module_types {
 enum ga_ioctl_commands {
 	GA_IOCTL_NULL = 0,		/**< Not used */
 	GA_IOCTL_RECONFIGURE,		/**< Reconfiguration */
+	GA_IOCTL_REQUEST_KEYFRAME,	/**< Encode the next frame as a keyframe (IDR) */
 	GA_IOCTL_GETSPS = 0x100,	/**< Get SPS: for H.264 and H.265 */
 	GA_IOCTL_GETPPS,		/**< Get PPS: for H.264 and H.265 */
 	GA_IOCTL_GETVPS,		/**< Get VPS: for H.265 */
@@ -83,6 +84,13 @@ typedef struct ga_ioctl_buffer_s {
 	int size;		/**< Size of the buffer */
 }	ga_ioctl_buffer_t;
 
+/**
+ * Parameter for ioctl()'s request keyframe command.
+ */
+typedef struct ga_ioctl_keyframe_s {
+	int id;			/**< Channel id */
+}	ga_ioctl_keyframe_t;
+
 /**
  * Parameter for ioctl()'s codec reconfiguration command.
  */
@@ -93,8 +101,8 @@ typedef struct ga_ioctl_reconfigure_s {
 	int framerate_d;	/**< Framerate denominator */
 	int bitrateKbps;	/**< bitrate in Kbit-per-second. Affects both bitrate and vbv-maxrate */
 	int bufsize;		/**< vbv-bufsize */
-	int width;		/**< Width */
-	int height;		/**< Height */
+	int width;		/**< Output width, see video_source_set_out_size() */
+	int height;		/**< Output height */
 }	ga_ioctl_reconfigure_t;
 
 #ifdef __cplusplus
@@ -117,7 +125,7 @@ typedef struct ga_module_s {
 	int (*ioctl)(int command, int argsize, void *arg);	/**< Pointer to ioctl function */
 	int (*notify)(void *arg);	/**< Pointer to the notify function */
 	void * (*raw)(void *arg, int *size);	/**< Pointer to the raw function */
-	int (*send_packet)(const char *prefix, int channelId, AVPacket *pkt, int64_t encoderPts, struct timeval *ptv);	/**< Pointer to the send packet function: sink only */
+	int (*send_packet)(const char *prefix, int channelId, AVPacket *pkt, int64_t encoderPts, int64_t ptime);	/**< Pointer to the send packet function: sink only */
 	void * privdata;		/**< Private data of this module */
 }	ga_module_t;
 //////////////////////////////////////////////
@@ -146,7 +154,8 @@ EXPORT int ga_module_deinit(ga_module_t *m, void *arg);
 EXPORT int ga_module_ioctl(ga_module_t *m, int command, int argsize, void *arg);
 EXPORT int ga_module_notify(ga_module_t *m, void *arg);
 EXPORT void * ga_module_raw(ga_module_t *m, void *arg, int *size);
-EXPORT int ga_module_send_packet(ga_module_t *m, const char *prefix, int channelId, AVPacket *pkt, int64_t encoderPts, struct timeval *ptv);
+EXPORT int ga_module_send_packet(ga_module_t *m, const char *prefix, int channelId, AVPacket *pkt, int64_t encoderPts, int64_t ptime);
+EXPORT void ga_module_reconfigure_merge(ga_ioctl_reconfigure_t *pending, const ga_ioctl_reconfigure_t *reconf);
 
 #ifdef GA_MODULE
 // a module must have exported the module_load function
@@ -0,0 +1,258 @@
+/*
+ * Copyright (c) 2013-2015 Chun-Ying Huang
+ *
+ * This file is part of GamingAnywhere (GA).
+ *
+ * GA is free software; you can redistribute it and/or modify it
+ * under the terms of the 3-clause BSD License as published by the
+ * Free Software Foundation: http://directory.fsf.org/wiki/License:BSD_3Clause
+ *
+ * GA is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * You should have received a copy of the 3-clause BSD License along with GA;
+ * if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/**
+ * @file
+ * A shared pool of worker threads: implementations
+ *
+ * Each ga_parallel_run() call submits a task of \a njobs jobs.
+ * Workers and the submitting thread claim jobs of the pending tasks
+ * in order, and the submitting thread returns when all jobs are done.
+ * Tasks submitted from different threads share the same workers.
+ */
+
+#include <stdio.h>
+#include <pthread.h>
+#ifdef ANDROID
+#include <signal.h>
+#endif
+
+#include "ga-common.h"
+#include "ga-parallel.h"
+
+/**
+ * A task submitted by ga_parallel_run(). It lives on the submitter's stack.
+ */
+typedef struct ga_parallel_task_s {
+	ga_parallel_func_t func;	/**< Function to run jobs */
+	void *arg;			/**< Argument of \a func */
+	int njobs;			/**< Number of jobs */
+	int claimed;			/**< Number of claimed jobs */
+	int done;			/**< Number of finished jobs */
+	struct ga_parallel_task_s *next;	/**< Next pending task */
+}	ga_parallel_task_t;
+
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_work = PTHREAD_COND_INITIALIZER;	/**< Signaled on new tasks */
+static pthread_cond_t pool_done = PTHREAD_COND_INITIALIZER;	/**< Signaled when a task is done */
+static ga_parallel_task_t *pool_head = NULL;	/**< Tasks that have unclaimed jobs */
+static ga_parallel_task_t *pool_tail = NULL;
+static pthread_t pool_tid[GA_PARALLEL_MAX_THREADS];
+static int pool_threads = 0;
+static int pool_quit = 0;
+
+/**
+ * Claim a job from the first pending task. This is an internal function.
+ * The caller must hold \a pool_mutex.
+ *
+ * @param job [out] The claimed job index.
+ * @return The task of the job, or NULL if no tasks are pending.
+ */
+static ga_parallel_task_t *
+ga_parallel_claim(int *job) {
+	ga_parallel_task_t *task = pool_head;
+	//
+	if(task == NULL)
+		return NULL;
+	*job = task->claimed++;
+	if(task->claimed >= task->njobs) {
+		// all jobs claimed: remove from the pending list
+		if((pool_head = task->next) == NULL)
+			pool_tail = NULL;
+		task->next = NULL;
+	}
+	return task;
+}
+
+/**
+ * Run a claimed job. This is an internal function.
+ * The caller must hold \a pool_mutex, which is released while running.
+ */
+static void
+ga_parallel_exec(ga_parallel_task_t *task, int job) {
+	pthread_mutex_unlock(&pool_mutex);
+	task->func(task->arg, job);
+	pthread_mutex_lock(&pool_mutex);
+	if(++task->done == task->njobs)
+		pthread_cond_broadcast(&pool_done);
+	return;
+}
+
+/**
+ * Worker thread. This is an internal function.
+ */
+static void *
+ga_parallel_threadproc(void *arg) {
+	ga_parallel_task_t *task;
+	int job;
+	//
+	pthread_mutex_lock(&pool_mutex);
+	while(pool_quit == 0) {
+		if((task = ga_parallel_claim(&job)) == NULL) {
+			pthread_cond_wait(&pool_work, &pool_mutex);
+			continue;
+		}
+		ga_parallel_exec(task, job);
+	}
+	pthread_mutex_unlock(&pool_mutex);
+	return NULL;
+}
+
+/**
+ * Create the shared worker threads.
+ *
+ * @param nthreads [in] Number of worker threads.
+ *	If it is less than 0, one worker per CPU core is created.
+ * @return The number of worker threads.
+ *
+ * Only the first call creates workers. Later calls return the
+ * number of existing workers. Without workers, ga_parallel_run()
+ * runs all the jobs in the calling thread.
+ */
+int
+ga_parallel_init(int nthreads) {
+	int i;
+	//
+	pthread_mutex_lock(&pool_mutex);
+	if(pool_threads > 0) {
+		nthreads = pool_threads;
+		goto quit;
+	}
+	if(nthreads < 0) {
+#ifdef WIN32
+		SYSTEM_INFO si;
+		GetSystemInfo(&si);
+		nthreads = si.dwNumberOfProcessors;
+#else
+		nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+	}
+	if(nthreads > GA_PARALLEL_MAX_THREADS)
+		nthreads = GA_PARALLEL_MAX_THREADS;
+	pool_quit = 0;
+	for(i = 0; i < nthreads; i++) {
+		if(pthread_create(&pool_tid[i], NULL, ga_parallel_threadproc, NULL) != 0) {
+			ga_error("parallel: create worker thread failed.\n");
+			break;
+		}
+		pool_threads++;
+	}
+	nthreads = pool_threads;
+	if(nthreads > 0)
+		ga_error("parallel: %d worker threads created.\n", nthreads);
+quit:
+	pthread_mutex_unlock(&pool_mutex);
+	return nthreads;
+}
+
+/**
+ * Terminate the shared worker threads.
+ * It must not be called while tasks are running.
+ */
+void
+ga_parallel_deinit() {
+	int i, n;
+	//
+	pthread_mutex_lock(&pool_mutex);
+	pool_quit = 1;
+	n = pool_threads;
+	pool_threads = 0;
+	pthread_cond_broadcast(&pool_work);
+	pthread_mutex_unlock(&pool_mutex);
+	for(i = 0; i < n; i++)
+		pthread_join(pool_tid[i], NULL);
+	return;
+}
+
+/**
+ * Get the number of shared worker threads.
+ */
+int
+ga_parallel_threads() {
+	return pool_threads;
+}
+
+/**
+ * Run jobs on the shared worker threads and wait for all of them.
+ *
+ * @param njobs [in] Number of jobs.
+ * @param func [in] Function to run a job.
+ * @param arg [in] Argument passed to \a func.
+ *
+ * The calling thread runs jobs as well, so it is safe to call
+ * this function from multiple threads, or without workers.
+ *
+ * The calling thread cannot be cancelled while its task is queued:
+ * the task lives on its stack, and the pool mutex must be released.
+ * A pending cancellation is acted upon after the function returns.
+ */
+void
+ga_parallel_run(int njobs, ga_parallel_func_t func, void *arg) {
+	ga_parallel_task_t task, *t;
+	int job;
+#ifdef ANDROID
+	// pthread_cancel() is emulated with SIGUSR2, see pthread_cancel_init()
+	sigset_t cancelsig, oldmask;
+#else
+	int oldstate;
+#endif
+	//
+	if(njobs <= 0)
+		return;
+	if(njobs == 1 || pool_threads == 0) {
+		for(job = 0; job < njobs; job++)
+			func(arg, job);
+		return;
+	}
+	task.func = func;
+	task.arg = arg;
+	task.njobs = njobs;
+	task.claimed = 0;
+	task.done = 0;
+	task.next = NULL;
+	//
+#ifdef ANDROID
+	sigemptyset(&cancelsig);
+	sigaddset(&cancelsig, SIGUSR2);
+	pthread_sigmask(SIG_BLOCK, &cancelsig, &oldmask);
+#else
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &oldstate);
+#endif
+	pthread_mutex_lock(&pool_mutex);
+	if(pool_tail == NULL) {
+		pool_head = pool_tail = &task;
+	} else {
+		pool_tail->next = &task;
+		pool_tail = &task;
+	}
+	pthread_cond_broadcast(&pool_work);
+	// help with our own jobs, then wait for the others
+	while(task.claimed < task.njobs) {
+		t = ga_parallel_claim(&job);
+		ga_parallel_exec(t, job);
+	}
+	while(task.done < task.njobs)
+		pthread_cond_wait(&pool_done, &pool_mutex);
+	pthread_mutex_unlock(&pool_mutex);
+#ifdef ANDROID
+	pthread_sigmask(SIG_SETMASK, &oldmask, NULL);
+#else
+	pthread_setcancelstate(oldstate, NULL);
+#endif
+	return;
+}
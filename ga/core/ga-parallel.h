@@ -0,0 +1,46 @@
+/*
+ * Copyright (c) 2013-2015 Chun-Ying Huang
+ *
+ * This file is part of GamingAnywhere (GA).
+ *
+ * GA is free software; you can redistribute it and/or modify it
+ * under the terms of the 3-clause BSD License as published by the
+ * Free Software Foundation: http://directory.fsf.org/wiki/License:BSD_3Clause
+ *
+ * GA is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * You should have received a copy of the 3-clause BSD License along with GA;
+ * if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __GA_PARALLEL_H__
+#define	__GA_PARALLEL_H__
+
+/**
+ * @file
+ * A shared pool of worker threads for data-parallel jobs,
+ * e.g., converting horizontal bands of a video frame.
+ */
+
+#include "ga-common.h"
+
+/** Maximum number of worker threads */
+#define	GA_PARALLEL_MAX_THREADS	32
+
+/**
+ * Function to run a job.
+ *
+ * @param arg [in] The argument passed to ga_parallel_run().
+ * @param job [in] The job index, from 0 to \a njobs-1.
+ */
+typedef void (*ga_parallel_func_t)(void *arg, int job);
+
+EXPORT int ga_parallel_init(int nthreads);
+EXPORT void ga_parallel_deinit();
+EXPORT int ga_parallel_threads();
+EXPORT void ga_parallel_run(int njobs, ga_parallel_func_t func, void *arg);
+
+#endif
@@ -0,0 +1,479 @@
+/*
+ * Copyright (c) 2013-2015 Chun-Ying Huang
+ *
+ * This file is part of GamingAnywhere (GA).
+ *
+ * GA is free software; you can redistribute it and/or modify it
+ * under the terms of the 3-clause BSD License as published by the
+ * Free Software Foundation: http://directory.fsf.org/wiki/License:BSD_3Clause
+ *
+ * GA is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * You should have received a copy of the 3-clause BSD License along with GA;
+ * if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/**
+ * @file
+ * Adaptive bitrate control of the video encoder: implementations
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+
+#include "ga-common.h"
+#include "ga-conf.h"
+#include "ga-atomic.h"
+#include "ga-module.h"
+#include "vsource.h"
+#include "encoder-common.h"
+#include "ga-ratectl.h"
+
+/** Number of round-trip time samples used by the trend estimator */
+#define	RATECTL_RTT_SAMPLES	16
+/** Smoothing factor of round-trip time samples */
+#define	RATECTL_RTT_SMOOTHING	0.9
+/** Bounds of the adaptive overuse threshold (in ms) */
+#define	RATECTL_THRESHOLD_MIN	6.0
+#define	RATECTL_THRESHOLD_MAX	600.0
+/** Adaption rates of the overuse threshold, per ms, when going up and down */
+#define	RATECTL_THRESHOLD_KUP	0.0087
+#define	RATECTL_THRESHOLD_KDOWN	0.039
+/** Longest interval (in ms) accounted for in one threshold adaption */
+#define	RATECTL_THRESHOLD_MAXDT	100.0
+/** Reset the state if no signal has been received for this long (in ns) */
+#define	RATECTL_STALE_NS	30000000000LL
+/** Increases smaller than this ratio of the applied bitrate are not applied */
+#define	RATECTL_APPLY_RATIO	0.05
+
+/**
+ * Controller configurations. Bitrates are in Kbps.
+ */
+typedef struct ga_ratectl_conf_s {
+	int minrate;		/**< Floor of the bitrate */
+	int maxrate;		/**< Ceiling of the bitrate */
+	int startrate;		/**< Bitrate when a client connects */
+	int ramp;		/**< Ramp-up policy, see \a ga_ratectl_ramps */
+	double increase;	/**< Multiplicative increase per second, as a ratio */
+	double increaseKbps;	/**< Additive increase per second */
+	double decrease;	/**< Backoff: ratio of the received rate to keep */
+	double losslow;		/**< Below this loss rate the bitrate may increase */
+	double losshigh;	/**< Above this loss rate the bitrate decreases */
+	double headroom;	/**< Ratio of the measured capacity that can be used */
+	int interval;		/**< Minimum interval between reconfigurations (in ms) */
+	int fps;		/**< Configured framerate */
+	int minfps;		/**< Lowest framerate at the bitrate floor, 0 to keep the framerate */
+	int bufsize;		/**< Configured vbv-bufsize (in Kbit), 0 if not set */
+	int bitrate;		/**< Configured bitrate, to scale \a bufsize */
+}	ga_ratectl_conf_t;
+
+/**
+ * Controller state.
+ */
+typedef struct ga_ratectl_state_s {
+	int active;		/**< Has been reset for the current encoding session */
+	double target;		/**< Target bitrate */
+	double lossrate;	/**< Latest loss rate */
+	double capacity;	/**< Latest capacity measured by the client, 0 if unknown */
+	double received;	/**< Latest rate received by the client, 0 if unknown */
+	int backoffs;		/**< Number of decreases since reset */
+	long long lastupdate;	/**< Time of the last update, see ga_clock_ns() */
+	// delay-based estimator
+	int rttsamples;		/**< Number of samples received since reset */
+	int nrtt;		/**< Number of samples in \a rtt */
+	double rtt[RATECTL_RTT_SAMPLES];	/**< Smoothed round-trip times (in ms) */
+	double rtttime[RATECTL_RTT_SAMPLES];	/**< Sample times (in ms since reset) */
+	double rttsmooth;	/**< Smoothed round-trip time */
+	double threshold;	/**< Adaptive overuse threshold (in ms) */
+	int overuses;		/**< Consecutive samples above the threshold */
+	int delaystate;		/**< See \a ga_ratectl_delay_states */
+	// applied to the encoder
+	int applied;		/**< Bitrate applied to the encoder */
+	int appliedfps;		/**< Framerate applied to the encoder */
+	long long lastapply;	/**< Time of the last reconfiguration */
+	long long starttime;	/**< Time of reset */
+}	ga_ratectl_state_t;
+
+static volatile int ratectl_state = -1;	/**< -1: not initialized; 0: disabled; 1: enabled */
+static pthread_once_t ratectl_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t ratectl_mutex = PTHREAD_MUTEX_INITIALIZER;
+static ga_ratectl_conf_t conf;
+static ga_ratectl_state_t st;
+
+/**
+ * Read an integer configuration with a default value. This is an internal function.
+ */
+static int
+ga_ratectl_readint(const char *key, int defval) {
+	char buf[64];
+	if(ga_conf_readv(key, buf, sizeof(buf)) == NULL || buf[0] == '\0')
+		return defval;
+	return strtol(buf, NULL, 0);
+}
+
+/**
+ * Load controller configurations. This is an internal function.
+ */
+static void
+ga_ratectl_init() {
+	char buf[64];
+	//
+	if(ga_conf_readbool("ratectl", 0) == 0) {
+		ga_atomic_store(&ratectl_state, 0);
+		return;
+	}
+	bzero(&conf, sizeof(conf));
+	// GA configures bitrates in bits
+	if(ga_conf_mapreadv("video-specific", "b", buf, sizeof(buf)) != NULL)
+		conf.bitrate = strtol(buf, NULL, 0) / 1000;
+	if(ga_conf_mapreadv("video-specific", "bufsize", buf, sizeof(buf)) != NULL)
+		conf.bufsize = strtol(buf, NULL, 0) / 1000;
+	conf.minrate = ga_ratectl_readint("ratectl-min-bitrate", 200);
+	conf.maxrate = ga_ratectl_readint("ratectl-max-bitrate", conf.bitrate > 0 ? conf.bitrate : 8000);
+	conf.startrate = ga_ratectl_readint("ratectl-start-bitrate", conf.bitrate > 0 ? conf.bitrate : conf.maxrate);
+	if(conf.minrate <= 0)
+		conf.minrate = 1;
+	if(conf.maxrate < conf.minrate)
+		conf.maxrate = conf.minrate;
+	if(conf.startrate < conf.minrate)
+		conf.startrate = conf.minrate;
+	if(conf.startrate > conf.maxrate)
+		conf.startrate = conf.maxrate;
+	//
+	conf.ramp = GA_RATECTL_RAMP_HYBRID;
+	if(ga_conf_readv("ratectl-ramp", buf, sizeof(buf)) != NULL) {
+		if(strcmp(buf, "multiplicative") == 0)
+			conf.ramp = GA_RATECTL_RAMP_MULTIPLICATIVE;
+		else if(strcmp(buf, "additive") == 0)
+			conf.ramp = GA_RATECTL_RAMP_ADDITIVE;
+		else if(strcmp(buf, "hybrid") != 0)
+			ga_error("ratectl: unknown ramp policy '%s', use hybrid.\n", buf);
+	}
+	conf.increase = ga_ratectl_readint("ratectl-increase-percent", 8) / 100.0;
+	conf.increaseKbps = ga_ratectl_readint("ratectl-increase-kbps", 50);
+	conf.decrease = ga_ratectl_readint("ratectl-decrease-percent", 85) / 100.0;
+	conf.losslow = ga_ratectl_readint("ratectl-loss-low", 2) / 100.0;
+	conf.losshigh = ga_ratectl_readint("ratectl-loss-high", 10) / 100.0;
+	conf.headroom = ga_ratectl_readint("ratectl-capacity-percent", 90) / 100.0;
+	conf.interval = ga_ratectl_readint("ratectl-interval", 1000);
+	conf.fps = ga_ratectl_readint("video-fps", 24);
+	conf.minfps = ga_ratectl_readint("ratectl-min-framerate", 0);
+	if(conf.minfps > conf.fps)
+		conf.minfps = conf.fps;
+	//
+	ga_error("ratectl: enabled, bitrate=%d-%dKbps (start %d); ramp=%d (+%.0f%%/s, +%.0fKbps/s); backoff=%.0f%%; loss=%.0f%%-%.0f%%; interval=%dms; min-framerate=%d\n",
+		conf.minrate, conf.maxrate, conf.startrate, conf.ramp,
+		conf.increase * 100.0, conf.increaseKbps, conf.decrease * 100.0,
+		conf.losslow * 100.0, conf.losshigh * 100.0,
+		conf.interval, conf.minfps);
+	ga_atomic_store(&ratectl_state, 1);
+	return;
+}
+
+/**
+ * Check if rate control is enabled.
+ *
+ * @return Non-zero if rate control is enabled.
+ *
+ * Rate control is enabled by the \em ratectl configuration.
+ * The configuration must have been loaded before the first call.
+ */
+int
+ga_ratectl_enabled() {
+	if(ratectl_state < 0)
+		pthread_once(&ratectl_once, ga_ratectl_init);
+	return ratectl_state;
+}
+
+/**
+ * Reset the state for a new encoding session. This is an internal function.
+ *
+ * @param now [in] Current time, see ga_clock_ns().
+ */
+static void
+ga_ratectl_reset(long long now) {
+	bzero(&st, sizeof(st));
+	st.active = 1;
+	st.target = conf.startrate;
+	st.threshold = 12.5;
+	st.applied = conf.startrate;
+	st.appliedfps = conf.fps;
+	st.lastupdate = st.lastapply = st.starttime = now;
+	return;
+}
+
+/**
+ * Feed a round-trip time sample into the delay-based estimator.
+ * This is an internal function.
+ *
+ * @param now [in] Current time, see ga_clock_ns().
+ * @param rtt [in] Round-trip time in ms.
+ *
+ * The trend of the smoothed round-trip time is estimated by linear
+ * regression, and compared against an adaptive threshold: a growing
+ * round-trip time means queues are building up on the path.
+ */
+static void
+ga_ratectl_delay(long long now, double rtt) {
+	double t = (now - st.starttime) / 1000000.0;
+	double sumt = 0, sumr = 0, sumtt = 0, sumtr = 0;
+	double slope, trend, dt;
+	int i, n;
+	//
+	st.rttsamples++;
+	if(st.rttsmooth <= 0) {
+		st.rttsmooth = rtt;
+	} else {
+		st.rttsmooth = RATECTL_RTT_SMOOTHING * st.rttsmooth + (1.0 - RATECTL_RTT_SMOOTHING) * rtt;
+	}
+	if(st.nrtt == RATECTL_RTT_SAMPLES) {
+		memmove(st.rtt, st.rtt+1, sizeof(double) * (RATECTL_RTT_SAMPLES-1));
+		memmove(st.rtttime, st.rtttime+1, sizeof(double) * (RATECTL_RTT_SAMPLES-1));
+		st.nrtt--;
+	}
+	dt = st.nrtt > 0 ? t - st.rtttime[st.nrtt-1] : 0;
+	st.rtt[st.nrtt] = st.rttsmooth;
+	st.rtttime[st.nrtt] = t;
+	n = ++st.nrtt;
+	if(n < 3)
+		return;
+	// least squares: slope in ms of rtt per ms
+	for(i = 0; i < n; i++) {
+		sumt += st.rtttime[i];
+		sumr += st.rtt[i];
+		sumtt += st.rtttime[i] * st.rtttime[i];
+		sumtr += st.rtttime[i] * st.rtt[i];
+	}
+	if(n * sumtt - sumt * sumt <= 0)
+		return;
+	slope = (n * sumtr - sumt * sumr) / (n * sumtt - sumt * sumt);
+	// expected growth over the sampled window
+	trend = slope * (st.rtttime[n-1] - st.rtttime[0]);
+	//
+	if(trend > st.threshold) {
+		if(++st.overuses >= 2)
+			st.delaystate = GA_RATECTL_DELAY_OVERUSE;
+	} else if(trend < -st.threshold) {
+		st.overuses = 0;
+		st.delaystate = GA_RATECTL_DELAY_UNDERUSE;
+	} else {
+		st.overuses = 0;
+		st.delaystate = GA_RATECTL_DELAY_NORMAL;
+	}
+	// adapt the threshold, but not to spikes
+	if(fabs(trend) - st.threshold < 15.0) {
+		if(dt > RATECTL_THRESHOLD_MAXDT)
+			dt = RATECTL_THRESHOLD_MAXDT;
+		st.threshold += (fabs(trend) < st.threshold ? RATECTL_THRESHOLD_KDOWN : RATECTL_THRESHOLD_KUP)
+			* (fabs(trend) - st.threshold) * dt;
+		if(st.threshold < RATECTL_THRESHOLD_MIN)
+			st.threshold = RATECTL_THRESHOLD_MIN;
+		if(st.threshold > RATECTL_THRESHOLD_MAX)
+			st.threshold = RATECTL_THRESHOLD_MAX;
+	}
+	return;
+}
+
+/**
+ * Update the target bitrate from the latest signals. This is an internal function.
+ *
+ * @param now [in] Current time, see ga_clock_ns().
+ * @param reconf [out] Reconfiguration to apply, if any.
+ * @return Non-zero if \a reconf must be applied to the encoder.
+ *
+ * Must be called with \a ratectl_mutex held.
+ */
+static int
+ga_ratectl_update(long long now, ga_ioctl_reconfigure_t *reconf) {
+	double elapsed = (now - st.lastupdate) / 1000000000.0;
+	double target = st.target;
+	int decreased = 0, overuse = 0, fps = st.appliedfps;
+	//
+	if(elapsed > 1.0)
+		elapsed = 1.0;
+	st.lastupdate = now;
+	// loss-based
+	if(st.lossrate > conf.losshigh) {
+		target = st.target * (1.0 - 0.5 * st.lossrate);
+		decreased = 1;
+	}
+	// delay-based: back off below the rate that actually got through
+	if(st.delaystate == GA_RATECTL_DELAY_OVERUSE) {
+		double base = st.received > 0 && st.received < st.target ? st.received : st.target;
+		if(conf.decrease * base < target)
+			target = conf.decrease * base;
+		decreased = overuse = 1;
+		// the next backoff needs a new trend
+		st.nrtt = 0;
+		st.overuses = 0;
+		st.delaystate = GA_RATECTL_DELAY_NORMAL;
+	} else if(decreased == 0
+	&& st.delaystate == GA_RATECTL_DELAY_NORMAL
+	&& st.lossrate < conf.losslow
+	&& (st.nrtt >= 3 || st.rttsamples == 0)) {
+		// with round-trip times, hold after a backoff until a new trend is known
+		// ramp up
+		if(conf.ramp == GA_RATECTL_RAMP_MULTIPLICATIVE
+		|| (conf.ramp == GA_RATECTL_RAMP_HYBRID && st.backoffs == 0)) {
+			target = st.target * pow(1.0 + conf.increase, elapsed);
+		} else {
+			target = st.target + conf.increaseKbps * elapsed;
+		}
+	}
+	if(decreased)
+		st.backoffs++;
+	// measured capacity
+	if(st.capacity > 0 && target > conf.headroom * st.capacity)
+		target = conf.headroom * st.capacity;
+	if(target < conf.minrate)
+		target = conf.minrate;
+	if(target > conf.maxrate)
+		target = conf.maxrate;
+	st.target = target;
+	// framerate: only lowered at the bitrate floor
+	if(conf.minfps > 0) {
+		if(decreased && target <= conf.minrate && fps > conf.minfps) {
+			fps = fps * 3 / 4;
+			if(fps < conf.minfps)
+				fps = conf.minfps;
+		} else if(!decreased && target >= 1.5 * conf.minrate && fps < conf.fps) {
+			fps = fps + 1 + fps / 4;
+			if(fps > conf.fps)
+				fps = conf.fps;
+		}
+	}
+	// apply decreases immediately, and increases at most once an interval
+	if(fps == st.appliedfps) {
+		if((int) target == st.applied)
+			return 0;
+		if(!decreased && target < conf.maxrate
+		&& target - st.applied < RATECTL_APPLY_RATIO * st.applied)
+			return 0;
+	}
+	if(!decreased && now - st.lastapply < conf.interval * 1000000LL)
+		return 0;
+	bzero(reconf, sizeof(ga_ioctl_reconfigure_t));
+	reconf->bitrateKbps = (int) target;
+	if(conf.bufsize > 0 && conf.bitrate > 0)
+		reconf->bufsize = (int) (1.0 * conf.bufsize * target / conf.bitrate);
+	if(fps != st.appliedfps) {
+		reconf->framerate_n = fps;
+		reconf->framerate_d = 1;
+	}
+	ga_error("ratectl: bitrate %d -> %dKbps; framerate=%d; loss=%.2f%%; rtt=%.1fms%s; capacity=%.0fKbps; received=%.0fKbps\n",
+		st.applied, reconf->bitrateKbps, fps,
+		100.0 * st.lossrate, st.rttsmooth, overuse ? " (overuse)" : "",
+		st.capacity, st.received);
+	st.applied = reconf->bitrateKbps;
+	st.appliedfps = fps;
+	st.lastapply = now;
+	return 1;
+}
+
+/**
+ * Update the controller and reconfigure the video encoder.
+ * This is an internal function.
+ *
+ * @param lossrate [in] Loss rate, or a negative value if not available.
+ * @param rtt [in] Round-trip time in ms, or a non-positive value if not available.
+ * @param capacity [in] Capacity in Kbps, or a non-positive value if not available.
+ * @param received [in] Received rate in Kbps, or a non-positive value if not available.
+ */
+static void
+ga_ratectl_feed(double lossrate, double rtt, double capacity, double received) {
+	ga_ioctl_reconfigure_t reconf;
+	ga_module_t *m;
+	long long now;
+	int apply, iid;
+	//
+	if(ga_ratectl_enabled() == 0)
+		return;
+	now = ga_clock_ns();
+	pthread_mutex_lock(&ratectl_mutex);
+	if(encoder_running() == 0) {
+		st.active = 0;
+		pthread_mutex_unlock(&ratectl_mutex);
+		return;
+	}
+	// a new session, or a session without feedback for a while
+	if(st.active == 0 || now - st.lastupdate > RATECTL_STALE_NS)
+		ga_ratectl_reset(now);
+	if(lossrate >= 0)
+		st.lossrate = lossrate;
+	if(capacity > 0)
+		st.capacity = capacity;
+	if(received > 0)
+		st.received = received;
+	if(rtt > 0)
+		ga_ratectl_delay(now, rtt);
+	apply = ga_ratectl_update(now, &reconf);
+	pthread_mutex_unlock(&ratectl_mutex);
+	//
+	if(apply == 0)
+		return;
+	if((m = encoder_get_vencoder()) == NULL || m->ioctl == NULL)
+		return;
+	for(iid = 0; iid < video_source_channels(); iid++) {
+		reconf.id = iid;
+		if(m->ioctl(GA_IOCTL_RECONFIGURE, sizeof(reconf), &reconf) < 0)
+			ga_error("ratectl: reconfigure video encoder #%d failed.\n", iid);
+	}
+	return;
+}
+
+/**
+ * Feed a net-report from the client.
+ *
+ * @param duration [in] Sample collection duration (in microseconds).
+ * @param pktcount [in] Packet count, including lost packets.
+ * @param pktloss [in] Packet loss count.
+ * @param bytecount [in] Received amount of data (in bytes).
+ * @param capacity [in] Measured capacity (in bits per second).
+ *
+ * See \a ctrlmsg_system_netreport_t for the report.
+ */
+void
+ga_ratectl_netreport(unsigned int duration, unsigned int pktcount, unsigned int pktloss, unsigned int bytecount, unsigned int capacity) {
+	if(pktcount == 0 || duration == 0)
+		return;
+	ga_ratectl_feed(1.0 * pktloss / pktcount,
+		0,
+		capacity / 1000.0,
+		8000.0 * bytecount / duration);
+	return;
+}
+
+/**
+ * Feed a RTCP receiver report of a video stream.
+ *
+ * @param lossrate [in] Fraction of packets lost since the previous report.
+ * @param rtt [in] Round-trip time in units of 1/65536 seconds, 0 if not available.
+ */
+void
+ga_ratectl_rtcp(double lossrate, unsigned int rtt) {
+	ga_ratectl_feed(lossrate, 1000.0 * rtt / 65536, 0, 0);
+	return;
+}
+
+/**
+ * Get the current target bitrate.
+ *
+ * @return Target bitrate in Kbps, or -1 if rate control is not active.
+ */
+int
+ga_ratectl_bitrate() {
+	int ret = -1;
+	if(ga_ratectl_enabled() == 0)
+		return -1;
+	pthread_mutex_lock(&ratectl_mutex);
+	if(st.active)
+		ret = (int) st.target;
+	pthread_mutex_unlock(&ratectl_mutex);
+	return ret;
+}
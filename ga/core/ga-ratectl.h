@@ -0,0 +1,59 @@
+/*
+ * Copyright (c) 2013-2015 Chun-Ying Huang
+ *
+ * This file is part of GamingAnywhere (GA).
+ *
+ * GA is free software; you can redistribute it and/or modify it
+ * under the terms of the 3-clause BSD License as published by the
+ * Free Software Foundation: http://directory.fsf.org/wiki/License:BSD_3Clause
+ *
+ * GA is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * You should have received a copy of the 3-clause BSD License along with GA;
+ * if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __GA_RATECTL_H__
+#define	__GA_RATECTL_H__
+
+/**
+ * @file
+ * Adaptive bitrate control of the video encoder.
+ *
+ * Network feedback comes from two sources: net-reports sent by the client
+ * (loss and measured capacity), and RTCP receiver reports collected by
+ * the sink server (loss and round-trip time). The controller combines
+ * a loss-based and a delay-based estimate, and reconfigures the registered
+ * video encoder with \em GA_IOCTL_RECONFIGURE.
+ * It is enabled by the \em ratectl configuration.
+ */
+
+#include "ga-common.h"
+
+/**
+ * Ramp-up policies of the controller.
+ */
+enum ga_ratectl_ramps {
+	GA_RATECTL_RAMP_HYBRID = 0,	/**< Multiplicative until the first backoff, additive afterwards */
+	GA_RATECTL_RAMP_MULTIPLICATIVE,	/**< Always multiplicative */
+	GA_RATECTL_RAMP_ADDITIVE	/**< Always additive */
+};
+
+/**
+ * States of the delay-based estimator.
+ */
+enum ga_ratectl_delay_states {
+	GA_RATECTL_DELAY_NORMAL = 0,	/**< Round-trip time is stable */
+	GA_RATECTL_DELAY_OVERUSE,	/**< Round-trip time keeps growing: queues build up */
+	GA_RATECTL_DELAY_UNDERUSE	/**< Round-trip time keeps dropping: queues drain */
+};
+
+EXPORT int ga_ratectl_enabled();
+EXPORT void ga_ratectl_netreport(unsigned int duration, unsigned int pktcount, unsigned int pktloss, unsigned int bytecount, unsigned int capacity);
+EXPORT void ga_ratectl_rtcp(double lossrate, unsigned int rtt);
+EXPORT int ga_ratectl_bitrate();
+
+#endif
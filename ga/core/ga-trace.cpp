@@ -0,0 +1,370 @@
+/*
+ * Copyright (c) 2013-2015 Chun-Ying Huang
+ *
+ * This file is part of GamingAnywhere (GA).
+ *
+ * GA is free software; you can redistribute it and/or modify it
+ * under the terms of the 3-clause BSD License as published by the
+ * Free Software Foundation: http://directory.fsf.org/wiki/License:BSD_3Clause
+ *
+ * GA is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * You should have received a copy of the 3-clause BSD License along with GA;
+ * if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/**
+ * @file
+ * Per-frame latency tracing: implementations
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <algorithm>
+
+#include "ga-common.h"
+#include "ga-conf.h"
+#include "ga-atomic.h"
+#include "ga-trace.h"
+
+using namespace std;
+
+/**
+ * Per-thread event ring. Only the owner thread writes into the ring.
+ */
+typedef struct ga_trace_ring_s {
+	volatile int owned;		/**< Non-zero if the ring is used by a thread */
+	int tid;			/**< Thread id of the owner */
+	volatile long long head;	/**< Number of events ever recorded */
+	ga_trace_event_t *events;	/**< The event ring */
+	struct ga_trace_ring_s *next;	/**< Next registered ring */
+}	ga_trace_ring_t;
+
+static volatile int trace_state = -1;	/**< -1: not initialized; 0: disabled; 1: enabled */
+static pthread_once_t trace_once = PTHREAD_ONCE_INIT;
+static pthread_key_t trace_key;		/**< Ring of the current thread */
+static pthread_mutex_t trace_mutex = PTHREAD_MUTEX_INITIALIZER;	/**< Protects ring registration */
+static void * volatile trace_rings = NULL;	/**< List of all registered rings */
+static int trace_size = GA_TRACE_DEFAULT_EVENTS;	/**< Ring size: must be a power of two */
+static char trace_output[1024] = "";	/**< Default output file */
+
+static const char *trace_stagename[GA_TRACE_STAGES] = {
+	"capture",
+	"filter-start",
+	"filter-end",
+	"encode-submit",
+	"encode-output",
+	"enqueue",
+	"send"
+};
+
+/**
+ * Release the ring of a terminated thread, so it can be reused by
+ * another thread. Recorded events are kept. This is an internal function.
+ */
+static void
+ga_trace_release(void *ring) {
+	ga_atomic_store(&((ga_trace_ring_t*) ring)->owned, 0);
+	return;
+}
+
+/**
+ * Load trace configurations. This is an internal function.
+ */
+static void
+ga_trace_init() {
+	int size;
+	if(ga_conf_readv("trace-output", trace_output, sizeof(trace_output)) == NULL
+	|| trace_output[0] == '\0') {
+		ga_atomic_store(&trace_state, 0);
+		return;
+	}
+	if((size = ga_conf_readint("trace-buffer-events")) <= 0)
+		size = GA_TRACE_DEFAULT_EVENTS;
+	for(trace_size = 1; trace_size < size; trace_size <<= 1)
+		;
+	if(pthread_key_create(&trace_key, ga_trace_release) != 0) {
+		ga_error("trace: cannot create thread key, tracing disabled.\n");
+		ga_atomic_store(&trace_state, 0);
+		return;
+	}
+	ga_error("trace: enabled, %d events per thread, output=%s\n",
+		trace_size, trace_output);
+	ga_atomic_store(&trace_state, 1);
+	return;
+}
+
+/**
+ * Check if tracing is enabled.
+ *
+ * @return Non-zero if tracing is enabled.
+ *
+ * Tracing is enabled if \em trace-output is configured.
+ * The configuration must have been loaded before the first call.
+ */
+int
+ga_trace_enabled() {
+	if(trace_state < 0)
+		pthread_once(&trace_once, ga_trace_init);
+	return trace_state;
+}
+
+/**
+ * Get the event ring of the calling thread. This is an internal function.
+ *
+ * @return Pointer to the ring, or NULL on error.
+ */
+static ga_trace_ring_t *
+ga_trace_ring() {
+	ga_trace_ring_t *ring;
+	if((ring = (ga_trace_ring_t*) pthread_getspecific(trace_key)) != NULL)
+		return ring;
+	// reuse a ring released by a terminated thread
+	for(ring = (ga_trace_ring_t*) ga_atomic_loadptr(&trace_rings); ring != NULL; ring = ring->next) {
+		if(ga_atomic_cas(&ring->owned, 0, 1))
+			goto ring_found;
+	}
+	if((ring = (ga_trace_ring_t*) calloc(1, sizeof(ga_trace_ring_t))) == NULL)
+		return NULL;
+	if((ring->events = (ga_trace_event_t*) calloc(trace_size, sizeof(ga_trace_event_t))) == NULL) {
+		free(ring);
+		return NULL;
+	}
+	ring->owned = 1;
+	pthread_mutex_lock(&trace_mutex);
+	ring->next = (ga_trace_ring_t*) trace_rings;
+	ga_atomic_storeptr(&trace_rings, ring);
+	pthread_mutex_unlock(&trace_mutex);
+ring_found:
+	ring->tid = (int) ga_gettid();
+	pthread_setspecific(trace_key, ring);
+	return ring;
+}
+
+/**
+ * Record a trace event of a frame.
+ *
+ * @param stage [in] The stage, see \a ga_trace_stages.
+ * @param channel [in] The video channel id.
+ * @param id [in] The frame id, i.e., the capture time of the frame.
+ *
+ * The event is stamped with the current ga_clock_ns() time.
+ * It never blocks: the eldest event of the thread is overwritten
+ * if the ring is full. It does nothing if tracing is disabled.
+ */
+void
+ga_trace(int stage, int channel, long long id) {
+	ga_trace_ring_t *ring;
+	ga_trace_event_t *e;
+	long long head;
+	//
+	if(ga_trace_enabled() <= 0)
+		return;
+	if((ring = ga_trace_ring()) == NULL)
+		return;
+	head = ring->head;
+	e = &ring->events[head & (trace_size - 1)];
+	e->id = id;
+	e->time = ga_clock_ns();
+	e->stage = stage;
+	e->channel = channel;
+	e->tid = ring->tid;
+	e->reserved = 0;
+	// publish
+	ga_atomic_store64(&ring->head, head + 1);
+	return;
+}
+
+/**
+ * Copy the recorded events of all threads.
+ *
+ * @param events [out] Pointer to the copied events. Release it with free().
+ * @return The number of events, or -1 on error.
+ *
+ * It can be called while other threads are recording.
+ * Events overwritten during the copy are discarded.
+ */
+int
+ga_trace_snapshot(ga_trace_event_t **events) {
+	ga_trace_ring_t *first, *ring;
+	ga_trace_event_t *buf;
+	int nrings = 0, count = 0;
+	//
+	*events = NULL;
+	if(ga_trace_enabled() <= 0)
+		return 0;
+	first = (ga_trace_ring_t*) ga_atomic_loadptr(&trace_rings);
+	for(ring = first; ring != NULL; ring = ring->next)
+		nrings++;
+	if(nrings == 0)
+		return 0;
+	if((buf = (ga_trace_event_t*) malloc(sizeof(ga_trace_event_t) * nrings * trace_size)) == NULL) {
+		ga_error("trace: snapshot failed - out of memory.\n");
+		return -1;
+	}
+	for(ring = first; ring != NULL; ring = ring->next) {
+		long long h1, h2, start, i;
+		int n = 0, skip;
+		h1 = ga_atomic_load64(&ring->head);
+		start = h1 > trace_size ? h1 - trace_size : 0;
+		for(i = start; i < h1; i++)
+			buf[count + n++] = ring->events[i & (trace_size - 1)];
+		ga_atomic_fence();
+		// the owner may have overwritten the eldest ones
+		h2 = ga_atomic_load64(&ring->head);
+		if((skip = (int) (h2 - trace_size + 1 - start)) > 0) {
+			if(skip > n)
+				skip = n;
+			memmove(&buf[count], &buf[count + skip], sizeof(ga_trace_event_t) * (n - skip));
+			n -= skip;
+		}
+		count += n;
+	}
+	*events = buf;
+	return count;
+}
+
+static bool
+ga_trace_by_time(const ga_trace_event_t &a, const ga_trace_event_t &b) {
+	return a.time < b.time;
+}
+
+static bool
+ga_trace_by_frame(const ga_trace_event_t &a, const ga_trace_event_t &b) {
+	if(a.channel != b.channel)	return a.channel < b.channel;
+	if(a.id != b.id)		return a.id < b.id;
+	if(a.stage != b.stage)		return a.stage < b.stage;
+	return a.time < b.time;
+}
+
+/**
+ * Write events in the Chrome trace-event JSON format. This is an internal function.
+ *
+ * @param fp [in] The output file.
+ * @param events [in] The events, sorted by time.
+ * @param count [in] Number of events.
+ *
+ * Process 1 has the raw events of each thread.
+ * Process 2 has the per-frame spans: one track per stage transition,
+ * and an async "frame" event from capture to the last recorded stage.
+ */
+static void
+ga_trace_write_json(FILE *fp, ga_trace_event_t *events, int count) {
+	long long origin = count > 0 ? events[0].time : 0;
+	int i, j, s, prev;
+	//
+	fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	fprintf(fp, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"threads\"}},\n");
+	fprintf(fp, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":2,\"args\":{\"name\":\"frames\"}}");
+	for(s = 1; s < GA_TRACE_STAGES; s++) {
+		fprintf(fp, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":2,\"tid\":%d,\"args\":{\"name\":\"to %s\"}}",
+			s, trace_stagename[s]);
+	}
+	for(i = 0; i < count; i++) {
+		ga_trace_event_t *e = &events[i];
+		fprintf(fp, ",\n{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,"
+			"\"args\":{\"frame\":%lld,\"channel\":%d}}",
+			trace_stagename[e->stage], e->tid, 0.001 * (e->time - origin),
+			e->id, e->channel);
+	}
+	// per-frame spans
+	sort(events, events + count, ga_trace_by_frame);
+	for(i = 0; i < count; i = j) {
+		long long first[GA_TRACE_STAGES], begin, end = 0;
+		for(s = 0; s < GA_TRACE_STAGES; s++)
+			first[s] = -1;
+		for(j = i; j < count
+		&& events[j].channel == events[i].channel
+		&& events[j].id == events[i].id; j++) {
+			if(first[events[j].stage] < 0)
+				first[events[j].stage] = events[j].time;
+			if(events[j].time > end)
+				end = events[j].time;
+		}
+		for(prev = -1, s = 0; s < GA_TRACE_STAGES; s++) {
+			if(first[s] < 0)
+				continue;
+			if(prev >= 0) {
+				fprintf(fp, ",\n{\"name\":\"%s -> %s\",\"ph\":\"X\",\"pid\":2,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,"
+					"\"args\":{\"frame\":%lld,\"channel\":%d}}",
+					trace_stagename[prev], trace_stagename[s], s,
+					0.001 * (first[prev] - origin), 0.001 * (first[s] - first[prev]),
+					events[i].id, events[i].channel);
+			}
+			prev = s;
+		}
+		// the frame id is the time when the capture started
+		begin = events[i].time;
+		if(events[i].id > 0 && events[i].id < begin && events[i].id >= origin)
+			begin = events[i].id;
+		fprintf(fp, ",\n{\"name\":\"frame\",\"cat\":\"latency\",\"ph\":\"b\",\"id\":\"%d:%lld\",\"pid\":2,\"tid\":0,\"ts\":%.3f}",
+			events[i].channel, events[i].id, 0.001 * (begin - origin));
+		fprintf(fp, ",\n{\"name\":\"frame\",\"cat\":\"latency\",\"ph\":\"e\",\"id\":\"%d:%lld\",\"pid\":2,\"tid\":0,\"ts\":%.3f,"
+			"\"args\":{\"latency_ms\":%.3f}}",
+			events[i].channel, events[i].id, 0.001 * (end - origin),
+			0.000001 * (end - begin));
+	}
+	fprintf(fp, "\n]}\n");
+	return;
+}
+
+/**
+ * Save recorded events into a file.
+ *
+ * @param filename [in] The output file, or NULL to use \em trace-output.
+ * @return The number of saved events, or -1 on error.
+ *
+ * A file name ending with ".json" is saved in the Chrome trace-event
+ * format (open it with chrome://tracing). Otherwise, the events are saved
+ * in a binary file: a \a ga_trace_header_t followed by the events.
+ * Events are sorted by time in both formats.
+ */
+int
+ga_trace_save(const char *filename) {
+	ga_trace_event_t *events = NULL;
+	ga_trace_header_t header;
+	FILE *fp = NULL;
+	int count, len;
+	//
+	if(ga_trace_enabled() <= 0)
+		return -1;
+	if(filename == NULL)
+		filename = trace_output;
+	if((count = ga_trace_snapshot(&events)) < 0)
+		return -1;
+	sort(events, events + count, ga_trace_by_time);
+	len = strlen(filename);
+	if(len > 5 && strcmp(filename + len - 5, ".json") == 0) {
+		if((fp = fopen(filename, "wt")) == NULL)
+			goto save_failed;
+		ga_trace_write_json(fp, events, count);
+	} else {
+		if((fp = fopen(filename, "wb")) == NULL)
+			goto save_failed;
+		bzero(&header, sizeof(header));
+		strncpy(header.magic, "GATRACE", sizeof(header.magic));
+		header.version = 1;
+		header.count = count;
+		if(fwrite(&header, sizeof(header), 1, fp) != 1
+		|| (count > 0 && fwrite(events, sizeof(ga_trace_event_t), count, fp) != (size_t) count)) {
+			fclose(fp);
+			goto save_failed;
+		}
+	}
+	fclose(fp);
+	if(events != NULL)
+		free(events);
+	ga_error("trace: %d events saved to %s\n", count, filename);
+	return count;
+save_failed:
+	ga_error("trace: save to %s failed.\n", filename);
+	if(events != NULL)
+		free(events);
+	return -1;
+}
@@ -0,0 +1,77 @@
+/*
+ * Copyright (c) 2013-2015 Chun-Ying Huang
+ *
+ * This file is part of GamingAnywhere (GA).
+ *
+ * GA is free software; you can redistribute it and/or modify it
+ * under the terms of the 3-clause BSD License as published by the
+ * Free Software Foundation: http://directory.fsf.org/wiki/License:BSD_3Clause
+ *
+ * GA is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * You should have received a copy of the 3-clause BSD License along with GA;
+ * if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __GA_TRACE_H__
+#define	__GA_TRACE_H__
+
+/**
+ * @file
+ * Per-frame latency tracing: from capture to the sink server.
+ *
+ * A frame is identified by its capture time (\a vsource_frame_t::timestamp),
+ * which is carried as the presentation time of encoded packets.
+ * Each thread records events into its own ring, so recording never blocks.
+ * Tracing is enabled by the \em trace-output configuration.
+ */
+
+#include "ga-common.h"
+
+/**
+ * Traced stages of a video frame.
+ */
+enum ga_trace_stages {
+	GA_TRACE_CAPTURE = 0,	/**< Frame captured */
+	GA_TRACE_FILTER_START,	/**< Filter starts processing the frame */
+	GA_TRACE_FILTER_END,	/**< Filter finished processing the frame */
+	GA_TRACE_ENCODE_SUBMIT,	/**< Frame submitted to the encoder */
+	GA_TRACE_ENCODE_OUTPUT,	/**< Encoded packet produced */
+	GA_TRACE_ENQUEUE,	/**< Packet appended into the packet queue */
+	GA_TRACE_SEND,		/**< Packet handed to the sink server */
+	GA_TRACE_STAGES		/**< Number of stages */
+};
+
+/**
+ * A trace record. Also the record format of a binary trace file.
+ */
+typedef struct ga_trace_event_s {
+	long long id;		/**< Frame id: the capture time of the frame */
+	long long time;		/**< When the event happened, see ga_clock_ns() */
+	int stage;		/**< One of \a ga_trace_stages */
+	int channel;		/**< Video channel id */
+	int tid;		/**< Thread id of the recorder */
+	int reserved;		/**< Padding: always zero */
+}	ga_trace_event_t;
+
+/**
+ * Header of a binary trace file, followed by \a count ga_trace_event_t records.
+ */
+typedef struct ga_trace_header_s {
+	char magic[8];		/**< "GATRACE" */
+	int version;		/**< Format version, currently 1 */
+	int count;		/**< Number of records */
+}	ga_trace_header_t;
+
+/** Default number of events buffered per thread */
+#define	GA_TRACE_DEFAULT_EVENTS	16384
+
+EXPORT int ga_trace_enabled();
+EXPORT void ga_trace(int stage, int channel, long long id);
+EXPORT int ga_trace_snapshot(ga_trace_event_t **events);
+EXPORT int ga_trace_save(const char *filename);
+
+#endif
@@ -0,0 +1,633 @@
+/*
+ * Copyright (c) 2013-2015 Chun-Ying Huang
+ *
+ * This file is part of GamingAnywhere (GA).
+ *
+ * GA is free software; you can redistribute it and/or modify it
+ * under the terms of the 3-clause BSD License as published by the
+ * Free Software Foundation: http://directory.fsf.org/wiki/License:BSD_3Clause
+ *
+ * GA is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * You should have received a copy of the 3-clause BSD License along with GA;
+ * if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/**
+ * @file
+ * video frame converter: BGRA/RGBA to YUV420P/NV12 kernels
+ *
+ * Colors are converted with BT.601 limited-range coefficients in 8-bit
+ * fixed point, chroma is the average of a 2x2 block.
+ * Frames can be downscaled by 2 or 4 while converting: each output pixel
+ * is the rounded average of a 2x2 or 4x4 box of source pixels.
+ * SIMD kernels produce exactly the same output as the scalar kernel.
+ * The fastest kernel supported by the CPU is selected on the first use.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "ga-common.h"
+#include "ga-cpu.h"
+
+#include "vconverter.h"
+
+#if defined(__i386__) || defined(__x86_64__) || defined(_M_IX86) || defined(_M_X64)
+#define	VCONV_X86
+#include <emmintrin.h>
+#if !defined(_MSC_VER) || _MSC_VER >= 1800
+#define	VCONV_AVX2
+#include <immintrin.h>
+#endif
+#endif
+
+#ifdef _MSC_VER
+#define	VCONV_TARGET(x)
+#else
+/** Compile a function for instruction set \a x without global compiler flags */
+#define	VCONV_TARGET(x)	__attribute__((target(x)))
+#endif
+
+// fixed-point coefficients: Y, U, and V for R, G, and B
+#define	YR	66
+#define	YG	129
+#define	YB	25
+#define	UR	(-38)
+#define	UG	(-74)
+#define	UB	112
+#define	VR	112
+#define	VG	(-94)
+#define	VB	(-18)
+
+/**
+ * Arguments of a conversion kernel.
+ */
+typedef struct vconv_args_s {
+	const unsigned char *src;	/**< BGRA or RGBA pixels */
+	int srcstride;			/**< Bytes per source row */
+	int rgba;			/**< Non-zero if the source is RGBA */
+	int nv12;			/**< Non-zero for NV12, otherwise YUV420P */
+	unsigned char *dst[3];		/**< Y, U (or UV), and V planes */
+	int dststride[3];		/**< Bytes per row of each plane */
+	int width;			/**< Frame width */
+	int height;			/**< Frame height */
+}	vconv_args_t;
+
+/**
+ * Kernel type: convert columns [\a x0, \a x1) of rows \a y and \a y+1.
+ * \a x0 and \a x1 are even. Only the scalar kernel handles odd
+ * widths, odd heights, and the trailing columns of SIMD kernels.
+ */
+typedef int (*vconv_kernel_t)(vconv_args_t *a, int y, int x0, int x1);
+
+/**
+ * Box filter type: downscale one row of \a width output pixels
+ * from \a src, which has 2 or 4 rows of \a srcstride bytes.
+ * Returns the number of output pixels done, the remaining pixels
+ * are done by the scalar box filter.
+ */
+typedef int (*vconv_box_t)(const unsigned char *src, int srcstride, unsigned char *dst, int width);
+
+static inline unsigned char
+clip_uint8(int v) {
+	return v < 0 ? 0 : (v > 255 ? 255 : v);
+}
+
+/**
+ * Scalar kernel: the reference implementation.
+ */
+static int
+vconv_kernel_c(vconv_args_t *a, int y, int x0, int x1) {
+	const unsigned char *s0 = a->src + y * a->srcstride;
+	const unsigned char *s1 = (y+1 < a->height) ? s0 + a->srcstride : s0;
+	unsigned char *y0 = a->dst[0] + y * a->dststride[0];
+	unsigned char *y1 = (y+1 < a->height) ? y0 + a->dststride[0] : NULL;
+	unsigned char *u = a->dst[1] + (y>>1) * a->dststride[1];
+	unsigned char *v = a->dst[2] + (y>>1) * a->dststride[2];
+	int ri = a->rgba ? 0 : 2, bi = a->rgba ? 2 : 0;
+	int x, x2, r, g, b;
+	//
+	for(x = x0; x < x1; x += 2) {
+		x2 = (x+1 < a->width) ? x+1 : x;
+		y0[x] = ((YR*s0[x*4+ri] + YG*s0[x*4+1] + YB*s0[x*4+bi] + 128) >> 8) + 16;
+		if(x2 != x)
+			y0[x2] = ((YR*s0[x2*4+ri] + YG*s0[x2*4+1] + YB*s0[x2*4+bi] + 128) >> 8) + 16;
+		if(y1 != NULL) {
+			y1[x] = ((YR*s1[x*4+ri] + YG*s1[x*4+1] + YB*s1[x*4+bi] + 128) >> 8) + 16;
+			if(x2 != x)
+				y1[x2] = ((YR*s1[x2*4+ri] + YG*s1[x2*4+1] + YB*s1[x2*4+bi] + 128) >> 8) + 16;
+		}
+		r = (s0[x*4+ri] + s0[x2*4+ri] + s1[x*4+ri] + s1[x2*4+ri] + 2) >> 2;
+		g = (s0[x*4+1] + s0[x2*4+1] + s1[x*4+1] + s1[x2*4+1] + 2) >> 2;
+		b = (s0[x*4+bi] + s0[x2*4+bi] + s1[x*4+bi] + s1[x2*4+bi] + 2) >> 2;
+		if(a->nv12) {
+			u[x] = clip_uint8(((UR*r + UG*g + UB*b + 128) >> 8) + 128);
+			u[x+1] = clip_uint8(((VR*r + VG*g + VB*b + 128) >> 8) + 128);
+		} else {
+			u[x>>1] = clip_uint8(((UR*r + UG*g + UB*b + 128) >> 8) + 128);
+			v[x>>1] = clip_uint8(((VR*r + VG*g + VB*b + 128) >> 8) + 128);
+		}
+	}
+	return x1;
+}
+
+/**
+ * Scalar 2:1 box filter: the reference implementation.
+ */
+static int
+vconv_box2_c(const unsigned char *src, int srcstride, unsigned char *dst, int width) {
+	const unsigned char *s0 = src, *s1 = src + srcstride;
+	int x, c;
+	for(x = 0; x < width; x++, s0 += 8, s1 += 8) {
+		for(c = 0; c < 4; c++)
+			dst[x*4+c] = (s0[c] + s0[c+4] + s1[c] + s1[c+4] + 2) >> 2;
+	}
+	return width;
+}
+
+/**
+ * Scalar 4:1 box filter: the reference implementation.
+ */
+static int
+vconv_box4_c(const unsigned char *src, int srcstride, unsigned char *dst, int width) {
+	const unsigned char *s;
+	int x, c, i, sum;
+	for(x = 0; x < width; x++, src += 16) {
+		for(c = 0; c < 4; c++) {
+			sum = 8;
+			for(i = 0, s = src; i < 4; i++, s += srcstride)
+				sum += s[c] + s[c+4] + s[c+8] + s[c+12];
+			dst[x*4+c] = sum >> 4;
+		}
+	}
+	return width;
+}
+
+#ifdef VCONV_X86
+/**
+ * SSE2: sum pairs of 32-bit madd results of 4 pixels, \a m0 and \a m1,
+ * into four 32-bit values.
+ */
+VCONV_TARGET("sse2")
+static inline __m128i
+vconv_hsum_sse2(__m128i m0, __m128i m1) {
+	__m128 e = _mm_shuffle_ps(_mm_castsi128_ps(m0), _mm_castsi128_ps(m1), _MM_SHUFFLE(2,0,2,0));
+	__m128 o = _mm_shuffle_ps(_mm_castsi128_ps(m0), _mm_castsi128_ps(m1), _MM_SHUFFLE(3,1,3,1));
+	return _mm_add_epi32(_mm_castps_si128(e), _mm_castps_si128(o));
+}
+
+/**
+ * SSE2: Y of 4 pixels as 32-bit values.
+ */
+VCONV_TARGET("sse2")
+static inline __m128i
+vconv_luma_sse2(__m128i px, __m128i coef) {
+	__m128i zero = _mm_setzero_si128();
+	__m128i s = vconv_hsum_sse2(
+		_mm_madd_epi16(_mm_unpacklo_epi8(px, zero), coef),
+		_mm_madd_epi16(_mm_unpackhi_epi8(px, zero), coef));
+	return _mm_srai_epi32(_mm_add_epi32(s, _mm_set1_epi32(128 + (16<<8))), 8);
+}
+
+/**
+ * SSE2: 2x2 averages of 4 pixels from two rows, as 16-bit channels
+ * of 2 chroma samples.
+ */
+VCONV_TARGET("sse2")
+static inline __m128i
+vconv_avg_sse2(__m128i p0, __m128i p1) {
+	__m128i zero = _mm_setzero_si128();
+	__m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(p0, zero), _mm_unpacklo_epi8(p1, zero));
+	__m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(p0, zero), _mm_unpackhi_epi8(p1, zero));
+	__m128i t = _mm_add_epi16(_mm_unpacklo_epi64(lo, hi), _mm_unpackhi_epi64(lo, hi));
+	return _mm_srli_epi16(_mm_add_epi16(t, _mm_set1_epi16(2)), 2);
+}
+
+/**
+ * SSE2: U or V of 4 chroma samples (from two averages) as 32-bit values.
+ */
+VCONV_TARGET("sse2")
+static inline __m128i
+vconv_chroma_sse2(__m128i a0, __m128i a1, __m128i coef) {
+	__m128i s = vconv_hsum_sse2(_mm_madd_epi16(a0, coef), _mm_madd_epi16(a1, coef));
+	return _mm_srai_epi32(_mm_add_epi32(s, _mm_set1_epi32(128 + (128<<8))), 8);
+}
+
+/**
+ * SSE2 kernel: 16 pixels from each of two rows per iteration.
+ */
+VCONV_TARGET("sse2")
+static int
+vconv_kernel_sse2(vconv_args_t *a, int y, int x0, int x1) {
+	const unsigned char *s0 = a->src + y * a->srcstride;
+	const unsigned char *s1 = s0 + a->srcstride;
+	unsigned char *y0 = a->dst[0] + y * a->dststride[0];
+	unsigned char *y1 = y0 + a->dststride[0];
+	unsigned char *u = a->dst[1] + (y>>1) * a->dststride[1];
+	unsigned char *v = a->dst[2] + (y>>1) * a->dststride[2];
+	__m128i ycoef, ucoef, vcoef;
+	__m128i p0[4], p1[4], avg[4], cu, cv;
+	int x, i;
+	//
+	if(y+1 >= a->height)
+		return x0;
+	if(a->rgba) {
+		ycoef = _mm_setr_epi16(YR, YG, YB, 0, YR, YG, YB, 0);
+		ucoef = _mm_setr_epi16(UR, UG, UB, 0, UR, UG, UB, 0);
+		vcoef = _mm_setr_epi16(VR, VG, VB, 0, VR, VG, VB, 0);
+	} else {
+		ycoef = _mm_setr_epi16(YB, YG, YR, 0, YB, YG, YR, 0);
+		ucoef = _mm_setr_epi16(UB, UG, UR, 0, UB, UG, UR, 0);
+		vcoef = _mm_setr_epi16(VB, VG, VR, 0, VB, VG, VR, 0);
+	}
+	for(x = x0; x + 16 <= x1; x += 16) {
+		for(i = 0; i < 4; i++) {
+			p0[i] = _mm_loadu_si128((const __m128i*) (s0 + (x + i*4) * 4));
+			p1[i] = _mm_loadu_si128((const __m128i*) (s1 + (x + i*4) * 4));
+			avg[i] = vconv_avg_sse2(p0[i], p1[i]);
+		}
+		_mm_storeu_si128((__m128i*) (y0 + x), _mm_packus_epi16(
+			_mm_packs_epi32(vconv_luma_sse2(p0[0], ycoef), vconv_luma_sse2(p0[1], ycoef)),
+			_mm_packs_epi32(vconv_luma_sse2(p0[2], ycoef), vconv_luma_sse2(p0[3], ycoef))));
+		_mm_storeu_si128((__m128i*) (y1 + x), _mm_packus_epi16(
+			_mm_packs_epi32(vconv_luma_sse2(p1[0], ycoef), vconv_luma_sse2(p1[1], ycoef)),
+			_mm_packs_epi32(vconv_luma_sse2(p1[2], ycoef), vconv_luma_sse2(p1[3], ycoef))));
+		// [U0..U7 V0..V7]
+		cu = _mm_packs_epi32(vconv_chroma_sse2(avg[0], avg[1], ucoef), vconv_chroma_sse2(avg[2], avg[3], ucoef));
+		cv = _mm_packs_epi32(vconv_chroma_sse2(avg[0], avg[1], vcoef), vconv_chroma_sse2(avg[2], avg[3], vcoef));
+		cu = _mm_packus_epi16(cu, cv);
+		if(a->nv12) {
+			_mm_storeu_si128((__m128i*) (u + x), _mm_unpacklo_epi8(cu, _mm_srli_si128(cu, 8)));
+		} else {
+			_mm_storel_epi64((__m128i*) (u + (x>>1)), cu);
+			_mm_storel_epi64((__m128i*) (v + (x>>1)), _mm_srli_si128(cu, 8));
+		}
+	}
+	return x;
+}
+
+/**
+ * SSE2 2:1 box filter: 4 output pixels per iteration.
+ */
+VCONV_TARGET("sse2")
+static int
+vconv_box2_sse2(const unsigned char *src, int srcstride, unsigned char *dst, int width) {
+	const unsigned char *s0 = src, *s1 = src + srcstride;
+	__m128i a0, a1;
+	int x;
+	for(x = 0; x + 4 <= width; x += 4) {
+		a0 = vconv_avg_sse2(_mm_loadu_si128((const __m128i*) (s0 + x*8)),
+				_mm_loadu_si128((const __m128i*) (s1 + x*8)));
+		a1 = vconv_avg_sse2(_mm_loadu_si128((const __m128i*) (s0 + x*8 + 16)),
+				_mm_loadu_si128((const __m128i*) (s1 + x*8 + 16)));
+		_mm_storeu_si128((__m128i*) (dst + x*4), _mm_packus_epi16(a0, a1));
+	}
+	return x;
+}
+
+/**
+ * SSE2: channel sums of a 4x4 box, in the lower 4 16-bit lanes.
+ */
+VCONV_TARGET("sse2")
+static inline __m128i
+vconv_box4sum_sse2(const unsigned char *src, int srcstride) {
+	__m128i zero = _mm_setzero_si128();
+	__m128i lo = zero, hi = zero, p;
+	int i;
+	for(i = 0; i < 4; i++, src += srcstride) {
+		p = _mm_loadu_si128((const __m128i*) src);
+		lo = _mm_add_epi16(lo, _mm_unpacklo_epi8(p, zero));
+		hi = _mm_add_epi16(hi, _mm_unpackhi_epi8(p, zero));
+	}
+	lo = _mm_add_epi16(lo, hi);
+	return _mm_add_epi16(lo, _mm_srli_si128(lo, 8));
+}
+
+/**
+ * SSE2 4:1 box filter: 4 output pixels per iteration.
+ */
+VCONV_TARGET("sse2")
+static int
+vconv_box4_sse2(const unsigned char *src, int srcstride, unsigned char *dst, int width) {
+	__m128i round = _mm_set1_epi16(8), p01, p23;
+	int x;
+	for(x = 0; x + 4 <= width; x += 4) {
+		p01 = _mm_unpacklo_epi64(vconv_box4sum_sse2(src + x*16, srcstride),
+				vconv_box4sum_sse2(src + x*16 + 16, srcstride));
+		p23 = _mm_unpacklo_epi64(vconv_box4sum_sse2(src + x*16 + 32, srcstride),
+				vconv_box4sum_sse2(src + x*16 + 48, srcstride));
+		p01 = _mm_srli_epi16(_mm_add_epi16(p01, round), 4);
+		p23 = _mm_srli_epi16(_mm_add_epi16(p23, round), 4);
+		_mm_storeu_si128((__m128i*) (dst + x*4), _mm_packus_epi16(p01, p23));
+	}
+	return x;
+}
+#endif	/* VCONV_X86 */
+
+#ifdef VCONV_AVX2
+/**
+ * AVX2: sum pairs of 32-bit madd results, see vconv_hsum_sse2().
+ */
+VCONV_TARGET("avx2")
+static inline __m256i
+vconv_hsum_avx2(__m256i m0, __m256i m1) {
+	__m256 e = _mm256_shuffle_ps(_mm256_castsi256_ps(m0), _mm256_castsi256_ps(m1), _MM_SHUFFLE(2,0,2,0));
+	__m256 o = _mm256_shuffle_ps(_mm256_castsi256_ps(m0), _mm256_castsi256_ps(m1), _MM_SHUFFLE(3,1,3,1));
+	return _mm256_add_epi32(_mm256_castps_si256(e), _mm256_castps_si256(o));
+}
+
+/**
+ * AVX2: Y of 8 pixels as 32-bit values, in order.
+ */
+VCONV_TARGET("avx2")
+static inline __m256i
+vconv_luma_avx2(__m256i px, __m256i coef) {
+	__m256i zero = _mm256_setzero_si256();
+	__m256i s = vconv_hsum_avx2(
+		_mm256_madd_epi16(_mm256_unpacklo_epi8(px, zero), coef),
+		_mm256_madd_epi16(_mm256_unpackhi_epi8(px, zero), coef));
+	return _mm256_srai_epi32(_mm256_add_epi32(s, _mm256_set1_epi32(128 + (16<<8))), 8);
+}
+
+/**
+ * AVX2: 2x2 averages of 8 pixels from two rows, 4 chroma samples in order.
+ */
+VCONV_TARGET("avx2")
+static inline __m256i
+vconv_avg_avx2(__m256i p0, __m256i p1) {
+	__m256i zero = _mm256_setzero_si256();
+	__m256i lo = _mm256_add_epi16(_mm256_unpacklo_epi8(p0, zero), _mm256_unpacklo_epi8(p1, zero));
+	__m256i hi = _mm256_add_epi16(_mm256_unpackhi_epi8(p0, zero), _mm256_unpackhi_epi8(p1, zero));
+	__m256i t = _mm256_add_epi16(_mm256_unpacklo_epi64(lo, hi), _mm256_unpackhi_epi64(lo, hi));
+	return _mm256_srli_epi16(_mm256_add_epi16(t, _mm256_set1_epi16(2)), 2);
+}
+
+/**
+ * AVX2: U or V of 8 chroma samples as 32-bit values,
+ * in the order of 0 1 4 5 2 3 6 7.
+ */
+VCONV_TARGET("avx2")
+static inline __m256i
+vconv_chroma_avx2(__m256i a0, __m256i a1, __m256i coef) {
+	__m256i s = vconv_hsum_avx2(_mm256_madd_epi16(a0, coef), _mm256_madd_epi16(a1, coef));
+	return _mm256_srai_epi32(_mm256_add_epi32(s, _mm256_set1_epi32(128 + (128<<8))), 8);
+}
+
+/**
+ * AVX2: pack Y of 32 pixels into bytes, in order.
+ */
+VCONV_TARGET("avx2")
+static inline __m256i
+vconv_packy_avx2(__m256i y0, __m256i y1, __m256i y2, __m256i y3) {
+	__m256i p = _mm256_packus_epi16(_mm256_packs_epi32(y0, y1), _mm256_packs_epi32(y2, y3));
+	return _mm256_permutevar8x32_epi32(p, _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7));
+}
+
+/**
+ * AVX2 kernel: 32 pixels from each of two rows per iteration.
+ */
+VCONV_TARGET("avx2")
+static int
+vconv_kernel_avx2(vconv_args_t *a, int y, int x0, int x1) {
+	const unsigned char *s0 = a->src + y * a->srcstride;
+	const unsigned char *s1 = s0 + a->srcstride;
+	unsigned char *y0 = a->dst[0] + y * a->dststride[0];
+	unsigned char *y1 = y0 + a->dststride[0];
+	unsigned char *u = a->dst[1] + (y>>1) * a->dststride[1];
+	unsigned char *v = a->dst[2] + (y>>1) * a->dststride[2];
+	__m256i ycoef, ucoef, vcoef;
+	__m256i p0[4], p1[4], avg[4], cu, cv;
+	__m256i cperm = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+	__m256i cshuf = _mm256_setr_epi8(
+		0, 1, 4, 5, 2, 3, 6, 7, 8, 9, 12, 13, 10, 11, 14, 15,
+		0, 1, 4, 5, 2, 3, 6, 7, 8, 9, 12, 13, 10, 11, 14, 15);
+	__m128i uu, vv;
+	int x, i;
+	//
+	if(y+1 >= a->height)
+		return x0;
+	if(a->rgba) {
+		ycoef = _mm256_setr_epi16(YR, YG, YB, 0, YR, YG, YB, 0, YR, YG, YB, 0, YR, YG, YB, 0);
+		ucoef = _mm256_setr_epi16(UR, UG, UB, 0, UR, UG, UB, 0, UR, UG, UB, 0, UR, UG, UB, 0);
+		vcoef = _mm256_setr_epi16(VR, VG, VB, 0, VR, VG, VB, 0, VR, VG, VB, 0, VR, VG, VB, 0);
+	} else {
+		ycoef = _mm256_setr_epi16(YB, YG, YR, 0, YB, YG, YR, 0, YB, YG, YR, 0, YB, YG, YR, 0);
+		ucoef = _mm256_setr_epi16(UB, UG, UR, 0, UB, UG, UR, 0, UB, UG, UR, 0, UB, UG, UR, 0);
+		vcoef = _mm256_setr_epi16(VB, VG, VR, 0, VB, VG, VR, 0, VB, VG, VR, 0, VB, VG, VR, 0);
+	}
+	for(x = x0; x + 32 <= x1; x += 32) {
+		for(i = 0; i < 4; i++) {
+			p0[i] = _mm256_loadu_si256((const __m256i*) (s0 + (x + i*8) * 4));
+			p1[i] = _mm256_loadu_si256((const __m256i*) (s1 + (x + i*8) * 4));
+			avg[i] = vconv_avg_avx2(p0[i], p1[i]);
+		}
+		_mm256_storeu_si256((__m256i*) (y0 + x), vconv_packy_avx2(
+			vconv_luma_avx2(p0[0], ycoef), vconv_luma_avx2(p0[1], ycoef),
+			vconv_luma_avx2(p0[2], ycoef), vconv_luma_avx2(p0[3], ycoef)));
+		_mm256_storeu_si256((__m256i*) (y1 + x), vconv_packy_avx2(
+			vconv_luma_avx2(p1[0], ycoef), vconv_luma_avx2(p1[1], ycoef),
+			vconv_luma_avx2(p1[2], ycoef), vconv_luma_avx2(p1[3], ycoef)));
+		// 16 U and 16 V: reorder into [U0..U15 | V0..V15]
+		cu = _mm256_packs_epi32(vconv_chroma_avx2(avg[0], avg[1], ucoef), vconv_chroma_avx2(avg[2], avg[3], ucoef));
+		cv = _mm256_packs_epi32(vconv_chroma_avx2(avg[0], avg[1], vcoef), vconv_chroma_avx2(avg[2], avg[3], vcoef));
+		cu = _mm256_packus_epi16(cu, cv);
+		cu = _mm256_shuffle_epi8(_mm256_permutevar8x32_epi32(cu, cperm), cshuf);
+		uu = _mm256_castsi256_si128(cu);
+		vv = _mm256_extracti128_si256(cu, 1);
+		if(a->nv12) {
+			_mm_storeu_si128((__m128i*) (u + x), _mm_unpacklo_epi8(uu, vv));
+			_mm_storeu_si128((__m128i*) (u + x + 16), _mm_unpackhi_epi8(uu, vv));
+		} else {
+			_mm_storeu_si128((__m128i*) (u + (x>>1)), uu);
+			_mm_storeu_si128((__m128i*) (v + (x>>1)), vv);
+		}
+	}
+	return x;
+}
+#endif	/* VCONV_AVX2 */
+
+static vconv_kernel_t vconv_kernel = vconv_kernel_c;
+static vconv_box_t vconv_box2 = vconv_box2_c;
+static vconv_box_t vconv_box4 = vconv_box4_c;
+static pthread_once_t vconv_once = PTHREAD_ONCE_INIT;
+
+/**
+ * Select the fastest kernel. This is an internal function.
+ */
+static void
+vconv_init() {
+	unsigned int flags = ga_cpu_features();
+	const char *name = "scalar";
+	//
+#ifdef VCONV_X86
+	if(flags & GA_CPU_SSE2) {
+		vconv_kernel = vconv_kernel_sse2;
+		vconv_box2 = vconv_box2_sse2;
+		vconv_box4 = vconv_box4_sse2;
+		name = "sse2";
+	}
+#endif
+#ifdef VCONV_AVX2
+	if(flags & GA_CPU_AVX2) {
+		vconv_kernel = vconv_kernel_avx2;
+		name = "avx2";
+	}
+#endif
+	ga_error("Frame converter: rgb2yuv kernel = %s\n", name);
+	return;
+}
+
+/**
+ * Check if a conversion is supported by vconv_rgb2yuv().
+ *
+ * @param srcfmt [in] Source pixel format.
+ * @param dstfmt [in] Destination pixel format.
+ * @return Non-zero if it is supported.
+ */
+int
+vconv_rgb2yuv_supported(AVPixelFormat srcfmt, AVPixelFormat dstfmt) {
+	if(srcfmt != AV_PIX_FMT_BGRA && srcfmt != AV_PIX_FMT_RGBA)
+		return 0;
+	if(dstfmt != AV_PIX_FMT_YUV420P && dstfmt != AV_PIX_FMT_NV12)
+		return 0;
+	return 1;
+}
+
+/**
+ * Get the downscale factor supported by vconv_rgb2yuv_downscale().
+ *
+ * @param srcw [in] Source frame width.
+ * @param srch [in] Source frame height.
+ * @param dstw [in] Destination frame width.
+ * @param dsth [in] Destination frame height.
+ * @return 1 (no scaling), 2, or 4, or 0 if the ratio is not supported.
+ */
+int
+vconv_rgb2yuv_scale(int srcw, int srch, int dstw, int dsth) {
+	int f;
+	for(f = 1; f <= 4; f <<= 1) {
+		if(srcw == dstw * f && srch == dsth * f)
+			return f;
+	}
+	return 0;
+}
+
+/**
+ * Convert a BGRA or RGBA frame to YUV420P or NV12 without scaling.
+ *
+ * @param srcfmt [in] Source pixel format: AV_PIX_FMT_BGRA or AV_PIX_FMT_RGBA.
+ * @param src [in] Source pixels.
+ * @param srcstride [in] Bytes per source row.
+ * @param dstfmt [in] Destination pixel format: AV_PIX_FMT_YUV420P or AV_PIX_FMT_NV12.
+ * @param dst [in] Destination planes: Y, U, and V for YUV420P, or Y and UV for NV12.
+ * @param dststride [in] Bytes per row of each destination plane.
+ * @param width [in] Frame width.
+ * @param height [in] Frame height.
+ * @return 0 on success, or -1 if the conversion is not supported.
+ *
+ * A horizontal band of a frame can be converted by offsetting
+ * the pointers to an even row.
+ */
+int
+vconv_rgb2yuv(AVPixelFormat srcfmt, const unsigned char *src, int srcstride,
+		AVPixelFormat dstfmt, unsigned char **dst, const int *dststride,
+		int width, int height) {
+	vconv_args_t a;
+	int y, x, xsimd = width & ~1;
+	//
+	if(vconv_rgb2yuv_supported(srcfmt, dstfmt) == 0)
+		return -1;
+	pthread_once(&vconv_once, vconv_init);
+	//
+	a.src = src;
+	a.srcstride = srcstride;
+	a.rgba = (srcfmt == AV_PIX_FMT_RGBA);
+	a.nv12 = (dstfmt == AV_PIX_FMT_NV12);
+	a.dst[0] = dst[0];
+	a.dst[1] = dst[1];
+	a.dst[2] = a.nv12 ? dst[1] : dst[2];
+	a.dststride[0] = dststride[0];
+	a.dststride[1] = dststride[1];
+	a.dststride[2] = a.nv12 ? dststride[1] : dststride[2];
+	a.width = width;
+	a.height = height;
+	//
+	for(y = 0; y < height; y += 2) {
+		x = vconv_kernel(&a, y, 0, xsimd);
+		if(x < width)
+			vconv_kernel_c(&a, y, x, width);
+	}
+	return 0;
+}
+
+/**
+ * Downscale a BGRA or RGBA frame by 2 or 4, and convert it to YUV420P or NV12.
+ *
+ * @param srcfmt [in] Source pixel format: AV_PIX_FMT_BGRA or AV_PIX_FMT_RGBA.
+ * @param src [in] Source pixels, \a width*scale x \a height*scale.
+ * @param srcstride [in] Bytes per source row.
+ * @param dstfmt [in] Destination pixel format: AV_PIX_FMT_YUV420P or AV_PIX_FMT_NV12.
+ * @param dst [in] Destination planes: Y, U, and V for YUV420P, or Y and UV for NV12.
+ * @param dststride [in] Bytes per row of each destination plane.
+ * @param width [in] Destination frame width.
+ * @param height [in] Destination frame height.
+ * @param scale [in] Downscale factor: 1, 2, or 4, see vconv_rgb2yuv_scale().
+ * @return 0 on success, or -1 if the conversion is not supported.
+ *
+ * Each pair of destination rows is box-filtered into a small buffer,
+ * and then converted while it is still in the cache.
+ * A horizontal band of a frame can be converted by offsetting
+ * the pointers to an even destination row.
+ */
+int
+vconv_rgb2yuv_downscale(AVPixelFormat srcfmt, const unsigned char *src, int srcstride,
+		AVPixelFormat dstfmt, unsigned char **dst, const int *dststride,
+		int width, int height, int scale) {
+	vconv_args_t a;
+	vconv_box_t box, boxc;
+	unsigned char *tmp;
+	int y, i, x, xsimd = width & ~1;
+	//
+	if(scale == 1)
+		return vconv_rgb2yuv(srcfmt, src, srcstride, dstfmt, dst, dststride, width, height);
+	if(vconv_rgb2yuv_supported(srcfmt, dstfmt) == 0 || (scale != 2 && scale != 4))
+		return -1;
+	pthread_once(&vconv_once, vconv_init);
+	if((tmp = (unsigned char*) malloc(width * 4 * 2)) == NULL)
+		return -1;
+	box = scale == 2 ? vconv_box2 : vconv_box4;
+	boxc = scale == 2 ? vconv_box2_c : vconv_box4_c;
+	//
+	a.src = tmp;
+	a.srcstride = width * 4;
+	a.rgba = (srcfmt == AV_PIX_FMT_RGBA);
+	a.nv12 = (dstfmt == AV_PIX_FMT_NV12);
+	a.dststride[0] = dststride[0];
+	a.dststride[1] = dststride[1];
+	a.dststride[2] = a.nv12 ? dststride[1] : dststride[2];
+	a.width = width;
+	//
+	for(y = 0; y < height; y += 2) {
+		a.height = (y+1 < height) ? 2 : 1;
+		for(i = 0; i < a.height; i++) {
+			const unsigned char *s = src + (y+i) * scale * srcstride;
+			x = box(s, srcstride, tmp + i * a.srcstride, width);
+			if(x < width)
+				boxc(s + x * scale * 4, srcstride, tmp + i * a.srcstride + x * 4, width - x);
+		}
+		a.dst[0] = dst[0] + y * dststride[0];
+		a.dst[1] = dst[1] + (y>>1) * dststride[1];
+		a.dst[2] = a.nv12 ? a.dst[1] : dst[2] + (y>>1) * dststride[2];
+		x = vconv_kernel(&a, 0, 0, xsimd);
+		if(x < width)
+			vconv_kernel_c(&a, 0, x, width);
+	}
+	free(tmp);
+	return 0;
+}
@@ -22,55 +22,130 @@
  */
 
 #include <stdio.h>
-#include <map>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
 
 #include "ga-common.h"
 #include "ga-conf.h"
+#include "ga-atomic.h"
 
 #include "vconverter.h"
 
-using namespace std;
+/**
+ * Number of buckets of the shared converter table. Must be a power of 2.
+ */
+#define	VCONV_BUCKETS		64
+/**
+ * Number of converters cached by a thread, see vconv_thread_converter().
+ */
+#define	VCONV_THREAD_CACHE	4
+/**
+ * Max number of pre-warmed converters, see vconv_prewarm().
+ */
+#define	VCONV_SPARES		16
 
-static map<struct vconvcfg, struct SwsContext *> ga_converters;
+/**
+ * A shared converter. Nodes are never modified after being published,
+ * and never released: lookups read the table without locking.
+ */
+typedef struct vconv_node_s {
+	unsigned int hash;		/**< Hash of \a cfg */
+	struct vconvcfg cfg;		/**< Converter configuration */
+	struct SwsContext *ctx;		/**< The converter */
+	struct vconv_node_s *next;	/**< Next node in the same bucket */
+}	vconv_node_t;
 
 /**
- * Implement operator< for \a vconvcfg data structure.
- *
- * @param a [in] The left hand side operand.
- * @param b [in] The right hand side operand.
- * @return \a true if \a is smaller than \b,
- *	or \a false if \a is not smaller than \b.
- */
-bool operator<(struct vconvcfg a, struct vconvcfg b) {
-	if(a.src_width < b.src_width)	return true;
-	if(a.src_width > b.src_width)	return false;
-	if(a.src_height < b.src_height)	return true;
-	if(a.src_height > b.src_height)	return false;
-	if(a.src_fmt < b.src_fmt)	return true;
-	if(a.src_fmt > b.src_fmt)	return false;
-	if(a.dst_width < b.dst_width)	return true;
-	if(a.dst_width > b.dst_width)	return false;
-	if(a.dst_height < b.dst_height)	return true;
-	if(a.dst_height > b.dst_height)	return false;
-	if(a.dst_fmt < b.dst_fmt)	return true;
-	if(a.dst_fmt > b.dst_fmt)	return false;
-	/* all fields are equal */
-	return false;
+ * A converter owned by a thread, or a pre-warmed spare converter.
+ */
+typedef struct vconv_entry_s {
+	unsigned int hash;		/**< Hash of \a cfg */
+	unsigned int lastuse;		/**< LRU clock of the last lookup */
+	struct vconvcfg cfg;		/**< Converter configuration */
+	struct SwsContext *ctx;		/**< The converter, or NULL if unused */
+}	vconv_entry_t;
+
+/**
+ * Per-thread converter cache.
+ */
+typedef struct vconv_cache_s {
+	unsigned int clock;		/**< LRU clock */
+	int last;			/**< Index of the last hit */
+	vconv_entry_t entry[VCONV_THREAD_CACHE];
+}	vconv_cache_t;
+
+static vconv_node_t * volatile vconv_table[VCONV_BUCKETS];
+static pthread_mutex_t vconv_table_mutex = PTHREAD_MUTEX_INITIALIZER;
+//
+static vconv_entry_t vconv_spares[VCONV_SPARES];
+static int vconv_spares_next = 0;
+static pthread_mutex_t vconv_spares_mutex = PTHREAD_MUTEX_INITIALIZER;
+//
+static pthread_once_t vconv_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t vconv_key;
+static int vconv_key_ok = 0;
+
+/**
+ * Fill a \a vconvcfg data structure and return its hash value.
+ * This is an internal function.
+ */
+static unsigned int
+vconv_makecfg(struct vconvcfg *ccfg,
+		int srcw, int srch, AVPixelFormat srcfmt,
+		int dstw, int dsth, AVPixelFormat dstfmt) {
+	unsigned int h;
+	//
+	bzero(ccfg, sizeof(struct vconvcfg));
+	ccfg->src_width = srcw;
+	ccfg->src_height = srch;
+	ccfg->src_fmt = srcfmt;
+	ccfg->dst_width = dstw;
+	ccfg->dst_height = dsth;
+	ccfg->dst_fmt = dstfmt;
+	// FNV-1a style mixing of the fields
+	h = 2166136261U;
+	h = (h ^ (unsigned int) srcw) * 16777619U;
+	h = (h ^ (unsigned int) srch) * 16777619U;
+	h = (h ^ (unsigned int) srcfmt) * 16777619U;
+	h = (h ^ (unsigned int) dstw) * 16777619U;
+	h = (h ^ (unsigned int) dsth) * 16777619U;
+	h = (h ^ (unsigned int) dstfmt) * 16777619U;
+	return h ^ (h >> 16);
+}
+
+static inline int
+vconv_samecfg(const struct vconvcfg *a, const struct vconvcfg *b) {
+	return a->src_width == b->src_width && a->src_height == b->src_height
+		&& a->src_fmt == b->src_fmt && a->dst_width == b->dst_width
+		&& a->dst_height == b->dst_height && a->dst_fmt == b->dst_fmt;
+}
+
+static struct SwsContext *
+vconv_new_context(struct vconvcfg *ccfg) {
+	return sws_getContext(ccfg->src_width, ccfg->src_height, ccfg->src_fmt,
+			ccfg->dst_width, ccfg->dst_height, ccfg->dst_fmt,
+			SWS_BICUBIC, NULL, NULL, NULL);
 }
 
 /**
  * Look up an existing converter. This is an internal function.
  *
  * @param ccfg [in] Pointer to a prepared \a vconvcfg data structure.
+ * @param hash [in] Hash value of \a ccfg.
  * @return Pointer to the \a SwsContext structure of the converter,
  *	or NULL if not found.
+ *
+ * This function never locks.
  */
 static struct SwsContext *
-lookup_frame_converter_internal(struct vconvcfg *ccfg) {
-	map<struct vconvcfg, struct SwsContext *>::iterator mi;
+lookup_frame_converter_internal(struct vconvcfg *ccfg, unsigned int hash) {
+	vconv_node_t *node;
 	//
-	if((mi = ga_converters.find(*ccfg)) != ga_converters.end()) {
-		return mi->second;
+	node = (vconv_node_t*) ga_atomic_loadptr((void * volatile *) &vconv_table[hash & (VCONV_BUCKETS-1)]);
+	for(; node != NULL; node = node->next) {
+		if(node->hash == hash && vconv_samecfg(&node->cfg, ccfg))
+			return node->ctx;
 	}
 	//
 	return NULL;
@@ -87,19 +162,19 @@ lookup_frame_converter_internal(struct vconvcfg *ccfg) {
  * @param dstfmt [in] Video destination frame pixel format.
  * @return Pointer to the \a SwsContext structure of the converter,
  *	or NULL if not found.
+ *
+ * Converters returned by this function are shared by all callers.
+ * Use vconv_thread_converter() if the converter is used in a hot loop
+ * that may run concurrently with other threads.
  */
 struct SwsContext *
 lookup_frame_converter(int srcw, int srch, AVPixelFormat srcfmt, int dstw, int dsth, AVPixelFormat dstfmt) {
 	struct vconvcfg ccfg;
+	unsigned int hash;
 	//
-	ccfg.src_width = srcw;
-	ccfg.src_height = srch;
-	ccfg.src_fmt = srcfmt;
-	ccfg.dst_width = dstw;
-	ccfg.dst_height = dsth;
-	ccfg.dst_fmt = dstfmt;
+	hash = vconv_makecfg(&ccfg, srcw, srch, srcfmt, dstw, dsth, dstfmt);
 	//
-	return lookup_frame_converter_internal(&ccfg);
+	return lookup_frame_converter_internal(&ccfg, hash);
 }
 
 /**
@@ -116,34 +191,224 @@ lookup_frame_converter(int srcw, int srch, AVPixelFormat srcfmt, int dstw, int d
  *
  * This function does not create duplicated converters.
  * An existing converter is returned if it has already been created.
+ * The returned converter is shared and is never released.
  */
 struct SwsContext *
 create_frame_converter(int srcw, int srch, AVPixelFormat srcfmt,
 		 int dstw, int dsth, AVPixelFormat dstfmt) {
-	map<struct vconvcfg, struct SwsContext *>::iterator mi;
 	struct vconvcfg ccfg;
 	struct SwsContext *ctx;
+	vconv_node_t *node;
+	unsigned int hash, bucket;
 	//
-	ccfg.src_width = srcw;
-	ccfg.src_height = srch;
-	ccfg.src_fmt = srcfmt;
-	ccfg.dst_width = dstw;
-	ccfg.dst_height = dsth;
-	ccfg.dst_fmt = dstfmt;
+	hash = vconv_makecfg(&ccfg, srcw, srch, srcfmt, dstw, dsth, dstfmt);
+	bucket = hash & (VCONV_BUCKETS-1);
 	//
-	if((ctx = lookup_frame_converter_internal(&ccfg)) != NULL)
+	if((ctx = lookup_frame_converter_internal(&ccfg, hash)) != NULL)
 		return ctx;
 	//
-	if((ctx = sws_getContext(srcw, srch, srcfmt,
-				 dstw, dsth, dstfmt,
-				 SWS_BICUBIC, NULL, NULL, NULL)) == NULL) {
-		return NULL;
+	pthread_mutex_lock(&vconv_table_mutex);
+	// double check: created by another thread?
+	if((ctx = lookup_frame_converter_internal(&ccfg, hash)) != NULL)
+		goto create_done;
+	if((ctx = vconv_new_context(&ccfg)) == NULL)
+		goto create_done;
+	if((node = (vconv_node_t*) malloc(sizeof(vconv_node_t))) == NULL) {
+		sws_freeContext(ctx);
+		ctx = NULL;
+		goto create_done;
 	}
-	ga_converters[ccfg] = ctx;
+	node->hash = hash;
+	node->cfg = ccfg;
+	node->ctx = ctx;
+	node->next = vconv_table[bucket];
+	ga_atomic_storeptr((void * volatile *) &vconv_table[bucket], node);
 	ga_error("Frame converter created: from (%d,%d)[%d] -> (%d,%d)[%d]\n",
 		(int) srcw, (int) srch, (int) srcfmt,
 		(int) dstw, (int) dsth, (int) dstfmt);
+create_done:
+	pthread_mutex_unlock(&vconv_table_mutex);
 	//
 	return ctx;
 }
 
+/**
+ * Put a converter into the spare pool. A spare is released if the pool is full.
+ * This is an internal function.
+ */
+static void
+vconv_spare_put(vconv_entry_t *e) {
+	struct SwsContext *evicted = NULL;
+	int i;
+	pthread_mutex_lock(&vconv_spares_mutex);
+	for(i = 0; i < VCONV_SPARES; i++) {
+		if(vconv_spares[i].ctx == NULL)
+			break;
+	}
+	if(i == VCONV_SPARES) {
+		// full: spares are replaced in turn
+		i = vconv_spares_next;
+		vconv_spares_next = (vconv_spares_next + 1) % VCONV_SPARES;
+		evicted = vconv_spares[i].ctx;
+	}
+	vconv_spares[i] = *e;
+	e->ctx = NULL;
+	pthread_mutex_unlock(&vconv_spares_mutex);
+	if(evicted != NULL)
+		sws_freeContext(evicted);
+}
+
+/**
+ * Take a pre-warmed converter from the spare pool.
+ * This is an internal function.
+ */
+static struct SwsContext *
+vconv_spare_get(struct vconvcfg *ccfg, unsigned int hash) {
+	struct SwsContext *ctx = NULL;
+	int i;
+	pthread_mutex_lock(&vconv_spares_mutex);
+	for(i = 0; i < VCONV_SPARES; i++) {
+		if(vconv_spares[i].ctx != NULL
+		&& vconv_spares[i].hash == hash
+		&& vconv_samecfg(&vconv_spares[i].cfg, ccfg)) {
+			ctx = vconv_spares[i].ctx;
+			vconv_spares[i].ctx = NULL;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&vconv_spares_mutex);
+	return ctx;
+}
+
+/**
+ * Release the converter cache of a terminated thread.
+ * Converters are kept as spares for threads created later.
+ */
+static void
+vconv_cache_release(void *arg) {
+	vconv_cache_t *cache = (vconv_cache_t*) arg;
+	int i;
+	for(i = 0; i < VCONV_THREAD_CACHE; i++) {
+		if(cache->entry[i].ctx != NULL)
+			vconv_spare_put(&cache->entry[i]);
+	}
+	free(cache);
+}
+
+static void
+vconv_key_init() {
+	if(pthread_key_create(&vconv_key, vconv_cache_release) == 0)
+		vconv_key_ok = 1;
+	else
+		ga_error("Frame converter: cannot create thread key.\n");
+}
+
+/**
+ * Pre-warm converters for vconv_thread_converter().
+ *
+ * @param srcw [in] Video source frame width.
+ * @param srch [in] Video source frame height.
+ * @param srcfmt [in] Video source frame pixel format.
+ * @param dstw [in] Video destination frame width.
+ * @param dsth [in] Video destination frame height.
+ * @param dstfmt [in] Video destination frame pixel format.
+ * @param count [in] Number of converters to create, one for each thread
+ *	expected to use the configuration.
+ * @return 0 on success, or -1 if it fails on creating a converter.
+ *
+ * Converters are created in advance, so that a thread does not pay
+ * for the initialization of a converter when the first frame arrives.
+ * Spares not taken by any thread are released when evicted by newer ones.
+ */
+int
+vconv_prewarm(int srcw, int srch, AVPixelFormat srcfmt,
+		int dstw, int dsth, AVPixelFormat dstfmt, int count) {
+	vconv_entry_t e;
+	//
+	bzero(&e, sizeof(e));
+	e.hash = vconv_makecfg(&e.cfg, srcw, srch, srcfmt, dstw, dsth, dstfmt);
+	while(count-- > 0) {
+		if((e.ctx = vconv_new_context(&e.cfg)) == NULL)
+			return -1;
+		vconv_spare_put(&e);
+	}
+	return 0;
+}
+
+/**
+ * Get a converter owned by the calling thread.
+ *
+ * @param srcw [in] Video source frame width.
+ * @param srch [in] Video source frame height.
+ * @param srcfmt [in] Video source frame pixel format.
+ * @param dstw [in] Video destination frame width.
+ * @param dsth [in] Video destination frame height.
+ * @param dstfmt [in] Video destination frame pixel format.
+ * @return Pointer to the \a SwsContext structure of the converter,
+ *	or NULL if it fails on creating a converter.
+ *
+ * Each thread has a small converter cache, so a converter is never used
+ * by two threads at the same time and lookups never lock.
+ * A cache miss takes a pre-warmed converter (see vconv_prewarm()),
+ * or creates a new one. The least recently used converter, usually
+ * one for a stale resolution, is released when the cache is full.
+ * A returned converter remains valid until the thread gets
+ * \em VCONV_THREAD_CACHE other converters.
+ * The cache owns the converter: the caller must not free it.
+ */
+struct SwsContext *
+vconv_thread_converter(int srcw, int srch, AVPixelFormat srcfmt,
+		int dstw, int dsth, AVPixelFormat dstfmt) {
+	vconv_cache_t *cache;
+	vconv_entry_t *e, *victim;
+	struct vconvcfg ccfg;
+	unsigned int hash;
+	int i;
+	//
+	hash = vconv_makecfg(&ccfg, srcw, srch, srcfmt, dstw, dsth, dstfmt);
+	pthread_once(&vconv_key_once, vconv_key_init);
+	if(vconv_key_ok == 0)
+		return create_frame_converter(srcw, srch, srcfmt, dstw, dsth, dstfmt);
+	if((cache = (vconv_cache_t*) pthread_getspecific(vconv_key)) == NULL) {
+		if((cache = (vconv_cache_t*) calloc(1, sizeof(vconv_cache_t))) == NULL)
+			return NULL;
+		pthread_setspecific(vconv_key, cache);
+	}
+	// fast path: the same converter as the last frame
+	e = &cache->entry[cache->last];
+	if(e->ctx != NULL && e->hash == hash && vconv_samecfg(&e->cfg, &ccfg)) {
+		e->lastuse = ++cache->clock;
+		return e->ctx;
+	}
+	victim = &cache->entry[0];
+	for(i = 0; i < VCONV_THREAD_CACHE; i++) {
+		e = &cache->entry[i];
+		if(e->ctx != NULL && e->hash == hash && vconv_samecfg(&e->cfg, &ccfg)) {
+			e->lastuse = ++cache->clock;
+			cache->last = i;
+			return e->ctx;
+		}
+		if(victim->ctx != NULL
+		&& (e->ctx == NULL || e->lastuse < victim->lastuse))
+			victim = e;
+	}
+	// miss: replace the least recently used one
+	if(victim->ctx != NULL) {
+		ga_error("Frame converter: evict (%d,%d)[%d] -> (%d,%d)[%d]\n",
+			victim->cfg.src_width, victim->cfg.src_height, victim->cfg.src_fmt,
+			victim->cfg.dst_width, victim->cfg.dst_height, victim->cfg.dst_fmt);
+		sws_freeContext(victim->ctx);
+		victim->ctx = NULL;
+	}
+	if((victim->ctx = vconv_spare_get(&ccfg, hash)) == NULL) {
+		if((victim->ctx = vconv_new_context(&ccfg)) == NULL)
+			return NULL;
+		ga_error("Frame converter created (tid=%ld): from (%d,%d)[%d] -> (%d,%d)[%d]\n",
+			ga_gettid(), srcw, srch, (int) srcfmt, dstw, dsth, (int) dstfmt);
+	}
+	victim->hash = hash;
+	victim->cfg = ccfg;
+	victim->lastuse = ++cache->clock;
+	cache->last = victim - cache->entry;
+	return victim->ctx;
+}
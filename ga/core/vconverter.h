@@ -52,5 +52,21 @@ EXPORT struct SwsContext * lookup_frame_converter(int srcw, int srch, AVPixelFor
 EXPORT struct SwsContext * create_frame_converter(
 		int srcw, int srch, AVPixelFormat srcfmt,
 		int dstw, int dsth, AVPixelFormat dstfmt);
+// per-thread converters for hot loops
+EXPORT struct SwsContext * vconv_thread_converter(
+		int srcw, int srch, AVPixelFormat srcfmt,
+		int dstw, int dsth, AVPixelFormat dstfmt);
+EXPORT int vconv_prewarm(int srcw, int srch, AVPixelFormat srcfmt,
+		int dstw, int dsth, AVPixelFormat dstfmt, int count);
+// fast BGRA/RGBA to YUV420P/NV12 conversion without scaling
+EXPORT int vconv_rgb2yuv_supported(AVPixelFormat srcfmt, AVPixelFormat dstfmt);
+EXPORT int vconv_rgb2yuv(AVPixelFormat srcfmt, const unsigned char *src, int srcstride,
+		AVPixelFormat dstfmt, unsigned char **dst, const int *dststride,
+		int width, int height);
+// fast 2:1 and 4:1 downscaling while converting
+EXPORT int vconv_rgb2yuv_scale(int srcw, int srch, int dstw, int dsth);
+EXPORT int vconv_rgb2yuv_downscale(AVPixelFormat srcfmt, const unsigned char *src, int srcstride,
+		AVPixelFormat dstfmt, unsigned char **dst, const int *dststride,
+		int width, int height, int scale);
 
 #endif
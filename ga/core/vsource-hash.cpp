@@ -0,0 +1,232 @@
+/*
+ * Copyright (c) 2013-2015 Chun-Ying Huang
+ *
+ * This file is part of GamingAnywhere (GA).
+ *
+ * GA is free software; you can redistribute it and/or modify it
+ * under the terms of the 3-clause BSD License as published by the
+ * Free Software Foundation: http://directory.fsf.org/wiki/License:BSD_3Clause
+ *
+ * GA is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * You should have received a copy of the 3-clause BSD License along with GA;
+ * if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/**
+ * @file
+ * video source: detect unchanged frames by comparing tile hashes
+ *
+ * An image is divided into tiles of \em VSOURCE_HASH_TILE_BYTES x
+ * \em VSOURCE_HASH_TILE_ROWS. Each tile is hashed with Fletcher-style
+ * sums of four 32-bit lanes: for every 16 bytes \a v, a += v and b += a.
+ * The sums are cheap enough to run at memory bandwidth, and any single
+ * changed byte changes the hash of its tile.
+ * The SSE2 kernel produces exactly the same hashes as the scalar kernel.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "vsource.h"
+#include "ga-common.h"
+#include "ga-cpu.h"
+
+#if defined(__i386__) || defined(__x86_64__) || defined(_M_IX86) || defined(_M_X64)
+#define	VHASH_X86
+#include <emmintrin.h>
+#endif
+
+#ifdef _MSC_VER
+#define	VHASH_TARGET(x)
+#else
+#define	VHASH_TARGET(x)	__attribute__((target(x)))
+#endif
+
+/** Number of 32-bit sums per tile: four lanes of a and b */
+#define	VHASH_ACC	8
+
+/**
+ * Kernel type: add a row of \a rowbytes bytes into the sums of tiles.
+ */
+typedef void (*vhash_row_t)(const unsigned char *row, int rowbytes, unsigned int *acc);
+
+/**
+ * Scalar kernel: the reference implementation.
+ */
+static void
+vhash_row_c(const unsigned char *row, int rowbytes, unsigned int *acc) {
+	unsigned char pad[16];
+	const unsigned char *p;
+	unsigned int v;
+	int x, n, i;
+	//
+	for(x = 0; x < rowbytes; x += VSOURCE_HASH_TILE_BYTES, acc += VHASH_ACC) {
+		n = rowbytes - x < VSOURCE_HASH_TILE_BYTES ? rowbytes - x : VSOURCE_HASH_TILE_BYTES;
+		for(p = row + x; n > 0; p += 16, n -= 16) {
+			if(n < 16) {
+				bzero(pad, sizeof(pad));
+				bcopy(p, pad, n);
+				p = pad;
+			}
+			for(i = 0; i < 4; i++) {
+				bcopy(p + i*4, &v, 4);
+				acc[i] += v;
+				acc[i+4] += acc[i];
+			}
+		}
+	}
+	return;
+}
+
+#ifdef VHASH_X86
+/**
+ * SSE2 kernel.
+ */
+VHASH_TARGET("sse2")
+static void
+vhash_row_sse2(const unsigned char *row, int rowbytes, unsigned int *acc) {
+	unsigned char pad[16];
+	const unsigned char *p, *end;
+	__m128i a, b, v;
+	int x, n;
+	//
+	for(x = 0; x < rowbytes; x += VSOURCE_HASH_TILE_BYTES, acc += VHASH_ACC) {
+		n = rowbytes - x < VSOURCE_HASH_TILE_BYTES ? rowbytes - x : VSOURCE_HASH_TILE_BYTES;
+		a = _mm_loadu_si128((const __m128i*) acc);
+		b = _mm_loadu_si128((const __m128i*) (acc + 4));
+		for(p = row + x, end = p + (n & ~15); p < end; p += 16) {
+			v = _mm_loadu_si128((const __m128i*) p);
+			a = _mm_add_epi32(a, v);
+			b = _mm_add_epi32(b, a);
+		}
+		if(n & 15) {
+			bzero(pad, sizeof(pad));
+			bcopy(p, pad, n & 15);
+			a = _mm_add_epi32(a, _mm_loadu_si128((const __m128i*) pad));
+			b = _mm_add_epi32(b, a);
+		}
+		_mm_storeu_si128((__m128i*) acc, a);
+		_mm_storeu_si128((__m128i*) (acc + 4), b);
+	}
+	return;
+}
+#endif
+
+static vhash_row_t vhash_row = vhash_row_c;
+static pthread_once_t vhash_once = PTHREAD_ONCE_INIT;
+
+static void
+vhash_init() {
+#ifdef VHASH_X86
+	if(ga_cpu_features() & GA_CPU_SSE2)
+		vhash_row = vhash_row_sse2;
+#endif
+	return;
+}
+
+/**
+ * Create a tile hash context.
+ *
+ * @return Pointer to the context, or NULL on error.
+ */
+vsource_hash_t *
+vsource_hash_create() {
+	vsource_hash_t *h;
+	pthread_once(&vhash_once, vhash_init);
+	if((h = (vsource_hash_t*) calloc(1, sizeof(vsource_hash_t))) == NULL)
+		return NULL;
+	return h;
+}
+
+/**
+ * Release a tile hash context.
+ *
+ * @param h [in] The context.
+ */
+void
+vsource_hash_release(vsource_hash_t *h) {
+	if(h == NULL)
+		return;
+	if(h->hash != NULL)
+		free(h->hash);
+	if(h->acc != NULL)
+		free(h->acc);
+	free(h);
+	return;
+}
+
+/**
+ * Forget the previous image: the next image is reported as changed.
+ *
+ * @param h [in] The context.
+ */
+void
+vsource_hash_reset(vsource_hash_t *h) {
+	if(h != NULL)
+		h->valid = 0;
+	return;
+}
+
+/**
+ * Hash an image and compare it with the previous image.
+ *
+ * @param h [in] The context.
+ * @param image [in] Pointer to the first row of the image.
+ * @param rowbytes [in] Bytes per row to compare, e.g., width * 4 for RGBA.
+ * @param height [in] Number of rows.
+ * @param stride [in] Bytes between the beginnings of two rows.
+ * @return Number of changed tiles: 0 if the image is unchanged,
+ *	or -1 on error. All tiles are changed for the first image
+ *	and when the image size changes.
+ */
+int
+vsource_hash_update(vsource_hash_t *h, const unsigned char *image, int rowbytes, int height, int stride) {
+	unsigned long long hash;
+	unsigned int *acc;
+	int tx, ty, y, y1, i, changed = 0;
+	//
+	if(h == NULL || image == NULL || rowbytes <= 0 || height <= 0)
+		return -1;
+	if(h->rowbytes != rowbytes || h->height != height || h->hash == NULL) {
+		if(h->hash != NULL)	free(h->hash);
+		if(h->acc != NULL)	free(h->acc);
+		h->cols = (rowbytes + VSOURCE_HASH_TILE_BYTES - 1) / VSOURCE_HASH_TILE_BYTES;
+		h->rows = (height + VSOURCE_HASH_TILE_ROWS - 1) / VSOURCE_HASH_TILE_ROWS;
+		h->hash = (unsigned long long*) malloc(sizeof(unsigned long long) * h->cols * h->rows);
+		h->acc = (unsigned int*) malloc(sizeof(unsigned int) * VHASH_ACC * h->cols);
+		if(h->hash == NULL || h->acc == NULL) {
+			ga_error("video source: cannot allocate tile hashes.\n");
+			h->rowbytes = h->height = 0;
+			return -1;
+		}
+		h->rowbytes = rowbytes;
+		h->height = height;
+		h->valid = 0;
+	}
+	//
+	for(ty = 0; ty < h->rows; ty++) {
+		bzero(h->acc, sizeof(unsigned int) * VHASH_ACC * h->cols);
+		y1 = (ty + 1) * VSOURCE_HASH_TILE_ROWS;
+		if(y1 > height)
+			y1 = height;
+		for(y = ty * VSOURCE_HASH_TILE_ROWS; y < y1; y++)
+			vhash_row(image + (long long) y * stride, rowbytes, h->acc);
+		for(tx = 0, acc = h->acc; tx < h->cols; tx++, acc += VHASH_ACC) {
+			// 64-bit FNV-1a over the sums
+			hash = 14695981039346656037ULL;
+			for(i = 0; i < VHASH_ACC; i++)
+				hash = (hash ^ acc[i]) * 1099511628211ULL;
+			if(h->valid == 0 || h->hash[ty * h->cols + tx] != hash)
+				changed++;
+			h->hash[ty * h->cols + tx] = hash;
+		}
+	}
+	h->valid = 1;
+	return changed;
+}
@@ -36,6 +36,7 @@
 #include "ga-conf.h"
 #include "ga-avcodec.h"
 #include "ga-crc.h"
+#include "ga-atomic.h"
 
 /**< Video buffer allocation alignment: should be 2^n */
 #define	VSOURCE_ALIGNMENT	16
@@ -57,25 +58,39 @@
 static int gChannels;		/**< Total number of video channels */
 static vsource_t gVsource[VIDEO_SOURCE_CHANNEL_MAX];	/**< Video source */
 static dpipe_t *gPipe[VIDEO_SOURCE_CHANNEL_MAX];	/**< Video pipeline */
+static volatile int gRefresh[VIDEO_SOURCE_CHANNEL_MAX];	/**< Full frame requested */
+static pthread_mutex_t gOutMutex = PTHREAD_MUTEX_INITIALIZER;	/**< Protects output resolutions changed at runtime */
 
 /**
- * Initialize a video frame
+ * Video source setup published in the user data area of a shared memory pipe.
+ */
+typedef struct vsource_shminfo_s {
+	int channel;		/**< Channel Id of the video source */
+	volatile int max_width;	/**< Maximum video frame width,
+				 * non-zero if the setup has been published */
+	int max_height;		/**< Maximum video frame height */
+	int max_stride;		/**< Maximum video frame stride */
+	int curr_width;		/**< Current video frame width */
+	int curr_height;	/**< Current video frame height */
+	int curr_stride;	/**< Current video frame stride */
+	int out_width;		/**< Video output width */
+	int out_height;		/**< Video output height */
+	int out_stride;		/**< Video output stride */
+	int out_pixelformat;	/**< Video output pixel format */
+}	vsource_shminfo_t;
+
+/**
+ * Initialize a video frame. This is an internal function.
  *
  * @param channel [in] The channel Id of the video frame.
  * @param frame [in] Pointer to an allocated video frame structure.
+ * @param extbuf [in] Non-zero if the frame buffer is provided later by
+ *	the video source: \a imgbuf is set to NULL and only
+ *	\em sizeof(vsource_frame_t) bytes are required for \a frame.
  * @return Return the same pointer as \a frame, unless an incorrect configuration is given.
- *
- * Note that video frame data is stored right after a video frame structure.
- * So the size of allocated video frame structure must be at least:
- * \em sizeof(vsource_frame_t)
- * + \em video-source-max-stride * \em video-source-max-height
- * + \em VSOURCE_ALIGNMENT.
- *
- * \a imgbufsize will be set to \em video-source-max-stride * \em video-source-max-height,
- * and \a imgbuf is pointed to an aligned memory address.
  */
-vsource_frame_t *
-vsource_frame_init(int channel, vsource_frame_t *frame) {
+static vsource_frame_t *
+vsource_frame_init_internal(int channel, vsource_frame_t *frame, int extbuf) {
 	int i;
 	vsource_t *vs;
 	//
@@ -93,6 +108,10 @@ vsource_frame_init(int channel, vsource_frame_t *frame) {
 	}
 	frame->maxstride = vs->max_stride;
 	frame->imgbufsize = vs->max_height * vs->max_stride;
+	if(extbuf != 0) {
+		frame->imgbuf = NULL;
+		return frame;
+	}
 	frame->imgbuf = ((unsigned char *) frame) + sizeof(vsource_frame_t);
 	frame->imgbuf += ga_alignment(frame->imgbuf, VSOURCE_ALIGNMENT);
 	//ga_error("XXX: frame=%p, imgbuf=%p, sizeof(vframe)=%d, bzero(%d)\n",
@@ -101,6 +120,44 @@ vsource_frame_init(int channel, vsource_frame_t *frame) {
 	return frame;
 }
 
+/**
+ * Initialize a video frame
+ *
+ * @param channel [in] The channel Id of the video frame.
+ * @param frame [in] Pointer to an allocated video frame structure.
+ * @return Return the same pointer as \a frame, unless an incorrect configuration is given.
+ *
+ * Note that video frame data is stored right after a video frame structure.
+ * So the size of allocated video frame structure must be at least:
+ * \em sizeof(vsource_frame_t)
+ * + \em video-source-max-stride * \em video-source-max-height
+ * + \em VSOURCE_ALIGNMENT.
+ *
+ * \a imgbufsize will be set to \em video-source-max-stride * \em video-source-max-height,
+ * and \a imgbuf is pointed to an aligned memory address.
+ */
+vsource_frame_t *
+vsource_frame_init(int channel, vsource_frame_t *frame) {
+	return vsource_frame_init_internal(channel, frame, 0);
+}
+
+/**
+ * Fix the video frame buffer pointer of a frame in a shared memory pipe.
+ *
+ * @param dpipe [in] The shared memory pipe.
+ * @param buffer [in] The pipe buffer that contains the video frame.
+ *
+ * The frame is initialized by the process that creates the pipe,
+ * so \a imgbuf has to be recomputed in the address space of this process.
+ */
+static void
+vsource_frame_localize(dpipe_t *dpipe, dpipe_buffer_t *buffer) {
+	vsource_frame_t *frame = (vsource_frame_t*) buffer->pointer;
+	frame->imgbuf = ((unsigned char *) frame) + sizeof(vsource_frame_t);
+	frame->imgbuf += ga_alignment(frame->imgbuf, VSOURCE_ALIGNMENT);
+	return;
+}
+
 /**
  * Release a video frame data structure.
  *
@@ -116,6 +173,8 @@ vsource_frame_release(vsource_frame_t *frame) {
  *
  * @param src [in] Pointer to a source video frame.
  * @param dst [in] Pointer to an initialized destination video frame.
+ *
+ * To publish a frame to multiple pipes without copying, use dpipe_share().
  */
 void
 vsource_dup_frame(vsource_frame_t *src, vsource_frame_t *dst) {
@@ -124,15 +183,119 @@ vsource_dup_frame(vsource_frame_t *src, vsource_frame_t *dst) {
 	dst->pixelformat = src->pixelformat;
 	for(j = 0; j < VIDEO_SOURCE_MAX_STRIDE; j++) {
 		dst->linesize[j] = src->linesize[j];
+		dst->planeoffset[j] = src->planeoffset[j];
 	}
 	dst->realwidth = src->realwidth;
 	dst->realheight = src->realheight;
 	dst->realstride = src->realstride;
+	dst->flipped = src->flipped;
+	dst->unchanged = src->unchanged;
+	dst->dirtycount = src->dirtycount;
+	for(j = 0; j < src->dirtycount; j++)
+		dst->dirty[j] = src->dirty[j];
 	dst->realsize = src->realsize;
 	bcopy(src->imgbuf, dst->imgbuf, src->realstride * src->realheight/*dst->imgbufsize*/);
 	return;
 }
 
+/**
+ * Setup the pixel format, the size, and the plane layout of a video frame.
+ *
+ * @param frame [in] Pointer to an initialized video frame.
+ * @param pixelformat [in] RGBA, BGRA, YUV420P, or NV12.
+ * @param width [in] Frame width.
+ * @param height [in] Frame height.
+ * @return 0 on success, or -1 if the format is not supported
+ *	or the frame buffer is too small.
+ *
+ * Planes are packed without padding: YUV420P has Y, U, and V planes,
+ * and NV12 has a Y plane and an interleaved UV plane.
+ */
+int
+vsource_frame_setup(vsource_frame_t *frame, AVPixelFormat pixelformat, int width, int height) {
+	int i, size;
+	//
+	for(i = 0; i < VIDEO_SOURCE_MAX_STRIDE; i++) {
+		frame->linesize[i] = 0;
+		frame->planeoffset[i] = 0;
+	}
+	switch(pixelformat) {
+	case AV_PIX_FMT_RGBA:
+	case AV_PIX_FMT_BGRA:
+		frame->linesize[0] = width * 4;
+		size = height * width * 4;
+		break;
+	case AV_PIX_FMT_YUV420P:
+		frame->linesize[0] = width;
+		frame->linesize[1] = width >> 1;
+		frame->linesize[2] = width >> 1;
+		frame->planeoffset[1] = width * height;
+		frame->planeoffset[2] = frame->planeoffset[1] + (width >> 1) * (height >> 1);
+		size = width * height * 3 / 2;
+		break;
+	case AV_PIX_FMT_NV12:
+		frame->linesize[0] = width;
+		frame->linesize[1] = width;
+		frame->planeoffset[1] = width * height;
+		size = width * height * 3 / 2;
+		break;
+	default:
+		ga_error("video source: unsupported frame pixel format (%d).\n", pixelformat);
+		return -1;
+	}
+	if(size > frame->imgbufsize) {
+		ga_error("video source: frame %dx%d[%d] exceeds the buffer size (%d > %d).\n",
+			width, height, pixelformat, size, frame->imgbufsize);
+		return -1;
+	}
+	frame->pixelformat = pixelformat;
+	frame->realwidth = width;
+	frame->realheight = height;
+	frame->realstride = frame->linesize[0];
+	frame->realsize = size;
+	frame->flipped = 0;
+	frame->unchanged = 0;
+	frame->dirtycount = 0;
+	return 0;
+}
+
+/**
+ * Get the plane pointers of a video frame.
+ *
+ * @param frame [in] Pointer to the video frame.
+ * @param planes [out] Pointers to the planes, at least \em VIDEO_SOURCE_MAX_STRIDE entries.
+ * @return Number of planes: 1 for RGBA and BGRA, 2 for NV12, and 3 for YUV420P.
+ */
+int
+vsource_frame_planes(vsource_frame_t *frame, unsigned char **planes) {
+	int i, n;
+	//
+	switch(frame->pixelformat) {
+	case AV_PIX_FMT_YUV420P:	n = 3; break;
+	case AV_PIX_FMT_NV12:		n = 2; break;
+	default:			n = 1; break;
+	}
+	for(i = 0; i < VIDEO_SOURCE_MAX_STRIDE; i++) {
+		planes[i] = i < n ? frame->imgbuf + frame->planeoffset[i] : NULL;
+	}
+	return n;
+}
+
+/**
+ * Parse the name of a video pixel format.
+ *
+ * @param name [in] The name: rgba, bgra, yuv420p, or nv12.
+ * @return The pixel format, or AV_PIX_FMT_NONE if it is unknown.
+ */
+AVPixelFormat
+vsource_parse_pixelformat(const char *name) {
+	if(strcasecmp(name, "rgba") == 0)	return AV_PIX_FMT_RGBA;
+	if(strcasecmp(name, "bgra") == 0)	return AV_PIX_FMT_BGRA;
+	if(strcasecmp(name, "yuv420p") == 0)	return AV_PIX_FMT_YUV420P;
+	if(strcasecmp(name, "nv12") == 0)	return AV_PIX_FMT_NV12;
+	return AV_PIX_FMT_NONE;
+}
+
 /**
  * Color code colors based on RGBA color.
  * The order is: blak blue green, red, yellow, magenta, cyan, and white */
@@ -305,6 +468,7 @@ vsource_embed_yuv_code(vsource_frame_t *frame, unsigned int value) {
 	unsigned char *srcU = srcY + vsource_colorcode_total_width;
 	unsigned char *srcV = srcU + (vsource_colorcode_total_width>>1);
 	unsigned char *dstY, *dstU, *dstV;
+	unsigned char *planes[VIDEO_SOURCE_MAX_STRIDE];
 	// save code-timestamp mapping
 	struct timeval ccodets;
 	if(savefp_ccodets != NULL) {
@@ -356,20 +520,30 @@ vsource_embed_yuv_code(vsource_frame_t *frame, unsigned int value) {
 	//// fill color code line
 	height = frame->realheight < vsource_colorcode_height ?
 			frame->realheight : vsource_colorcode_height;
-	dstY = frame->imgbuf;
-	dstU = dstY + frame->linesize[0] * (frame->realheight);
-	dstV = dstU + frame->linesize[1] * (frame->realheight >> 1);
+	vsource_frame_planes(frame, planes);
+	dstY = planes[0];
+	dstU = planes[1];
+	dstV = planes[2];
 	//
 	for(i = 0; i < height; i++) {
 		bcopy(srcY, dstY, vsource_colorcode_total_width);
 		dstY += frame->linesize[0];
 	}
 	height >>= 1;
+	width = vsource_colorcode_total_width>>1;
 	for(i = 0; i < height; i++) {
-		bcopy(srcU, dstU, vsource_colorcode_total_width>>1);
-		bcopy(srcV, dstV, vsource_colorcode_total_width>>1);
+		if(frame->pixelformat == AV_PIX_FMT_NV12) {
+			// interleaved UV
+			for(j = 0; j < width; j++) {
+				dstU[j*2] = srcU[j];
+				dstU[j*2+1] = srcV[j];
+			}
+		} else {
+			bcopy(srcU, dstU, width);
+			bcopy(srcV, dstV, width);
+			dstV += frame->linesize[2];
+		}
 		dstU += frame->linesize[1];
-		dstV += frame->linesize[2];
 	}
 	//
 	return;
@@ -476,7 +650,8 @@ vsource_embed_colorcode(vsource_frame_t *frame, unsigned int value) {
 		return;
 	if(frame->realwidth < vsource_colorcode_total_width)
 		return;
-	if(frame->pixelformat == AV_PIX_FMT_YUV420P) {
+	if(frame->pixelformat == AV_PIX_FMT_YUV420P
+	|| frame->pixelformat == AV_PIX_FMT_NV12) {
 		vsource_embed_yuv_code(frame, value);
 	} else if(frame->pixelformat == AV_PIX_FMT_RGBA) {
 		vsource_embed_rgba_code(frame, value, rgbacolor);
@@ -669,6 +844,108 @@ video_source_out_stride(int channel) {
 	return vs == NULL ? -1 : vs->out_stride;
 }
 
+/**
+ * Get the output resolution of a video source.
+ *
+ * @param channel [in] The channel id of the video source.
+ * @param width [out] The output width.
+ * @param height [out] The output height.
+ * @return 0 on success, or -1 on error.
+ *
+ * Unlike video_source_out_width() and video_source_out_height(),
+ * the width and height are read consistently while the resolution
+ * is being changed by video_source_set_out_size().
+ */
+int
+video_source_out_size(int channel, int *width, int *height) {
+	vsource_t *vs = video_source(channel);
+	if(vs == NULL)
+		return -1;
+	pthread_mutex_lock(&gOutMutex);
+	*width = vs->out_width;
+	*height = vs->out_height;
+	pthread_mutex_unlock(&gOutMutex);
+	return 0;
+}
+
+/**
+ * Change the output resolution of a video source at runtime.
+ *
+ * @param channel [in] The channel id of the video source.
+ * @param width [in] The new output width: a multiple of 4, up to the maximum width.
+ * @param height [in] The new output height: a multiple of 4, up to the maximum height.
+ * @return 0 on success, or -1 on error.
+ *
+ * Filters convert frames into the new resolution from the next frame,
+ * and encoders follow the size of the frames they receive.
+ * Frame buffers are allocated for the maximum resolution,
+ * so no buffer has to be reallocated.
+ */
+int
+video_source_set_out_size(int channel, int width, int height) {
+	vsource_t *vs = video_source(channel);
+	if(vs == NULL)
+		return -1;
+	if(width <= 0 || height <= 0 || width % 4 != 0 || height % 4 != 0
+	|| width > vs->max_width || height > vs->max_height) {
+		ga_error("video source: unsupported output resolution %dx%d (max %dx%d).\n",
+			width, height, vs->max_width, vs->max_height);
+		return -1;
+	}
+	pthread_mutex_lock(&gOutMutex);
+	vs->out_width = width;
+	vs->out_height = height;
+	vs->out_stride = width * 4;
+	pthread_mutex_unlock(&gOutMutex);
+	ga_error("video source: channel %d output resolution changed to %dx%d.\n",
+		channel, width, height);
+	return 0;
+}
+
+/**
+ * Get the output pixel format of a video source.
+ *
+ * @param channel [in] The channel id of the video source.
+ * @return The output pixel format (YUV420P or NV12), or AV_PIX_FMT_NONE on error.
+ *
+ * The format is read from the \em output-pixelformat parameter.
+ * Filters produce frames in this format, and encoders consume them.
+ */
+AVPixelFormat
+video_source_out_pixelformat(int channel) {
+	vsource_t *vs = video_source(channel);
+	return vs == NULL ? AV_PIX_FMT_NONE : vs->out_pixelformat;
+}
+
+/**
+ * Request the video source to deliver the next frame in full.
+ *
+ * @param channel [in] The channel id.
+ *
+ * Sources that skip unchanged frames mark the next frame as changed,
+ * e.g., when the encoder is requested to encode a keyframe.
+ */
+void
+video_source_request_refresh(int channel) {
+	if(channel < 0 || channel >= VIDEO_SOURCE_CHANNEL_MAX)
+		return;
+	ga_atomic_store(&gRefresh[channel], 1);
+}
+
+/**
+ * Check and clear a pending refresh request.
+ *
+ * @param channel [in] The channel id.
+ * @return Non-zero if video_source_request_refresh() has been called
+ *	since the last check.
+ */
+int
+video_source_refresh_requested(int channel) {
+	if(channel < 0 || channel >= VIDEO_SOURCE_CHANNEL_MAX)
+		return 0;
+	return ga_atomic_cas(&gRefresh[channel], 1, 0);
+}
+
 /**
   * Return the maximum memory size to store a frame (including size for alignment)
   *
@@ -705,6 +982,11 @@ video_source_setup_ex(vsource_config_t *config, int nConfig) {
 	int idx;
 	int maxres[2] = { 0, 0 };
 	int outres[2] = { 0, 0 };
+	int pipemode = DPIPE_MODE_LOCKED;
+	int pipepolicy = DPIPE_POLICY_FIFO;
+	int pipedepth;
+	AVPixelFormat outfmt = AV_PIX_FMT_YUV420P;
+	char buf[64];
 	//
 	if(config==NULL || nConfig <=0 || nConfig > VIDEO_SOURCE_CHANNEL_MAX) {
 		ga_error("video source: invalid video source configuration request=%d; MAX=%d; config=%p\n",
@@ -718,6 +1000,26 @@ video_source_setup_ex(vsource_config_t *config, int nConfig) {
 	if(ga_conf_readints("output-resolution", outres, 2) != 2) {
 		outres[0] = outres[1] = 0;
 	}
+	if(ga_conf_readv("output-pixelformat", buf, sizeof(buf)) != NULL) {
+		outfmt = vsource_parse_pixelformat(buf);
+		if(outfmt != AV_PIX_FMT_YUV420P && outfmt != AV_PIX_FMT_NV12) {
+			ga_error("video source: unsupported output-pixelformat '%s', use yuv420p.\n", buf);
+			outfmt = AV_PIX_FMT_YUV420P;
+		}
+	}
+	if(ga_conf_readv("video-pipe-mode", buf, sizeof(buf)) != NULL) {
+		if((pipemode = dpipe_parse_mode(buf)) < 0) {
+			ga_error("video source: unknown video-pipe-mode '%s', use default.\n", buf);
+			pipemode = DPIPE_MODE_LOCKED;
+		}
+	}
+	if(ga_conf_readv("video-pipe-policy", buf, sizeof(buf)) != NULL) {
+		if((pipepolicy = dpipe_parse_policy(buf)) < 0) {
+			ga_error("video source: unknown video-pipe-policy '%s', use default.\n", buf);
+			pipepolicy = DPIPE_POLICY_FIFO;
+		}
+	}
+	pipedepth = ga_conf_readint("video-pipe-depth");
 	//
 	for(idx = 0; idx < nConfig; idx++) {
 		vsource_t *vs = &gVsource[idx];
@@ -746,15 +1048,41 @@ video_source_setup_ex(vsource_config_t *config, int nConfig) {
 			vs->out_height  = vs->curr_height;
 			vs->out_stride  = vs->curr_stride;
 		}
+		vs->out_pixelformat = outfmt;
+		vs->extbuf      = config[idx].extbuf;
+		if(vs->extbuf != 0 && pipemode == DPIPE_MODE_SHM) {
+			ga_error("video source: frames of a shared memory pipe must be in the pipe.\n");
+			vs->extbuf = 0;
+		}
 		// create pipe
-		gPipe[idx] = dpipe_create(idx, pipename, VIDEO_SOURCE_POOLSIZE,
-				sizeof(vsource_frame_t) + vs->max_height * vs->max_stride + VSOURCE_ALIGNMENT);
+		gPipe[idx] = dpipe_create_ex(idx, pipename, VIDEO_SOURCE_POOLSIZE,
+				sizeof(vsource_frame_t) + (vs->extbuf ? 0 : vs->max_height * vs->max_stride) + VSOURCE_ALIGNMENT,
+				pipemode);
 		if(gPipe[idx] == NULL) {
 			ga_error("video source: init pipeline failed.\n");
 			return -1;
 		}
+		if(pipepolicy != DPIPE_POLICY_FIFO)
+			dpipe_set_policy(gPipe[idx], pipepolicy, pipedepth);
+		if(pipemode == DPIPE_MODE_SHM) {
+			vsource_shminfo_t *info;
+			info = (vsource_shminfo_t*) dpipe_shm_userdata(gPipe[idx], NULL);
+			info->channel     = vs->channel;
+			info->max_height  = vs->max_height;
+			info->max_stride  = vs->max_stride;
+			info->curr_width  = vs->curr_width;
+			info->curr_height = vs->curr_height;
+			info->curr_stride = vs->curr_stride;
+			info->out_width   = vs->out_width;
+			info->out_height  = vs->out_height;
+			info->out_stride  = vs->out_stride;
+			info->out_pixelformat = vs->out_pixelformat;
+			// max_width is the last one: consumers wait for it
+			ga_atomic_store(&info->max_width, vs->max_width);
+			dpipe_set_localize(gPipe[idx], vsource_frame_localize);
+		}
 		for(data = gPipe[idx]->in; data != NULL; data = data->next) {
-			if(vsource_frame_init(idx, (vsource_frame_t*) data->pointer) == NULL) {
+			if(vsource_frame_init_internal(idx, (vsource_frame_t*) data->pointer, vs->extbuf) == NULL) {
 				ga_error("video source: init faile failed.\n");
 				return -1;
 			}
@@ -770,6 +1098,110 @@ video_source_setup_ex(vsource_config_t *config, int nConfig) {
 	return 0;
 }
 
+/**
+ * Attach to a video source pipe. This is an internal function.
+ *
+ * @param channel [in] The channel id of the video source.
+ * @param pipename [in] The pipeline name of the video source.
+ * @return Pointer to the attached pipe, or NULL if the pipe is not ready.
+ *
+ * The creator publishes the video source setup right after the pipe is
+ * created, so a pipe without the setup is treated as not ready.
+ */
+static dpipe_t *
+video_source_attach_pipe(int channel, const char *pipename) {
+	dpipe_t *pipe;
+	vsource_shminfo_t *info;
+	if((pipe = dpipe_attach(channel, pipename)) == NULL)
+		return NULL;
+	info = (vsource_shminfo_t*) dpipe_shm_userdata(pipe, NULL);
+	if(ga_atomic_load(&info->max_width) == 0) {
+		dpipe_destroy(pipe);
+		return NULL;
+	}
+	return pipe;
+}
+
+/**
+ * Attach to video sources published by another process.
+ *
+ * @param timeout [in] Seconds to wait for the first video source,
+ *	or zero (or a negative value) to wait forever.
+ * @return 0 on success, or -1 on error.
+ *
+ * The video sources must be created by video_source_setup_ex()
+ * with \em video-pipe-mode set to \em shm, e.g., by a hooked game.
+ * The video source setup of each channel is read from the shared memory
+ * pipe, and the attached pipes are registered with the default pipe names.
+ * The \em video-pipe-policy and \em video-pipe-depth parameters
+ * apply to the attached pipes as well.
+ */
+int
+video_source_attach(int timeout) {
+	int idx;
+	int pipepolicy = DPIPE_POLICY_FIFO;
+	int pipedepth;
+	char buf[64];
+	//
+	if(ga_conf_readv("video-pipe-policy", buf, sizeof(buf)) != NULL) {
+		if((pipepolicy = dpipe_parse_policy(buf)) < 0) {
+			ga_error("video source: unknown video-pipe-policy '%s', use default.\n", buf);
+			pipepolicy = DPIPE_POLICY_FIFO;
+		}
+	}
+	pipedepth = ga_conf_readint("video-pipe-depth");
+	//
+	for(idx = 0; idx < VIDEO_SOURCE_CHANNEL_MAX; idx++) {
+		vsource_t *vs = &gVsource[idx];
+		vsource_shminfo_t *info;
+		char pipename[64];
+		//
+		snprintf(pipename, sizeof(pipename), VIDEO_SOURCE_PIPEFORMAT, idx);
+		if((gPipe[idx] = video_source_attach_pipe(idx, pipename)) == NULL && idx == 0) {
+			int waited = 0;
+			ga_error("video source: waiting for %s ...\n", pipename);
+			while((gPipe[idx] = video_source_attach_pipe(idx, pipename)) == NULL) {
+				if(timeout > 0 && ++waited >= timeout) {
+					ga_error("video source: attach %s timed out.\n", pipename);
+					return -1;
+				}
+				ga_usleep(1000000, NULL);
+			}
+		}
+		if(gPipe[idx] == NULL)
+			break;
+		info = (vsource_shminfo_t*) dpipe_shm_userdata(gPipe[idx], NULL);
+		//
+		bzero(vs, sizeof(vsource_t));
+		vs->channel     = idx;
+		if(video_source_add_pipename_internal(vs, pipename) == NULL) {
+			ga_error("video source: setup pipename failed (%s).\n", pipename);
+			return -1;
+		}
+		vs->max_width   = info->max_width;
+		vs->max_height  = info->max_height;
+		vs->max_stride  = info->max_stride;
+		vs->curr_width  = info->curr_width;
+		vs->curr_height = info->curr_height;
+		vs->curr_stride = info->curr_stride;
+		vs->out_width   = info->out_width;
+		vs->out_height  = info->out_height;
+		vs->out_stride  = info->out_stride;
+		vs->out_pixelformat = (AVPixelFormat) info->out_pixelformat;
+		if(pipepolicy != DPIPE_POLICY_FIFO)
+			dpipe_set_policy(gPipe[idx], pipepolicy, pipedepth);
+		dpipe_set_localize(gPipe[idx], vsource_frame_localize);
+		//
+		ga_error("video-source: %s attached max-curr-out = (%dx%d)-(%dx%d)-(%dx%d)\n",
+			pipename, vs->max_width, vs->max_height,
+			vs->curr_width, vs->curr_height, vs->out_width, vs->out_height);
+	}
+	//
+	gChannels = idx;
+	//
+	return 0;
+}
+
 /**
  * Setup up a one-channel only video source
  *
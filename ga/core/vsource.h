@@ -46,6 +46,16 @@
 #define	VIDEO_SOURCE_PIPEFORMAT		"video-%d"
 /** Define the default video source pipe pool size (frames in the pipe) */
 #define	VIDEO_SOURCE_POOLSIZE		8
+/** Define the maximum number of dirty rectangles attached to a frame */
+#define	VIDEO_SOURCE_MAX_DIRTY		16
+
+/**
+ * A rectangle in a video frame.
+ */
+typedef struct vsource_rect_s {
+	int x, y;		/**< Top-left corner */
+	int width, height;	/**< Size of the rectangle */
+}	vsource_rect_t;
 
 /**
  * Data structure to store a video frame in RGBA or YUV420 format.
@@ -57,15 +67,28 @@ typedef struct vsource_frame_s {
 				 * This is actually a sequence number of
 				 * captured video frame.  */
 	AVPixelFormat pixelformat;/**< pixel format, currently support
-				 * RGBA, BGRA, or YUV420P
+				 * RGBA, BGRA, YUV420P, or NV12
 				 * Note: current use values defined in ffmpeg */
 	int linesize[VIDEO_SOURCE_MAX_STRIDE];	/**< strides
-				 * for each video plane (YUV420P only). */
+				 * for each video plane (YUV420P and NV12). */
+	int planeoffset[VIDEO_SOURCE_MAX_STRIDE];	/**< Offset of each
+				 * video plane from \a imgbuf, see vsource_frame_planes().
+				 * Offsets instead of pointers work with shared memory pipes. */
 	int realwidth;		/**< Actual width of the video frame */
 	int realheight;		/**< Actual height of the video frame */
 	int realstride;		/**< stride for RGBA and BGRA video frame */
+	int flipped;		/**< Non-zero if RGBA or BGRA rows are stored
+				 * bottom-up, e.g., by glReadPixels():
+				 * the first row in \a imgbuf is the bottom row */
+	int unchanged;		/**< Non-zero if the image is identical to
+				 * the previous frame of the source: the frame
+				 * does not have to be converted and encoded */
+	int dirtycount;		/**< Number of rectangles in \a dirty,
+				 * or 0 if unknown: the whole frame may have changed */
+	vsource_rect_t dirty[VIDEO_SOURCE_MAX_DIRTY];	/**< Regions changed
+				 * since the previous frame of the source */
 	int realsize;		/**< Total size of the video frame data */
-	struct timeval timestamp;	/**< Captured timestamp */
+	long long timestamp;	/**< Captured time in nano seconds, see ga_clock_ns() */
 	// internal data - should not change after initialized
 	int maxstride;		/**< */
 	int imgbufsize;		/**< Allocated video frame buffer size */
@@ -80,6 +103,24 @@ typedef struct vsource_frame_s {
 				 * XXX: NOT USED NOW. */
 }	vsource_frame_t;
 
+/** Width of a tile compared by \a vsource_hash_t, in bytes */
+#define	VSOURCE_HASH_TILE_BYTES		256
+/** Height of a tile compared by \a vsource_hash_t, in rows */
+#define	VSOURCE_HASH_TILE_ROWS		32
+
+/**
+ * Tile hashes of the previous image, to detect unchanged frames.
+ */
+typedef struct vsource_hash_s {
+	int rowbytes;		/**< Bytes per row of the image */
+	int height;		/**< Number of rows of the image */
+	int cols;		/**< Number of tile columns */
+	int rows;		/**< Number of tile rows */
+	int valid;		/**< Non-zero if \a hash has been computed */
+	unsigned long long *hash;	/**< Hashes of tiles, in row-major order */
+	unsigned int *acc;	/**< Work space: sums of a row of tiles */
+}	vsource_hash_t;
+
 /**
  * Data structure to setup a video configuration.
  */
@@ -90,6 +131,9 @@ typedef struct vsource_config_s {
 				 * should be the value of height * 4,
 				 * because the captured video should be
 				 * in RGBA or BGRA format */
+	int extbuf;		/**< Non-zero if frame buffers are provided
+				 * by the video source: frames in the pipe
+				 * are created with \a imgbuf set to NULL */
 }	vsource_config_t;
 
 /**
@@ -119,12 +163,21 @@ typedef struct vsource_s {
 	int out_width;		/**< Video output width */
 	int out_height;		/**< Video output height */
 	int out_stride;		/**< Video output stride: should be at least out_height * 4 */
+	AVPixelFormat out_pixelformat;	/**< Video output pixel format: YUV420P or NV12 */
+	int extbuf;		/**< Frame buffers are provided by the video source */
 	//
 }	vsource_t;
 
 EXPORT vsource_frame_t * vsource_frame_init(int channel, vsource_frame_t *frame);
 EXPORT void vsource_frame_release(vsource_frame_t *frame);
 EXPORT void vsource_dup_frame(vsource_frame_t *src, vsource_frame_t *dst);
+EXPORT int vsource_frame_setup(vsource_frame_t *frame, AVPixelFormat pixelformat, int width, int height);
+EXPORT int vsource_frame_planes(vsource_frame_t *frame, unsigned char **planes);
+EXPORT AVPixelFormat vsource_parse_pixelformat(const char *name);
+EXPORT vsource_hash_t * vsource_hash_create();
+EXPORT void vsource_hash_release(vsource_hash_t *h);
+EXPORT void vsource_hash_reset(vsource_hash_t *h);
+EXPORT int vsource_hash_update(vsource_hash_t *h, const unsigned char *image, int rowbytes, int height, int stride);
 EXPORT int vsource_embed_colorcode_init(int RGBmode);
 EXPORT void vsource_embed_colorcode_reset();
 EXPORT void vsource_embed_colorcode_inc(vsource_frame_t *frame);
@@ -144,9 +197,15 @@ EXPORT int video_source_curr_stride(int channel);
 EXPORT int video_source_out_width(int channel);
 EXPORT int video_source_out_height(int channel);
 EXPORT int video_source_out_stride(int channel);
+EXPORT int video_source_out_size(int channel, int *width, int *height);
+EXPORT int video_source_set_out_size(int channel, int width, int height);
+EXPORT AVPixelFormat video_source_out_pixelformat(int channel);
+EXPORT void video_source_request_refresh(int channel);
+EXPORT int video_source_refresh_requested(int channel);
 EXPORT int video_source_mem_size(int channel);
 
 EXPORT int video_source_setup_ex(vsource_config_t *config, int nConfig);
 EXPORT int video_source_setup(int curr_width, int curr_height, int curr_stride);
+EXPORT int video_source_attach(int timeout);
 
 #endif
@@ -209,12 +209,7 @@ aencoder_threadproc(void *arg) {
 	int nsamples, samplebytes, maxsamples, samplesize;
 	int offset;
 	// for a/v sync
-#ifdef WIN32
-	LARGE_INTEGER baseT, currT, freq;
-#else
-	struct timeval baseT, currT;
-#endif
-	struct timeval tv;
+	long long baseT = 0LL, currT, ptime;
 	long long pts = -1LL, newpts = 0LL, ptsOffset = 0LL, ptsSync = 0LL;
 	//
 	audio_buffer_t *ab = NULL;
@@ -259,10 +254,6 @@ aencoder_threadproc(void *arg) {
 		audio_source_chunkbytes(),	//audio->chunk_bytes
 		encoder->delay);
 	//
-#ifdef WIN32
-	QueryPerformanceFrequency(&freq);
-#endif
-	//
 	while(aencoder_started != 0 && encoder_running() > 0) {
 		//
 		if(buffer_purged == 0) {
@@ -271,27 +262,19 @@ aencoder_threadproc(void *arg) {
 		}
 		// read audio frames
 		r = audio_source_buffer_read(ab, samples + samplebytes, maxsamples - nsamples);
-		gettimeofday(&tv, NULL);
+		ptime = ga_clock_ns();
 		if(r <= 0) {
 			usleep(1000);
 			continue;
 		}
-#ifdef WIN32
-		QueryPerformanceCounter(&currT);
-#else
-		gettimeofday(&currT, NULL);
-#endif
+		currT = ptime;
 		if(pts == -1LL) {
 			baseT = currT;
 			ptsSync = encoder_pts_sync(rtspconf->audio_samplerate);
 			pts = newpts = ptsSync;
 			ptsOffset = r;
 		} else {
-#ifdef WIN32
-			newpts = ptsSync + pcdiff_us(currT, baseT, freq) * rtspconf->audio_samplerate / 1000000LL;
-#else
-			newpts = ptsSync + tvdiff_us(&currT, &baseT) * rtspconf->audio_samplerate / 1000000LL;
-#endif
+			newpts = ptsSync + (currT - baseT) / 1000LL * rtspconf->audio_samplerate / 1000000LL;
 			newpts -= r;
 			newpts -= ptsOffset;
 		}
@@ -334,7 +317,7 @@ aencoder_threadproc(void *arg) {
 				ga_error("DEBUG: avcodec_fill_audio_frame failed.\n");
 			}
 			snd_in->pts = pts;
-			encoder_pts_put(rtp_id, pts, &tv);
+			encoder_pts_put(rtp_id, pts, ptime);
 			//
 			pkt->data = buf;
 			pkt->size = bufsize;
@@ -359,14 +342,14 @@ aencoder_threadproc(void *arg) {
 				av_freep(snd_in->extended_data);
 			pkt->stream_index = 0;
 			//
-			if(encoder_ptv_get(rtp_id, pkt->pts, &tv, rtspconf->audio_samplerate) == NULL) {
-				gettimeofday(&tv, NULL);
+			if((ptime = encoder_ptv_get(rtp_id, pkt->pts, rtspconf->audio_samplerate)) < 0) {
+				ptime = ga_clock_ns();
 			}
 			// send the packet
 			if(encoder_send_packet("audio-encoder",
 				rtp_id/*rtspconf->audio_id*/, pkt,
 				/*encoder->coded_frame->*/pkt->pts == AV_NOPTS_VALUE ? pts : /*encoder->coded_frame->*/pkt->pts,
-				&tv) < 0) {
+				ptime) < 0) {
 				goto audio_quit;
 			}
 			//
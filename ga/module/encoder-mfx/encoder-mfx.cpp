@@ -96,6 +96,10 @@ mfx_init(void *arg) {
 		snprintf(pipename, sizeof(pipename), pipefmt, iid);
 		outputW = video_source_out_width(iid);
 		outputH = video_source_out_height(iid);
+		if(video_source_out_pixelformat(iid) != AV_PIX_FMT_YUV420P) {
+			ga_error("video encoder: only yuv420p output is supported.\n");
+			goto init_failed;
+		}
 		if((pipe = dpipe_lookup(pipename)) == NULL) {
 			ga_error("video encoder: pipe %s is not found\n", pipename);
 			goto init_failed;
@@ -142,7 +146,7 @@ mfx_threadproc(void *arg) {
 	unsigned char startcode[] = { 0, 0, 0, 1 };
 	unsigned long long timeunit;
 	unsigned long long lastTimeStamp = (unsigned long long) -1LL;
-	struct timeval pkttv;
+	long long pkttime = 0LL;
 	//
 	int video_written = 0;
 	//
@@ -200,7 +204,7 @@ mfx_threadproc(void *arg) {
 		to.tv_nsec = tv.tv_usec * 1000;
 		data = dpipe_load(pipe, &to);
 		if(data == NULL) {
-			ga_error("viedo encoder: image source timed out.\n");
+			GA_ERROR_RATELIMITED("viedo encoder: image source timed out.\n");
 			continue;
 		}
 		frame = (vsource_frame_t*) data->pointer;
@@ -327,7 +331,7 @@ mfx_threadproc(void *arg) {
 		MFXVideoCORE_SyncOperation(_session[cid], encsync, MFX_INFINITE);
 		if(_mfxbs[cid].TimeStamp != lastTimeStamp) {
 			lastTimeStamp = _mfxbs[cid].TimeStamp;
-			gettimeofday(&pkttv, NULL);
+			pkttime = ga_clock_ns();
 		}
 #ifdef SAVEENC
 		if(fsaveenc != NULL)
@@ -356,7 +360,7 @@ mfx_threadproc(void *arg) {
 				pkt.size = nextptr != NULL ?
 						(nextptr - ptr) :
 						(_mfxbs[cid].Data+_mfxbs[cid].DataOffset+_mfxbs[cid].DataLength-ptr);
-				if(encoder_send_packet("video-encoder", cid, &pkt, pkt.pts, &pkttv) < 0) {
+				if(encoder_send_packet("video-encoder", cid, &pkt, pkt.pts, pkttime) < 0) {
 					goto video_quit;
 				}
 				ptr = nextptr;
@@ -367,7 +371,7 @@ mfx_threadproc(void *arg) {
 			av_init_packet(&pkt);
 			pkt.data = ptr;
 			pkt.size = _mfxbs[cid].Data+_mfxbs[cid].DataOffset+_mfxbs[cid].DataLength-ptr;
-			if(encoder_send_packet("video-encoder", cid, &pkt, pkt.pts, &pkttv) < 0) {
+			if(encoder_send_packet("video-encoder", cid, &pkt, pkt.pts, pkttime) < 0) {
 				goto video_quit;
 			}
 			video_written = 1;
@@ -377,7 +381,7 @@ mfx_threadproc(void *arg) {
 		if(_mfxbs[cid].Data) {
 			pkt.data = _mfxbs[cid].Data + _mfxbs[cid].DataOffset;
 			pkt.size = _mfxbs[cid].DataLength;
-			if(encoder_send_packet("video-encoder", cid, &pkt, pkt.pts, &pkttv) < 0) {
+			if(encoder_send_packet("video-encoder", cid, &pkt, pkt.pts, pkttime) < 0) {
 				goto video_quit;
 			}
 		}
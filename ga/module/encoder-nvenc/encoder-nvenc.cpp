@@ -227,7 +227,7 @@ int CNvEncoderLowLatency::ThreadProc()
 
 		data = dpipe_load(pipe, &to);
 		if(data == NULL) {
-			ga_error("viedo encoder: image source timed out.\n");
+			GA_ERROR_RATELIMITED("viedo encoder: image source timed out.\n");
 			continue;
 		}
 		frame = (vsource_frame_t*) data->pointer;
@@ -347,7 +347,7 @@ int CNvEncoderLowLatency::ThreadProc()
 		// send the packet
 		if(encoder_send_packet("video-encoder",
 				0/*iid*/, &pkt,
-				pkt.pts, NULL) < 0) {
+				pkt.pts, 0) < 0) {
 			goto exit;
 		}
     }
@@ -582,6 +582,11 @@ nvenc_init(void *arg) {
 	if(vencoder_initialized != 0)
 		return 0;
 
+	if(video_source_out_pixelformat(0) != AV_PIX_FMT_YUV420P) {
+		ga_error("+++ NVENC supports only yuv420p output +++\n");
+		return -1;
+	}
+
 	if (nvEncoder.NvencInit() != 0)
 		return 0;
 	
@@ -28,6 +28,8 @@
 #include "ga-module.h"
 
 #include "dpipe.h"
+#include "ga-atomic.h"
+#include "ga-trace.h"
 
 //// Prevent use of GLOBAL_HEADER to pass parameters, disabled by default
 //#define STANDALONE_SDP	1
@@ -42,6 +44,7 @@ static AVCodecContext *vencoder[VIDEO_SOURCE_CHANNEL_MAX];
 // Mutex for reconfiguration settings
 static pthread_mutex_t vencoder_reconf_mutex[VIDEO_SOURCE_CHANNEL_MAX];
 static ga_ioctl_reconfigure_t vencoder_reconf[VIDEO_SOURCE_CHANNEL_MAX];
+static volatile int vencoder_keyframe[VIDEO_SOURCE_CHANNEL_MAX];	/**< Keyframe requested */
 #ifdef STANDALONE_SDP
 //// encoders for generating SDP
 /* separate encoder and encoder_sdp because some ffmpeg codecs
@@ -121,7 +124,8 @@ vencoder_init(void *arg) {
 		vencoder[iid] = ga_avcodec_vencoder_init(NULL,
 				rtspconf->video_encoder_codec,
 				outputW, outputH,
-				rtspconf->video_fps, rtspconf->vso);
+				rtspconf->video_fps, rtspconf->vso,
+				video_source_out_pixelformat(iid));
 		if(vencoder[iid] == NULL)
 			goto init_failed;
 #ifdef STANDALONE_SDP
@@ -139,7 +143,8 @@ vencoder_init(void *arg) {
 			avc = ga_avcodec_vencoder_init(avc,
 				rtspconf->video_encoder_codec,
 				outputW, outputH,
-				rtspconf->video_fps, rtspconf->vso);
+				rtspconf->video_fps, rtspconf->vso,
+				video_source_out_pixelformat(iid));
 			if(avc == NULL)
 				goto init_failed;
 			ga_error("video encoder: meta-encoder #%d created.\n", iid);
@@ -199,7 +204,8 @@ vencoder_reconfigure(int iid) {
 			rtspconf->video_encoder_codec,
 			outputW, outputH,
 			rtspconf->video_fps,
-			rtspconf->vso);
+			rtspconf->vso,
+			video_source_out_pixelformat(iid));
 
 		if (vencoder[iid] == NULL) {
 			ga_error("video encoder: reconfigure failed. crf=%d; framerate=%d/%d; bitrate=%d; bufsize=%d.\n",
@@ -219,6 +225,7 @@ static void *
 vencoder_threadproc(void *arg) {
 	// arg is pointer to source pipename
 	int iid, outputW, outputH;
+	AVPixelFormat outputFmt;
 	vsource_frame_t *frame = NULL;
 	char *pipename = (char*) arg;
 	dpipe_t *pipe = dpipe_lookup(pipename);
@@ -231,6 +238,7 @@ vencoder_threadproc(void *arg) {
 	unsigned char *nalbuf = NULL, *nalbuf_a = NULL;
 	int nalbuf_size = 0, nalign = 0;
 	long long basePts = -1LL, newpts = 0LL, pts = -1LL, ptsSync = 0LL;
+	long long ptime;
 	pthread_mutex_t condMutex = PTHREAD_MUTEX_INITIALIZER;
 	pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
 	//
@@ -248,6 +256,7 @@ vencoder_threadproc(void *arg) {
 	//
 	outputW = video_source_out_width(iid);
 	outputH = video_source_out_height(iid);
+	outputFmt = video_source_out_pixelformat(iid);
 	//
 	encoder_pts_clear(iid);
 	//
@@ -264,14 +273,14 @@ vencoder_threadproc(void *arg) {
 	}
 	pic_in->width = outputW;
 	pic_in->height = outputH;
-	pic_in->format = AV_PIX_FMT_YUV420P;
-	pic_in_size = avpicture_get_size(AV_PIX_FMT_YUV420P, outputW, outputH);
+	pic_in->format = outputFmt;
+	pic_in_size = avpicture_get_size(outputFmt, outputW, outputH);
 	if((pic_in_buf = (unsigned char*) av_malloc(pic_in_size)) == NULL) {
 		ga_error("video encoder: picture buffer allocation failed, terminated.\n");
 		goto video_quit;
 	}
 	avpicture_fill((AVPicture*) pic_in, pic_in_buf,
-			AV_PIX_FMT_YUV420P, outputW, outputH);
+			outputFmt, outputW, outputH);
 	//ga_error("video encoder: linesize = %d|%d|%d\n", pic_in->linesize[0], pic_in->linesize[1], pic_in->linesize[2]);
 	// start encoding
 	ga_error("video encoding started: tid=%ld %dx%d@%dfps, nalbuf_size=%d, pic_in_size=%d.\n",
@@ -292,7 +301,7 @@ vencoder_threadproc(void *arg) {
 		to.tv_nsec = tv.tv_usec * 1000;
 		data = dpipe_load(pipe, &to);
 		if(data == NULL) {
-			ga_error("viedo encoder: image source timed out.\n");
+			GA_ERROR_RATELIMITED("viedo encoder: image source timed out.\n");
 			continue;
 		}
 		frame = (vsource_frame_t*) data->pointer;
@@ -304,7 +313,7 @@ vencoder_threadproc(void *arg) {
 		} else {
 			newpts = ptsSync + frame->imgpts - basePts;
 		}
-		// XXX: assume always YUV420P
+		// XXX: assume always the configured output format (YUV420P or NV12)
 		if(pic_in->linesize[0] == frame->linesize[0]
 		&& pic_in->linesize[1] == frame->linesize[1]
 		&& pic_in->linesize[2] == frame->linesize[2]) {
@@ -316,7 +325,7 @@ vencoder_threadproc(void *arg) {
 			dpipe_put(pipe, data);
 			goto video_quit;
 		}
-		tv = frame->timestamp;
+		ptime = frame->timestamp;
 		dpipe_put(pipe, data);
 		// pts must be monotonically increasing
 		if(newpts > pts) {
@@ -325,11 +334,18 @@ vencoder_threadproc(void *arg) {
 			pts++;
 		}
 		// encode
-		encoder_pts_put(iid, pts, &tv);
+		encoder_pts_put(iid, pts, ptime);
 		pic_in->pts = pts;
+		// keyframe requested?
+		if(ga_atomic_cas(&vencoder_keyframe[iid], 1, 0)) {
+			pic_in->pict_type = AV_PICTURE_TYPE_I;
+		} else {
+			pic_in->pict_type = AV_PICTURE_TYPE_NONE;
+		}
 		av_init_packet(&pkt);
 		pkt.data = nalbuf_a;
 		pkt.size = nalbuf_size;
+		ga_trace(GA_TRACE_ENCODE_SUBMIT, iid, ptime);
 		if(avcodec_encode_video2(encoder, &pkt, pic_in, &got_packet) < 0) {
 			ga_error("video encoder: encode failed, terminated.\n");
 			goto video_quit;
@@ -354,17 +370,15 @@ vencoder_threadproc(void *arg) {
 			} while(0);
 #endif
 			//
-			if(pkt.pts != AV_NOPTS_VALUE) {
-				if(encoder_ptv_get(iid, pkt.pts, &tv, 0) == NULL) {
-					gettimeofday(&tv, NULL);
-				}
-			} else {
-				gettimeofday(&tv, NULL);
+			if(pkt.pts == AV_NOPTS_VALUE
+			|| (ptime = encoder_ptv_get(iid, pkt.pts, 0)) < 0) {
+				ptime = ga_clock_ns();
 			}
+			ga_trace(GA_TRACE_ENCODE_OUTPUT, iid, ptime);
 			// send the packet
 			if(encoder_send_packet("video-encoder",
 				iid/*rtspconf->video_id*/, &pkt,
-				pkt.pts, &tv) < 0) {
+				pkt.pts, ptime) < 0) {
 				goto video_quit;
 			}
 			// free unused side-data
@@ -576,9 +590,19 @@ vencoder_ioctl(int command, int argsize, void *arg) {
 	case GA_IOCTL_RECONFIGURE:
 		ga_error("Staging video encoder reconfiguration\n");
 		pthread_mutex_lock(&vencoder_reconf_mutex[((ga_ioctl_reconfigure_t *) arg)->id]);
-		bcopy(arg, &vencoder_reconf[((ga_ioctl_reconfigure_t *) arg)->id], sizeof(ga_ioctl_reconfigure_t));
+		ga_module_reconfigure_merge(&vencoder_reconf[((ga_ioctl_reconfigure_t *) arg)->id], (ga_ioctl_reconfigure_t *) arg);
 		pthread_mutex_unlock(&vencoder_reconf_mutex[((ga_ioctl_reconfigure_t *) arg)->id]);
 		return ret; // 0
+	case GA_IOCTL_REQUEST_KEYFRAME:
+		if(argsize != sizeof(ga_ioctl_keyframe_t))
+			return GA_IOCTL_ERR_INVALID_ARGUMENT;
+		if(((ga_ioctl_keyframe_t*) arg)->id < 0
+		|| ((ga_ioctl_keyframe_t*) arg)->id >= VIDEO_SOURCE_CHANNEL_MAX)
+			return GA_IOCTL_ERR_BADID;
+		ga_atomic_store(&vencoder_keyframe[((ga_ioctl_keyframe_t*) arg)->id], 1);
+		// the source may be skipping unchanged frames
+		video_source_request_refresh(((ga_ioctl_keyframe_t*) arg)->id);
+		return ret; // 0
 	case GA_IOCTL_GETSPS:
 	case GA_IOCTL_GETPPS:
 	case GA_IOCTL_GETVPS:
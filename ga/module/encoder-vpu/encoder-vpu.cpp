@@ -91,6 +91,10 @@ vencoder_init(void *arg) {
 		snprintf(pipename, sizeof(pipename), pipefmt, iid);
 		outputW = video_source_out_width(iid);
 		outputH = video_source_out_height(iid);
+		if(video_source_out_pixelformat(iid) != AV_PIX_FMT_YUV420P) {
+			ga_error("video encoder: only yuv420p output is supported.\n");
+			goto init_failed;
+		}
 		if((pipe = dpipe_lookup(pipename)) == NULL) {
 			ga_error("video encoder: pipe %s is not found\n", pipename);
 			goto init_failed;
@@ -128,10 +132,7 @@ vencoder_threadproc(void *arg) {
 	//
 	int outputW, outputH;
 	//
-	struct timeval pkttv;
-#ifdef PRINT_LATENCY
-	struct timeval ptv;
-#endif
+	long long pkttime;
 	//
 	int video_written = 0;
 	//
@@ -161,7 +162,7 @@ vencoder_threadproc(void *arg) {
 		to.tv_nsec = tv.tv_usec * 1000;
 		data = dpipe_load(pipe, &to);
 		if(data == NULL) {
-			ga_error("viedo encoder: image source timed out.\n");
+			GA_ERROR_RATELIMITED("viedo encoder: image source timed out.\n");
 			continue;
 		}
 		frame = (vsource_frame_t*) data->pointer;
@@ -174,7 +175,7 @@ vencoder_threadproc(void *arg) {
 			newpts = ptsSync + frame->imgpts - basePts;
 		}
 		// encode!
-		gettimeofday(&pkttv, NULL);
+		pkttime = ga_clock_ns();
 		enc = vpu_encoder_encode(&vpu[cid], frame->imgbuf, vpu[cid].vpu_framesize, &encsize);
 		//
 		dpipe_put(pipe, data);
@@ -196,7 +197,7 @@ vencoder_threadproc(void *arg) {
 #endif
 		pkt.data = enc;
 		pkt.size = encsize;
-		if(encoder_send_packet("video-encoder", cid, &pkt, pkt.pts, &pkttv) < 0) {
+		if(encoder_send_packet("video-encoder", cid, &pkt, pkt.pts, pkttime) < 0) {
 			goto video_quit;
 		}
 		if(video_written == 0) {
@@ -204,8 +205,7 @@ vencoder_threadproc(void *arg) {
 			ga_error("first video frame written (pts=%lld)\n", pts);
 		}
 #ifdef PRINT_LATENCY		/* print out latency */
-		gettimeofday(&ptv, NULL);
-		ga_aggregated_print(0x0001, 601, tvdiff_us(&ptv, &frame->timestamp));
+		ga_aggregated_print(0x0001, 601, (ga_clock_ns() - frame->timestamp) / 1000LL);
 #endif
 	}
 	//
@@ -19,6 +19,7 @@
 #include <stdio.h>
 
 #include "vsource.h"
+#include "vconverter.h"
 #include "rtspconf.h"
 #include "encoder-common.h"
 
@@ -28,6 +29,8 @@
 #include "ga-module.h"
 
 #include "dpipe.h"
+#include "ga-atomic.h"
+#include "ga-trace.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -43,7 +46,9 @@ static int vencoder_initialized = 0;
 static int vencoder_started = 0;
 static pthread_t vencoder_tid[VIDEO_SOURCE_CHANNEL_MAX];
 static pthread_mutex_t vencoder_reconf_mutex[VIDEO_SOURCE_CHANNEL_MAX];
+static pthread_mutex_t vencoder_headers_mutex[VIDEO_SOURCE_CHANNEL_MAX];	/**< Protects encoder replacement and SPS/PPS */
 static ga_ioctl_reconfigure_t vencoder_reconf[VIDEO_SOURCE_CHANNEL_MAX];
+static volatile int vencoder_keyframe[VIDEO_SOURCE_CHANNEL_MAX];	/**< Keyframe requested */
 //// encoders for encoding
 static x264_t* vencoder[VIDEO_SOURCE_CHANNEL_MAX];
 
@@ -53,6 +58,29 @@ static int _spslen[VIDEO_SOURCE_CHANNEL_MAX];
 static char *_pps[VIDEO_SOURCE_CHANNEL_MAX];
 static int _ppslen[VIDEO_SOURCE_CHANNEL_MAX];
 
+// slice streaming: send each slice as soon as x264 produces it
+/** Max number of out-of-order slices held by vencoder_nalu_process() */
+#define	MAX_PENDING_SLICES	64
+
+/**
+ * Per-channel state of slice streaming.
+ * It is passed to vencoder_nalu_process() as the opaque of the input picture.
+ */
+typedef struct vencoder_slices_s {
+	int iid;			/**< Video channel id */
+	pthread_mutex_t mutex;		/**< Serializes callbacks from slice threads */
+	int64_t pts;			/**< pts of the frame being encoded */
+	long long ptime;		/**< Capture time of the frame being encoded */
+	int nextmb;			/**< First macroblock of the next slice to send */
+	int nsent;			/**< Number of NALs sent for the frame */
+	int failed;			/**< Sending a NAL has failed */
+	int npending;			/**< Number of held slices */
+	x264_nal_t pending[MAX_PENDING_SLICES];	/**< Held slices, payloads are malloc'ed */
+}	vencoder_slices_t;
+
+static int vencoder_slice_streaming = 0;
+static vencoder_slices_t vencoder_slices[VIDEO_SOURCE_CHANNEL_MAX];
+
 //#define	SAVEENC	"save.264"
 #ifdef SAVEENC
 static FILE *fsaveenc = NULL;
@@ -75,6 +103,8 @@ vencoder_deinit(void *arg) {
 		if(vencoder[iid] != NULL)
 			x264_encoder_close(vencoder[iid]);
 		pthread_mutex_destroy(&vencoder_reconf_mutex[iid]);
+		pthread_mutex_destroy(&vencoder_headers_mutex[iid]);
+		pthread_mutex_destroy(&vencoder_slices[iid].mutex);
 		vencoder[iid] = NULL;
 	}
 	bzero(_sps, sizeof(_sps));
@@ -94,6 +124,136 @@ ga_x264_param_parse_bit(x264_param_t *params, const char *name, const char *bitv
 	return x264_param_parse(params, name, kbit);
 }
 
+/**
+ * Send an escaped NAL of the frame being encoded.
+ *
+ * @param s [in] Slice streaming state of the channel.
+ * @param nal [in] The NAL, \a p_payload and \a i_payload hold the escaped data.
+ *
+ * Must be called with \a s->mutex held.
+ */
+static void
+vencoder_send_nal(vencoder_slices_t *s, x264_nal_t *nal) {
+	AVPacket pkt;
+	//
+	if(s->failed)
+		return;
+	if(s->nsent++ == 0)
+		ga_trace(GA_TRACE_ENCODE_OUTPUT, s->iid, s->ptime);
+	av_init_packet(&pkt);
+	pkt.pts = s->pts;
+	pkt.stream_index = 0;
+	pkt.data = nal->p_payload;
+	pkt.size = nal->i_payload;
+	// parameter sets only precede IDR frames, and the packet queue
+	// decides whether a frame is a keyframe by its first packet
+	if(nal->i_type == NAL_SLICE_IDR || nal->i_type == NAL_SPS || nal->i_type == NAL_PPS)
+		pkt.flags |= AV_PKT_FLAG_KEY;
+	if(nal->i_type == NAL_SLICE && nal->i_ref_idc == 0)
+		pkt.flags |= AV_PKT_FLAG_DISPOSABLE;
+	if(encoder_send_packet("video-encoder", s->iid, &pkt, pkt.pts, s->ptime) < 0)
+		s->failed = 1;
+#ifdef SAVEENC
+	if(fsaveenc != NULL)
+		fwrite(pkt.data, sizeof(char), pkt.size, fsaveenc);
+#endif
+	return;
+}
+
+/**
+ * Send held slices that follow the last sent slice.
+ *
+ * @param s [in] Slice streaming state of the channel.
+ * @param all [in] Also send slices after a gap, in macroblock order.
+ *
+ * Must be called with \a s->mutex held.
+ */
+static void
+vencoder_send_pending(vencoder_slices_t *s, int all) {
+	int i, next;
+	while(s->npending > 0) {
+		next = 0;
+		for(i = 1; i < s->npending; i++) {
+			if(s->pending[i].i_first_mb < s->pending[next].i_first_mb)
+				next = i;
+		}
+		if(s->pending[next].i_first_mb != s->nextmb && all == 0)
+			break;
+		vencoder_send_nal(s, &s->pending[next]);
+		s->nextmb = s->pending[next].i_last_mb + 1;
+		free(s->pending[next].p_payload);
+		s->pending[next] = s->pending[--s->npending];
+	}
+	return;
+}
+
+/**
+ * The nalu_process callback of x264.
+ *
+ * @param h [in] The x264 encoder.
+ * @param nal [in] The NAL just produced, not yet escaped.
+ * @param opaque [in] Opaque of the input picture: a vencoder_slices_t.
+ *
+ * With sliced threads, slices of a frame are produced concurrently and
+ * may complete out of order. Slices are sent in macroblock order, so
+ * a completed slice is held until all slices before it have been sent.
+ *
+ * A NAL that can be sent at once is escaped directly into the space
+ * reserved in the packet queue (see encoder_pktqueue_reserve()),
+ * so it is neither allocated nor copied.
+ */
+static void
+vencoder_nalu_process(x264_t *h, x264_nal_t *nal, void *opaque) {
+	vencoder_slices_t *s = (vencoder_slices_t*) opaque;
+	x264_nal_t escaped;
+	unsigned char *buf;
+	int slice, bufsize;
+	//
+	if(s == NULL)
+		return;
+	// x264 requires this much space to escape a nal
+	bufsize = nal->i_payload * 3 / 2 + 5 + 64;
+	slice = (nal->i_type == NAL_SLICE || nal->i_type == NAL_SLICE_IDR);
+	escaped = *nal;
+	// can be sent at once: escape it into the packet queue
+	pthread_mutex_lock(&s->mutex);
+	if(s->failed == 0
+	&& (slice == 0 || escaped.i_first_mb == s->nextmb)
+	&& (buf = (unsigned char*) encoder_pktqueue_reserve(s->iid, bufsize)) != NULL) {
+		x264_nal_encode(h, buf, &escaped);
+		vencoder_send_nal(s, &escaped);
+		if(slice) {
+			s->nextmb = escaped.i_last_mb + 1;
+			vencoder_send_pending(s, 0);
+		}
+		pthread_mutex_unlock(&s->mutex);
+		return;
+	}
+	pthread_mutex_unlock(&s->mutex);
+	// x264_nal_encode can be called without synchronization
+	if((buf = (unsigned char*) malloc(bufsize)) == NULL) {
+		ga_error("video encoder: slice streaming - alloc nal failed.\n");
+		s->failed = 1;
+		return;
+	}
+	x264_nal_encode(h, buf, &escaped);
+	//
+	pthread_mutex_lock(&s->mutex);
+	if(slice == 0) {
+		vencoder_send_nal(s, &escaped);
+		free(buf);
+	} else if(escaped.i_first_mb != s->nextmb && s->npending < MAX_PENDING_SLICES) {
+		s->pending[s->npending++] = escaped;
+	} else {
+		vencoder_send_nal(s, &escaped);
+		s->nextmb = escaped.i_last_mb + 1;
+		free(buf);
+		vencoder_send_pending(s, 0);
+	}
+	pthread_mutex_unlock(&s->mutex);
+	return;
+}
+
 static int
 vencoder_init(void *arg) {
 	int iid;
@@ -110,6 +270,8 @@ vencoder_init(void *arg) {
 	if(vencoder_initialized != 0)
 		return 0;
 	//
+	vencoder_slice_streaming = ga_conf_readbool("video-slice-streaming", 0);
+	//
 	for(iid = 0; iid < video_source_channels(); iid++) {
 		char pipename[64];
 		int outputW, outputH;
@@ -119,7 +281,10 @@ vencoder_init(void *arg) {
 		_sps[iid] = _pps[iid] = NULL;
 		_spslen[iid] = _ppslen[iid] = 0;
 		pthread_mutex_init(&vencoder_reconf_mutex[iid], NULL);
+		pthread_mutex_init(&vencoder_headers_mutex[iid], NULL);
 		vencoder_reconf[iid].id = -1;
+		pthread_mutex_init(&vencoder_slices[iid].mutex, NULL);
+		vencoder_slices[iid].iid = iid;
 		//
 		snprintf(pipename, sizeof(pipename), pipefmt, iid);
 		outputW = video_source_out_width(iid);
@@ -188,7 +353,8 @@ vencoder_init(void *arg) {
 			x264_param_parse(&params, "slices", tmpbuf);
 		//
 		params.i_log_level = X264_LOG_INFO;
-		params.i_csp = X264_CSP_I420;
+		params.i_csp = video_source_out_pixelformat(iid) == AV_PIX_FMT_NV12 ?
+					X264_CSP_NV12 : X264_CSP_I420;
 		params.i_width  = outputW;
 		params.i_height = outputH;
 		//params.vui.b_fullrange = 1;
@@ -208,11 +374,20 @@ vencoder_init(void *arg) {
 				name = strtok_r(NULL, ":", &saveptr);
 			}
 		}
+		// slice streaming: slices of a frame are encoded in parallel,
+		// and must not be delayed by lookahead or reordering
+		if(vencoder_slice_streaming) {
+			params.b_sliced_threads = 1;
+			params.i_sync_lookahead = 0;
+			params.rc.i_lookahead = 0;
+			params.i_bframe = 0;
+			params.nalu_process = vencoder_nalu_process;
+		}
 		//
 		vencoder[iid] = x264_encoder_open(&params);
 		if(vencoder[iid] == NULL)
 			goto init_failed;
-		ga_error("video encoder: opened! bitrate=%dKbps; me_method=%d; me_range=%d; refs=%d; g=%d; intra-refresh=%d; width=%d; height=%d; crop=%d,%d,%d,%d; threads=%d; slices=%d; repeat-hdr=%d; annexb=%d\n",
+		ga_error("video encoder: opened! bitrate=%dKbps; me_method=%d; me_range=%d; refs=%d; g=%d; intra-refresh=%d; width=%d; height=%d; crop=%d,%d,%d,%d; threads=%d; slices=%d; repeat-hdr=%d; annexb=%d; slice-streaming=%d\n",
 			params.rc.i_bitrate,
 			params.analyse.i_me_method, params.analyse.i_me_range,
 			params.i_frame_reference,
@@ -222,7 +397,8 @@ vencoder_init(void *arg) {
 			params.crop_rect.i_left, params.crop_rect.i_top,
 			params.crop_rect.i_right, params.crop_rect.i_bottom,
 			params.i_threads, params.i_slice_count,
-			params.b_repeat_headers, params.b_annexb);
+			params.b_repeat_headers, params.b_annexb,
+			vencoder_slice_streaming);
 	}
 #ifdef SAVEENC
 	fsaveenc = fopen(SAVEENC, "wb");
@@ -235,6 +411,45 @@ init_failed:
 	return -1;
 }
 
+/**
+ * Reopen the encoder of a channel with a new resolution.
+ *
+ * @param iid [in] The channel id.
+ * @param width [in] The new width.
+ * @param height [in] The new height.
+ * @return 0 on success, or -1 on error.
+ *
+ * x264 cannot change the resolution of an opened encoder. The new
+ * encoder keeps the current parameters, and starts with SPS/PPS and
+ * an IDR frame. Frames delayed in the old encoder are dropped.
+ */
+static int
+vencoder_resize(int iid, int width, int height) {
+	x264_param_t params;
+	x264_t *encoder;
+	//
+	x264_encoder_parameters(vencoder[iid], &params);
+	params.i_width = width;
+	params.i_height = height;
+	if((encoder = x264_encoder_open(&params)) == NULL) {
+		ga_error("video encoder: reopen encoder for %dx%d failed.\n", width, height);
+		return -1;
+	}
+	pthread_mutex_lock(&vencoder_headers_mutex[iid]);
+	x264_encoder_close(vencoder[iid]);
+	vencoder[iid] = encoder;
+	// new parameter sets for the sinks
+	if(_sps[iid] != NULL)
+		free(_sps[iid]);
+	if(_pps[iid] != NULL)
+		free(_pps[iid]);
+	_sps[iid] = _pps[iid] = NULL;
+	_spslen[iid] = _ppslen[iid] = 0;
+	pthread_mutex_unlock(&vencoder_headers_mutex[iid]);
+	ga_error("video encoder: channel %d resized to %dx%d.\n", iid, width, height);
+	return 0;
+}
+
 static int
 vencoder_reconfigure(int iid) {
 	int ret = 0;
@@ -267,6 +482,18 @@ vencoder_reconfigure(int iid) {
 			params.rc.i_vbv_buffer_size = reconf->bufsize;
 			doit++;
 		}
+		// resolution: the filter switches first, and the encoder is
+		// reopened when frames of the new size arrive
+		if(reconf->width > 0 && reconf->height > 0
+		&& (reconf->width != params.i_width || reconf->height != params.i_height)) {
+			if(video_source_set_out_size(iid, reconf->width, reconf->height) < 0) {
+				ga_error("video encoder: cannot change resolution to %dx%d.\n",
+					reconf->width, reconf->height);
+				ret = -1;
+			} else {
+				video_source_request_refresh(iid);
+			}
+		}
 		//
 		if(doit > 0) {
 			if(x264_encoder_reconfig(encoder, &params) < 0) {
@@ -290,10 +517,58 @@ vencoder_reconfigure(int iid) {
 	return ret;
 }
 
+/**
+ * Convert a captured BGRA or RGBA frame into the input picture of x264.
+ *
+ * @param frame [in] The captured frame, read directly from a video source.
+ * @param pic [in] Picture allocated by x264_picture_alloc().
+ * @param outputW [in] Width of \a pic.
+ * @param outputH [in] Height of \a pic.
+ * @return 0 on success, or -1 on error.
+ *
+ * This replaces the filter stage when \em video-direct-input is enabled.
+ * x264 only takes RGB input for 4:4:4 encoding, so frames are converted
+ * here with the same converters used by the filter.
+ */
+static int
+vencoder_convert(vsource_frame_t *frame, x264_picture_t *pic, int outputW, int outputH) {
+	AVPixelFormat dstfmt = pic->img.i_csp == X264_CSP_NV12 ? AV_PIX_FMT_NV12 : AV_PIX_FMT_YUV420P;
+	const unsigned char *src[4] = { frame->imgbuf, NULL, NULL, NULL };
+	int srcstride[4] = { frame->realstride, 0, 0, 0 };
+	unsigned char *dst[4] = { pic->img.plane[0], pic->img.plane[1], pic->img.plane[2], NULL };
+	int dststride[4] = { pic->img.i_stride[0], pic->img.i_stride[1], pic->img.i_stride[2], 0 };
+	struct SwsContext *swsctx;
+	int scale;
+	//
+	if(frame->pixelformat != AV_PIX_FMT_BGRA && frame->pixelformat != AV_PIX_FMT_RGBA) {
+		ga_error("video encoder: unsupported input pixel format (%d)\n", frame->pixelformat);
+		return -1;
+	}
+	// bottom-up: flip while converting with a negative stride
+	if(frame->flipped) {
+		src[0] += (frame->realheight - 1) * frame->realstride;
+		srcstride[0] = -frame->realstride;
+	}
+	scale = vconv_rgb2yuv_scale(frame->realwidth, frame->realheight, outputW, outputH);
+	if(scale > 0 && vconv_rgb2yuv_supported(frame->pixelformat, dstfmt)) {
+		return vconv_rgb2yuv_downscale(frame->pixelformat, src[0], srcstride[0],
+				dstfmt, dst, dststride, outputW, outputH, scale);
+	}
+	if((swsctx = vconv_thread_converter(frame->realwidth, frame->realheight,
+			frame->pixelformat, outputW, outputH, dstfmt)) == NULL) {
+		ga_error("video encoder: cannot create frame converter (%dx%d,%d)->(%dx%d,%d)\n",
+			frame->realwidth, frame->realheight, frame->pixelformat,
+			outputW, outputH, dstfmt);
+		return -1;
+	}
+	sws_scale(swsctx, src, srcstride, 0, frame->realheight, dst, dststride);
+	return 0;
+}
+
 static void *
 vencoder_threadproc(void *arg) {
 	// arg is pointer to source pipename
-	int iid, outputW, outputH;
+	int iid, outputW, outputH, width, height;
 	vsource_frame_t *frame = NULL;
 	char *pipename = (char*) arg;
 	dpipe_t *pipe = dpipe_lookup(pipename);
@@ -304,10 +579,11 @@ vencoder_threadproc(void *arg) {
 	pthread_mutex_t condMutex = PTHREAD_MUTEX_INITIALIZER;
 	pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
 	//
-	unsigned char *pktbuf = NULL;
-	int pktbufsize = 0, pktbufmax = 0;
+	x264_picture_t pic_conv;	// converted frames, see vencoder_convert()
+	int pic_conv_alloc = 0;
 	int video_written = 0;
 	int64_t x264_pts = 0;
+	long long ptime;
 	//
 	if(pipe == NULL) {
 		ga_error("video encoder: invalid pipeline specified (%s).\n", pipename);
@@ -321,11 +597,7 @@ vencoder_threadproc(void *arg) {
 	//
 	outputW = video_source_out_width(iid);
 	outputH = video_source_out_height(iid);
-	pktbufmax = outputW * outputH * 2;
-	if((pktbuf = (unsigned char*) malloc(pktbufmax)) == NULL) {
-		ga_error("video encoder: allocate memory failed.\n");
-		goto video_quit;
-	}
+	encoder_pts_clear(iid);
 	// start encoding
 	ga_error("video encoding started: tid=%ld %dx%d@%dfps.\n",
 		ga_gettid(),
@@ -334,7 +606,7 @@ vencoder_threadproc(void *arg) {
 	while(vencoder_started != 0 && encoder_running() > 0) {
 		x264_picture_t pic_in, pic_out = {0};
 		x264_nal_t *nal;
-		int i, size, nnal;
+		int size, nnal;
 		struct timeval tv;
 		struct timespec to;
 		gettimeofday(&tv, NULL);
@@ -345,10 +617,57 @@ vencoder_threadproc(void *arg) {
 		to.tv_nsec = tv.tv_usec * 1000;
 		data = dpipe_load(pipe, &to);
 		if(data == NULL) {
-			ga_error("viedo encoder: image source timed out.\n");
+			GA_ERROR_RATELIMITED("viedo encoder: image source timed out.\n");
 			continue;
 		}
 		frame = (vsource_frame_t*) data->pointer;
+		// resolution changed? filtered frames carry the new size,
+		// and frames read directly are converted into it
+		if(frame->pixelformat == AV_PIX_FMT_YUV420P
+		|| frame->pixelformat == AV_PIX_FMT_NV12) {
+			width = frame->realwidth;
+			height = frame->realheight;
+		} else {
+			video_source_out_size(iid, &width, &height);
+		}
+		if(width != outputW || height != outputH) {
+			if(vencoder_resize(iid, width, height) < 0) {
+				dpipe_put(pipe, data);
+				goto video_quit;
+			}
+			encoder = vencoder[iid];
+			outputW = width;
+			outputH = height;
+			if(pic_conv_alloc != 0) {
+				x264_picture_clean(&pic_conv);
+				pic_conv_alloc = 0;
+			}
+		}
+		// read directly from a video source: do the filter's job
+		if(frame->pixelformat != AV_PIX_FMT_YUV420P
+		&& frame->pixelformat != AV_PIX_FMT_NV12) {
+			if(frame->unchanged) {
+				dpipe_put(pipe, data);
+				continue;
+			}
+			if(pic_conv_alloc == 0) {
+				if(x264_picture_alloc(&pic_conv,
+					video_source_out_pixelformat(iid) == AV_PIX_FMT_NV12 ?
+						X264_CSP_NV12 : X264_CSP_I420,
+					outputW, outputH) < 0) {
+					ga_error("video encoder: allocate picture failed.\n");
+					dpipe_put(pipe, data);
+					goto video_quit;
+				}
+				pic_conv_alloc = 1;
+			}
+			ga_trace(GA_TRACE_FILTER_START, iid, frame->timestamp);
+			if(vencoder_convert(frame, &pic_conv, outputW, outputH) < 0) {
+				dpipe_put(pipe, data);
+				goto video_quit;
+			}
+			ga_trace(GA_TRACE_FILTER_END, iid, frame->timestamp);
+		}
 		// handle pts
 		if(basePts == -1LL) {
 			basePts = frame->imgpts;
@@ -360,14 +679,17 @@ vencoder_threadproc(void *arg) {
 		//
 		x264_picture_init(&pic_in);
 		//
-		pic_in.img.i_csp = X264_CSP_I420;
-		pic_in.img.i_plane = 3;
-		pic_in.img.i_stride[0] = frame->linesize[0];
-		pic_in.img.i_stride[1] = frame->linesize[1];
-		pic_in.img.i_stride[2] = frame->linesize[2];
-		pic_in.img.plane[0] = frame->imgbuf;
-		pic_in.img.plane[1] = pic_in.img.plane[0] + outputW*outputH;
-		pic_in.img.plane[2] = pic_in.img.plane[1] + ((outputW * outputH) >> 2);
+		if(frame->pixelformat == AV_PIX_FMT_YUV420P
+		|| frame->pixelformat == AV_PIX_FMT_NV12) {
+			pic_in.img.i_csp = frame->pixelformat == AV_PIX_FMT_NV12 ?
+						X264_CSP_NV12 : X264_CSP_I420;
+			pic_in.img.i_plane = vsource_frame_planes(frame, pic_in.img.plane);
+			pic_in.img.i_stride[0] = frame->linesize[0];
+			pic_in.img.i_stride[1] = frame->linesize[1];
+			pic_in.img.i_stride[2] = frame->linesize[2];
+		} else {
+			pic_in.img = pic_conv.img;
+		}
 		// pts must be monotonically increasing
 		if(newpts > pts) {
 			pts = newpts;
@@ -376,32 +698,67 @@ vencoder_threadproc(void *arg) {
 		}
 		//pic_in.i_pts = pts;
 		pic_in.i_pts = x264_pts++;
+		// streamed slices carry the capture time in vencoder_slices,
+		// and nothing would read it back from the pts queue
+		if(vencoder_slice_streaming == 0)
+			encoder_pts_put(iid, pic_in.i_pts, frame->timestamp);
+		// keyframe requested?
+		if(ga_atomic_cas(&vencoder_keyframe[iid], 1, 0))
+			pic_in.i_type = X264_TYPE_IDR;
+		// slices are sent by vencoder_nalu_process()
+		if(vencoder_slice_streaming) {
+			vencoder_slices_t *s = &vencoder_slices[iid];
+			pthread_mutex_lock(&s->mutex);
+			s->pts = pic_in.i_pts;
+			s->ptime = frame->timestamp;
+			s->nextmb = 0;
+			s->nsent = 0;
+			pthread_mutex_unlock(&s->mutex);
+			pic_in.opaque = s;
+		}
 		// encode
+		ga_trace(GA_TRACE_ENCODE_SUBMIT, iid, frame->timestamp);
 		if((size = x264_encoder_encode(encoder, &nal, &nnal, &pic_in, &pic_out)) < 0) {
 			ga_error("video encoder: encode failed, err = %d\n", size);
 			dpipe_put(pipe, data);
 			break;
 		}
 		dpipe_put(pipe, data);
+		// returned nals are not valid with nalu_process:
+		// send slices held by a lost one, if any
+		if(vencoder_slice_streaming) {
+			vencoder_slices_t *s = &vencoder_slices[iid];
+			int failed;
+			pthread_mutex_lock(&s->mutex);
+			vencoder_send_pending(s, 1);
+			failed = s->failed;
+			pthread_mutex_unlock(&s->mutex);
+			if(failed)
+				goto video_quit;
+			if(video_written == 0 && s->nsent > 0) {
+				video_written = 1;
+				ga_error("first video frame written (pts=%lld)\n", pic_in.i_pts);
+			}
+			continue;
+		}
 		// encode
 		if(size > 0) {
 			AVPacket pkt;
-#if 1
+			// capture time of the encoded frame
+			if((ptime = encoder_ptv_get(iid, pic_out.i_pts, 0)) < 0)
+				ptime = ga_clock_ns();
+			ga_trace(GA_TRACE_ENCODE_OUTPUT, iid, ptime);
 			av_init_packet(&pkt);
 			pkt.pts = pic_in.i_pts;
 			pkt.stream_index = 0;
-			// concatenate nals
-			pktbufsize = 0;
-			for(i = 0; i < nnal; i++) {
-				if(pktbufsize + nal[i].i_payload > pktbufmax) {
-					ga_error("video encoder: nal dropped (%d < %d).\n", i+1, nnal);
-					break;
-				}
-				bcopy(nal[i].p_payload, pktbuf + pktbufsize, nal[i].i_payload);
-				pktbufsize += nal[i].i_payload;
-			}
-			pkt.size = pktbufsize;
-			pkt.data = pktbuf;
+			if(pic_out.b_keyframe)
+				pkt.flags |= AV_PKT_FLAG_KEY;
+			if(pic_out.i_type == X264_TYPE_B)
+				pkt.flags |= AV_PKT_FLAG_DISPOSABLE;
+			// x264 outputs the payloads of all nals sequentially
+			// in memory: send them as is, valid until the next encode
+			pkt.size = size;
+			pkt.data = nal[0].p_payload;
 #if 0			// XXX: dump naltype
 			do {
 				int codelen;
@@ -419,64 +776,12 @@ vencoder_threadproc(void *arg) {
 			// send the packet
 			if(encoder_send_packet("video-encoder",
 					iid/*rtspconf->video_id*/, &pkt,
-					pkt.pts, NULL) < 0) {
+					pkt.pts, ptime) < 0) {
 				goto video_quit;
 			}
 #ifdef SAVEENC
 			if(fsaveenc != NULL)
 				fwrite(pkt.data, sizeof(char), pkt.size, fsaveenc);
-#endif
-#else
-			// handling special nals (type > 5)
-			for(i = 0; i < nnal; i++) {
-				unsigned char *ptr;
-				int offset;
-				if((ptr = ga_find_startcode(nal[i].p_payload, nal[i].p_payload + nal[i].i_payload, &offset))
-				!= nal[i].p_payload) {
-					ga_error("video encoder: no startcode found for nals\n");
-					goto video_quit;
-				}
-				if((*(ptr+offset) & 0x1f) <= 5)
-					break;
-				av_init_packet(&pkt);
-				pkt.pts = pic_in.i_pts;
-				pkt.stream_index = 0;
-				pkt.size = nal[i].i_payload;
-				pkt.data = ptr;
-				if(encoder_send_packet("video-encoder",
-					iid/*rtspconf->video_id*/, &pkt, pkt.pts, NULL) < 0) {
-					goto video_quit;
-				}
-#ifdef SAVEENC
-				if(fsaveenc != NULL)
-					fwrite(pkt.data, sizeof(char), pkt.size, fsaveenc);
-#endif
-			}
-			// handling video frame data
-			pktbufsize = 0;
-			for(; i < nnal; i++) {
-				if(pktbufsize + nal[i].i_payload > pktbufmax) {
-					ga_error("video encoder: nal dropped (%d < %d).\n", i+1, nnal);
-					break;
-				}
-				bcopy(nal[i].p_payload, pktbuf + pktbufsize, nal[i].i_payload);
-				pktbufsize += nal[i].i_payload;
-			}
-			if(pktbufsize > 0) {
-				av_init_packet(&pkt);
-				pkt.pts = pic_in.i_pts;
-				pkt.stream_index = 0;
-				pkt.size = pktbufsize;
-				pkt.data = pktbuf;
-				if(encoder_send_packet("video-encoder",
-					iid/*rtspconf->video_id*/, &pkt, pkt.pts, NULL) < 0) {
-					goto video_quit;
-				}
-#ifdef SAVEENC
-				if(fsaveenc != NULL)
-					fwrite(pkt.data, sizeof(char), pkt.size, fsaveenc);
-#endif
-			}
 #endif
 			// free unused side-data
 			if(pkt.side_data_elems > 0) {
@@ -498,10 +803,8 @@ video_quit:
 	if(pipe) {
 		pipe = NULL;
 	}
-	if(pktbuf != NULL) {
-		free(pktbuf);
-	}
-	pktbuf = NULL;
+	if(pic_conv_alloc != 0)
+		x264_picture_clean(&pic_conv);
 	//
 	ga_error("video encoder: thread terminated (tid=%ld).\n", ga_gettid());
 	//
@@ -567,13 +870,15 @@ x264_reconfigure(ga_ioctl_reconfigure_t *reconf) {
 		return 0;
 	}
 	pthread_mutex_lock(&vencoder_reconf_mutex[reconf->id]);
-	bcopy(reconf, &vencoder_reconf[reconf->id], sizeof(ga_ioctl_reconfigure_t));
+	// the rate controller may send requests before a pending one is applied
+	ga_module_reconfigure_merge(&vencoder_reconf[reconf->id], reconf);
 	pthread_mutex_unlock(&vencoder_reconf_mutex[reconf->id]);
 	return 0;
 }
 
 static int
 x264_get_sps_pps(int iid) {
+	x264_t *encoder = vencoder[iid];
 	x264_nal_t *p_nal;
 	int ret = 0;
 	int i, i_nal;
@@ -583,8 +888,19 @@ x264_get_sps_pps(int iid) {
 	//
 	if(vencoder_initialized == 0)
 		return GA_IOCTL_ERR_NOTINITIALIZED;
-	if(x264_encoder_headers(vencoder[iid], &p_nal, &i_nal) < 0)
-		return GA_IOCTL_ERR_NOTFOUND;
+	// headers would go to nalu_process without an input picture:
+	// use an identical encoder without the callback
+	if(vencoder_slice_streaming) {
+		x264_param_t params;
+		x264_encoder_parameters(vencoder[iid], &params);
+		params.nalu_process = NULL;
+		if((encoder = x264_encoder_open(&params)) == NULL)
+			return GA_IOCTL_ERR_NOTFOUND;
+	}
+	if(x264_encoder_headers(encoder, &p_nal, &i_nal) < 0) {
+		ret = GA_IOCTL_ERR_NOTFOUND;
+		goto headers_done;
+	}
 	for(i = 0; i < i_nal; i++) {
 		if(p_nal[i].i_type == NAL_SPS) {
 			if((_sps[iid] = (char*) malloc(p_nal[i].i_payload)) == NULL) {
@@ -612,6 +928,9 @@ x264_get_sps_pps(int iid) {
 		ga_error("video encoder: found sps (%d bytes); pps (%d bytes)\n",
 			_spslen[iid], _ppslen[iid]);
 	}
+headers_done:
+	if(encoder != vencoder[iid])
+		x264_encoder_close(encoder);
 	return ret;
 }
 
@@ -629,25 +948,43 @@ vencoder_ioctl(int command, int argsize, void *arg) {
 			return GA_IOCTL_ERR_INVALID_ARGUMENT;
 		x264_reconfigure((ga_ioctl_reconfigure_t*) arg);
 		break;
+	case GA_IOCTL_REQUEST_KEYFRAME:
+		if(argsize != sizeof(ga_ioctl_keyframe_t))
+			return GA_IOCTL_ERR_INVALID_ARGUMENT;
+		if(((ga_ioctl_keyframe_t*) arg)->id < 0
+		|| ((ga_ioctl_keyframe_t*) arg)->id >= VIDEO_SOURCE_CHANNEL_MAX)
+			return GA_IOCTL_ERR_BADID;
+		ga_atomic_store(&vencoder_keyframe[((ga_ioctl_keyframe_t*) arg)->id], 1);
+		// the source may be skipping unchanged frames
+		video_source_request_refresh(((ga_ioctl_keyframe_t*) arg)->id);
+		break;
 	case GA_IOCTL_GETSPS:
 		if(argsize != sizeof(ga_ioctl_buffer_t))
 			return GA_IOCTL_ERR_INVALID_ARGUMENT;
-		if(x264_get_sps_pps(buf->id) < 0)
-			return GA_IOCTL_ERR_NOTFOUND;
-		if(buf->size < _spslen[buf->id])
-			return GA_IOCTL_ERR_BUFFERSIZE;
-		buf->size = _spslen[buf->id];
-		bcopy(_sps[buf->id], buf->ptr, buf->size);
+		pthread_mutex_lock(&vencoder_headers_mutex[buf->id]);
+		if(x264_get_sps_pps(buf->id) < 0) {
+			ret = GA_IOCTL_ERR_NOTFOUND;
+		} else if(buf->size < _spslen[buf->id]) {
+			ret = GA_IOCTL_ERR_BUFFERSIZE;
+		} else {
+			buf->size = _spslen[buf->id];
+			bcopy(_sps[buf->id], buf->ptr, buf->size);
+		}
+		pthread_mutex_unlock(&vencoder_headers_mutex[buf->id]);
 		break;
 	case GA_IOCTL_GETPPS:
 		if(argsize != sizeof(ga_ioctl_buffer_t))
 			return GA_IOCTL_ERR_INVALID_ARGUMENT;
-		if(x264_get_sps_pps(buf->id) < 0)
-			return GA_IOCTL_ERR_NOTFOUND;
-		if(buf->size < _ppslen[buf->id])
-			return GA_IOCTL_ERR_BUFFERSIZE;
-		buf->size = _ppslen[buf->id];
-		bcopy(_pps[buf->id], buf->ptr, buf->size);
+		pthread_mutex_lock(&vencoder_headers_mutex[buf->id]);
+		if(x264_get_sps_pps(buf->id) < 0) {
+			ret = GA_IOCTL_ERR_NOTFOUND;
+		} else if(buf->size < _ppslen[buf->id]) {
+			ret = GA_IOCTL_ERR_BUFFERSIZE;
+		} else {
+			buf->size = _ppslen[buf->id];
+			bcopy(_pps[buf->id], buf->ptr, buf->size);
+		}
+		pthread_mutex_unlock(&vencoder_headers_mutex[buf->id]);
 		break;
 	default:
 		ret = GA_IOCTL_ERR_NOTSUPPORTED;
@@ -31,15 +31,21 @@
 
 #include "dpipe.h"
 #include "dpipe.h"
+#include "ga-trace.h"
+#include "ga-parallel.h"
 #include "filter-rgb2yuv.h"
 
 #define	POOLSIZE		8
 #define	ENABLE_EMBED_COLORCODE	1
+/** Minimum number of rows in a band */
+#define	MINBANDROWS		16
 
 using namespace std;
 
 static int filter_initialized = 0;
 static int filter_started = 0;
+static int filter_fastconv = 1;
+static int filter_bands = 1;		/**< Number of horizontal bands of a frame */
 static pthread_t filter_tid[VIDEO_SOURCE_CHANNEL_MAX];
 static FILE *savefp = NULL;
 
@@ -56,6 +62,10 @@ filter_RGB2YUV_init(void *arg) {
 	dpipe_t *srcpipe[VIDEO_SOURCE_CHANNEL_MAX];
 	dpipe_t *dstpipe[VIDEO_SOURCE_CHANNEL_MAX];
 	char savefile[128];
+	char pipemode[64];
+	int dstmode = DPIPE_MODE_LOCKED;
+	int dstpolicy = DPIPE_POLICY_FIFO;
+	int dstdepth;
 	//
 	if(filter_initialized != 0)
 		return 0;
@@ -63,6 +73,30 @@ filter_RGB2YUV_init(void *arg) {
 	if(ga_conf_readv("save-yuv-image", savefile, sizeof(savefile)) != NULL) {
 		savefp = ga_save_init(savefile);
 	}
+	if(ga_conf_readv("filter-pipe-mode", pipemode, sizeof(pipemode)) != NULL) {
+		if((dstmode = dpipe_parse_mode(pipemode)) < 0) {
+			ga_error("RGB2YUV filter: unknown filter-pipe-mode '%s', use default.\n", pipemode);
+			dstmode = DPIPE_MODE_LOCKED;
+		}
+	}
+	if(ga_conf_readv("filter-pipe-policy", pipemode, sizeof(pipemode)) != NULL) {
+		if((dstpolicy = dpipe_parse_policy(pipemode)) < 0) {
+			ga_error("RGB2YUV filter: unknown filter-pipe-policy '%s', use default.\n", pipemode);
+			dstpolicy = DPIPE_POLICY_FIFO;
+		}
+	}
+	dstdepth = ga_conf_readint("filter-pipe-depth");
+	filter_fastconv = ga_conf_readbool("filter-fast-convert", 1);
+	// slice-parallel conversion: the filter thread and the shared workers
+	if(ga_conf_readv("filter-threads", pipemode, sizeof(pipemode)) != NULL) {
+		if(strcasecmp(pipemode, "auto") == 0)
+			filter_bands = ga_parallel_init(-1) + 1;
+		else if((filter_bands = ga_conf_readint("filter-threads")) > 1)
+			filter_bands = ga_parallel_init(filter_bands - 1) + 1;
+		else
+			filter_bands = 1;
+		ga_error("RGB2YUV filter: convert frames in %d band(s).\n", filter_bands);
+	}
 #ifdef ENABLE_EMBED_COLORCODE
 	vsource_embed_colorcode_init(0/*RGBmode*/);
 #endif
@@ -73,7 +107,7 @@ filter_RGB2YUV_init(void *arg) {
 		char pixelfmt[64];
 		char srcpipename[64], dstpipename[64];
 		int inputW, inputH, outputW, outputH;
-		struct SwsContext *swsctx = NULL;
+		AVPixelFormat srcfmt, outputFmt;
 		dpipe_buffer_t *data = NULL;
 		//
 		snprintf(srcpipename, sizeof(srcpipename), filterpipe[0], iid);
@@ -87,47 +121,42 @@ filter_RGB2YUV_init(void *arg) {
 		inputH = video_source_curr_height(iid);
 		outputW = video_source_out_width(iid);
 		outputH = video_source_out_height(iid);
-		// create default converters
+		outputFmt = video_source_out_pixelformat(iid);
+		// pre-warm default converters for the filter thread
+		srcfmt = AV_PIX_FMT_NONE;
 		if(ga_conf_readv("filter-source-pixelformat", pixelfmt, sizeof(pixelfmt)) != NULL) {
 			if(strcasecmp("rgba", pixelfmt) == 0) {
-				swsctx = create_frame_converter(
-						inputW, inputH, AV_PIX_FMT_RGBA,
-						outputW, outputH, AV_PIX_FMT_YUV420P);
+				srcfmt = AV_PIX_FMT_RGBA;
 				ga_error("RGB2YUV filter: RGBA source specified.\n");
 			} else if(strcasecmp("bgra", pixelfmt) == 0) {
-				swsctx = create_frame_converter(
-						inputW, inputH, AV_PIX_FMT_BGRA,
-						outputW, outputH, AV_PIX_FMT_YUV420P);
+				srcfmt = AV_PIX_FMT_BGRA;
 				ga_error("RGB2YUV filter: BGRA source specified.\n");
 			} else if(strcasecmp("yuv420p", pixelfmt) == 0) {
-				swsctx = create_frame_converter(
-						inputW, inputH, AV_PIX_FMT_YUV420P,
-						outputW, outputH, AV_PIX_FMT_YUV420P);
+				srcfmt = AV_PIX_FMT_YUV420P;
 				ga_error("RGB2YUV filter: YUV source specified.\n");
 			}
 		}
-		if(swsctx == NULL) {
+		if(srcfmt == AV_PIX_FMT_NONE) {
 #ifdef __APPLE__
-			swsctx = create_frame_converter(
-					inputW, inputH, AV_PIX_FMT_RGBA,
-					outputW, outputH, AV_PIX_FMT_YUV420P);
+			srcfmt = AV_PIX_FMT_RGBA;
 #else
-			swsctx = create_frame_converter(
-					inputW, inputH, AV_PIX_FMT_BGRA,
-					outputW, outputH, AV_PIX_FMT_YUV420P);
+			srcfmt = AV_PIX_FMT_BGRA;
 #endif
 		}
-		if(swsctx == NULL) {
+		if(vconv_prewarm(inputW, inputH, srcfmt, outputW, outputH, outputFmt, 1) < 0) {
 			ga_error("RGB2YUV filter: cannot initialize converters.\n");
 			goto init_failed;
 		}
 		//
-		dstpipe[iid] = dpipe_create(iid, dstpipename, POOLSIZE,
-				sizeof(vsource_frame_t) + video_source_mem_size(iid));
+		dstpipe[iid] = dpipe_create_ex(iid, dstpipename, POOLSIZE,
+				sizeof(vsource_frame_t) + video_source_mem_size(iid),
+				dstmode);
 		if(dstpipe[iid] == NULL) {
 			ga_error("RGB2YUV filter: create dst-pipeline failed (%s).\n", dstpipename);
 			goto init_failed;
 		}
+		if(dstpolicy != DPIPE_POLICY_FIFO)
+			dpipe_set_policy(dstpipe[iid], dstpolicy, dstdepth);
 		for(data = dstpipe[iid]->in; data != NULL; data = data->next) {
 			if(vsource_frame_init(iid, (vsource_frame_t*) data->pointer) == NULL) {
 				ga_error("RGB2YUV filter: init frame failed for %s.\n", dstpipename);
@@ -156,6 +185,7 @@ init_failed:
 
 static int
 filter_RGB2YUV_deinit(void *arg) {
+	ga_parallel_deinit();
 	if(savefp != NULL) {
 		ga_save_close(savefp);
 		savefp = NULL;
@@ -163,6 +193,108 @@ filter_RGB2YUV_deinit(void *arg) {
 	return 0;
 }
 
+/**
+ * A horizontal band of a frame to be converted.
+ */
+typedef struct filter_band_s {
+	AVPixelFormat srcfmt;		/**< Source pixel format */
+	unsigned char **src;		/**< Source planes */
+	int *srcstride;			/**< Source strides */
+	AVPixelFormat dstfmt;		/**< Destination pixel format: YUV420P or NV12 */
+	unsigned char **dst;		/**< Destination planes */
+	int *dststride;			/**< Destination strides */
+	int width, height;		/**< Output frame size */
+	int scale;			/**< Downscale factor of SIMD kernels: 1, 2, or 4 */
+	int nbands;			/**< Number of bands */
+	struct SwsContext **swsctx;	/**< Converter of each band, or NULL for SIMD kernels */
+}	filter_band_t;
+
+/**
+ * Converters of bands: a SwsContext cannot be shared by concurrent bands.
+ */
+typedef struct filter_bandctx_s {
+	int nbands, width, height;
+	AVPixelFormat srcfmt, dstfmt;
+	struct SwsContext *ctx[GA_PARALLEL_MAX_THREADS+1];
+}	filter_bandctx_t;
+
+/* filter_band_row: first row of a band, always even for chroma planes */
+
+static int
+filter_band_row(int height, int nbands, int band) {
+	if(band >= nbands)
+		return height;
+	return (height * band / nbands) & ~1;
+}
+
+/* filter_RGB2YUV_band: convert a band, run by ga_parallel_run() */
+
+static void
+filter_RGB2YUV_band(void *arg, int band) {
+	filter_band_t *b = (filter_band_t*) arg;
+	int y0 = filter_band_row(b->height, b->nbands, band);
+	int y1 = filter_band_row(b->height, b->nbands, band+1);
+	unsigned char *src[] = { NULL, NULL, NULL, NULL };
+	unsigned char *dst[] = { NULL, NULL, NULL, NULL };
+	//
+	src[0] = b->src[0] + y0 * b->scale * b->srcstride[0];
+	if(b->srcfmt == AV_PIX_FMT_YUV420P) {
+		src[1] = b->src[1] + (y0>>1) * b->srcstride[1];
+		src[2] = b->src[2] + (y0>>1) * b->srcstride[2];
+	}
+	dst[0] = b->dst[0] + y0 * b->dststride[0];
+	dst[1] = b->dst[1] + (y0>>1) * b->dststride[1];
+	if(b->dstfmt == AV_PIX_FMT_YUV420P)
+		dst[2] = b->dst[2] + (y0>>1) * b->dststride[2];
+	//
+	if(b->swsctx == NULL) {
+		vconv_rgb2yuv_downscale(b->srcfmt, src[0], b->srcstride[0],
+			b->dstfmt, dst, b->dststride,
+			b->width, y1 - y0, b->scale);
+	} else {
+		sws_scale(b->swsctx[band],
+			src, b->srcstride, 0, y1 - y0,
+			dst, b->dststride);
+	}
+	return;
+}
+
+/* filter_RGB2YUV_bandctx: (re)create converters of bands */
+
+static struct SwsContext **
+filter_RGB2YUV_bandctx(filter_bandctx_t *bc, int nbands, int width, int height,
+		AVPixelFormat srcfmt, AVPixelFormat dstfmt) {
+	int i, h;
+	//
+	if(bc->nbands == nbands && bc->width == width && bc->height == height
+	&& bc->srcfmt == srcfmt && bc->dstfmt == dstfmt)
+		return bc->ctx;
+	for(i = 0; i < bc->nbands; i++) {
+		sws_freeContext(bc->ctx[i]);
+		bc->ctx[i] = NULL;
+	}
+	bc->nbands = 0;
+	for(i = 0; i < nbands; i++) {
+		h = filter_band_row(height, nbands, i+1) - filter_band_row(height, nbands, i);
+		if((bc->ctx[i] = sws_getContext(width, h, srcfmt,
+				width, h, dstfmt,
+				SWS_BICUBIC, NULL, NULL, NULL)) == NULL) {
+			ga_error("RGB2YUV filter: cannot create converter for band %d.\n", i);
+			while(--i >= 0) {
+				sws_freeContext(bc->ctx[i]);
+				bc->ctx[i] = NULL;
+			}
+			return NULL;
+		}
+	}
+	bc->nbands = nbands;
+	bc->width = width;
+	bc->height = height;
+	bc->srcfmt = srcfmt;
+	bc->dstfmt = dstfmt;
+	return bc->ctx;
+}
+
 /* filter_RGB2YUV_threadproc: arg is two pointers to pipeline name */
 /*	1st ptr: source pipeline */
 /*	2nd ptr: destination pipeline */
@@ -184,9 +316,12 @@ filter_RGB2YUV_threadproc(void *arg) {
 	unsigned char *src[] = { NULL, NULL, NULL, NULL };
 	unsigned char *dst[] = { NULL, NULL, NULL, NULL };
 	int srcstride[] = { 0, 0, 0, 0 };
-	int dststride[] = { 0, 0, 0, 0 };
 	int iid;
 	int outputW, outputH;
+	AVPixelFormat outputFmt;
+	int fastconv, scale, nbands;
+	filter_band_t band;
+	filter_bandctx_t bandctx;
 	//
 	struct SwsContext *swsctx = NULL;
 	//
@@ -204,6 +339,8 @@ filter_RGB2YUV_threadproc(void *arg) {
 	iid = dstpipe->channel_id;
 	outputW = video_source_out_width(iid);
 	outputH = video_source_out_height(iid);
+	outputFmt = video_source_out_pixelformat(iid);
+	bzero(&bandctx, sizeof(bandctx));
 	//
 	ga_error("RGB2YUV filter[%ld]: pipe#%d from '%s' to '%s' (output-resolution=%dx%d)\n",
 		ga_gettid(), iid,
@@ -215,44 +352,65 @@ filter_RGB2YUV_threadproc(void *arg) {
 		srcdata = dpipe_load(srcpipe, NULL);
 		if(srcdata == NULL) {
 			ga_error("RGB2YUV filter: unexpected NULL frame received (from '%s', data=%d, buf=%d).\n",
-				srcpipe->name, srcpipe->out_count, srcpipe->in_count);
+				srcpipe->name, srcpipe->ctl->out_count, srcpipe->ctl->in_count);
 			exit(-1);
 			// should never be here
 			goto filter_quit;
 		}
 		srcframe = (vsource_frame_t*) srcdata->pointer;
+		// unchanged: nothing to convert and encode
+		if(srcframe->unchanged) {
+			dpipe_put(srcpipe, srcdata);
+			continue;
+		}
+		ga_trace(GA_TRACE_FILTER_START, iid, srcframe->timestamp);
 		//
 		dstdata = dpipe_get(dstpipe);
 		dstframe = (vsource_frame_t*) dstdata->pointer;
 		// basic info
 		dstframe->imgpts = srcframe->imgpts;
 		dstframe->timestamp = srcframe->timestamp;
-		dstframe->pixelformat = AV_PIX_FMT_YUV420P;	//yuv420p;
-		dstframe->realwidth = outputW;
-		dstframe->realheight = outputH;
-		dstframe->realstride = outputW;
-		dstframe->realsize = outputW * outputH * 3 / 2;
+		// the output resolution may be changed at runtime
+		video_source_out_size(iid, &outputW, &outputH);
+		if(vsource_frame_setup(dstframe, outputFmt, outputW, outputH) < 0) {
+			ga_error("RGB2YUV filter: fatal - cannot setup output frame.\n");
+			exit(-1);
+		}
+		// no scaling, or downscaling by 2 or 4: RGBA or BGRA are
+		// converted by SIMD kernels, and frames are converted in bands
+		// by the shared workers
+		scale = vconv_rgb2yuv_scale(srcframe->realwidth, srcframe->realheight,
+				outputW, outputH);
+		fastconv = filter_fastconv
+			&& scale > 0
+			&& vconv_rgb2yuv_supported(srcframe->pixelformat, outputFmt);
+		nbands = 1;
+		if(fastconv || scale == 1) {
+			nbands = filter_bands;
+			if(nbands > outputH / MINBANDROWS)
+				nbands = outputH / MINBANDROWS > 0 ? outputH / MINBANDROWS : 1;
+		}
+		band.swsctx = NULL;
+		if(fastconv == 0 && nbands > 1) {
+			band.swsctx = filter_RGB2YUV_bandctx(&bandctx, nbands,
+					outputW, outputH, srcframe->pixelformat, outputFmt);
+			if(band.swsctx == NULL)
+				nbands = 1;
+		}
 		// scale image: RGBA, BGRA, or YUV
-		swsctx = lookup_frame_converter(
+		if(fastconv == 0 && nbands == 1) {
+			swsctx = vconv_thread_converter(
 				srcframe->realwidth,
 				srcframe->realheight,
 				srcframe->pixelformat,
 				dstframe->realwidth,
 				dstframe->realheight,
 				dstframe->pixelformat);
-		if(swsctx == NULL) {
-			swsctx = create_frame_converter(
-				srcframe->realwidth,
-				srcframe->realheight,
-				srcframe->pixelformat,
-				dstframe->realwidth,
-				dstframe->realheight,
-				dstframe->pixelformat);
-		}
-		if(swsctx == NULL) {
-			ga_error("RGB2YUV filter: fatal - cannot create frame converter (%d,%d,%d)->(%x,%d,%d)\n",
-				srcframe->realwidth, srcframe->realheight, srcframe->pixelformat,
-				dstframe->realwidth, dstframe->realheight, dstframe->pixelformat);
+			if(swsctx == NULL) {
+				ga_error("RGB2YUV filter: fatal - cannot create frame converter (%d,%d,%d)->(%x,%d,%d)\n",
+					srcframe->realwidth, srcframe->realheight, srcframe->pixelformat,
+					dstframe->realwidth, dstframe->realheight, dstframe->pixelformat);
+			}
 		}
 		//
 		if(srcframe->pixelformat == AV_PIX_FMT_RGBA
@@ -261,6 +419,11 @@ filter_RGB2YUV_threadproc(void *arg) {
 			src[1] = NULL;
 			srcstride[0] = srcframe->realstride; //srcframe->stride;
 			srcstride[1] = 0;
+			// bottom-up: flip while converting with a negative stride
+			if(srcframe->flipped) {
+				src[0] += (srcframe->realheight - 1) * srcframe->realstride;
+				srcstride[0] = -srcframe->realstride;
+			}
 		} else if(srcframe->pixelformat == AV_PIX_FMT_YUV420P) {
 			src[0] = srcframe->imgbuf;
 			src[1] = src[0] + ((srcframe->realwidth * srcframe->realheight));
@@ -275,27 +438,38 @@ filter_RGB2YUV_threadproc(void *arg) {
 			exit(-1);
 		}
 		//
-		dst[0] = dstframe->imgbuf;
-		dst[1] = dstframe->imgbuf + outputH*outputW;
-		dst[2] = dstframe->imgbuf + outputH*outputW + (outputH*outputW>>2);
-		dst[3] = NULL;
-		dstframe->linesize[0] = dststride[0] = outputW;
-		dstframe->linesize[1] = dststride[1] = outputW>>1;
-		dstframe->linesize[2] = dststride[2] = outputW>>1;
-		dstframe->linesize[3] = dststride[3] = 0;
+		vsource_frame_planes(dstframe, dst);
 		//
-		sws_scale(swsctx,
-			src, srcstride, 0, srcframe->realheight,
-			dst, dstframe->linesize);
+		if(fastconv || nbands > 1) {
+			band.srcfmt = srcframe->pixelformat;
+			band.src = src;
+			band.srcstride = srcstride;
+			band.dstfmt = outputFmt;
+			band.dst = dst;
+			band.dststride = dstframe->linesize;
+			band.width = outputW;
+			band.height = outputH;
+			band.scale = fastconv ? scale : 1;
+			band.nbands = nbands;
+			ga_parallel_run(nbands, filter_RGB2YUV_band, &band);
+		} else {
+			sws_scale(swsctx,
+				src, srcstride, 0, srcframe->realheight,
+				dst, dstframe->linesize);
+		}
 		// embed first, and then save
 #ifdef ENABLE_EMBED_COLORCODE
 		vsource_embed_colorcode_inc(dstframe);
 #endif
 		// only save the first channel
 		if(iid == 0 && savefp != NULL) {
-			ga_save_yuv420p(savefp, outputW, outputH, dst, dstframe->linesize);
+			if(outputFmt == AV_PIX_FMT_NV12)
+				ga_save_nv12(savefp, outputW, outputH, dst, dstframe->linesize);
+			else
+				ga_save_yuv420p(savefp, outputW, outputH, dst, dstframe->linesize);
 		}
 		//
+		ga_trace(GA_TRACE_FILTER_END, iid, dstframe->timestamp);
 		dpipe_put(srcpipe, srcdata);
 		dpipe_store(dstpipe, dstdata);
 		//
@@ -310,7 +484,8 @@ filter_quit:
 		dstpipe = NULL;
 	}
 	//
-	if(swsctx)	sws_freeContext(swsctx);
+	// swsctx is owned by the per-thread converter cache
+	filter_RGB2YUV_bandctx(&bandctx, 0, 0, 0, AV_PIX_FMT_NONE, AV_PIX_FMT_NONE);
 	//
 	ga_error("RGB2YUV filter: thread terminated.\n");
 	//
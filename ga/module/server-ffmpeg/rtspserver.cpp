@@ -373,7 +373,8 @@ per_client_init(RTSPContext *ctx) {
 			rtspconf->video_encoder_codec,
 			video_source_out_width(i), video_source_out_height(i),
 			rtspconf->video_fps,
-			rtspconf->vso)) == NULL) {
+			rtspconf->vso,
+			video_source_out_pixelformat(i))) == NULL) {
 			//
 			ga_error("cannot init video encoder\n");
 			return -1;
@@ -697,7 +698,8 @@ rtp_new_av_stream(RTSPContext *ctx, struct sockaddr_in *sin, int streamid, enum
 				video_source_out_width(streamid),
 				video_source_out_height(streamid),
 				rtspconf->video_fps,
-				rtspconf->vso);
+				rtspconf->vso,
+				video_source_out_pixelformat(streamid));
 	} else if(codecid == rtspconf->audio_encoder_codec->id) {
 		encoder = ga_avcodec_aencoder_init(
 				stream->codec,
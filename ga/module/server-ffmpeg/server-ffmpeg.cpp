@@ -31,6 +31,8 @@
 
 #include "ga-common.h"
 #include "ga-module.h"
+#include "ga-trace.h"
+#include "vsource.h"
 #include "encoder-common.h"
 #include "rtspconf.h"
 
@@ -183,7 +185,7 @@ ff_server_deinit(void *arg) {
 }
 
 static int
-ff_server_send_packet_1(const char *prefix, void *ctx, int channelId, AVPacket *pkt, int64_t encoderPts, struct timeval *ptv) {
+ff_server_send_packet_1(const char *prefix, void *ctx, int channelId, AVPacket *pkt, int64_t encoderPts, int64_t ptime) {
 	int iolen;
 	uint8_t *iobuf;
 	RTSPContext *rtsp = (RTSPContext*) ctx;
@@ -249,11 +251,13 @@ ff_server_send_packet_1(const char *prefix, void *ctx, int channelId, AVPacket *
 }
 
 static int
-ff_server_send_packet(const char *prefix, int channelId, AVPacket *pkt, int64_t encoderPts, struct timeval *ptv) {
+ff_server_send_packet(const char *prefix, int channelId, AVPacket *pkt, int64_t encoderPts, int64_t ptime) {
 	map<void*, void*>::iterator mi;
+	if(ptime > 0 && channelId < video_source_channels())
+		ga_trace(GA_TRACE_SEND, channelId, ptime);
 	pthread_rwlock_rdlock(&cclock);
 	for(mi = client_context.begin(); mi != client_context.end(); mi++) {
-		ff_server_send_packet_1(prefix, mi->second, channelId, pkt, encoderPts, ptv);
+		ff_server_send_packet_1(prefix, mi->second, channelId, pkt, encoderPts, ptime);
 	}
 	pthread_rwlock_unlock(&cclock);
 	return 0;
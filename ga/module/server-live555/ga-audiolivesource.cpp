@@ -129,7 +129,7 @@ void GAAudioLiveSource
 		fFrameSize = newFrameSize;
 	}
 	//gettimeofday(&fPresentationTime, NULL); // If you have a more accurate time - e.g., from an encoder - then use that instead.
-	fPresentationTime = pkt.pts_tv;
+	ga_clock_timeval(pkt.pts_ns, &fPresentationTime);
 	// If the device is *not* a 'live source' (e.g., it comes instead from a file or buffer), then set "fDurationInMicroseconds" here.
 	memmove(fTo, newFrameDataStart, fFrameSize);
 
@@ -3,6 +3,7 @@
 #include <map>
 
 #include "ga-common.h"
+#include "ga-ratectl.h"
 #include "rtspconf.h"
 #include "encoder-common.h"
 #include "vsource.h"
@@ -118,6 +119,7 @@ qos_server_report(void *clientData) {
 			unsigned long long bytes_sent, d_byte_sent;
 			unsigned pkts_sent_hi, pkts_sent_lo;
 			unsigned bytes_sent_hi, bytes_sent_lo;
+			struct timeval rr_timestamp;
 			long long elapsed;
 			//
 			if((mj = mi->second.find(ssrc)) == mi->second.end()) {
@@ -127,6 +129,15 @@ qos_server_report(void *clientData) {
 				mi->second[ssrc] = qr;
 				continue;
 			}
+			// rate control: feed each new receiver report of video
+			rr_timestamp = stats->lastTimeReceived();
+			if(tvdiff_us(&rr_timestamp, &mj->second.rr_timestamp) != 0) {
+				mj->second.rr_timestamp = rr_timestamp;
+				if(strcmp(mi->first->sdpMediaType(), "video") == 0) {
+					ga_ratectl_rtcp(stats->packetLossRatio() / 256.0,
+						stats->roundTripDelay());
+				}
+			}
 			//
 			elapsed = tvdiff_us(&now, &mj->second.timestamp);
 			if(elapsed < QOS_SERVER_REPORT_INTERVAL_MS * 1000)
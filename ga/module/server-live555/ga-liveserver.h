@@ -34,6 +34,7 @@ typedef struct qos_server_record_s {
 	unsigned long long pkts_sent;
 	unsigned long long bytes_sent;
 	struct timeval timestamp;
+	struct timeval rr_timestamp;	/* time of the last receiver report */
 }	qos_server_record_t;
 
 void * liveserver_taskscheduler();
@@ -20,6 +20,7 @@
 #include <H265VideoStreamDiscreteFramer.hh>
 #include <H264VideoStreamFramer.hh>
 #include <H265VideoStreamFramer.hh>
+#include <Base64.hh>
 
 #include "ga-common.h"
 #include "ga-conf.h"
@@ -37,6 +38,7 @@ GAMediaSubsession
 		: OnDemandServerMediaSubsession(env, True/*reuseFirstSource*/, initialPortNum, multiplexRTCPWithRTP) {
 	this->mimetype = strdup(mimetype);
 	this->channelId = cid;
+	this->spsSize = this->ppsSize = 0;
 }
 
 GAMediaSubsession * GAMediaSubsession
@@ -157,6 +159,12 @@ RTPSink* GAMediaSubsession
 		}
 		PPSSize = mb.size;
 		//
+		// remember the parameter sets in the SDP lines, see sdpLines()
+		bcopy(SPS, this->sps, SPSSize);
+		this->spsSize = SPSSize;
+		bcopy(PPS, this->pps, PPSSize);
+		this->ppsSize = PPSSize;
+		//
 		if (SPSSize >= 1/*'profile_level_id' offset within SPS*/ + 3/*num bytes needed*/) {
 			profile_level_id = (SPS[1]<<16) | (SPS[2]<<8) | SPS[3];
 		}
@@ -215,3 +223,78 @@ RTPSink* GAMediaSubsession
 	return result;
 }
 
+/* replace the value of a fmtp parameter: returns new SDP lines, or NULL if not found */
+char * GAMediaSubsession
+::replaceFmtp(const char *lines, const char *name, const char *value) {
+	const char *begin, *end;
+	char *result;
+	int len;
+	//
+	if((begin = strstr(lines, name)) == NULL)
+		return NULL;
+	begin += strlen(name);
+	end = begin + strcspn(begin, ";\r\n");
+	len = (begin - lines) + strlen(value) + strlen(end);
+	result = new char[len + 1];
+	snprintf(result, len + 1, "%.*s%s%s", (int) (begin - lines), lines, value, end);
+	return result;
+}
+
+/*
+ * The encoder emits new SPS/PPS when it is reopened, e.g., on a resolution
+ * change. Existing clients get them in-band with the next IDR frame, and
+ * clients joining later get them from the updated sprop-parameter-sets.
+ * SDP lines are patched instead of rebuilt, because rebuilding creates
+ * another source for a running stream.
+ */
+char const* GAMediaSubsession
+::sdpLines() {
+	char const *lines = OnDemandServerMediaSubsession::sdpLines();
+	ga_module_t *m = encoder_get_vencoder();
+	ga_ioctl_buffer_t mb;
+	u_int8_t SPS[256]; int SPSSize = 0;
+	u_int8_t PPS[256]; int PPSSize = 0;
+	char *b64sps, *b64pps, *newlines, *tmp;
+	char value[1024];
+	//
+	if(lines == NULL || strcmp(this->mimetype, "video/H264") != 0)
+		return lines;
+	mb.id = this->channelId;
+	mb.ptr = SPS;
+	mb.size = sizeof(SPS);
+	if(ga_module_ioctl(m, GA_IOCTL_GETSPS, sizeof(mb), &mb) < 0)
+		return lines;
+	SPSSize = mb.size;
+	mb.id = this->channelId;
+	mb.ptr = PPS;
+	mb.size = sizeof(PPS);
+	if(ga_module_ioctl(m, GA_IOCTL_GETPPS, sizeof(mb), &mb) < 0)
+		return lines;
+	PPSSize = mb.size;
+	if(SPSSize < 4
+	|| (SPSSize == this->spsSize && memcmp(SPS, this->sps, SPSSize) == 0
+	 && PPSSize == this->ppsSize && memcmp(PPS, this->pps, PPSSize) == 0))
+		return lines;
+	// new parameter sets
+	b64sps = base64Encode((char*) SPS, SPSSize);
+	b64pps = base64Encode((char*) PPS, PPSSize);
+	snprintf(value, sizeof(value), "%s,%s", b64sps, b64pps);
+	delete[] b64sps;
+	delete[] b64pps;
+	if((newlines = replaceFmtp(lines, "sprop-parameter-sets=", value)) == NULL)
+		return lines;
+	snprintf(value, sizeof(value), "%06X", (SPS[1]<<16) | (SPS[2]<<8) | SPS[3]);
+	if((tmp = replaceFmtp(newlines, "profile-level-id=", value)) != NULL) {
+		delete[] newlines;
+		newlines = tmp;
+	}
+	delete[] fSDPLines;
+	fSDPLines = newlines;
+	bcopy(SPS, this->sps, SPSSize);
+	this->spsSize = SPSSize;
+	bcopy(PPS, this->pps, PPSSize);
+	this->ppsSize = PPSSize;
+	ga_error("GAMediaSubsession: %s SDP updated with new SPS(%d)/PPS(%d)\n",
+		this->mimetype, SPSSize, PPSSize);
+	return fSDPLines;
+}
@@ -26,7 +26,13 @@ class GAMediaSubsession : public OnDemandServerMediaSubsession {
 private:
 	const char *mimetype;
 	int channelId;
+	unsigned char sps[256];	/* SPS in the SDP lines */
+	int spsSize;
+	unsigned char pps[256];	/* PPS in the SDP lines */
+	int ppsSize;
+	char *replaceFmtp(const char *lines, const char *name, const char *value);
 public:
+	virtual char const* sdpLines();
 	static GAMediaSubsession * createNew(UsageEnvironment &env,
 			int cid, /* channel Id */
 			const char *mimetype = NULL,
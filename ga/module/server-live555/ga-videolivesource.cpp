@@ -17,6 +17,7 @@
  */
 
 #include "ga-common.h"
+#include "ga-trace.h"
 #include "vsource.h"
 #include "encoder-common.h"
 
@@ -152,7 +153,7 @@ void GAVideoLiveSource
 		fFrameSize = fMaxSize;
 #ifdef DISCRETE_FRAMER
 		fNumTruncatedBytes = newFrameSize - fMaxSize;
-		ga_error("video encoder: packet truncated (%d > %d).\n", newFrameSize, fMaxSize);
+		GA_ERROR_RATELIMITED("video encoder: packet truncated (%d > %d).\n", newFrameSize, fMaxSize);
 #else		// for regular H264Framer
 		encoder_pktqueue_split_packet(this->channelId, (char*) newFrameDataStart + fMaxSize);
 #endif
@@ -160,7 +161,8 @@ void GAVideoLiveSource
 		fFrameSize = newFrameSize;
 	}
 	//gettimeofday(&fPresentationTime, NULL); // If you have a more accurate time - e.g., from an encoder - then use that instead.
-	fPresentationTime = pkt.pts_tv;
+	ga_clock_timeval(pkt.pts_ns, &fPresentationTime);
+	ga_trace(GA_TRACE_SEND, this->channelId, pkt.pts_ns);
 	// If the device is *not* a 'live source' (e.g., it comes instead from a file or buffer), then set "fDurationInMicroseconds" here.
 	memmove(fTo, newFrameDataStart, fFrameSize);
 
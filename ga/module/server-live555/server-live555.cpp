@@ -82,8 +82,8 @@ live_server_deinit(void *arg) {
 }
 
 static int
-live_server_send_packet(const char *prefix, int channelId, AVPacket *pkt, int64_t encoderPts, struct timeval *ptv) {
-	encoder_pktqueue_append(channelId, pkt, encoderPts, ptv);
+live_server_send_packet(const char *prefix, int channelId, AVPacket *pkt, int64_t encoderPts, int64_t ptime) {
+	encoder_pktqueue_append(channelId, pkt, encoderPts, ptime);
 	return 0;
 }
 
@@ -21,10 +21,40 @@
 #include <string.h>
 #include <sys/ipc.h>
 #include <sys/shm.h>
+#include <X11/extensions/Xdamage.h>
+#include <X11/extensions/Xfixes.h>
 
 #include "ga-common.h"
+#include "ga-conf.h"
 #include "ga-xwin.h"
 
+/** Max damaged rectangles fetched one by one, otherwise fetch the screen */
+#define	XWIN_MAX_RECTS		32
+/** Number of captures remembered to update frame buffers incrementally */
+#define	XWIN_HISTORY		16
+/** Number of frame buffers tracked */
+#define	XWIN_MAX_BUFFERS	32
+
+/**
+ * Damaged rectangles of a capture, in screen coordinates.
+ */
+typedef struct xwin_damage_s {
+	int full;		/**< Non-zero if the whole screen is damaged */
+	int count;		/**< Number of rectangles */
+	vsource_rect_t rect[XWIN_MAX_RECTS];
+}	xwin_damage_t;
+
+/**
+ * A frame buffer filled by ga_xwin_capture() and the capture it contains.
+ */
+typedef struct xwin_buffer_s {
+	char *buf;		/**< The frame buffer */
+	long long seq;		/**< Capture sequence number of the content */
+	XImage *ximage;		/**< Image on \a buf if it is a shared memory segment,
+				 * see ga_xwin_alloc_buffer() */
+	XShmSegmentInfo shminfo;	/**< The shared memory segment of \a ximage */
+}	xwin_buffer_t;
+
 static int screenNumber;
 static int width, height, depth;
 
@@ -37,6 +67,18 @@ static XImage *image = NULL;
 static XShmSegmentInfo __xshminfo;
 static bool __xshmattached = false;
 
+// XDamage: only damaged regions are fetched into image, and only regions
+// changed since the last capture of a frame buffer are copied into it
+static int damageEvent = 0;
+static Damage damage = None;
+static XShmSegmentInfo __xshmscratch;	/**< Fetch damaged rectangles */
+static bool __xshmscratchattached = false;
+static long long captureSeq = 0;	/**< Number of captures, 0: image is empty */
+static xwin_damage_t history[XWIN_HISTORY];
+static xwin_buffer_t buffers[XWIN_MAX_BUFFERS];
+static int nbuffers = 0;
+static int ndirect = 0;			/**< Number of shared memory frame buffers */
+
 int
 ga_xwin_init(const char *displayname, gaImage *gaimg) {
 	int ignore = 0;
@@ -97,6 +139,34 @@ ga_xwin_init(const char *displayname, gaImage *gaimg) {
 	//
 	__xshmattached = true;
 	rootWindow = XRootWindow(display, screenNumber);
+	// XDamage
+	if(ga_conf_readbool("xdamage", 1) != 0) {
+		int damageError;
+		if(XDamageQueryExtension(display, &damageEvent, &damageError) == False) {
+			ga_error("XDamage extension not supported, capture full screens.\n");
+		} else if((__xshmscratch.shmid = shmget(IPC_PRIVATE,
+				image->bytes_per_line*image->height,
+				IPC_CREAT | 0777)) < 0) {
+			perror("shmget");
+		} else if((__xshmscratch.shmaddr = (char*) shmat(__xshmscratch.shmid, 0, 0)) == (char*) -1) {
+			perror("shmat");
+			ga_error("XDamage scratch buffer unavailable, capture full screens.\n");
+			shmctl(__xshmscratch.shmid, IPC_RMID, NULL);
+			__xshmscratch.shmaddr = NULL;
+		} else {
+			__xshmscratch.readOnly = False;
+			if(XShmAttach(display, &__xshmscratch) == 0) {
+				ga_error("XShmAttach failed, capture full screens.\n");
+			} else {
+				__xshmscratchattached = true;
+				damage = XDamageCreate(display, rootWindow, XDamageReportNonEmpty);
+				ga_error("X-Window-init: capture damaged regions (XDamage)\n");
+			}
+		}
+	}
+	captureSeq = 0;
+	nbuffers = 0;
+	ndirect = 0;
 	gaimg->width = image->width;
 	gaimg->height = image->height;
 	gaimg->bytes_per_line = image->bytes_per_line;
@@ -111,6 +181,35 @@ xcap_init_error:
 void
 //ga_xwin_deinit(Display *display, XImage *image) {
 ga_xwin_deinit() {
+	int i;
+	// shared memory frame buffers
+	for(i = 0; i < nbuffers; i++) {
+		xwin_buffer_t *b = &buffers[i];
+		if(b->ximage == NULL)
+			continue;
+		XShmDetach(display, &b->shminfo);
+		shmdt(b->shminfo.shmaddr);
+		shmctl(b->shminfo.shmid, IPC_RMID, NULL);
+		b->ximage->data = NULL;
+		XDestroyImage(b->ximage);
+		b->ximage = NULL;
+	}
+	nbuffers = 0;
+	ndirect = 0;
+	//
+	if(damage != None) {
+		XDamageDestroy(display, damage);
+		damage = None;
+	}
+	if(__xshmscratchattached) {
+		XShmDetach(display, &__xshmscratch);
+		__xshmscratchattached = false;
+	}
+	if(__xshmscratch.shmaddr) {
+		shmdt(__xshmscratch.shmaddr);
+		shmctl(__xshmscratch.shmid, IPC_RMID, NULL);
+		__xshmscratch.shmaddr = NULL;
+	}
 	//
 	if(__xshmattached) {
 		XShmDetach(display, &__xshminfo);
@@ -130,6 +229,68 @@ ga_xwin_deinit() {
 	return;
 }
 
+/**
+ * Allocate a frame buffer that the X server can write into directly.
+ *
+ * @param size [in] Size of the frame buffer.
+ * @param rect [in] Captured area, or NULL for the whole screen.
+ *	Must be the same as the one passed to ga_xwin_capture().
+ * @return Pointer to the frame buffer, or NULL on failure.
+ *
+ * The frame buffer is a shared memory segment attached to the X server,
+ * so ga_xwin_capture() fetches the screen into the buffer without copying.
+ * The buffer is released by ga_xwin_deinit().
+ */
+char *
+ga_xwin_alloc_buffer(int size, struct gaRect *rect) {
+	xwin_buffer_t *b;
+	int w = rect ? rect->width : width;
+	int h = rect ? rect->height : height;
+	//
+	if(display == NULL || nbuffers >= XWIN_MAX_BUFFERS)
+		return NULL;
+	b = &buffers[nbuffers];
+	bzero(b, sizeof(xwin_buffer_t));
+	if((b->ximage = XShmCreateImage(display,
+			XDefaultVisual(display, screenNumber),
+			depth, ZPixmap, NULL, &b->shminfo, w, h)) == NULL) {
+		ga_error("XShmCreateImage failed.\n");
+		return NULL;
+	}
+	// frames are packed: rows must be in the layout of the frame
+	if(b->ximage->bytes_per_line != w * RGBA_SIZE
+	|| b->ximage->bytes_per_line * h > size) {
+		ga_error("X-Window: cannot capture into frame buffers (bytes-per-line=%d).\n",
+			b->ximage->bytes_per_line);
+		goto alloc_error;
+	}
+	if((b->shminfo.shmid = shmget(IPC_PRIVATE, size, IPC_CREAT | 0777)) < 0) {
+		perror("shmget");
+		goto alloc_error;
+	}
+	if((b->shminfo.shmaddr = (char*) shmat(b->shminfo.shmid, 0, 0)) == (char*) -1) {
+		perror("shmat");
+		shmctl(b->shminfo.shmid, IPC_RMID, NULL);
+		goto alloc_error;
+	}
+	b->shminfo.readOnly = False;
+	if(XShmAttach(display, &b->shminfo) == 0) {
+		ga_error("XShmAttach failed.\n");
+		shmdt(b->shminfo.shmaddr);
+		shmctl(b->shminfo.shmid, IPC_RMID, NULL);
+		goto alloc_error;
+	}
+	b->ximage->data = b->buf = b->shminfo.shmaddr;
+	b->seq = 0;
+	nbuffers++;
+	ndirect++;
+	return b->buf;
+alloc_error:
+	XDestroyImage(b->ximage);
+	b->ximage = NULL;
+	return NULL;
+}
+
 void
 ga_xwin_imageinfo(XImage *image) {
 	ga_error("ga-imageinfo: %dx%dx%d xoffset=%d format=%d byte-order=%d\n",
@@ -144,19 +305,13 @@ ga_xwin_imageinfo(XImage *image) {
 	return;
 }
 
-void
-ga_xwin_capture(char *buf, int buflen, struct gaRect *rect) {
-	int frameSize = image->height * image->bytes_per_line;
-	if(buflen < frameSize) {
-		ga_error("FATAL: insufficient buffer size\n");
-		exit(-1);
-	}
-	if(XShmGetImage(display, rootWindow, image, 0, 0, XAllPlanes()) == 0) {
-		ga_error("FATAL: XShmGetImage failed.\n");
-		exit(-1);
-	}
+/**
+ * Copy the captured area of the screen image into a frame buffer.
+ */
+static void
+ga_xwin_copyrect_full(char *buf, struct gaRect *rect) {
 	if(rect == NULL) {
-		bcopy(image->data, buf, frameSize/*buflen*/);
+		bcopy(image->data, buf, image->height * image->bytes_per_line);
 	} else {
 		int i;
 		char *src, *dst;
@@ -174,3 +329,313 @@ ga_xwin_capture(char *buf, int buflen, struct gaRect *rect) {
 	return;
 }
 
+/**
+ * Extend rectangle \a a to cover rectangle \a b.
+ */
+static void
+ga_xwin_mergerect(vsource_rect_t *a, vsource_rect_t *b) {
+	int x1 = a->x + a->width, y1 = a->y + a->height;
+	if(b->x + b->width > x1)	x1 = b->x + b->width;
+	if(b->y + b->height > y1)	y1 = b->y + b->height;
+	if(b->x < a->x)	a->x = b->x;
+	if(b->y < a->y)	a->y = b->y;
+	a->width = x1 - a->x;
+	a->height = y1 - a->y;
+	return;
+}
+
+/**
+ * Fetch an image of the root window.
+ *
+ * @param img [in] A shared memory image.
+ * @param x [in] Left of the fetched area.
+ * @param y [in] Top of the fetched area.
+ */
+static void
+ga_xwin_getimage(XImage *img, int x, int y) {
+	if(XShmGetImage(display, rootWindow, img, x, y, XAllPlanes()) == 0) {
+		ga_error("FATAL: XShmGetImage failed.\n");
+		exit(-1);
+	}
+	return;
+}
+
+/**
+ * Fetch a rectangle of the root window through the scratch segment.
+ *
+ * @param r [in] The rectangle, in screen coordinates.
+ * @param dst [in] Where to store the top-left pixel of the rectangle.
+ * @param linesize [in] Bytes per line of \a dst.
+ */
+static void
+ga_xwin_fetchrect(vsource_rect_t *r, char *dst, int linesize) {
+	XImage *sub;
+	char *src;
+	int y;
+	if((sub = XShmCreateImage(display,
+			XDefaultVisual(display, screenNumber),
+			depth, ZPixmap, __xshmscratch.shmaddr, &__xshmscratch,
+			r->width, r->height)) == NULL) {
+		ga_error("FATAL: XShmCreateImage failed.\n");
+		exit(-1);
+	}
+	ga_xwin_getimage(sub, r->x, r->y);
+	src = sub->data;
+	for(y = 0; y < r->height; y++) {
+		bcopy(src, dst, r->width * RGBA_SIZE);
+		src += sub->bytes_per_line;
+		dst += linesize;
+	}
+	// the data belongs to the scratch segment
+	sub->data = NULL;
+	XDestroyImage(sub);
+	return;
+}
+
+/**
+ * Collect damaged rectangles of the root window.
+ *
+ * @param d [out] Damaged rectangles.
+ * @param full [in] Non-zero to mark the whole screen as damaged.
+ */
+static void
+ga_xwin_poll_damage(xwin_damage_t *d, int full) {
+	XserverRegion region;
+	XRectangle *xr;
+	XEvent ev;
+	long long area = 0;
+	int i, n = 0;
+	// damage notifications are not used, just drop them
+	while(XPending(display) > 0)
+		XNextEvent(display, &ev);
+	region = XFixesCreateRegion(display, NULL, 0);
+	XDamageSubtract(display, damage, None, region);
+	xr = XFixesFetchRegion(display, region, &n);
+	XFixesDestroyRegion(display, region);
+	//
+	d->full = full;
+	d->count = 0;
+	for(i = 0; i < n; i++) {
+		vsource_rect_t *r = &d->rect[d->count];
+		r->x = xr[i].x < 0 ? 0 : xr[i].x;
+		r->y = xr[i].y < 0 ? 0 : xr[i].y;
+		r->width = (xr[i].x + xr[i].width > width ? width : xr[i].x + xr[i].width) - r->x;
+		r->height = (xr[i].y + xr[i].height > height ? height : xr[i].y + xr[i].height) - r->y;
+		if(r->width <= 0 || r->height <= 0)
+			continue;
+		area += r->width * r->height;
+		if(++d->count == XWIN_MAX_RECTS)
+			break;
+	}
+	if(xr != NULL)
+		XFree(xr);
+	// too many rectangles or a large area: one fetch is faster
+	if(d->full || i < n || area * 2 > (long long) width * height) {
+		d->full = 1;
+		d->count = 0;
+	}
+	return;
+}
+
+/**
+ * Fetch damaged rectangles of the root window into the screen image.
+ *
+ * @param d [in] Damaged rectangles, see ga_xwin_poll_damage().
+ */
+static void
+ga_xwin_fetch_damage(xwin_damage_t *d) {
+	int i;
+	if(d->full) {
+		ga_xwin_getimage(image, 0, 0);
+		return;
+	}
+	for(i = 0; i < d->count; i++) {
+		vsource_rect_t *r = &d->rect[i];
+		ga_xwin_fetchrect(r,
+			image->data + r->y * image->bytes_per_line + r->x * RGBA_SIZE,
+			image->bytes_per_line);
+	}
+	return;
+}
+
+/**
+ * Clip a rectangle to the captured area.
+ *
+ * @param r [in,out] The rectangle, in screen coordinates.
+ * @param rect [in] Captured area, or NULL for the whole screen.
+ * @return 0 if the clipped rectangle is empty, or non-zero otherwise.
+ */
+static int
+ga_xwin_cliprect(vsource_rect_t *r, struct gaRect *rect) {
+	int x1 = r->x + r->width, y1 = r->y + r->height;
+	if(rect == NULL)
+		return r->width > 0 && r->height > 0;
+	if(r->x < rect->left)		r->x = rect->left;
+	if(r->y < rect->top)		r->y = rect->top;
+	if(x1 > rect->right + 1)	x1 = rect->right + 1;
+	if(y1 > rect->bottom + 1)	y1 = rect->bottom + 1;
+	if(r->x >= x1 || r->y >= y1)
+		return 0;
+	r->width = x1 - r->x;
+	r->height = y1 - r->y;
+	return 1;
+}
+
+/**
+ * Copy a rectangle of the screen image into a frame buffer.
+ */
+static void
+ga_xwin_copyrect(char *buf, struct gaRect *rect, vsource_rect_t *r) {
+	vsource_rect_t c = *r;
+	int y, linesize;
+	char *src, *dst;
+	//
+	if(ga_xwin_cliprect(&c, rect) == 0)
+		return;
+	src = image->data + c.y * image->bytes_per_line + c.x * RGBA_SIZE;
+	if(rect == NULL) {
+		linesize = image->bytes_per_line;
+		dst = buf + c.y * linesize + c.x * RGBA_SIZE;
+	} else {
+		linesize = rect->linesize;
+		dst = buf + (c.y - rect->top) * linesize + (c.x - rect->left) * RGBA_SIZE;
+	}
+	for(y = 0; y < c.height; y++) {
+		bcopy(src, dst, c.width * RGBA_SIZE);
+		src += image->bytes_per_line;
+		dst += linesize;
+	}
+	return;
+}
+
+/**
+ * Fetch a rectangle of the root window into a shared memory frame buffer.
+ */
+static void
+ga_xwin_fetchrect_direct(xwin_buffer_t *b, struct gaRect *rect, vsource_rect_t *r) {
+	vsource_rect_t c = *r;
+	int linesize = b->ximage->bytes_per_line;
+	int x, y;
+	//
+	if(ga_xwin_cliprect(&c, rect) == 0)
+		return;
+	x = rect ? c.x - rect->left : c.x;
+	y = rect ? c.y - rect->top : c.y;
+	ga_xwin_fetchrect(&c, b->buf + y * linesize + x * RGBA_SIZE, linesize);
+	return;
+}
+
+/**
+ * Capture the screen.
+ *
+ * @param buf [in] Frame buffer to store the captured image.
+ * @param buflen [in] Size of \a buf.
+ * @param rect [in] Captured area, or NULL for the whole screen.
+ * @param dirty [out] Regions of \a rect changed since the previous capture.
+ * @param maxdirty [in] Max number of rectangles in \a dirty.
+ * @return Number of rectangles in \a dirty, 0 if nothing changed,
+ *	or -1 if unknown: the whole screen may have changed.
+ *
+ * If \a buf is allocated by ga_xwin_alloc_buffer(), the X server writes
+ * into \a buf directly. Otherwise the screen is fetched into a shared
+ * image and then copied into \a buf.
+ *
+ * With XDamage, only damaged regions are fetched from the X server.
+ * Frame buffers are usually reused in a pipe, so only the regions
+ * changed since the last capture stored in \a buf are updated.
+ * Regions are merged into their bounding box if there are more than
+ * \a maxdirty regions.
+ */
+int
+ga_xwin_capture(char *buf, int buflen, struct gaRect *rect, vsource_rect_t *dirty, int maxdirty) {
+	int frameSize = rect ? rect->height * rect->linesize : image->height * image->bytes_per_line;
+	xwin_damage_t *d;
+	xwin_buffer_t *b = NULL;
+	long long seq;
+	int i, ndirty, merged = 0;
+	//
+	if(buflen < frameSize) {
+		ga_error("FATAL: insufficient buffer size\n");
+		exit(-1);
+	}
+	for(i = 0; i < nbuffers; i++) {
+		if(buffers[i].buf == buf) {
+			b = &buffers[i];
+			break;
+		}
+	}
+	if(damage == None) {
+		if(b != NULL && b->ximage != NULL) {
+			ga_xwin_getimage(b->ximage, rect ? rect->left : 0, rect ? rect->top : 0);
+			return -1;
+		}
+		ga_xwin_getimage(image, 0, 0);
+		ga_xwin_copyrect_full(buf, rect);
+		return -1;
+	}
+	// collect damaged regions: the screen image is not used
+	// if the X server writes into frame buffers directly
+	d = &history[(captureSeq + 1) % XWIN_HISTORY];
+	ga_xwin_poll_damage(d, captureSeq == 0);
+	captureSeq++;
+	if(ndirect == 0) {
+		ga_xwin_fetch_damage(d);
+		if(b == NULL) {
+			b = &buffers[nbuffers < XWIN_MAX_BUFFERS ? nbuffers++ : captureSeq % XWIN_MAX_BUFFERS];
+			b->buf = buf;
+			b->seq = 0;
+		}
+	}
+	// update the frame buffer
+	if(b == NULL) {
+		// an unknown buffer among shared memory buffers
+		ga_xwin_getimage(image, 0, 0);
+		ga_xwin_copyrect_full(buf, rect);
+	} else {
+		for(seq = b->seq + 1; b->seq > 0 && seq <= captureSeq; seq++) {
+			if(captureSeq - seq >= XWIN_HISTORY || history[seq % XWIN_HISTORY].full)
+				break;
+		}
+		if(b->seq == 0 || seq <= captureSeq) {
+			if(b->ximage != NULL)
+				ga_xwin_getimage(b->ximage, rect ? rect->left : 0, rect ? rect->top : 0);
+			else
+				ga_xwin_copyrect_full(buf, rect);
+		} else {
+			for(seq = b->seq + 1; seq <= captureSeq; seq++) {
+				xwin_damage_t *h = &history[seq % XWIN_HISTORY];
+				for(i = 0; i < h->count; i++) {
+					if(b->ximage != NULL)
+						ga_xwin_fetchrect_direct(b, rect, &h->rect[i]);
+					else
+						ga_xwin_copyrect(buf, rect, &h->rect[i]);
+				}
+			}
+		}
+		b->seq = captureSeq;
+	}
+	// report changed regions in frame coordinates
+	if(d->full || (maxdirty < 1 && d->count > 0))
+		return -1;
+	for(i = 0, ndirty = 0; i < d->count; i++) {
+		vsource_rect_t r = d->rect[i];
+		if(ga_xwin_cliprect(&r, rect) == 0)
+			continue;
+		if(rect != NULL) {
+			r.x -= rect->left;
+			r.y -= rect->top;
+		}
+		if(merged == 0 && ndirty < maxdirty) {
+			dirty[ndirty++] = r;
+			continue;
+		}
+		// too many: merge into the bounding box
+		if(merged == 0) {
+			while(ndirty > 1)
+				ga_xwin_mergerect(&dirty[0], &dirty[--ndirty]);
+			merged = 1;
+		}
+		ga_xwin_mergerect(&dirty[0], &r);
+	}
+	return ndirty;
+}
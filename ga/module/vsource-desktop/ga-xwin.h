@@ -24,6 +24,7 @@
 #include <X11/extensions/XShm.h>
 
 #include "ga-common.h"
+#include "vsource.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -33,7 +34,8 @@ extern "C" {
 int	ga_xwin_init(const char *displayname, gaImage *gaimg);
 void	ga_xwin_deinit();
 void	ga_xwin_imageinfo(XImage *image);
-void	ga_xwin_capture(char *buf, int buflen, struct gaRect *rect);
+char *	ga_xwin_alloc_buffer(int size, struct gaRect *rect);
+int	ga_xwin_capture(char *buf, int buflen, struct gaRect *rect, vsource_rect_t *dirty, int maxdirty);
 #ifdef __cplusplus
 }
 #endif
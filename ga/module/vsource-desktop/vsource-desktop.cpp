@@ -27,10 +27,12 @@
 
 #include "vsource.h"
 #include "dpipe.h"
+#include "ga-trace.h"
 #include "encoder-common.h"
 #include "rtspconf.h"
 
 #include "ga-common.h"
+#include "ga-conf.h"
 
 #ifdef WIN32
 #include "ga-win32-common.h"
@@ -68,6 +70,13 @@ static int vsource_initialized = 0;
 static int vsource_started = 0;
 static pthread_t vsource_tid;
 
+/* capture pacing statistics, reported when the encoder stops */
+static ga_hist_t jitterHist;		/* lateness of captures, in us */
+static long long jitterFrames = 0;
+static long long jitterSum = 0;		/* in ns */
+static long long jitterMax = 0;		/* in ns */
+static long long jitterMissed = 0;	/* capture slots skipped */
+
 /* support reconfiguration of frame rate */
 static int vsource_framerate_n = -1;
 static int vsource_framerate_d = -1;
@@ -152,10 +161,34 @@ vsource_init(void *arg) {
 			config[i].curr_width = prect ? prect->width : image->width;
 			config[i].curr_height = prect ? prect->height : image->height;
 			config[i].curr_stride = prect ? prect->linesize : image->bytes_per_line;
+#if !defined(WIN32) && !defined(__APPLE__) && !defined(ANDROID)
+			// X11: frames are shared memory segments written by the X server
+			config[i].extbuf = 1;
+#endif
 		}
 		if(video_source_setup_ex(config, SOURCES) < 0) {
 			return -1;
 		}
+#if !defined(WIN32) && !defined(__APPLE__) && !defined(ANDROID)
+		for(i = 0; i < SOURCES; i++) {
+			char pipename[64];
+			dpipe_t *pipe;
+			dpipe_buffer_t *data;
+			snprintf(pipename, sizeof(pipename), VIDEO_SOURCE_PIPEFORMAT, i);
+			if((pipe = dpipe_lookup(pipename)) == NULL)
+				return -1;
+			for(data = pipe->in; data != NULL; data = data->next) {
+				vsource_frame_t *frame = (vsource_frame_t*) data->pointer;
+				if(frame->imgbuf != NULL)
+					continue;
+				frame->imgbuf = (unsigned char*) ga_xwin_alloc_buffer(frame->imgbufsize, prect);
+				if(frame->imgbuf == NULL) {
+					ga_error("video source: cannot allocate shared memory frame buffers.\n");
+					return -1;
+				}
+			}
+		}
+#endif
 	} while(0);
 #else
 	if(video_source_setup(
@@ -170,19 +203,45 @@ vsource_init(void *arg) {
 	return 0;
 }
 
+/*
+ * report and reset capture pacing statistics
+ */
+static void
+vsource_report_jitter() {
+	long long count[GA_HIST_BUCKETS], n = 0;
+	int i;
+	if(jitterFrames == 0)
+		return;
+	ga_hist_snapshot(&jitterHist, count);
+	for(i = 0; i < GA_HIST_BUCKETS-1; i++) {
+		n += count[i];
+		if(n * 100 >= jitterFrames * 99)
+			break;
+	}
+	ga_error("video source: %lld frames, jitter avg=%lldus p99<%lldus max=%lldus, %lld frames missed\n",
+		jitterFrames, jitterSum / jitterFrames / 1000LL,
+		i == 0 ? 1LL : (1LL << i), jitterMax / 1000LL, jitterMissed);
+	bzero(&jitterHist, sizeof(jitterHist));
+	jitterFrames = jitterSum = jitterMax = jitterMissed = 0;
+	return;
+}
+
 /*
  * vsource_threadproc accepts no arguments
  */
 static void *
 vsource_threadproc(void *arg) {
 	int i;
-	int token;
+	long long period;	// frame interval in ns
+	long long deadline, jitter;
 	int frame_interval;
-	struct timeval tv;
 	dpipe_buffer_t *data;
 	vsource_frame_t *frame;
 	dpipe_t *pipe[SOURCES];
-	struct timeval initialTv, lastTv, captureTv;
+	long long initialTime, captureTime;
+	long long lastFullTime = 0LL, refreshInterval = 0LL;
+	vsource_hash_t *hash = NULL;
+	int changed, refresh, damaged;
 	struct RTSPConf *rtspconf = rtspconf_global();
 	// reset framerate setup
 	vsource_framerate_n = rtspconf->video_fps;
@@ -191,6 +250,7 @@ vsource_threadproc(void *arg) {
 	//
 	frame_interval = 1000000/rtspconf->video_fps;	// in the unif of us
 	frame_interval++;
+	period = 1000000000LL / rtspconf->video_fps;
 #ifdef ENABLE_EMBED_COLORCODE
 	vsource_embed_colorcode_reset();
 #endif
@@ -202,42 +262,55 @@ vsource_threadproc(void *arg) {
 			exit(-1);
 		}
 	}
+	// skip unchanged frames?
+	if(ga_conf_readbool("static-frame-skip", 1) != 0) {
+		refreshInterval = ga_conf_readint("static-frame-refresh");
+		if(refreshInterval <= 0)
+			refreshInterval = 1000;
+		ga_error("video source: skip unchanged frames, refresh every %lld ms\n", refreshInterval);
+		refreshInterval *= 1000000LL;
+		if((hash = vsource_hash_create()) == NULL)
+			ga_error("video source: cannot detect unchanged frames.\n");
+	}
 	//
 	ga_error("video source thread started: tid=%ld\n", ga_gettid());
-	gettimeofday(&initialTv, NULL);
-	lastTv = initialTv;
-	token = frame_interval;
+	initialTime = ga_clock_ns();
+	deadline = initialTime;
 	while(vsource_started != 0) {
-		// encoder has not launched?
+		// encoder has not launched? wait for a client
 		if(encoder_running() == 0) {
-#ifdef WIN32
-			Sleep(1);
-#else
-			usleep(1000);
-#endif
-			gettimeofday(&lastTv, NULL);
-			token = frame_interval;
+			struct timeval tv;
+			struct timespec to;
+			vsource_report_jitter();
+			gettimeofday(&tv, NULL);
+			to.tv_sec = tv.tv_sec+1;
+			to.tv_nsec = tv.tv_usec * 1000;
+			encoder_wait_running(&to);
+			deadline = ga_clock_ns();
 			continue;
 		}
-		// token bucket based capturing
-		gettimeofday(&captureTv, NULL);
-		token += tvdiff_us(&captureTv, &lastTv);
-		if(token > (frame_interval<<1)) {
-			token = (frame_interval<<1);
+		// capture at absolute deadlines, so that delays do not accumulate
+		ga_sleep_until_ns(deadline);
+		captureTime = ga_clock_ns();
+		jitter = captureTime - deadline;
+		jitterFrames++;
+		jitterSum += jitter;
+		if(jitter > jitterMax)
+			jitterMax = jitter;
+		ga_hist_add(&jitterHist, jitter / 1000LL);
+		if(jitter >= period) {
+			// late for a whole frame: skip the missed slots
+			jitterMissed += jitter / period;
+			deadline = captureTime + period;
+		} else {
+			deadline += period;
 		}
-		lastTv = captureTv;
-		//
-		if(token < frame_interval) {
-#ifdef WIN32
-			Sleep(1);
-#else
-			usleep(1000);
-#endif
+		// copy image 
+		if((data = dpipe_get(pipe[0])) == NULL) {
+			// all buffers are still shared with lagging channels
+			GA_ERROR_RATELIMITED("video source: no free frame buffer, frame skipped.\n");
 			continue;
 		}
-		token -= frame_interval;
-		// copy image 
-		data = dpipe_get(pipe[0]);
 		frame = (vsource_frame_t*) data->pointer;
 #ifdef __APPLE__
 		frame->pixelformat = AV_PIX_FMT_RGBA;
@@ -260,6 +333,7 @@ vsource_threadproc(void *arg) {
 		////////////////////////////////////////
 		}
 		frame->linesize[0] = frame->realstride/*frame->stride*/;
+		damaged = -1;
 #ifdef WIN32
 	#ifdef D3D_CAPTURE
 		ga_win32_D3D_capture((char*) frame->imgbuf, frame->imgbufsize, prect);
@@ -273,28 +347,52 @@ vsource_threadproc(void *arg) {
 #elif defined ANDROID
 		ga_androidvideo_capture((char*) frame->imgbuf, frame->imgbufsize);
 #else // X11
-		ga_xwin_capture((char*) frame->imgbuf, frame->imgbufsize, prect);
+		damaged = ga_xwin_capture((char*) frame->imgbuf, frame->imgbufsize, prect,
+				frame->dirty, VIDEO_SOURCE_MAX_DIRTY);
 #endif
+		frame->dirtycount = damaged > 0 ? damaged : 0;
 		// draw cursor
 #ifdef WIN32
 		ga_win32_draw_system_cursor(frame);
 #endif
+		// unchanged frames are skipped by the filter and the encoder,
+		// but a full frame is delivered periodically and on requests
+		frame->unchanged = 0;
+		if(hash != NULL) {
+			// damage reports tell the changes without hashing
+			if(damaged >= 0) {
+				changed = damaged;
+				vsource_hash_reset(hash);
+			} else {
+				changed = vsource_hash_update(hash, frame->imgbuf,
+					frame->realwidth * 4, frame->realheight, frame->realstride);
+			}
+			refresh = 0;
+			for(i = 0; i < SOURCES; i++)
+				refresh |= video_source_refresh_requested(i);
+			if(changed == 0 && refresh == 0
+			&& captureTime - lastFullTime < refreshInterval) {
+				frame->unchanged = 1;
+			} else {
+				lastFullTime = captureTime;
+				if(changed == 0 || refresh != 0)
+					frame->dirtycount = 0;
+			}
+		}
 		//gImgPts++;
-		frame->imgpts = tvdiff_us(&captureTv, &initialTv)/frame_interval;
-		frame->timestamp = captureTv;
+		frame->imgpts = (captureTime - initialTime) / 1000LL / frame_interval;
+		frame->timestamp = captureTime;
+		ga_trace(GA_TRACE_CAPTURE, 0, frame->timestamp);
 		// embed color code?
 #ifdef ENABLE_EMBED_COLORCODE
 		vsource_embed_colorcode_inc(frame);
+		frame->dirtycount = 0;
 #endif
-		// duplicate from channel 0 to other channels
+		// share from channel 0 to other channels: no copy
 		for(i = 1; i < SOURCES; i++) {
 			dpipe_buffer_t *dupdata;
-			vsource_frame_t *dupframe;
-			dupdata = dpipe_get(pipe[i]);
-			dupframe = (vsource_frame_t*) dupdata->pointer;
-			//
-			vsource_dup_frame(frame, dupframe);
-			//
+			if((dupdata = dpipe_share(pipe[i], data)) == NULL)
+				continue;
 			dpipe_store(pipe[i], dupdata);
 		}
 		dpipe_store(pipe[0], data);
@@ -302,12 +400,15 @@ vsource_threadproc(void *arg) {
 		if(vsource_reconfigured != 0) {
 			frame_interval = (int) (1000000.0 * vsource_framerate_d / vsource_framerate_n);
 			frame_interval++;
+			period = 1000000000LL * vsource_framerate_d / vsource_framerate_n;
 			vsource_reconfigured = 0;
 			ga_error("video source: reconfigured - framerate=%d/%d (interval=%d)\n",
 				vsource_framerate_n, vsource_framerate_d, frame_interval);
 		}
 	}
 	//
+	vsource_hash_release(hash);
+	vsource_report_jitter();
 	ga_error("video source: thread terminated.\n");
 	//
 	return NULL;
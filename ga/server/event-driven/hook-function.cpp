@@ -22,6 +22,7 @@
 #include "ga-common.h"
 #include "vsource.h"
 #include "dpipe.h"
+#include "ga-trace.h"
 #include "rtspconf.h"
 
 #include "ga-hook-common.h"
@@ -59,7 +60,7 @@ static IDirect3DSurface9 *offscreenSurface = NULL;
 static bool
 D3D9_screen_capture(IDirect3DDevice9 * pDevice) {
 	static int frame_interval;
-	static LARGE_INTEGER initialTv, captureTv, freq;
+	static long long initialTime, captureTime;
 	static int capture_initialized = 0;
 	//
 	HRESULT hr;
@@ -100,11 +101,10 @@ D3D9_screen_capture(IDirect3DDevice9 * pDevice) {
 	if (capture_initialized == 0) {
 		frame_interval = 1000000/video_fps; // in the unif of us
 		frame_interval++;
-		QueryPerformanceFrequency(&freq);
-		QueryPerformanceCounter(&initialTv);
+		captureTime = initialTime = ga_clock_ns();
 		capture_initialized = 1;
 	} else {
-		QueryPerformanceCounter(&captureTv);
+		captureTime = ga_clock_ns();
 	}
 	
 	// check if the surface of local game enable multisampling,
@@ -174,7 +174,11 @@ D3D9_screen_capture(IDirect3DDevice9 * pDevice) {
 	// copy image 
 	do {
 		unsigned char *src, *dst;
-		data = dpipe_get(g_pipe[0]);
+		// all buffers are still shared with lagging channels
+		if((data = dpipe_get(g_pipe[0])) == NULL) {
+			GA_ERROR_RATELIMITED("ga_hook: no free frame buffer, frame skipped.\n");
+			break;
+		}
 		frame = (vsource_frame_t*) data->pointer;
 		frame->pixelformat = PIX_FMT_BGRA;
 		frame->realwidth = desc.Width;
@@ -192,23 +196,20 @@ D3D9_screen_capture(IDirect3DDevice9 * pDevice) {
 			src += lockedRect.Pitch;
 			dst += frame->realstride;//frame->stride;
 		}
-		frame->imgpts = pcdiff_us(captureTv, initialTv, freq)/frame_interval;
-		gettimeofday(&frame->timestamp, NULL);
+		frame->imgpts = (captureTime - initialTime) / 1000LL / frame_interval;
+		frame->timestamp = captureTime;
+		ga_trace(GA_TRACE_CAPTURE, 0, frame->timestamp);
 	} while(0);
 
-	// duplicate from channel 0 to other channels
-	for(i = 1; i < SOURCES; i++) {
-		int j;
+	// share from channel 0 to other channels: no copy
+	for(i = 1; data != NULL && i < SOURCES; i++) {
 		dpipe_buffer_t *dupdata;
-		vsource_frame_t *dupframe;
-		dupdata = dpipe_get(g_pipe[i]);
-		dupframe = (vsource_frame_t*) dupdata->pointer;
-		//
-		vsource_dup_frame(frame, dupframe);
-		//
+		if((dupdata = dpipe_share(g_pipe[i], data)) == NULL)
+			continue;
 		dpipe_store(g_pipe[i], dupdata);
 	}
-	dpipe_store(g_pipe[0], data);
+	if(data != NULL)
+		dpipe_store(g_pipe[0], data);
 	
 	offscreenSurface->UnlockRect();
 #if 1	// XXX: disable until we have found a good place to safely Release()
@@ -602,7 +603,7 @@ hook_DXGISwapChainPresent(
 	)
 {
 	static int frame_interval;
-	static LARGE_INTEGER initialTv, captureTv, freq;
+	static long long initialTime, captureTime;
 	static int capture_initialized = 0;
 	//
 	int i;
@@ -656,11 +657,10 @@ hook_DXGISwapChainPresent(
 	if (capture_initialized == 0) {
 		frame_interval = 1000000/video_fps; // in the unif of us
 		frame_interval++;
-		QueryPerformanceFrequency(&freq);
-		QueryPerformanceCounter(&initialTv);
+		captureTime = initialTime = ga_clock_ns();
 		capture_initialized = 1;
 	} else {
-		QueryPerformanceCounter(&captureTv);
+		captureTime = ga_clock_ns();
 	}
 
 	hr = 0;
@@ -715,7 +715,11 @@ hook_DXGISwapChainPresent(
 		// copy image 
 		do {
 			unsigned char *src, *dst;
-			data = dpipe_get(g_pipe[0]);
+			// all buffers are still shared with lagging channels
+			if((data = dpipe_get(g_pipe[0])) == NULL) {
+				GA_ERROR_RATELIMITED("ga_hook: no free frame buffer, frame skipped.\n");
+				break;
+			}
 			frame = (vsource_frame_t*) data->pointer;
 			frame->pixelformat = PIX_FMT_BGRA;
 			frame->realwidth = desc.Width;
@@ -731,23 +735,20 @@ hook_DXGISwapChainPresent(
 				src += mapped_screen.RowPitch;
 				dst += frame->realstride;//frame->stride;
 			}
-			frame->imgpts = pcdiff_us(captureTv, initialTv, freq)/frame_interval;
-			gettimeofday(&frame->timestamp, NULL);
+			frame->imgpts = (captureTime - initialTime) / 1000LL / frame_interval;
+			frame->timestamp = captureTime;
+			ga_trace(GA_TRACE_CAPTURE, 0, frame->timestamp);
 		} while(0);
 	
-		// duplicate from channel 0 to other channels
-		for(i = 1; i < SOURCES; i++) {
-			int j;
+		// share from channel 0 to other channels: no copy
+		for(i = 1; data != NULL && i < SOURCES; i++) {
 			dpipe_buffer_t *dupdata;
-			vsource_frame_t *dupframe;
-			dupdata = dpipe_get(g_pipe[i]);
-			dupframe = (vsource_frame_t*) dupdata->pointer;
-			//
-			vsource_dup_frame(frame, dupframe);
-			//
+			if((dupdata = dpipe_share(g_pipe[i], data)) == NULL)
+				continue;
 			dpipe_store(g_pipe[i], dupdata);
 		}
-		dpipe_store(g_pipe[0], data);
+		if(data != NULL)
+			dpipe_store(g_pipe[0], data);
 		
 		pDstBuffer->Unmap(0);
 
@@ -797,7 +798,11 @@ hook_DXGISwapChainPresent(
 		// copy image 
 		do {
 			unsigned char *src, *dst;
-			data = dpipe_get(g_pipe[0]);
+			// all buffers are still shared with lagging channels
+			if((data = dpipe_get(g_pipe[0])) == NULL) {
+				GA_ERROR_RATELIMITED("ga_hook: no free frame buffer, frame skipped.\n");
+				break;
+			}
 			frame = (vsource_frame_t*) data->pointer;
 			frame->pixelformat = PIX_FMT_BGRA;
 			frame->realwidth = desc.Width;
@@ -813,23 +818,20 @@ hook_DXGISwapChainPresent(
 				src += mapped_screen.RowPitch;
 				dst += frame->realstride;//frame->stride;
 			}
-			frame->imgpts = pcdiff_us(captureTv, initialTv, freq)/frame_interval;
-			gettimeofday(&frame->timestamp, NULL);
+			frame->imgpts = (captureTime - initialTime) / 1000LL / frame_interval;
+			frame->timestamp = captureTime;
+			ga_trace(GA_TRACE_CAPTURE, 0, frame->timestamp);
 		} while(0);
 	
-		// duplicate from channel 0 to other channels
-		for(i = 1; i < SOURCES; i++) {
-			int j;
+		// share from channel 0 to other channels: no copy
+		for(i = 1; data != NULL && i < SOURCES; i++) {
 			dpipe_buffer_t *dupdata;
-			vsource_frame_t *dupframe;
-			dupdata = dpipe_get(g_pipe[i]);
-			dupframe = (vsource_frame_t*) dupdata->pointer;
-			//
-			vsource_dup_frame(frame, dupframe);
-			//
+			if((dupdata = dpipe_share(g_pipe[i], data)) == NULL)
+				continue;
 			dpipe_store(g_pipe[i], dupdata);
 		}
-		dpipe_store(g_pipe[0], data);
+		if(data != NULL)
+			dpipe_store(g_pipe[0], data);
 
 		pDeviceContext->Unmap(pDstBuffer, 0);
 
@@ -75,6 +75,12 @@ static struct gaRect rect;
 
 static ga_module_t *m_filter, *m_vencoder, *m_asource, *m_aencoder, *m_ctrl, *m_server;
 
+// video-pipe-mode = shm: only capture and publish frames,
+// filters, encoders, and the server run in a separate ga-server process
+static int publish_only = 0;
+// video-direct-input: encoder-x264 converts and encodes captured frames
+static int direct_input = 0;
+
 int	// should be called only once
 vsource_init(int width, int height) {
 	int i;
@@ -152,16 +158,13 @@ ga_hook_capture_prepared(int width, int height, int check_resolution) {
 }
 
 void
-ga_hook_capture_dupframe(vsource_frame_t *frame) {
+ga_hook_capture_dupframe(dpipe_buffer_t *data) {
 	int i;
+	// share the captured frame with other channels: no copy
 	for(i = 1; i < SOURCES; i++) {
 		dpipe_buffer_t *dupdata;
-		vsource_frame_t *dupframe;
-		dupdata = dpipe_get(g_pipe[i]);
-		dupframe = (vsource_frame_t*) dupdata->pointer;
-		//
-		vsource_dup_frame(frame, dupframe);
-		//
+		if((dupdata = dpipe_share(g_pipe[i], data)) == NULL)
+			continue;
 		dpipe_store(g_pipe[i], dupdata);
 	}
 	return;
@@ -177,15 +180,25 @@ load_modules() {
 	char module_path[2048] = "";
 	char hook_audio[64] = "";
 	//
+	if(publish_only)
+		goto load_ctrl;
+	if(direct_input == 0) {
 	snprintf(module_path, sizeof(module_path),
 		BACKSLASHDIR("%s/mod/filter-rgb2yuv", "%smod\\filter-rgb2yuv"),
 		ga_root);
 	if((m_filter = ga_load_module(module_path, "filter_RGB2YUV_")) == NULL)
 		return -1;
+	}
 	//
+	if(direct_input != 0) {
+	snprintf(module_path, sizeof(module_path),
+		BACKSLASHDIR("%s/mod/encoder-x264", "%smod\\encoder-x264"),
+		ga_root);
+	} else {
 	snprintf(module_path, sizeof(module_path),
 		BACKSLASHDIR("%s/mod/encoder-video", "%smod\\encoder-video"),
 		ga_root);
+	}
 	if((m_vencoder = ga_load_module(module_path, "vencoder_")) == NULL)
 		return -1;
 	if(ga_conf_readbool("enable-audio", 1) != 0) {
@@ -209,6 +222,7 @@ load_modules() {
 		return -1;
 	//////////////////////////
 	}
+load_ctrl:
 	if(no_default_controller == 0) {
 	snprintf(module_path, sizeof(module_path),
 		BACKSLASHDIR("%s/mod/ctrl-sdl", "%smod\\ctrl-sdl"),
@@ -216,6 +230,8 @@ load_modules() {
 	if((m_ctrl = ga_load_module(module_path, "sdlmsg_replay_")) == NULL)
 		return -1;
 	}
+	if(publish_only)
+		return 0;
 	//////////////////////////
 	snprintf(module_path, sizeof(module_path),
 		BACKSLASHDIR("%s/mod/server-live555", "%smod\\server-live555"),
@@ -240,9 +256,13 @@ init_modules() {
 		}
 	}
 	// controller server is built-in - no need to init
+	if(publish_only)
+		return 0;
+	if(direct_input == 0) {
 	ga_init_single_module_or_quit("filter", m_filter, (void*) filter_param);
+	}
 	//
-	ga_init_single_module_or_quit("video-encoder", m_vencoder, filterpipefmt);
+	ga_init_single_module_or_quit("video-encoder", m_vencoder, video_encoder_param);
 	if(ga_conf_readbool("enable-audio", 1) != 0) {
 	//////////////////////////
 #ifndef __APPLE__
@@ -271,9 +291,13 @@ run_modules() {
 			//ga_run_single_module_or_quit("control replayer", m_ctrl->threadproc, conf);
 		}
 	}
+	if(publish_only)
+		return 0;
 	// video
 	//ga_run_single_module_or_quit("filter 0", m_filter->threadproc, (void*) filterpipe);
+	if(direct_input == 0) {
 	if(m_filter->start(filter_param) < 0)	exit(-1);
+	}
 	encoder_register_vencoder(m_vencoder, video_encoder_param);
 	// audio
 	if(ga_conf_readbool("enable-audio", 1) != 0) {
@@ -296,6 +320,7 @@ run_modules() {
 
 void *
 ga_server(void *arg) {
+	char pipemode[64];
 	//
 	do {
 		usleep(100000);
@@ -303,6 +328,17 @@ ga_server(void *arg) {
 	//
 	ga_error("[ga_server] load modules and run the server\n");
 	//
+	if(ga_conf_readv("video-pipe-mode", pipemode, sizeof(pipemode)) != NULL
+	&& dpipe_parse_mode(pipemode) == DPIPE_MODE_SHM) {
+		ga_error("[ga_server] publish video frames only: run ga-server-periodic to stream.\n");
+		publish_only = 1;
+	}
+	if(ga_conf_readbool("video-direct-input", 0) != 0) {
+		ga_error("[ga_server] video encoder reads captured frames directly (encoder-x264).\n");
+		direct_input = 1;
+		video_encoder_param = imagepipefmt;
+	}
+	//
 	if(vsource_init(encoder_width, encoder_height) < 0) {
 		ga_error("[ga_server] video source init failed.\n");
 		return NULL;
@@ -381,24 +417,13 @@ ga_hook_video_rate_control() {
 	static int initialized = 0;
 	static int max_tokens;
 	static long long tokens = 0LL;
-#ifdef WIN32
-	static LARGE_INTEGER lastCounter, freq;
-	LARGE_INTEGER currCounter;
-#else
-	static struct timeval lastCounter;
-	struct timeval currCounter;
-#endif
-	long long delta;
+	static long long lastCounter;
+	long long currCounter, delta;
 	// init
 	if(initialized == 0) {
 		tokens = 0LL;
 		max_tokens = server_max_tokens * server_token_fill_interval;
-#ifdef WIN32
-		QueryPerformanceFrequency(&freq);
-		QueryPerformanceCounter(&lastCounter);
-#else
-		gettimeofday(&lastCounter, NULL);
-#endif
+		lastCounter = ga_clock_ns();
 		ga_error("[token_bucket] interval=%d, fill=%d, max=%d (%d)\n",
 			(int) server_token_fill_interval,
 			(int) server_num_token_to_fill,
@@ -408,16 +433,11 @@ ga_hook_video_rate_control() {
 		return -1;
 	}
 	//
-#ifdef WIN32
-	QueryPerformanceCounter(&currCounter);
-	delta = pcdiff_us(currCounter, lastCounter, freq);
-#else
-	gettimeofday(&currCounter, NULL);
-	delta = tvdiff_us(&currCounter, &lastCounter);
-#endif
+	currCounter = ga_clock_ns();
+	delta = (currCounter - lastCounter) / 1000LL;
 	if(delta >= server_token_fill_interval) {
 		tokens += delta;
-		lastCounter = currCounter;
+		lastCounter += delta * 1000LL;
 	}
 	if(tokens > max_tokens) {
 		tokens = max_tokens;
@@ -54,7 +54,7 @@ extern dpipe_t *g_pipe[SOURCES];
 int vsource_init(int width, int height);
 
 int ga_hook_capture_prepared(int width, int height, int check_resolution);
-void ga_hook_capture_dupframe(vsource_frame_t *frame);
+void ga_hook_capture_dupframe(dpipe_buffer_t *data);
 
 void *ga_server(void *arg);
 int ga_hook_get_resolution(int width, int height);
@@ -29,6 +29,7 @@
 #include "ga-conf.h"
 #include "vsource.h"
 #include "dpipe.h"
+#include "ga-trace.h"
 
 #include "ga-hook-common.h"
 #include "ga-hook-gl.h"
@@ -107,15 +108,13 @@ WINAPI
 #endif
 hook_glFlush() {
 	static int frame_interval;
-	static struct timeval initialTv, captureTv;
+	static long long initialTime, captureTime;
 	static int frameLinesize;
-	static unsigned char *frameBuf;
 	static int sb_initialized = 0;
 	static int global_initialized = 0;
 	//
 	GLint vp[4];
 	int vp_x, vp_y, vp_width, vp_height;
-	int i;
 	//
 	dpipe_buffer_t *data;
 	vsource_frame_t *frame;
@@ -149,16 +148,11 @@ hook_glFlush() {
 	if(sb_initialized == 0) {
 		frame_interval = 1000000/video_fps; // in the unif of us
 		frame_interval++;
-		gettimeofday(&initialTv, NULL);
-		frameBuf = (unsigned char*) malloc(encoder_width * encoder_height * 4);
-		if(frameBuf == NULL) {
-			ga_error("allocate frame failed.\n");
-			return;
-		}
+		captureTime = initialTime = ga_clock_ns();
 		frameLinesize = game_width * 4;
 		sb_initialized = 1;
 	} else {
-		gettimeofday(&captureTv, NULL);
+		captureTime = ga_clock_ns();
 	}
 	//
 	if (enable_server_rate_control && ga_hook_video_rate_control() < 0) {
@@ -166,11 +160,13 @@ hook_glFlush() {
 	}
 	//
 	do {
-		unsigned char *src, *dst;
-		//
 		frameLinesize = game_width<<2;
 		//
-		data = dpipe_get(g_pipe[0]);
+		// all buffers are still shared with lagging channels
+		if((data = dpipe_get(g_pipe[0])) == NULL) {
+			GA_ERROR_RATELIMITED("ga_hook: no free frame buffer, frame skipped.\n");
+			return;
+		}
 		frame = (vsource_frame_t*) data->pointer;
 		frame->pixelformat = AV_PIX_FMT_RGBA;
 		frame->realwidth = game_width;
@@ -180,20 +176,15 @@ hook_glFlush() {
 		frame->linesize[0] = frameLinesize;/*frame->stride*/;
 		// read a block of pixels from the framebuffer (backbuffer)
 		glReadBuffer(GL_BACK);
-		glReadPixels(0, 0, game_width, game_height, GL_RGBA, GL_UNSIGNED_BYTE, frameBuf);
-		// image is upside down!
-		src = frameBuf + frameLinesize * (game_height - 1);
-		dst = frame->imgbuf;
-		for(i = 0; i < frame->realheight; i++) {
-			bcopy(src, dst, frameLinesize);
-			dst += frameLinesize/*frame->stride*/;
-			src -= frameLinesize;
-		}
-		frame->imgpts = tvdiff_us(&captureTv, &initialTv)/frame_interval;
-		frame->timestamp = captureTv;
+		glReadPixels(0, 0, game_width, game_height, GL_RGBA, GL_UNSIGNED_BYTE, frame->imgbuf);
+		// image is upside down: flipped by the filter
+		frame->flipped = 1;
+		frame->imgpts = (captureTime - initialTime) / 1000LL / frame_interval;
+		frame->timestamp = captureTime;
+		ga_trace(GA_TRACE_CAPTURE, 0, frame->timestamp);
 	} while(0);
 	// duplicate from channel 0 to other channels
-	ga_hook_capture_dupframe(frame);
+	ga_hook_capture_dupframe(data);
 	dpipe_store(g_pipe[0], data);
 	//
 	return;
@@ -30,6 +30,7 @@
 #include "asource.h"
 #include "vsource.h"
 #include "dpipe.h"
+#include "ga-trace.h"
 #include "controller.h"
 #include "ctrl-sdl.h"
 
@@ -408,7 +409,7 @@ hook_SDL2_CreateTexture(SDL_Renderer* renderer, uint32_t format, int access, int
 static void
 hook_SDL2_capture_screen(const char *caller, SDL_Renderer *renderer) {
 	static int frame_interval;
-	static struct timeval initialTv, captureTv;
+	static long long initialTime, captureTime;
 	static int sb_initialized = 0;
 	dpipe_buffer_t *data;
 	vsource_frame_t *frame;
@@ -422,17 +423,21 @@ hook_SDL2_capture_screen(const char *caller, SDL_Renderer *renderer) {
 	if(sb_initialized == 0) {
 		frame_interval = 1000000/video_fps; // in the unif of us
 		frame_interval++;
-		gettimeofday(&initialTv, NULL);
+		captureTime = initialTime = ga_clock_ns();
 		sb_initialized = 1;
 	} else {
-		gettimeofday(&captureTv, NULL);
+		captureTime = ga_clock_ns();
 	}
 	//
 	if (enable_server_rate_control && ga_hook_video_rate_control() < 0)
 		return;
 	// copy screen
 	do {
-		data = dpipe_get(g_pipe[0]);
+		// all buffers are still shared with lagging channels
+		if((data = dpipe_get(g_pipe[0])) == NULL) {
+			GA_ERROR_RATELIMITED("ga_hook: no free frame buffer, frame skipped.\n");
+			return;
+		}
 		frame = (vsource_frame_t*) data->pointer;
 		frame->pixelformat = AV_PIX_FMT_BGRA;
 		frame->realwidth = curr_width; //dupsurface->w;
@@ -444,11 +449,12 @@ hook_SDL2_capture_screen(const char *caller, SDL_Renderer *renderer) {
 		if(old_SDL2_RenderReadPixels(renderer, NULL, SDL_PIXELFORMAT_ARGB8888, frame->imgbuf, curr_width * 4) != 0) {
 			ga_error("hook_sdl2: read pixels failed: %s\n", SDL_GetError());
 		}
-		frame->imgpts = tvdiff_us(&captureTv, &initialTv)/frame_interval;
-		frame->timestamp = captureTv;
+		frame->imgpts = (captureTime - initialTime) / 1000LL / frame_interval;
+		frame->timestamp = captureTime;
+		ga_trace(GA_TRACE_CAPTURE, 0, frame->timestamp);
 	} while(0);
 	// duplicate from channel 0 to other channels
-	ga_hook_capture_dupframe(frame);
+	ga_hook_capture_dupframe(data);
 	dpipe_store(g_pipe[0], data);
 	return;
 }
@@ -508,14 +514,12 @@ hook_SDL2_RenderPresent(SDL_Renderer *renderer) {
 static void
 GL_capture() {
 	static int frame_interval;
-	static struct timeval initialTv, captureTv;
+	static long long initialTime, captureTime;
 	static int frameLinesize;
-	static unsigned char *frameBuf;
 	static int sb_initialized = 0;
 	//
 	GLint vp[4];
 	int vp_x, vp_y, vp_width, vp_height;
-	int i;
 	dpipe_buffer_t *data;
 	vsource_frame_t *frame;
 	//
@@ -532,16 +536,11 @@ GL_capture() {
 	if(sb_initialized == 0) {
 		frame_interval = 1000000/video_fps; // in the unif of us
 		frame_interval++;
-		gettimeofday(&initialTv, NULL);
-		frameBuf = (unsigned char*) malloc(encoder_width * encoder_height * 4);
-		if(frameBuf == NULL) {
-			ga_error("allocate frame failed.\n");
-			return;
-		}
+		captureTime = initialTime = ga_clock_ns();
 		frameLinesize = game_width * 4;
 		sb_initialized = 1;
 	} else {
-		gettimeofday(&captureTv, NULL);
+		captureTime = ga_clock_ns();
 	}
 	
 	if (enable_server_rate_control && ga_hook_video_rate_control() < 0)
@@ -549,11 +548,13 @@ GL_capture() {
 
 	// copy screen
 	do {
-		unsigned char *src, *dst;
-		//
 		frameLinesize = game_width<<2;
 		//
-		data = dpipe_get(g_pipe[0]);
+		// all buffers are still shared with lagging channels
+		if((data = dpipe_get(g_pipe[0])) == NULL) {
+			GA_ERROR_RATELIMITED("ga_hook: no free frame buffer, frame skipped.\n");
+			return;
+		}
 		frame = (vsource_frame_t*) data->pointer;
 		frame->pixelformat = AV_PIX_FMT_RGBA;
 		frame->realwidth = game_width;
@@ -563,21 +564,16 @@ GL_capture() {
 		frame->linesize[0] = frameLinesize;
 		// read a block of pixels from the framebuffer (backbuffer)
 		glReadBuffer(GL_BACK);
-		glReadPixels(0, 0, game_width, game_height, GL_RGBA, GL_UNSIGNED_BYTE, frameBuf);
-		// image is upside down!
-		src = frameBuf + frameLinesize * (game_height - 1);
-		dst = frame->imgbuf;
-		for(i = 0; i < frame->realheight; i++) {
-			bcopy(src, dst, frameLinesize);
-			dst += frameLinesize;
-			src -= frameLinesize;
-		}
-		frame->imgpts = tvdiff_us(&captureTv, &initialTv)/frame_interval;
-		frame->timestamp = captureTv;
+		glReadPixels(0, 0, game_width, game_height, GL_RGBA, GL_UNSIGNED_BYTE, frame->imgbuf);
+		// image is upside down: flipped by the filter
+		frame->flipped = 1;
+		frame->imgpts = (captureTime - initialTime) / 1000LL / frame_interval;
+		frame->timestamp = captureTime;
+		ga_trace(GA_TRACE_CAPTURE, 0, frame->timestamp);
 	} while(0);
 
 	// duplicate from channel 0 to other channels
-	ga_hook_capture_dupframe(frame);
+	ga_hook_capture_dupframe(data);
 	dpipe_store(g_pipe[0], data);
 	
 	return;
@@ -28,11 +28,15 @@
 #include "rtspconf.h"
 #include "controller.h"
 #include "encoder-common.h"
+#include "ga-ratectl.h"
+#include "vsource.h"
 
 #define	TEST_RECONFIGURE
 
 // image source pipeline:
 //	vsource -- [vsource-%d] --> filter -- [filter-%d] --> encoder
+// or, with video-direct-input:
+//	vsource -- [vsource-%d] --> encoder-x264
 
 // configurations:
 static char *imagepipefmt = "video-%d";
@@ -48,13 +52,23 @@ static struct gaRect rect;
 
 static ga_module_t *m_vsource, *m_filter, *m_vencoder, *m_asource, *m_aencoder, *m_ctrl, *m_server;
 
+// video-pipe-mode = shm: video frames and the controller are
+// provided by another process, e.g., a hooked game
+static int attach_vsource = 0;
+// video-direct-input: encoder-x264 converts and encodes captured frames
+static int direct_input = 0;
+
 int
 load_modules() {
+	if(attach_vsource == 0) {
 	if((m_vsource = ga_load_module("mod/vsource-desktop", "vsource_")) == NULL)
 		return -1;
+	}
+	if(direct_input == 0) {
 	if((m_filter = ga_load_module("mod/filter-rgb2yuv", "filter_RGB2YUV_")) == NULL)
 		return -1;
-	if((m_vencoder = ga_load_module("mod/encoder-video", "vencoder_")) == NULL)
+	}
+	if((m_vencoder = ga_load_module(direct_input ? "mod/encoder-x264" : "mod/encoder-video", "vencoder_")) == NULL)
 		return -1;
 	if(ga_conf_readbool("enable-audio", 1) != 0) {
 	//////////////////////////
@@ -66,8 +80,10 @@ load_modules() {
 		return -1;
 	//////////////////////////
 	}
+	if(attach_vsource == 0) {
 	if((m_ctrl = ga_load_module("mod/ctrl-sdl", "sdlmsg_replay_")) == NULL)
 		return -1;
+	}
 	if((m_server = ga_load_module("mod/server-live555", "live_")) == NULL)
 		return -1;
 	return 0;
@@ -77,15 +93,22 @@ int
 init_modules() {
 	struct RTSPConf *conf = rtspconf_global();
 	//static const char *filterpipe[] = { imagepipe0, filterpipe0 };
-	if(conf->ctrlenable) {
+	if(conf->ctrlenable && attach_vsource == 0) {
 		ga_init_single_module_or_quit("controller", m_ctrl, (void *) prect);
 	}
 	// controller server is built-in - no need to init
 	// note the order of the two modules ...
-	ga_init_single_module_or_quit("video-source", m_vsource, (void*) prect);
+	if(attach_vsource == 0) {
+		ga_init_single_module_or_quit("video-source", m_vsource, (void*) prect);
+	} else if(video_source_attach(0) < 0) {
+		ga_error("attach video source failed.\n");
+		exit(-1);
+	}
+	if(direct_input == 0) {
 	ga_init_single_module_or_quit("filter", m_filter, (void*) filter_param);
+	}
 	//
-	ga_init_single_module_or_quit("video-encoder", m_vencoder, filterpipefmt);
+	ga_init_single_module_or_quit("video-encoder", m_vencoder, video_encoder_param);
 	if(ga_conf_readbool("enable-audio", 1) != 0) {
 	//////////////////////////
 #ifndef __APPLE__
@@ -105,16 +128,20 @@ run_modules() {
 	struct RTSPConf *conf = rtspconf_global();
 	static const char *filterpipe[] =  { imagepipe0, filterpipe0 };
 	// controller server is built-in, but replay is a module
-	if(conf->ctrlenable) {
+	if(conf->ctrlenable && attach_vsource == 0) {
 		ga_run_single_module_or_quit("control server", ctrl_server_thread, conf);
 		// XXX: safe to comment out?
 		//ga_run_single_module_or_quit("control replayer", m_ctrl->threadproc, conf);
 	}
 	// video
 	//ga_run_single_module_or_quit("image source", m_vsource->threadproc, (void*) imagepipefmt);
+	if(attach_vsource == 0) {
 	if(m_vsource->start(prect) < 0)		exit(-1);
+	}
 	//ga_run_single_module_or_quit("filter 0", m_filter->threadproc, (void*) filterpipe);
+	if(direct_input == 0) {
 	if(m_filter->start(filter_param) < 0)	exit(-1);
+	}
 	encoder_register_vencoder(m_vencoder, video_encoder_param);
 	// audio
 	if(ga_conf_readbool("enable-audio", 1) != 0) {
@@ -202,12 +229,15 @@ handle_netreport(ctrlmsg_system_t *msg) {
 		msgn->bytecount / 1024,
 		msgn->duration / 1000000.0,
 		msgn->bytecount / 1024.0 / (msgn->duration / 1000000.0));
+	ga_ratectl_netreport(msgn->duration, msgn->pktcount, msgn->pktloss,
+		msgn->bytecount, msgn->capacity);
 	return;
 }
 
 int
 main(int argc, char *argv[]) {
 	int notRunning = 0;
+	char pipemode[64];
 #ifdef WIN32
 	if(CoInitializeEx(NULL, COINIT_MULTITHREADED) < 0) {
 		fprintf(stderr, "cannot initialize COM.\n");
@@ -227,6 +257,17 @@ main(int argc, char *argv[]) {
 	if(rtspconf_parse(rtspconf_global()) < 0)
 					{ return -1; }
 	//
+	if(ga_conf_readv("video-pipe-mode", pipemode, sizeof(pipemode)) != NULL
+	&& dpipe_parse_mode(pipemode) == DPIPE_MODE_SHM) {
+		ga_error("*** Video source is attached from another process.\n");
+		attach_vsource = 1;
+	}
+	if(ga_conf_readbool("video-direct-input", 0) != 0) {
+		ga_error("*** Video encoder reads captured frames directly (encoder-x264).\n");
+		direct_input = 1;
+		video_encoder_param = imagepipefmt;
+	}
+	//
 	prect = NULL;
 	//
 	if(ga_crop_window(&rect, &prect) < 0) {
@@ -247,7 +288,9 @@ main(int argc, char *argv[]) {
 	//
 #ifdef TEST_RECONFIGURE
 	pthread_t t;
-	pthread_create(&t, NULL, test_reconfig, NULL);
+	// the rate controller reconfigures the encoder by itself
+	if(ga_ratectl_enabled() == 0)
+		pthread_create(&t, NULL, test_reconfig, NULL);
 #endif
 	//rtspserver_main(NULL);
 	//liveserver_main(NULL);